@@ -0,0 +1,8 @@
+-- the samples in the former layout, for the scripts and everybody else reading them
+
+create or replace view samples as
+  select s.address, s.type, d.aggregate, from_unixtime(d.time) as time,
+         d.value, t.text, d.min, d.max, d.first, d.last, d.samples
+    from sampledata d
+      join series s on s.id = d.seriesid
+      left join statetexts t on t.id = d.textid
@@ -49,6 +49,8 @@ if ($action == "store")
       $max     = $_POST["max(" . $ID[$i] . ")"];
       $delta   = $_POST["Delta(" . $ID[$i] . ")"];
       $range   = $_POST["Range(" . $ID[$i] . ")"];
+      $runtime = $_POST["Runtime(" . $ID[$i] . ")"];
+      $switches = $_POST["Switches(" . $ID[$i] . ")"];
 
       $madr    = $_POST["MAdr(" . $ID[$i] . ")"];
       $msub    = $_POST["MSub(" . $ID[$i] . ")"];
@@ -62,9 +64,11 @@ if ($action == "store")
       if (!is_numeric($max))   $max = 0;
       if (!is_numeric($delta)) $delta = 0;
       if (!is_numeric($range)) $range = 0;
+      if (!is_numeric($runtime)) $runtime = 0;
+      if (!is_numeric($switches)) $switches = 0;
 
       $data = " address='$adr', type='" . mb_strtoupper($type) . "', min='$min', max='$max', "
-         . "maxrepeat='$int', delta='$delta', rangem='$range', "
+         . "maxrepeat='$int', delta='$delta', rangem='$range', maxruntime='$runtime', maxswitches='$switches', "
          . "maddress='$madr', msubject='$subject', mbody='$body', state='$act', kind='M' ";
 
       if ($i == count($ID)-1 && $adr != "")
@@ -182,7 +186,7 @@ function displayAlertConfig($ID, $row, $style)
    echo "         <div>\n";
    echo "           <span>ID:</span>\n";
    echo "           <span><input class=\"rounded-border input\" style=\"width:60px$style\" type=\"text\" id=\"$a\" name=\"Adr(" . $ID . ")\"   value=\"" . $row['address'] . "\"></input></span>\n";
-   configOptionItem(5, "Typ", "Type(" . $ID . ")", $row['type'], "VA:VA UD:US DI:DI DO:DO W1:W1", "", "id=\"$a\" style=\"width:60px$style\"");
+   configOptionItem(5, "Typ", "Type(" . $ID . ")", $row['type'], "VA:VA UD:US DI:DI DO:DO W1:W1 C2:C2", "", "id=\"$a\" style=\"width:60px$style\"");
    echo "         </div>\n";
 
    echo "         <div>\n";
@@ -199,6 +203,13 @@ function displayAlertConfig($ID, $row, $style)
    echo "           <span><input class=\"rounded-border input\" style=\"width:60px$style\" type=\"text\" id=\"$a\" name=\"Range(" . $ID . ")\" value=\"" . $row['rangem'] . "\"></input> Minuten</span>\n";
    echo "         </div>\n";
 
+   echo "         <div>\n";
+   echo "           <span>Laufzeit max:</span>\n";
+   echo "           <span><input class=\"rounded-border input\" style=\"width:60px$style\" type=\"text\" id=\"$a\" name=\"Runtime(" . $ID . ")\" value=\"" . $row['maxruntime'] . "\"></input> Minuten/Tag (DI/DO)</span>\n";
+   echo "           <span>Schaltungen max:</span>\n";
+   echo "           <span><input class=\"rounded-border input\" style=\"width:60px$style\" type=\"text\" id=\"$a\" name=\"Switches(" . $ID . ")\" value=\"" . $row['maxswitches'] . "\"></input> pro Tag</span>\n";
+   echo "         </div>\n";
+
    echo "         <div>\n";
    echo "           <span>Empfänger:</span>\n";
    echo "           <span><input class=\"rounded-border input\" style=\"width:805px$style\" type=\"text\" id=\"$a\" name=\"MAdr(" . $ID . ")\"  value=\"" . $row['maddress'] . "\"></input></span>\n";
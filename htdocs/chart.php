@@ -23,7 +23,7 @@ printHeader();
   $year  = isset($_GET['csyear'])  ? $_GET['csyear']  : (int)date("Y",time()-86400*$_SESSION['chartStart']);
   $range = isset($_GET['crange'])  ? $_GET['crange']  : $_SESSION['chartStart'];
 
-  $range = ($range > 7) ? 31 : (($range > 1) ? 7 : 1);
+  $range = ($range > 31) ? 365 : (($range > 7) ? 31 : (($range > 1) ? 7 : 1));
   $from = date_create_from_format('!Y-m-d', $year.'-'.$month.'-'.$day)->getTimestamp();
 
   echo "  <div class=\"rounded-border\" id=\"aSelect\">\n";
@@ -35,6 +35,7 @@ printHeader();
   echo "        <option value='1' "  . ($range == 1  ? "SELECTED" : "") . ">Tag</option>\n";
   echo "        <option value='7' "  . ($range == 7  ? "SELECTED" : "") . ">Woche</option>\n";
   echo "        <option value='31' " . ($range == 31 ? "SELECTED" : "") . ">Monat</option>\n";
+  echo "        <option value='365' " . ($range == 365 ? "SELECTED" : "") . ">Jahr</option>\n";
   echo "      </select>\n";
   echo "      <input type=submit value=\"Go\">\n";
   echo "    </form>\n";
@@ -83,7 +83,9 @@ syslog(LOG_DEBUG, "p4: ---------");
 // ------------------------------
 // get data from db
 
-$factsQuery = "select address, type, name, usrtitle, title, unit from valuefacts where " . $sensorCond;
+$factsQuery = "select address, type, name, usrtitle, title, unit,"
+   . " (select min(id) from series s where s.address = valuefacts.address and s.type = valuefacts.type) as seriesid"
+   . " from valuefacts where " . $sensorCond;
 syslog(LOG_DEBUG, "p4: range $range; from '" . strftime("%d. %b %Y  %H:%M", $from)
        . "' to '" . strftime("%d. %b %Y %H:%M", $to) . " [$factsQuery]");
 
@@ -99,8 +101,14 @@ if ($range < 3)
    $groupMinutes = 5;
 elseif ($range < 8)
    $groupMinutes = 10;
-else
+elseif ($range <= 31)
    $groupMinutes = 15;
+else
+   $groupMinutes = 24*60;
+
+readConfigItem("rollupTiers", $rollupTiers, "");
+readConfigItem("compressMaxGap", $compressMaxGap, "0");
+readConfigItem("ioEvents", $ioEvents, "0");
 
 // loop over sensors ..
 
@@ -111,15 +119,37 @@ while ($fact = $factResult->fetch_assoc())
    $title = (preg_replace("/($pumpDir)/i","",$fact['usrtitle']) != "") ? preg_replace("/($pumpDir)/i","",$fact['usrtitle']) : $fact['title'];
    $unit = $fact['unit'];
    $name = $fact['name'];
+   $seriesId = $fact['seriesid'];
+
+   if ($seriesId == "")             // nothing stored yet
+      continue;
+
+   // the rows of the rollup tier, the rollup rows are stamped with the end
+   // of their bucket, the raw samples complete the buckets not finished yet
+
+   list($tier, $tierSeconds, $tierLast) = selectTier($mysqli, $rollupTiers, $seriesId, $from, $groupMinutes * 60);
+   $seriesCond = "seriesid = " . $seriesId;
+
+   // time of sampledata is in seconds since epoch
 
    $query = "select"
-      . "   unix_timestamp(min(time)) as time,"
-      . "   avg(value) as value"
-      . " from samples where address = " . $address
-      . "   and type = '" . $type . "'"
-      . "   and time > from_unixtime(" . $from . ") and time < from_unixtime(" . $to . ")"
+      . "   min(time) as time,"
+      . "   sum(value * samples) / sum(samples) as value"
+      . " from (";
+
+   if ($tier != "S")
+      $query .= "select time - " . $tierSeconds . " as time, value, samples from sampledata"
+         . "   where " . $seriesCond . " and aggregate = '" . $tier . "'"
+         . "   and time > " . ($from + $tierSeconds)
+         . "   and time <= " . ($to + $tierSeconds)
+         . " union all ";
+
+   $query .= "select time, value, 1 as samples from sampledata"
+      . "   where " . $seriesCond . " and aggregate = 'S'"
+      . "   and time > " . max($from, $tierLast) . " and time < " . $to
+      . " ) s"
       . " group by"
-      . "   date(time), ((60/" . $groupMinutes . ") * hour(time) + floor(minute(time)/" . $groupMinutes . "))"
+      . "   date(from_unixtime(time)), floor(time_to_sec(from_unixtime(time)) / " . ($groupMinutes * 60) . ")"
       . " order by time";
 
    syslog(LOG_DEBUG, "p4: $query");
@@ -129,9 +159,27 @@ while ($fact = $factResult->fetch_assoc())
 
    syslog(LOG_DEBUG, "p4: " . $result->num_rows . " for $title ($address) $name");
 
-   $lastLabel = "";
+   // the raw samples of the days before are in the archive
+
+   $rows = ($tier == "S") ? archiveRows($mysqli, $seriesId, $from, $to, $groupMinutes * 60) : array();
 
    while ($row = $result->fetch_assoc())
+      $rows[] = $row;
+
+   $result->close();
+
+   // the digital inputs/outputs are stored as events (p4d option ioEvents)
+
+   if ($ioEvents && ($type == "DI" || $type == "DO"))
+      $rows = array_merge($rows, eventRows($mysqli, $seriesId, max($from, $tierLast), $to, $groupMinutes * 60));
+   $lastLabel = "";
+
+   // the samples dropped by the compression (p4d option compressAnalog)
+
+   if ($compressMaxGap > 0)
+      $rows = fillGaps($rows, $groupMinutes * 60, $compressMaxGap);
+
+   foreach ($rows as $row)
    {
       $time = $row['time'];
       $value = $row['value'];
@@ -155,7 +203,9 @@ while ($fact = $factResult->fetch_assoc())
             $times[] = strftime("%H:%M", $time);
          elseif ($range < 8 && ($utc % (12*60*60)) < 5*60)    // max diff 5 minutes
             $times[] = strftime("%d. %b %H:%M", $time);
-         elseif ($range >= 8 && ($utc % (60*60*24)) < 7*60)   // max diff 7 minutes
+         elseif ($range > 31 && date("j", $time) == 1)
+            $times[] = strftime("%b %Y", $time);
+         elseif ($range >= 8 && $range <= 31 && ($utc % (60*60*24)) < 7*60)   // max diff 7 minutes
             $times[] = strftime("%d. %b", $time);
          else
             $times[] = $lastLabel;
@@ -268,6 +318,273 @@ $dd = time() - $start;
 syslog(LOG_DEBUG, "p4: --------- done in $dd seconds");
 
 
+//***************************************************************************
+// Select Tier
+//   the coarsest rollup tier not coarser than the resolution which reaches
+//   back to 'from', if none does the one reaching back furthest.
+//   Returns the aggregate code, its interval and the end of its last bucket
+//***************************************************************************
+
+function selectTier($mysqli, $rollupTiers, $seriesId, $from, $resolution)
+{
+   $tiers = array("S" => 0);
+   $best = array("S", 0, 0);
+   $bestFirst = 0;
+
+   foreach (explode(",", $rollupTiers) as $tier)
+   {
+      $t = explode(":", $tier);
+
+      if (count($t) == 2)
+         $tiers[$t[0]] = $t[1];
+   }
+
+   arsort($tiers);
+
+   foreach ($tiers as $code => $seconds)
+   {
+      $result = $mysqli->query("select min(time) as first, max(time) as last"
+                               . " from sampledata where seriesid = " . $seriesId
+                               . " and aggregate = '" . $code . "'")
+         or die("Error" . $mysqli->error);
+
+      $row = $result->fetch_assoc();
+      $result->close();
+
+      if ($code == "S")           // the raw samples reach back into the archive
+      {
+         $result = $mysqli->query("select min(firsttime) as first from samplearchive"
+                                  . " where seriesid = " . $seriesId)
+            or die("Error" . $mysqli->error);
+
+         $archived = $result->fetch_assoc();
+         $result->close();
+
+         if ($archived['first'] != "" && ($row['first'] == "" || $archived['first'] < $row['first']))
+            $row['first'] = $archived['first'];
+      }
+
+      if ($row['first'] == "")
+         continue;
+
+      $first = $row['first'] - $seconds;
+      $last = $code != "S" ? $row['last'] : 0;
+
+      if ($seconds <= $resolution && $first <= $from)
+         return array($code, $seconds, $last);
+
+      if ($bestFirst == 0 || $first < $bestFirst)
+      {
+         $best = array($code, $seconds, $last);
+         $bestFirst = $first;
+      }
+   }
+
+   return $best;
+}
+
+//***************************************************************************
+// Fill Gaps
+//   the gaps up to the heartbeat of the compression are filled by the
+//   linear interpolation of the rows around, one row per group
+//***************************************************************************
+
+function fillGaps($rows, $groupSeconds, $maxGap)
+{
+   $filled = array();
+   $prev = null;
+
+   foreach ($rows as $row)
+   {
+      $gap = $prev ? $row['time'] - $prev['time'] : 0;
+
+      if ($gap > 1.5 * $groupSeconds && $gap <= $maxGap + $groupSeconds)
+      {
+         for ($t = $prev['time'] + $groupSeconds; $t < $row['time'] - $groupSeconds / 2; $t += $groupSeconds)
+            $filled[] = array("time" => $t,
+                              "value" => $prev['value'] + ($row['value'] - $prev['value']) * ($t - $prev['time']) / $gap);
+      }
+
+      $filled[] = $row;
+      $prev = $row;
+   }
+
+   return $filled;
+}
+
+//***************************************************************************
+// Event Rows
+//   the state changes of a digital input/output inside (from, to) as
+//   rows of the groups, 'value' is the part of the group in state on
+//***************************************************************************
+
+function eventRows($mysqli, $seriesId, $from, $to, $groupSeconds)
+{
+   $rows = array();
+   $events = array();
+   $state = null;
+   $to = min($to, time());
+
+   $result = $mysqli->query("select state from ioevents where seriesid = " . $seriesId
+                            . " and time <= " . $from . " order by time desc limit 1")
+      or die("Error" . $mysqli->error);
+
+   if ($row = $result->fetch_assoc())
+      $state = $row['state'];
+
+   $result->close();
+
+   $result = $mysqli->query("select time, state from ioevents where seriesid = " . $seriesId
+                            . " and time > " . $from . " and time < " . $to . " order by time")
+      or die("Error" . $mysqli->error);
+
+   while ($row = $result->fetch_assoc())
+      $events[] = $row;
+
+   $result->close();
+
+   $e = 0;
+
+   for ($start = $from; $start < $to; $start += $groupSeconds)
+   {
+      $end = min($start + $groupSeconds, $to);
+      $t = $start;
+      $on = 0;
+      $known = 0;
+
+      while ($t < $end)
+      {
+         $next = ($e < count($events) && $events[$e]['time'] < $end) ? $events[$e]['time'] : $end;
+
+         if ($state !== null)
+         {
+            $known += $next - $t;
+            $on += $state ? $next - $t : 0;
+         }
+
+         if ($next < $end)
+            $state = $events[$e++]['state'];
+
+         $t = $next;
+      }
+
+      if ($known)
+         $rows[] = array("time" => $start, "value" => $on / $known);
+   }
+
+   return $rows;
+}
+
+//***************************************************************************
+// Archive Rows
+//   the archived raw samples inside (from, to) grouped like the query of
+//   the samples does, 'time' is the first, 'value' the average of a group
+//***************************************************************************
+
+function archiveRows($mysqli, $seriesId, $from, $to, $groupSeconds)
+{
+   $rows = array();
+   $key = "";
+   $first = 0;
+   $sum = 0;
+   $n = 0;
+
+   $result = $mysqli->query("select day, data from samplearchive"
+                            . " where seriesid = " . $seriesId
+                            . " and lasttime > " . $from . " and day < " . $to
+                            . " order by day")
+      or die("Error" . $mysqli->error);
+
+   while ($chunk = $result->fetch_assoc())
+   {
+      foreach (decodeChunk($chunk['day'], $chunk['data']) as $point)
+      {
+         list($time, $value) = $point;
+
+         if ($time <= $from || $time >= $to)
+            continue;
+
+         $k = date("Ymd", $time) . ":"
+            . floor((date("G", $time) * 3600 + date("i", $time) * 60 + date("s", $time)) / $groupSeconds);
+
+         if ($k != $key)
+         {
+            if ($n)
+               $rows[] = array("time" => $first, "value" => $sum / $n);
+
+            $key = $k;
+            $first = $time;
+            $sum = 0;
+            $n = 0;
+         }
+
+         $sum += $value;
+         $n++;
+      }
+   }
+
+   if ($n)
+      $rows[] = array("time" => $first, "value" => $sum / $n);
+
+   $result->close();
+
+   return $rows;
+}
+
+//***************************************************************************
+// Decode Chunk
+//   of the sample archive, returns array(time, value) pairs (layout see
+//   p4archive.h of the daemon)
+//***************************************************************************
+
+function decodeChunk($day, $data)
+{
+   $points = array();
+   $raw = gzuncompress($data);
+
+   if ($raw === false || strlen($raw) < 8)
+      return $points;
+
+   $h = unpack("Cversion/Cscale/vpad/Vcount", $raw);
+   $count = $h['count'];
+
+   if (!$count || strlen($raw) < 8 + $count * ($h['scale'] == 255 ? 16 : 12))
+      return $points;
+
+   $times = array_values(unpack("V" . $count, substr($raw, 8, 4 * $count)));
+
+   if ($h['scale'] == 255)
+      $values = array_values(unpack("d" . $count, substr($raw, 8 + 4 * $count, 8 * $count)));
+   else
+      $values = array_values(unpack("V" . $count, substr($raw, 8 + 4 * $count, 4 * $count)));
+
+   $factor = pow(10, $h['scale']);
+   $time = $day;
+   $value = 0;
+
+   for ($i = 0; $i < $count; $i++)
+   {
+      $time += toInt32($times[$i]);
+
+      if ($h['scale'] == 255)
+      {
+         $points[] = array($time, $values[$i]);
+      }
+      else
+      {
+         $value += toInt32($values[$i]);
+         $points[] = array($time, $value / $factor);
+      }
+   }
+
+   return $points;
+}
+
+function toInt32($v)
+{
+   return $v >= 0x80000000 ? $v - 0x100000000 : $v;
+}
+
 //***************************************************************************
 // Build Address Condition
 //***************************************************************************
@@ -243,6 +243,42 @@ function readConfigItem($name, &$value, $default = "")
    return 0;
 }
 
+// ---------------------------------------------------------------------------
+// Latest Sample Condition
+//   the sample 'd' of each series at max, the series compressed by p4d
+//   (compressAnalog) have a row only on changes and at least one per
+//   compressMaxGap seconds -> their latest row before
+// ---------------------------------------------------------------------------
+
+function latestSampleCond($max)
+{
+   static $maxGap = null;
+
+   if ($maxGap === null)
+      readConfigItem("compressMaxGap", $maxGap, "0");
+
+   if ($maxGap <= 0)
+      return "d.time = unix_timestamp('" . $max . "')";
+
+   return "d.time = (select max(l.time) from sampledata l where l.seriesid = d.seriesid and l.aggregate = 'S'"
+      . " and l.time <= unix_timestamp('" . $max . "') and l.time > unix_timestamp('" . $max . "') - " . $maxGap . ")";
+}
+
+// ---------------------------------------------------------------------------
+// Io State Query
+//   the current state of a digital input/output (DI/DO), p4d keeps them in
+//   ioruntime - with the option ioEvents they have no rows in sampledata
+// ---------------------------------------------------------------------------
+
+function ioStateQuery($max, $addr, $type)
+{
+   return sprintf("select r.state as s_value, null as s_text, f.title as f_title, f.usrtitle as f_usrtitle, f.unit as f_unit"
+                  . " from ioruntime r join series s on s.id = r.seriesid, valuefacts f"
+                  . " where f.address = s.address and f.type = s.type and f.address = %s and f.type = '%s'"
+                  . " and r.lasttime >= unix_timestamp('%s')"
+                  . " order by r.day desc limit 1;", $addr, $type, $max);
+}
+
 // ---------------------------------------------------------------------------
 // Schema Selection
 // ---------------------------------------------------------------------------
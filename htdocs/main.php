@@ -28,8 +28,8 @@ printHeader(60);
   // -------------------------
   // get last time stamp
 
-  $result = $mysqli->query("select max(time), DATE_FORMAT(max(time),'%d. %M %Y   %H:%i') as maxPretty, " .
-                        "DATE_FORMAT(max(time),'%H:%i:%S') as maxPrettyShort from samples;")
+  $result = $mysqli->query("select from_unixtime(max(time)) as 'max(time)', DATE_FORMAT(from_unixtime(max(time)),'%d. %M %Y   %H:%i') as maxPretty, " .
+                        "DATE_FORMAT(from_unixtime(max(time)),'%H:%i:%S') as maxPrettyShort from sampledata where aggregate = 'S';")
      or die("Error" . $mysqli->error);
   $row = $result->fetch_assoc();
   $max = $row['max(time)'];
@@ -96,13 +96,14 @@ printHeader(60);
 
   $p4dstate = requestAction("p4d-state", 3, 0, "", $response);
   $load = "";
+  $link = "";
 
   if ($p4dstate == 0)
-    list($p4dNext, $p4dVersion, $p4dSince, $load) = explode("#", $response, 4);
+    list($p4dNext, $p4dVersion, $p4dSince, $load, $link) = array_pad(explode("#", $response, 5), 5, "");
 
-  $result = $mysqli->query("select * from samples where time >= CURDATE()")
+  $result = $mysqli->query("select count(*) from sampledata where aggregate = 'S' and time >= unix_timestamp(CURDATE())")
      or die("Error" . $mysqli->error);
-  $p4dCountDay = $result->num_rows;
+  $p4dCountDay = mysqli_result($result, 0, 0);
 
   // ------------------
   // State of S 3200
@@ -168,6 +169,7 @@ printHeader(60);
         echo  "              <div><span>Nächste Messung:</span>       <span>$p4dNext</span>        </div>\n";
         echo  "              <div><span>Version (p4d / webif):</span> <span>$p4dVersion / $p4WebVersion</span></div>\n";
         echo  "              <div><span>CPU-Last:</span>              <span>$load</span>           </div>\n";
+        echo  "              <div><span>Schnittstelle:</span>         <span>$link</span>           </div>\n";
      }
      else
      {
@@ -184,12 +186,21 @@ printHeader(60);
   {
      $addresses = !isMobile() ? $_SESSION['addrsMain'] : $_SESSION['addrsMainMobile'];
 
+     // the digital inputs/outputs with their runtime of today from ioruntime
+
      if ($addresses == "")
-        $strQuery = sprintf("select s.address as s_address, s.type as s_type, s.time as s_time, s.value as s_value, s.text as s_text, f.usrtitle as f_usrtitle, f.title as f_title, f.unit as f_unit
-                from samples s, valuefacts f where f.state = 'A' and f.address = s.address and f.type = s.type and s.time = '%s';", $max);
+        $strQuery = sprintf("select s.address as s_address, s.type as s_type, from_unixtime(d.time) as s_time, d.value as s_value, t.text as s_text, f.usrtitle as f_usrtitle, f.title as f_title, f.unit as f_unit, null as r_ontime, null as r_switches
+                from sampledata d join series s on s.id = d.seriesid left join statetexts t on t.id = d.textid, valuefacts f
+                where f.state = 'A' and f.address = s.address and f.type = s.type and s.type not in ('DI', 'DO') and d.aggregate = 'S' and %s
+                union all
+                select s.address, s.type, from_unixtime(r.lasttime), r.state, null, f.usrtitle, f.title, f.unit, r.ontime, r.switches
+                from ioruntime r join series s on s.id = r.seriesid, valuefacts f
+                where f.state = 'A' and f.address = s.address and f.type = s.type and r.lasttime >= unix_timestamp('%s')
+                  and r.day = (select max(x.day) from ioruntime x where x.seriesid = r.seriesid);", latestSampleCond($max), $max);
      else
-        $strQuery = sprintf("select s.address as s_address, s.type as s_type, s.time as s_time, s.value as s_value, s.text as s_text, f.usrtitle as f_usrtitle, f.title as f_title, f.unit as f_unit
-                from samples s, valuefacts f where f.state = 'A' and f.address = s.address and f.type = s.type and s.address in (%s) and s.type = 'VA' and s.time = '%s';", $addresses, $max);
+        $strQuery = sprintf("select s.address as s_address, s.type as s_type, from_unixtime(d.time) as s_time, d.value as s_value, t.text as s_text, f.usrtitle as f_usrtitle, f.title as f_title, f.unit as f_unit
+                from sampledata d join series s on s.id = d.seriesid left join statetexts t on t.id = d.textid, valuefacts f
+                where f.state = 'A' and f.address = s.address and f.type = s.type and s.address in (%s) and s.type = 'VA' and d.aggregate = 'S' and %s;", $addresses, latestSampleCond($max));
 
      // syslog(LOG_DEBUG, "p4: selecting " . " '" . $strQuery . "'");
 
@@ -212,6 +223,9 @@ printHeader(60);
         if ($type == 'DI' || $type == 'DO')
            $value = $value == "1.00" ? "an" : "aus";
 
+        if ($row['r_ontime'] != "")
+           $value .= sprintf(" (heute %.1f h, %dx)", $row['r_ontime'] / 3600, $row['r_switches']);
+
         if ($row['f_unit'] == 'T')
            $value = str_replace($wd_value, $wd_disp, $text);
 
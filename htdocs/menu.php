@@ -131,7 +131,7 @@ if ($menu == "update")
 
 elseif ($menu == "init")
 {
-   requestAction("initmenu", 60, 0, "", $resonse);
+   requestAction("initmenu", 60, 0, "force", $resonse);
    echo "      <br/><div class=\"info\"><b><center>Initialisierung abgeschlossen</center></b></div><br/>";
    $menu = $lastMenu;
 }
@@ -455,14 +455,14 @@ function getValue($address)
 
    $address = $mysqli->real_escape_string($address);
 
-   $result = $mysqli->query("select max(time) as max from samples")
+   $result = $mysqli->query("select from_unixtime(max(time)) as max from sampledata where aggregate = 'S'")
       or die("Error" . $mysqli->error);
 
    $row = $result->fetch_array(MYSQLI_ASSOC);
    $max = $row['max'];
 
-   $strQuery = sprintf("select s.value as s_value, f.unit as f_unit from samples s, valuefacts f
-              where f.address = s.address and f.type = s.type and s.time = '%s' and f.address = '%s' and f.type = 'VA'", $max, $address);
+   $strQuery = sprintf("select d.value as s_value, f.unit as f_unit from sampledata d join series s on s.id = d.seriesid, valuefacts f
+              where f.address = s.address and f.type = s.type and d.aggregate = 'S' and %s and f.address = '%s' and f.type = 'VA'", latestSampleCond($max), $address);
 
    // syslog(LOG_DEBUG, "p4: " . $strQuery);
 
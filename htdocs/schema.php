@@ -33,7 +33,10 @@ while ($rowConf = $resultConf->fetch_assoc())
    $showUnit = $rowConf['showunit'];
    $showText = $rowConf['showtext'];
 
-   $strQuery = sprintf("select s.value as s_value, s.text as s_text, f.title as f_title, f.usrtitle as f_usrtitle, f.unit as f_unit from samples s, valuefacts f where f.address = s.address and f.type = s.type and s.time = '%s' and f.address = %s and f.type = '%s';", $max, $addr, $type);
+   if ($type == "DI" || $type == "DO")
+      $strQuery = ioStateQuery($max, $addr, $type);
+   else
+      $strQuery = sprintf("select d.value as s_value, t.text as s_text, f.title as f_title, f.usrtitle as f_usrtitle, f.unit as f_unit from sampledata d join series s on s.id = d.seriesid left join statetexts t on t.id = d.textid, valuefacts f where f.address = s.address and f.type = s.type and d.aggregate = 'S' and %s and f.address = %s and f.type = '%s';", latestSampleCond($max), $addr, $type);
    $result = $mysqli->query($strQuery)
       or die("Error" . $mysqli->error);
 
@@ -190,7 +190,7 @@ if ($started == 1)
   // -------------------------
   // get last time stamp
 
-  $result = $mysqli->query("select max(time), DATE_FORMAT(max(time),'%d. %M %Y   %H:%i') as maxPretty from samples;")
+  $result = $mysqli->query("select from_unixtime(max(time)) as 'max(time)', DATE_FORMAT(from_unixtime(max(time)),'%d. %M %Y   %H:%i') as maxPretty from sampledata where aggregate = 'S';")
      or die("Error" . $mysqli->error);
 
   $row = $result->fetch_assoc();
@@ -278,7 +278,7 @@ function nextConf($dir)
 
    // get last time stamp
 
-   $result = $mysqli->query("select max(time), DATE_FORMAT(max(time),'%d. %M %Y   %H:%i') as maxPretty from samples;");
+   $result = $mysqli->query("select from_unixtime(max(time)) as 'max(time)', DATE_FORMAT(from_unixtime(max(time)),'%d. %M %Y   %H:%i') as maxPretty from sampledata where aggregate = 'S';");
    $row = $result->fetch_array(MYSQLI_ASSOC);
    $max = $row['max(time)'];
    $result->close();
@@ -309,12 +309,15 @@ function nextConf($dir)
 
    // get coresponding value/text and unit
 
-   $strQuery = sprintf("select s.value as s_value, s.text as s_text, f.unit as f_unit " .
-                       " from samples s, valuefacts f " .
-                       " where f.address = s.address " .
-                       "  and f.type = s.type and s.time = '%s' " .
-                       "  and f.address = %s and f.type = '%s';",
-                       $max, $_SESSION["addr"], $_SESSION["type"]);
+   if ($_SESSION["type"] == "DI" || $_SESSION["type"] == "DO")
+      $strQuery = ioStateQuery($max, $_SESSION["addr"], $_SESSION["type"]);
+   else
+      $strQuery = sprintf("select d.value as s_value, t.text as s_text, f.unit as f_unit " .
+                          " from sampledata d join series s on s.id = d.seriesid left join statetexts t on t.id = d.textid, valuefacts f " .
+                          " where f.address = s.address " .
+                          "  and f.type = s.type and d.aggregate = 'S' and %s " .
+                          "  and f.address = %s and f.type = '%s';",
+                          latestSampleCond($max), $_SESSION["addr"], $_SESSION["type"]);
 
    $result = $mysqli->query($strQuery)
       or die("Error" . $mysqli->error);
@@ -14,7 +14,7 @@
   // -------------------------
   // get last time stamp
 
-  $result = $mysqli->query("select max(time), DATE_FORMAT(max(time),'%d. %M %Y   %H:%i') as maxPretty from samples;")
+  $result = $mysqli->query("select from_unixtime(max(time)) as 'max(time)', DATE_FORMAT(from_unixtime(max(time)),'%d. %M %Y   %H:%i') as maxPretty from sampledata where aggregate = 'S';")
      or die("Error" . $mysqli->error);
 
   $row = $result->fetch_assoc();
@@ -28,7 +28,7 @@ if (isset($_POST["action"]))
 
 if ($action == "init")
 {
-   requestAction("initvaluefacts", 20, 0, "", $resonse);
+   requestAction("initvaluefacts", 20, 0, "force", $resonse);
    echo "<br/><div class=\"info\"><b><center>Initialisierung abgeschlossen</center></b></div><br/><br/>";
 }
 
@@ -84,6 +84,7 @@ showTable("DI", "Digitale Eingänge");
 showTable("DO", "Digitale Ausgänge");
 showTable("AO", "Analoge Ausgänge");
 showTable("W1", "One Wire Sensoren");
+showTable("C2", "COM2 Telegramm");
 echo "      </form>\n";
 
 $mysqli->close();
@@ -345,6 +345,41 @@ class Sem
          return success;
       }
 
+      // ----------------------
+      // get lock, wait at most 'timeout' ms
+
+      int p(int timeout)
+      {
+         sembuf sops[2];
+         struct timespec ts;
+
+         sops[0].sem_num = 0;
+         sops[0].sem_op = 0;                        // wait for lock
+         sops[0].sem_flg = SEM_UNDO;
+
+         sops[1].sem_num = 0;
+         sops[1].sem_op = 1;                        // increment
+         sops[1].sem_flg = SEM_UNDO | IPC_NOWAIT;
+
+         ts.tv_sec = timeout / 1000;
+         ts.tv_nsec = (timeout % 1000) * 1000000;
+
+         if (semtimedop(id, sops, 2, &ts) == -1)
+         {
+            if (errno == EAGAIN)
+               tell(eloAlways, "Error: Semaphore still locked after %d ms", timeout);
+            else
+               tell(eloAlways, "Error: Can't lock semaphore, errno (%d) '%s'",
+                    errno, strerror(errno));
+
+            return fail;
+         }
+
+         locked = yes;
+
+         return success;
+      }
+
       int inc()
       {
          sembuf sops[1];
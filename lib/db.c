@@ -632,6 +632,7 @@ cDbTable::cDbTable(cDbConnection* aConnection, const char* name)
    stmtSelect = 0;
    stmtInsert = 0;
    stmtUpdate = 0;
+   stmtUpsert = 0;
    lastInsertId = na;
 
    tableDef = dbDict.getTable(name);
@@ -674,6 +675,7 @@ int cDbTable::close()
    if (stmtSelect) { delete stmtSelect; stmtSelect = 0; }
    if (stmtInsert) { delete stmtInsert; stmtInsert = 0; }
    if (stmtUpdate) { delete stmtUpdate; stmtUpdate = 0; }
+   if (stmtUpsert) { delete stmtUpsert; stmtUpsert = 0; }
 
    detach();
 
@@ -834,6 +836,74 @@ int cDbTable::init(int allowAlter)
    if (stmtUpdate->prepare() != success)
       return fail;
 
+   // -----------------------------------------
+   // insert or update via primary key ...
+
+   stmtUpsert = new cDbStatement(this);
+
+   stmtUpsert->build("insert into %s set ", TableName());
+
+   n = 0;
+
+   for (f = tableDef->dfields.begin(); f != tableDef->dfields.end(); f++)
+   {
+      // the primary key is needed even if autoinc, NULL let mysql create it
+
+      if (f->second->getType() & ftAutoinc && !(f->second->getType() & ftPrimary))
+         continue;
+
+      stmtUpsert->bind(f->second, bndIn | bndSet, n++ ? ", " : "");
+   }
+
+   buildUpsertClause(stmtUpsert);
+   stmtUpsert->build(";");
+
+   if (stmtUpsert->prepare() != success)
+      return fail;
+
+   return success;
+}
+
+//***************************************************************************
+// Build Upsert Clause
+//   ' on duplicate key update <field> = values(<field>), ..' for all
+//   fields except the primary key, autoinc fields and the insert stamp
+//***************************************************************************
+
+int cDbTable::buildUpsertClause(cDbStatement* stmt)
+{
+   std::map<std::string, cDbFieldDef*>::iterator f;
+   int n = 0;
+
+   stmt->build(" on duplicate key update ");
+
+   for (f = tableDef->dfields.begin(); f != tableDef->dfields.end(); f++)
+   {
+      if (f->second->getType() & ftPrimary ||
+          f->second->getType() & ftAutoinc)
+         continue;
+
+      if (strcasecmp(f->second->getName(), "inssp") == 0)
+         continue;
+
+      stmt->build("%s%s = values(%s)", n++ ? ", " : "",
+                  f->second->getDbName(), f->second->getDbName());
+   }
+
+   // a table without data fields, nothing to update
+
+   if (!n)
+   {
+      for (f = tableDef->dfields.begin(); f != tableDef->dfields.end(); f++)
+      {
+         if (f->second->getType() & ftPrimary)
+         {
+            stmt->build("%s = %s", f->second->getDbName(), f->second->getDbName());
+            break;
+         }
+      }
+   }
+
    return success;
 }
 
@@ -954,6 +1024,13 @@ int cDbTable::validateStructure(int allowAlter)
       }
    }
 
+   // --------------------------------------
+   // the partitions requested by the dict are only reported,
+   //   altering copies the table (see partitionTable())
+
+   if (tableDef->getPartition() && !isPartitioned())
+      tell(0, "Info: Table '%s' not partitioned as defined in the dictionary", TableName());
+
    return success;
 }
 
@@ -1136,7 +1213,12 @@ int cDbTable::createTable()
    }
 
    // statement += std::string(") ENGINE MYISAM;");
-   statement += std::string(") ENGINE InnoDB;");
+   statement += std::string(") ENGINE InnoDB");
+
+   if (tableDef->getPartition())
+      statement += partitionLayout();
+
+   statement += ";";
 
    tell(1, "%s", statement.c_str());
 
@@ -1147,6 +1229,310 @@ int cDbTable::createTable()
    return success;
 }
 
+//***************************************************************************
+// Partitions
+//   monthly partitions are named p<key>_YYYYMM (pYYYYMM without key) and
+//   hold the rows up to the begin of the next month (local time), the
+//   catch all partition of a key is p<key> (pmax). The time column is a
+//   DateTime or an integer with seconds since epoch.
+//***************************************************************************
+
+static std::string partitionName(const char* key, int year = 0, int month = 0)
+{
+   char name[100];
+
+   if (!year)
+      sprintf(name, "p%s", key ? key : "max");
+   else if (key)
+      sprintf(name, "p%s_%04d%02d", key, year, month);
+   else
+      sprintf(name, "p%04d%02d", year, month);
+
+   return name;
+}
+
+static std::string partitionBound(const char* key, int year, int month, int epoch = no)
+{
+   char bound[100];
+   char begin[30];
+   const char* max = "MAXVALUE";
+
+   if (!year && key)
+      sprintf(bound, "('%s', %s)", key, max);
+   else if (!year)
+      sprintf(bound, "(%s)", max);
+   else
+   {
+      year += month / 12;          // begin of the next month
+      month = month % 12 + 1;
+
+      if (epoch)                   // time column in seconds since epoch
+      {
+         struct tm tm = {0};
+
+         tm.tm_year = year - 1900;
+         tm.tm_mon = month - 1;
+         tm.tm_mday = 1;
+         tm.tm_isdst = -1;
+
+         sprintf(begin, "%ld", (long)mktime(&tm));
+      }
+      else
+         sprintf(begin, "'%04d-%02d-01 00:00:00'", year, month);
+
+      if (key)
+         sprintf(bound, "('%s', %s)", key, begin);
+      else
+         sprintf(bound, "(%s)", begin);
+   }
+
+   return bound;
+}
+
+//***************************************************************************
+// Partition Layout
+//   the initial one, only the catch all partitions
+//***************************************************************************
+
+std::string cDbTable::partitionLayout()
+{
+   cDbPartitionDef* def = tableDef->getPartition();
+   std::string layout;
+
+   layout = " partition by range columns(";
+
+   if (def->getKeyField())
+      layout += std::string(def->getKeyField()->getDbName()) + ", ";
+
+   layout += std::string(def->getTimeField()->getDbName()) + ") (";
+
+   for (int i = 0; i < def->keyCount(); i++)
+   {
+      layout += "partition " + partitionName(def->getKey(i))
+         + " values less than " + partitionBound(def->getKey(i), 0, 0) + ", ";
+   }
+
+   layout += "partition pmax values less than ";
+   layout += def->getKeyField() ? "(MAXVALUE, MAXVALUE))" : "(MAXVALUE))";
+
+   return layout;
+}
+
+//***************************************************************************
+// Partition Table
+//   an existing table to the layout of the dict, the table is copied,
+//   this may take a while and locks the table meanwhile
+//***************************************************************************
+
+int cDbTable::partitionTable()
+{
+   if (!tableDef->getPartition() || isPartitioned())
+      return done;
+
+   std::string statement = "alter table " + std::string(TableName()) + partitionLayout();
+
+   tell(0, "Info: Table '%s' not partitioned, try to alter table, this may take a while", TableName());
+   tell(1, "%s", statement.c_str());
+
+   if (connection->query("%s", statement.c_str()))
+      return connection->errorSql(getConnection(), "partitionTable()", 0, statement.c_str());
+
+   return success;
+}
+
+//***************************************************************************
+// Get Partitions
+//***************************************************************************
+
+int cDbTable::getPartitions(std::vector<std::string>* names)
+{
+   MYSQL_RES* result;
+   MYSQL_ROW data;
+
+   names->clear();
+
+   if (connection->query("select partition_name from information_schema.partitions"
+                         " where table_schema = '%s' and table_name = '%s' and partition_name is not null"
+                         " order by partition_ordinal_position",
+                         connection->getName(), TableName()) != success)
+      return connection->errorSql(getConnection(), "getPartitions()");
+
+   if (!(result = mysql_store_result(connection->getMySql())))
+      return connection->errorSql(getConnection(), "getPartitions()");
+
+   while ((data = mysql_fetch_row(result)))
+      names->push_back(data[0]);
+
+   mysql_free_result(result);
+
+   return success;
+}
+
+int cDbTable::isPartitioned()
+{
+   std::vector<std::string> names;
+
+   return getPartitions(&names) == success && names.size();
+}
+
+//***************************************************************************
+// Is Catch All Empty
+//   splitting months off the catch all partition of a key copies its rows
+//***************************************************************************
+
+int cDbTable::isCatchAllEmpty(const char* key)
+{
+   int count = 0;
+
+   if (connection->query(count, "select count(*) from (select 1 from %s partition (%s) limit 1) t",
+                         TableName(), partitionName(key).c_str()) != success)
+   {
+      connection->errorSql(getConnection(), "isCatchAllEmpty()");
+      return no;
+   }
+
+   return count == 0;
+}
+
+//***************************************************************************
+// Months Of Key
+//   the monthly partitions of a key as YYYYMM, ascending
+//***************************************************************************
+
+int cDbTable::monthsOfKey(const char* key, std::vector<int>* months)
+{
+   std::vector<std::string> names;
+   std::string prefix = partitionName(key) + (key ? "_" : "");
+
+   months->clear();
+
+   if (getPartitions(&names) != success)
+      return fail;
+
+   for (uint i = 0; i < names.size(); i++)
+   {
+      const char* p = names[i].c_str();
+
+      if (strncasecmp(p, prefix.c_str(), prefix.length()) == 0 &&
+          strlen(p + prefix.length()) == 6 && strspn(p + prefix.length(), "0123456789") == 6)
+      {
+         months->push_back(atoi(p + prefix.length()));
+      }
+   }
+
+   std::sort(months->begin(), months->end());
+
+   return success;
+}
+
+//***************************************************************************
+// Create Partitions
+//   the months from 'from' (or behind the last existing month) up to
+//   'until' are split off the catch all partition of the key, cheap as
+//   long as it holds no rows of these months
+//***************************************************************************
+
+int cDbTable::createPartitions(const char* key, time_t from, time_t until)
+{
+   std::vector<int> months;
+   std::string statement;
+   struct tm tmFrom = {0};
+   struct tm tmUntil = {0};
+   int year, month;
+   int count = 0;
+
+   if (!tableDef->getPartition() || !isPartitioned())
+      return done;
+
+   int epoch = tableDef->getPartition()->getTimeField()->getFormat() != ffDateTime;
+
+   if (monthsOfKey(key, &months) != success)
+      return fail;
+
+   localtime_r(&from, &tmFrom);
+   localtime_r(&until, &tmUntil);
+
+   year = tmFrom.tm_year + 1900;
+   month = tmFrom.tm_mon + 1;
+
+   if (months.size())
+   {
+      year = months.back() / 100 + months.back() % 100 / 12;
+      month = months.back() % 100 % 12 + 1;
+   }
+
+   statement = "alter table " + std::string(TableName()) + " reorganize partition "
+      + partitionName(key) + " into (";
+
+   while (year * 100 + month <= (tmUntil.tm_year + 1900) * 100 + tmUntil.tm_mon + 1)
+   {
+      statement += "partition " + partitionName(key, year, month)
+         + " values less than " + partitionBound(key, year, month, epoch) + ", ";
+
+      year += month / 12;
+      month = month % 12 + 1;
+      count++;
+   }
+
+   if (!count)
+      return done;
+
+   statement += "partition " + partitionName(key) + " values less than " + partitionBound(key, 0, 0) + ")";
+
+   tell(1, "%s", statement.c_str());
+
+   if (connection->query("%s", statement.c_str()))
+      return connection->errorSql(getConnection(), "createPartitions()", 0, statement.c_str());
+
+   tell(0, "Created %d monthly partition(s) of '%s'%s%s", count, TableName(),
+        key ? " for " : "", key ? key : "");
+
+   return success;
+}
+
+//***************************************************************************
+// Drop Partitions
+//   the monthly partitions of the key ending before 'before'
+//***************************************************************************
+
+int cDbTable::dropPartitions(const char* key, time_t before, int& count)
+{
+   std::vector<int> months;
+   std::string names;
+
+   count = 0;
+
+   if (!tableDef->getPartition() || monthsOfKey(key, &months) != success)
+      return fail;
+
+   for (uint i = 0; i < months.size(); i++)
+   {
+      int year = months[i] / 100;
+      int month = months[i] % 100;
+      struct tm tm = {0};
+
+      tm.tm_year = year + month / 12 - 1900;   // begin of the next month
+      tm.tm_mon = month % 12;
+      tm.tm_mday = 1;
+      tm.tm_isdst = -1;
+
+      if (mktime(&tm) > before)
+         break;
+
+      names += std::string(count++ ? ", " : "") + partitionName(key, year, month);
+   }
+
+   if (!count)
+      return done;
+
+   tell(1, "alter table %s drop partition %s", TableName(), names.c_str());
+
+   if (connection->query("alter table %s drop partition %s", TableName(), names.c_str()))
+      return connection->errorSql(getConnection(), "dropPartitions()");
+
+   return success;
+}
+
 //***************************************************************************
 // Create Indices
 //***************************************************************************
@@ -1172,13 +1558,28 @@ int cDbTable::createIndices()
 
       idxName = "idx" + std::string(index->getName());
 
-      checkIndex(idxName.c_str(), fCount);
+      int unique = no;
+
+      checkIndex(idxName.c_str(), fCount, &unique);
+
+      if (fCount && fCount == index->fieldCount() && unique != index->isUnique())
+      {
+         // the index became unique (or not), create it again
+
+         tell(1, "drop index %s on %s", idxName.c_str(), TableName());
+
+         if (connection->query("drop index %s on %s", idxName.c_str(), TableName()))
+            return connection->errorSql(getConnection(), "createIndices()");
+
+         fCount = 0;
+      }
 
       if (fCount != index->fieldCount())
       {
          // create index
 
-         statement = "create index " + idxName;
+         statement = index->isUnique() ? "create unique index " : "create index ";
+         statement += idxName;
          statement += " on " + std::string(TableName()) + "(";
 
          int n = 0;
@@ -1200,8 +1601,14 @@ int cDbTable::createIndices()
          tell(1, "%s", statement.c_str());
 
          if (connection->query("%s", statement.c_str()))
+         {
+            if (index->isUnique())
+               tell(0, "Error: Can't create unique index '%s' on '%s', duplicate rows?",
+                    idxName.c_str(), TableName());
+
             return connection->errorSql(getConnection(), "createIndices()",
                                         0, statement.c_str());
+         }
       }
    }
 
@@ -1212,7 +1619,7 @@ int cDbTable::createIndices()
 // Check Index
 //***************************************************************************
 
-int cDbTable::checkIndex(const char* idxName, int& fieldCount)
+int cDbTable::checkIndex(const char* idxName, int& fieldCount, int* unique)
 {
    enum IndexQueryFields
    {
@@ -1254,7 +1661,12 @@ int cDbTable::checkIndex(const char* idxName, int& fieldCount)
               row[idSeqInIndex], row[idColumnName]);
 
          if (strcasecmp(row[idKeyName], idxName) == 0)
+         {
             fieldCount++;
+
+            if (unique)
+               *unique = strcmp(row[idNonUnique], "0") == 0;
+         }
       }
 
       mysql_free_result(result);
@@ -1486,6 +1898,39 @@ int cDbTable::store()
       return insert();
 }
 
+//***************************************************************************
+// Upsert
+//   like store() but with one statement, returns success for inserted,
+//   updated and unchanged rows
+//***************************************************************************
+
+int cDbTable::upsert(time_t stamp)
+{
+   std::map<std::string, cDbFieldDef*>::iterator f;
+   lastInsertId = na;
+
+   if (!stmtUpsert)
+   {
+      tell(0, "Fatal missing upsert statement\n");
+      return fail;
+   }
+
+   for (f = tableDef->dfields.begin(); f != tableDef->dfields.end(); f++)
+   {
+      cDbFieldDef* fld = f->second;
+
+      if (strcasecmp(fld->getName(), "updsp") == 0 || strcasecmp(fld->getName(), "inssp") == 0)
+         setValue(fld, stamp ? stamp : time(0));
+   }
+
+   if (stmtUpsert->execute())
+      return fail;
+
+   lastInsertId = stmtUpsert->getLastInsertId();
+
+   return success;
+}
+
 //***************************************************************************
 // Insert
 //***************************************************************************
@@ -1605,3 +2050,201 @@ void cDbTable::reset(cDbStatement* stmt)
    if (stmt)
       stmt->freeResult();
 }
+
+//***************************************************************************
+// Class cDbBatch
+//***************************************************************************
+
+cDbBatch::cDbBatch(cDbTable* aTable, int aChunkSize)
+{
+   table = aTable;
+   chunkSize = aChunkSize;
+   count = 0;
+   errors = 0;
+   ownTransaction = no;
+
+   rowsWritten = 0;
+   statementsExecuted = 0;
+   usWriting = 0;
+
+   lastRows = 0;
+   lastStatements = 0;
+   lastMs = 0;
+}
+
+cDbBatch::~cDbBatch()
+{
+   std::map<int, cDbStatement*>::iterator it;
+
+   for (it = statements.begin(); it != statements.end(); it++)
+      delete it->second;
+
+   for (unsigned int i = 0; i < rows.size(); i++)
+      delete rows[i];
+}
+
+//***************************************************************************
+// Add
+//***************************************************************************
+
+int cDbBatch::add()
+{
+   std::map<std::string, cDbFieldDef*>::iterator f;
+   cDbTableDef* tableDef = table->getTableDef();
+
+   if (count >= (int)rows.size())
+      rows.push_back(new cDbRow(tableDef));
+
+   rows[count]->copyValues(table->getRow());
+
+   for (f = tableDef->dfields.begin(); f != tableDef->dfields.end(); f++)
+   {
+      cDbFieldDef* fld = f->second;
+
+      if (strcasecmp(fld->getName(), "updsp") == 0 || strcasecmp(fld->getName(), "inssp") == 0)
+         rows[count]->setValue(fld, time(0));
+   }
+
+   if (++count < chunkSize)
+      return success;
+
+   return write();
+}
+
+//***************************************************************************
+// Flush
+//***************************************************************************
+
+int cDbBatch::flush()
+{
+   int status = write();
+   double start = usNow();
+
+   if (errors)                  // a chunk written by add() failed
+      status = fail;
+
+   if (ownTransaction)
+   {
+      if (status == success)
+         status = table->getConnection()->commit();
+      else
+         table->getConnection()->rollback();
+
+      ownTransaction = no;
+   }
+
+   usWriting += usNow() - start;
+
+   lastRows = rowsWritten;
+   lastStatements = statementsExecuted;
+   lastMs = usWriting / 1000;
+
+   rowsWritten = 0;
+   statementsExecuted = 0;
+   usWriting = 0;
+   errors = 0;
+
+   return status;
+}
+
+//***************************************************************************
+// Write
+//***************************************************************************
+
+int cDbBatch::write()
+{
+   int status;
+   cDbStatement* stmt;
+   cDbConnection* connection = table->getConnection();
+   double start = usNow();
+
+   if (!count)
+      return success;
+
+   if (!(stmt = getStatement(count)))
+   {
+      count = 0;
+      errors++;
+      return fail;
+   }
+
+   if (!connection->inTransaction())
+   {
+      connection->startTransaction();
+      ownTransaction = yes;
+   }
+
+   status = stmt->execute();
+
+   if (status == success)
+      rowsWritten += count;
+   else
+      errors++;
+
+   statementsExecuted++;
+   usWriting += usNow() - start;
+   count = 0;
+
+   return status;
+}
+
+//***************************************************************************
+// Get Statement
+//   insert into <table> (<fields>) values (?, ...), (?, ...) ..
+//     on duplicate key update <data field> = values(<data field>), ..
+//***************************************************************************
+
+cDbStatement* cDbBatch::getStatement(int rowCount)
+{
+   std::map<std::string, cDbFieldDef*>::iterator f;
+   std::map<int, cDbStatement*>::iterator it;
+   cDbTableDef* tableDef = table->getTableDef();
+   cDbStatement* stmt;
+   int n = 0;
+
+   if ((it = statements.find(rowCount)) != statements.end())
+      return it->second;
+
+   stmt = new cDbStatement(table);
+
+   stmt->build("insert into %s (", table->TableName());
+
+   for (f = tableDef->dfields.begin(); f != tableDef->dfields.end(); f++)
+   {
+      if (f->second->getType() & ftAutoinc)
+         continue;
+
+      stmt->build("%s%s", n++ ? ", " : "", f->second->getDbName());
+   }
+
+   stmt->build(") values ");
+
+   for (int r = 0; r < rowCount; r++)
+   {
+      stmt->build("%s(", r ? ", " : "");
+      n = 0;
+
+      for (f = tableDef->dfields.begin(); f != tableDef->dfields.end(); f++)
+      {
+         if (f->second->getType() & ftAutoinc)
+            continue;
+
+         stmt->bind(rows[r]->getValue(f->second), bndIn, n++ ? ", " : "");
+      }
+
+      stmt->build(")");
+   }
+
+   table->buildUpsertClause(stmt);
+   stmt->build(";");
+
+   if (stmt->prepare() != success)
+   {
+      delete stmt;
+      return 0;
+   }
+
+   statements[rowCount] = stmt;
+
+   return stmt;
+}
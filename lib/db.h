@@ -19,6 +19,8 @@
 #include <mysql/mysql.h>
 
 #include <list>
+#include <vector>
+#include <map>
 
 #include "common.h"
 #include "dbdict.h"
@@ -194,6 +196,21 @@ class cDbValue : public cDbService
             changed++;
       }
 
+      void copyValue(cDbValue* value)      // copy of a value with the same field definition
+      {
+         numValue = value->numValue;
+         longlongValue = value->longlongValue;
+         floatValue = value->floatValue;
+         timeValue = value->timeValue;
+         strValueSize = value->strValueSize;
+         nullValue = value->nullValue;
+
+         if (strValue && value->strValue)
+            memcpy(strValue, value->strValue, field->getSize()+TB);
+
+         changed++;
+      }
+
       void setCharValue(char value)
       {
          char tmp[2];
@@ -621,6 +638,12 @@ class cDbRow : public cDbService
          return count;
       }
 
+      void copyValues(cDbRow* from)
+      {
+         for (int f = 0; f < tableDef->fieldCount(); f++)
+            dbValues[f].copyValue(&from->dbValues[f]);
+      }
+
       virtual cDbFieldDef* getField(int id)                     { return tableDef->getField(id); }
       virtual cDbFieldDef* getField(const char* name)           { return tableDef->getField(name); }
       virtual cDbFieldDef* getFieldByDbName(const char* dbname) { return tableDef->getFieldByDbName(dbname); }
@@ -820,6 +843,33 @@ class cDbConnection
          return status;
       }
 
+      // value of a global status variable of the server
+
+      int getStatusValue(const char* name, unsigned long long& value)
+      {
+         MYSQL_RES* res;
+         MYSQL_ROW data;
+         int status = fail;
+
+         value = 0;
+
+         if (query("show global status like '%s'", name) != success)
+            return fail;
+
+         if ((res = mysql_store_result(getMySql())))
+         {
+            if ((data = mysql_fetch_row(res)) && data[1])
+            {
+               value = strtoull(data[1], 0, 10);
+               status = success;
+            }
+
+            mysql_free_result(res);
+         }
+
+         return status;
+      }
+
       virtual int vquery(const char* format, va_list more)
       {
          int status = 1;
@@ -1083,6 +1133,8 @@ class cDbTable : public cDbService
       virtual int insert(time_t inssp = 0);
       virtual int update(time_t updsp = 0);
       virtual int store();
+      virtual int upsert(time_t stamp = 0);     // insert or update with one statement
+      int buildUpsertClause(cDbStatement* stmt);
 
       virtual int __attribute__ ((format(printf, 2, 3))) deleteWhere(const char* where, ...);
       virtual int countWhere(const char* where, int& count, const char* what = 0);
@@ -1151,13 +1203,22 @@ class cDbTable : public cDbService
       virtual int createTable();
       virtual int createIndices();
 
+      int isPartitioned();
+      int partitionTable();                                     // copies the table!
+      int isCatchAllEmpty(const char* key);
+      virtual int createPartitions(const char* key, time_t from, time_t until);  // monthly, key 0 without key field
+      virtual int dropPartitions(const char* key, time_t before, int& count);    // months ending before
+
    protected:
 
       virtual int init(int allowAlter = 0);                     // 0 - off, 1 - on, 2 on with allow drop unused columns
-      virtual int checkIndex(const char* idxName, int& fieldCount);
+      virtual int checkIndex(const char* idxName, int& fieldCount, int* unique = 0);
       virtual int alterModifyField(cDbFieldDef* def);
       virtual int alterAddField(cDbFieldDef* def);
       virtual int alterDropField(const char* name);
+      std::string partitionLayout();
+      int getPartitions(std::vector<std::string>* names);
+      int monthsOfKey(const char* key, std::vector<int>* months);
 
       // data
 
@@ -1174,6 +1235,53 @@ class cDbTable : public cDbService
       cDbStatement* stmtSelect;
       cDbStatement* stmtInsert;
       cDbStatement* stmtUpdate;
+      cDbStatement* stmtUpsert;
+};
+
+//***************************************************************************
+// cDbBatch
+//   the batched variant of cDbTable::upsert(), collects rows of a table and
+//   writes them with multi row upsert statements in one transaction,
+//   a full chunk is written by add() already, the rest and the commit by flush()
+//***************************************************************************
+
+class cDbBatch : public cDbService
+{
+   public:
+
+      cDbBatch(cDbTable* aTable, int aChunkSize = 100);
+      virtual ~cDbBatch();
+
+      int add();                    // take a copy of the current row of the table
+      int flush();
+      int getCount()                { return count; }
+
+      // statistic of the last flush
+
+      int getLastRows()             { return lastRows; }
+      int getLastStatements()       { return lastStatements; }
+      double getLastMs()            { return lastMs; }
+
+   protected:
+
+      int write();
+      cDbStatement* getStatement(int rowCount);
+
+      cDbTable* table;
+      int chunkSize;
+      int count;
+      int errors;                   // failed writes of the current transaction
+      int ownTransaction;
+      std::vector<cDbRow*> rows;
+      std::map<int, cDbStatement*> statements;   // prepared per row count
+
+      int rowsWritten;
+      int statementsExecuted;
+      double usWriting;
+
+      int lastRows;
+      int lastStatements;
+      double lastMs;
 };
 
 //***************************************************************************
@@ -313,6 +313,7 @@ int cDbDict::atLine(const char* line)
    int status = success;
    static int prsTable = no;
    static int prsIndex = no;
+   static int prsPartition = no;
 
    const char* p;
 
@@ -339,6 +340,13 @@ int cDbDict::atLine(const char* line)
       prsIndex = yes;
       p = line + strlen("Table ");
    }
+   else if (strncasecmp(line, "Partition ", 10) == 0)
+   {
+      prsPartition = yes;
+
+      if (curTable)
+         curTable->setPartition(new cDbPartitionDef());
+   }
 
    else if (strchr(line, '{'))
       inside = yes;
@@ -348,6 +356,14 @@ int cDbDict::atLine(const char* line)
       inside = no;
       prsTable = no;
       prsIndex = no;
+
+      if (prsPartition && curTable && !curTable->getPartition()->isValid())
+      {
+         tell(0, "Error: Incomplete partition definition of table '%s', ignoring it", curTable->getName());
+         curTable->setPartition(0);
+      }
+
+      prsPartition = no;
    }
 
    else if (inside && prsTable)
@@ -356,6 +372,9 @@ int cDbDict::atLine(const char* line)
    else if (inside && prsIndex)
       status += parseIndex(line);
 
+   else if (inside && prsPartition)
+      status += parsePartition(line);
+
    else
       tell(0, "Info: Ignoring extra line [%s]", line);
 
@@ -453,6 +472,7 @@ int cDbDict::parseField(const char* line)
 
 //***************************************************************************
 // Parse Index
+//   '<name> "<description>" <field> ... [Unique],'
 //***************************************************************************
 
 int cDbDict::parseIndex(const char* line)
@@ -491,6 +511,8 @@ int cDbDict::parseIndex(const char* line)
          index->setName(token);
       else if (i == idtDescription)
          index->setDescription(token);
+      else if (i > idtFields && strcasecmp(token, "Unique") == 0)
+         index->setUnique(yes);
       else if (i >= idtFields && i < idtFields+20)
          index->addField(curTable->getField(token));
    }
@@ -499,3 +521,64 @@ int cDbDict::parseIndex(const char* line)
 
    return success;
 }
+
+//***************************************************************************
+// Parse Partition
+//   'Range <key field> <time field>,' or 'Range <time field>,'
+//   'Keys <value> ...,'
+//***************************************************************************
+
+int cDbDict::parsePartition(const char* line)
+{
+   const int sizeTokenMax = 100;
+   char token[sizeTokenMax+TB];
+   char attribute[sizeTokenMax+TB];
+   std::vector<std::string> values;
+   const char* p = line;
+   int done = no;
+
+   if (!curTable || !curTable->getPartition())
+      return fail;
+
+   cDbPartitionDef* partition = curTable->getPartition();
+
+   if (getToken(p, attribute, sizeTokenMax) != success)
+   {
+      tell(0, "Error: Can't parse line [%s]", line);
+      return fail;
+   }
+
+   while (!done && getToken(p, token, sizeTokenMax) == success)
+   {
+      if (strchr(token, ','))
+      {
+         done = yes;
+         *(strchr(token, ',')) = 0;
+      }
+
+      if (!isEmpty(token))
+         values.push_back(token);
+   }
+
+   if (strcasecmp(attribute, "Range") == 0 && values.size() == 2)
+   {
+      partition->setKeyField(curTable->getField(values[0].c_str()));
+      partition->setTimeField(curTable->getField(values[1].c_str()));
+   }
+   else if (strcasecmp(attribute, "Range") == 0 && values.size() == 1)
+   {
+      partition->setTimeField(curTable->getField(values[0].c_str()));
+   }
+   else if (strcasecmp(attribute, "Keys") == 0)
+   {
+      for (uint i = 0; i < values.size(); i++)
+         partition->addKey(values[i].c_str());
+   }
+   else
+   {
+      tell(0, "Error: Can't parse line [%s]", line);
+      return fail;
+   }
+
+   return success;
+}
@@ -11,6 +11,7 @@
 #include <stdio.h>
 
 #include <vector>
+#include <algorithm>
 #include <map>
 #include <string>
 
@@ -247,7 +248,7 @@ class cDbIndexDef
 {
    public:
 
-      cDbIndexDef()  { name = 0; description = 0; }
+      cDbIndexDef()  { name = 0; description = 0; unique = no; }
       ~cDbIndexDef() { free(name); free(description); }
 
       void setName(const char* n) { free(name); name = strdup(n); }
@@ -256,6 +257,9 @@ class cDbIndexDef
       void setDescription(const char* d) { free(description); description = strdup(d); }
       const char* getDescription()       { return description; }
 
+      void setUnique(int u)               { unique = u; }
+      int isUnique()                      { return unique; }
+
       int fieldCount()                    { return dfields.size(); }
       void addField(cDbFieldDef* f)       { dfields.push_back(f); }
       cDbFieldDef* getField(int i)        { return dfields[i]; }
@@ -276,9 +280,53 @@ class cDbIndexDef
 
       char* name;
       char* description;
+      int unique;
       std::vector<cDbFieldDef*> dfields;  // index fields
 };
 
+//***************************************************************************
+// cDbPartitionDef
+//   range partitions by month of a time column, optionally one set of
+//   partitions per value of a key column (range columns(key, time)).
+//   Each key (or the table) gets a catch all partition, the monthly
+//   partitions are split off it by cDbTable::createPartitions()
+//***************************************************************************
+
+class cDbPartitionDef
+{
+   public:
+
+      cDbPartitionDef()  { keyField = 0; timeField = 0; }
+
+      void setKeyField(cDbFieldDef* f)    { keyField = f; }
+      cDbFieldDef* getKeyField()          { return keyField; }
+      void setTimeField(cDbFieldDef* f)   { timeField = f; }
+      cDbFieldDef* getTimeField()         { return timeField; }
+
+      int keyCount()                      { return keys.size(); }
+      const char* getKey(int i)           { return keys[i].c_str(); }
+      void addKey(const char* k)          { keys.push_back(k); std::sort(keys.begin(), keys.end()); }
+
+      int isValid()                       { return timeField && (!keyField || keys.size()); }
+
+      void show()
+      {
+         std::string s = "";
+
+         for (uint i = 0; i < keys.size(); i++)
+            s += keys[i] + std::string(" ");
+
+         tell(0, "Partition by month of %s%s%s (%s)", timeField ? timeField->getName() : "?",
+              keyField ? " per " : "", keyField ? keyField->getName() : "", s.c_str());
+      }
+
+   protected:
+
+      cDbFieldDef* keyField;
+      cDbFieldDef* timeField;
+      std::vector<std::string> keys;      // sorted, like the partitions
+};
+
 //***************************************************************************
 // cDbTableDef
 //***************************************************************************
@@ -290,8 +338,9 @@ class cDbTableDef : public cDbService
       friend class cDbRow;
       friend class cDbTable;
       friend class cDbStatement;
+      friend class cDbBatch;
 
-      cDbTableDef(const char* n)       { name = strdup(n); }
+      cDbTableDef(const char* n)       { name = strdup(n); partition = 0; }
 
       ~cDbTableDef()                
       { 
@@ -299,6 +348,7 @@ class cDbTableDef : public cDbService
             delete indices[i];
 
          indices.clear();
+         delete partition;
 
          free(name);
          clear();
@@ -351,6 +401,9 @@ class cDbTableDef : public cDbService
       cDbIndexDef* getIndex(int i)        { return indices[i]; }
       void addIndex(cDbIndexDef* i)       { indices.push_back(i); }
 
+      cDbPartitionDef* getPartition()     { return partition; }
+      void setPartition(cDbPartitionDef* p) { delete partition; partition = p; }
+
       void clear()
       {
          std::map<std::string, cDbFieldDef*>::iterator f;
@@ -386,6 +439,9 @@ class cDbTableDef : public cDbService
          for (uint i = 0; i < indices.size(); i++)
             indices[i]->show();
 
+         if (partition)
+            partition->show();
+
          tell(0, " ");
       }
 
@@ -393,6 +449,7 @@ class cDbTableDef : public cDbService
 
       char* name;
       std::vector<cDbIndexDef*> indices;
+      cDbPartitionDef* partition;         // 0 -> not partitioned
 
       // FiledDefs stored as list to have access via index
       std::vector<cDbFieldDef*> _dfields;
@@ -451,6 +508,7 @@ class cDbDict : public cDbService
       int atLine(const char* line);
       int parseField(const char* line);
       int parseIndex(const char* line);
+      int parsePartition(const char* line);
       int toFilter(char* token);
 
       // data
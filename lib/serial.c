@@ -17,6 +17,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
+#include <poll.h>
+#include <libgen.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 
 #include "serial.h"
 
@@ -30,8 +35,13 @@ Serial::Serial()
    opened = no;
    readTimeout = 10;
    writeTimeout = 10;
+   rHead = rTail = 0;
+
+   tuning.lowLatency = na;
+   tuning.latencyTimer = 0;
 
    bzero(&oldtio, sizeof(oldtio));
+   resetStatistic();
 }
 
 Serial::~Serial()
@@ -55,6 +65,78 @@ int Serial::setWriteTimeout(int timeout)
    return success;
 }
 
+int Serial::setTuning(const Tuning* t)
+{
+   tuning = *t;
+
+   if (isOpen())
+      return applyTuning();
+
+   return success;
+}
+
+//***************************************************************************
+// Apply Tuning
+//   the driver buffers incoming bytes until its latency timer expires
+//   (16ms for FTDI chips), this dominates the round trip time of the
+//   short S 3200 frames
+//***************************************************************************
+
+int Serial::applyTuning()
+{
+   if (tuning.lowLatency != na)
+   {
+      struct serial_struct ss;
+
+      if (ioctl(fdDevice, TIOCGSERIAL, &ss) == 0)
+      {
+         if (tuning.lowLatency)
+            ss.flags |= ASYNC_LOW_LATENCY;
+         else
+            ss.flags &= ~ASYNC_LOW_LATENCY;
+
+         if (ioctl(fdDevice, TIOCSSERIAL, &ss) != 0)
+            tell(eloAlways, "Warning: Setting low latency mode of '%s' failed, errno was (%d) '%s'",
+                 deviceName, errno, strerror(errno));
+         else
+            tell(eloDetail, "Low latency mode of '%s' %s", deviceName, tuning.lowLatency ? "enabled" : "disabled");
+      }
+      else
+      {
+         tell(eloDetail, "Info: Device '%s' don't support low latency mode", deviceName);
+      }
+   }
+
+   if (tuning.latencyTimer > 0)
+   {
+      char path[PATH_MAX+TB];
+      char* sysfs = 0;
+      FILE* fp;
+
+      if (!realpath(deviceName, path))
+         return fail;
+
+      asprintf(&sysfs, "/sys/bus/usb-serial/devices/%s/latency_timer", basename(path));
+
+      if ((fp = fopen(sysfs, "w")))
+      {
+         fprintf(fp, "%d\n", tuning.latencyTimer);
+         fclose(fp);
+
+         tell(eloDetail, "Latency timer of '%s' set to %d ms", deviceName, tuning.latencyTimer);
+      }
+      else
+      {
+         tell(eloAlways, "Warning: Can't set latency timer '%s', errno was (%d) '%s'",
+              sysfs, errno, strerror(errno));
+      }
+
+      free(sysfs);
+   }
+
+   return success;
+}
+
 //***************************************************************************
 // Open Device
 //***************************************************************************
@@ -118,6 +200,7 @@ int Serial::open(const char* dev)
     }
 
    flush();
+   applyTuning();
    opened = yes;
 
    return success;
@@ -150,6 +233,7 @@ int Serial::close()
 
 int Serial::flush()
 {
+   rHead = rTail = 0;
    tcflush(fdDevice, TCIFLUSH);
 
    return done;
@@ -213,6 +297,8 @@ int Serial::write(void* line, int size)
    if (!line)
       return done;
 
+   statistic.writes++;
+
    if (::write(fdDevice, line, size) != size)
       return fail;
 
@@ -221,12 +307,13 @@ int Serial::write(void* line, int size)
 
 //***************************************************************************
 // Read
+//   serve the caller from the receive ring, the line is only touched
+//   if the ring is empty
 //***************************************************************************
 
 int Serial::read(void* buf, unsigned int count, int timeout)
 {
-   int res;
-   uint64_t start = cTimeMs::Now();
+   unsigned int n = 0;
 
    if (!fdDevice)
    {
@@ -234,21 +321,99 @@ int Serial::read(void* buf, unsigned int count, int timeout)
       return fail;
    }
 
-   while ((res = ::read(fdDevice, buf, count)) == 0)
+   if (!pending())
    {
-      if (cTimeMs::Now() > start + timeout)
-         return wrnTimeout;
-   };
+      int res;
 
-   if (res > 0)
+      if ((res = fill(timeout)) <= 0)
+         return res;
+   }
+
+   while (n < count && pending())
+      ((byte*)buf)[n++] = rBuffer[rHead++ & (sizeReadBuffer-1)];
+
+   return n;
+}
+
+//***************************************************************************
+// Fill
+//   wait with poll() until data is available or the deadline is reached,
+//   then take all pending bytes the ring can hold with one read()
+//***************************************************************************
+
+int Serial::fill(int timeout)
+{
+   int res;
+   uint64_t start = cTimeMs::Now();
+   uint64_t deadline = start + timeout;
+   unsigned int pos;
+   unsigned int space;
+   struct pollfd fds;
+
+   fds.fd = fdDevice;
+   fds.events = POLLIN;
+
+   while (true)
    {
-      for (int i = 0; i < res; i++)
+      uint64_t now = cTimeMs::Now();
+      int wait = now < deadline ? deadline - now : 0;
+
+      fds.revents = 0;
+      statistic.polls++;
+
+      res = poll(&fds, 1, wait);
+
+      if (res < 0 && errno == EINTR)
+         continue;
+
+      if (res < 0)
+         return fail;
+
+      if (res == 0)
       {
-         byte b = ((byte*)buf)[i];
-         tell(eloDebug3, "got %2.2X", b);
+         statistic.waitMs += cTimeMs::Now() - start;
+         return wrnTimeout;
+      }
+
+      // read as much as available, up to the end of the ring memory
+
+      pos = rTail & (sizeReadBuffer-1);
+      space = sizeReadBuffer - pending();
+
+      if (space > sizeReadBuffer - pos)
+         space = sizeReadBuffer - pos;
+
+      statistic.reads++;
+
+      if ((res = ::read(fdDevice, rBuffer + pos, space)) > 0)
+         break;
+
+      // end of file after POLLIN, the pty or usb adapter is gone -> let the caller reopen
+
+      if (res == 0)
+      {
+         tell(eloAlways, "Got end of file on '%s', line lost", deviceName);
+         return fail;
       }
+
+      if (errno != EAGAIN && errno != EINTR)
+         return fail;
+
+      // spurious wakeup -> poll again until the deadline
+
+      if (fds.revents & (POLLERR | POLLHUP | POLLNVAL))
+         return fail;
+   }
+
+   statistic.waitMs += cTimeMs::Now() - start;
+   statistic.bytes += res;
+   rTail += res;
+
+   if (loglevel >= eloDebug3)
+   {
+      for (int i = 0; i < res; i++)
+         tell(eloDebug3, "got %2.2X", rBuffer[(pos+i) & (sizeReadBuffer-1)]);
    }
 
    return res;
 }
-
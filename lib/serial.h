@@ -14,6 +14,7 @@
 //***************************************************************************
 
 #include <termios.h>
+#include <string.h>
 
 #include "common.h"
 
@@ -28,10 +29,30 @@ class Serial
       enum Misc
       {
          sizeCmdMax = 100,
+         sizeReadBuffer = 1024,     // size of the receive ring, power of 2 !
 
          wrnTimeout = -10
       };
 
+      // tuning profile of the usb-serial adapter, applied on open
+
+      struct Tuning
+      {
+         int lowLatency;            // ASYNC_LOW_LATENCY of the tty driver (na -> untouched)
+         int latencyTimer;          // FTDI latency timer in ms (0 -> untouched)
+      };
+
+      // counter for measurement
+
+      struct Statistic
+      {
+         unsigned long reads;       // read() syscalls
+         unsigned long polls;       // poll() syscalls
+         unsigned long writes;      // write() syscalls (one per request)
+         unsigned long bytes;       // bytes received
+         uint64_t waitMs;           // time spent in poll()
+      };
+
       // object
 
       Serial();
@@ -44,17 +65,27 @@ class Serial
       virtual int reopen(const char* dev = 0);
       virtual int isOpen()              { return fdDevice != 0 && opened; }
       virtual int look(byte& b, int timeout = 0);
+      virtual int read(void* buf, unsigned int count, int timeout = 0);
+      virtual int pending()             { return rTail - rHead; }
       virtual int flush();
       virtual int write(void* line, int size = 0);
+      virtual int release()             { return done; }     // end of a transaction (see P4Client)
 
       // settings
 
       virtual int setTimeout(int timeout);
       virtual int setWriteTimeout(int timeout);
+      virtual int setTuning(const Tuning* t);
+
+      // statistic
+
+      const Statistic* getStatistic()   { return &statistic; }
+      void resetStatistic()             { memset(&statistic, 0, sizeof(statistic)); }
 
    protected:
 
-      virtual int read(void* buf, unsigned int count, int timeout = 0);
+      int fill(int timeout);
+      int applyTuning();
 
       // data
 
@@ -65,6 +96,13 @@ class Serial
 
       int fdDevice;
       struct termios oldtio;
+
+      Tuning tuning;
+      Statistic statistic;
+
+      byte rBuffer[sizeReadBuffer];
+      unsigned int rHead;           // free running ring indices,
+      unsigned int rTail;           //   masked on access
 };
 
 //***************************************************************************
@@ -25,10 +25,31 @@ char dbUser[100+TB] = "p4";
 char dbPass[100+TB] = "p4";
 
 char ttyDeviceSvc[100+TB] = "/dev/ttyUSB1";
+int  ttyLowLatency = na;         // low latency mode of the tty driver (na -> untouched)
+int  ttyLatencyTimer = 0;        // FTDI latency timer in ms (0 -> untouched)
+int  ttyTimeoutFloor = 100;      // limits of the adaptive reply timeout in ms
+int  ttyTimeoutCeiling = 2000;
+int  ttyRetries = 1;
+char brokerSocket[100+TB] = "/var/run/p4d.sock";
+char brokerGroup[50+TB] = "";    // group of the socket, empty -> the one of ttyDeviceSvc
+char ttyDeviceCom2[100+TB] = "";     // passive COM2 telegram (empty -> not used)
+int  writerQueueSize = 4096;     // samples buffered for the writer thread
+char writerPolicy[20+TB] = "spool";  // if the queue is full: block, drop or spool
+char writerSpool[100+TB] = "/var/lib/p4d/samples.spool";
+int  writerSpoolSize = 16;       // MB
+int  writerWal = no;             // spool every sample before it is written
+int  writerFlushInterval = 0;    // minutes between two commits of the samples (0 -> each cycle)
+int  writerFlushRows = 0;        // commit latest at n samples (0 -> no limit)
+char sampleStore[20+TB] = "mysql";   // mysql, tsdb or both
+char tsdbPath[100+TB] = "/var/lib/p4d/tsdb";
 int  interval = 120;
 int  stateCheckInterval = 10;
 int  aggregateInterval = 15;     // aggregate interval in minutes
 int  aggregateHistory = 0;       // history in days
+char aggregateTiers[100+TB] = "A:0,H:0,D:0";   // rollup tiers 'code:days' (0 -> keep forever)
+int  archiveHistory = 0;         // days of raw samples before they are archived (0 -> off)
+char compressAnalog[20+TB] = "N";   // compression of the analog values, see p4filter.h
+int  ioEvents = 0;               // DI/DO only as events, without the rows in sampledata
 
 //***************************************************************************
 // Configuration
@@ -48,9 +69,30 @@ int atConfigItem(const char* Name, const char* Value)
    else if (!strcasecmp(Name, "interval"))            interval = atoi(Value);
    else if (!strcasecmp(Name, "stateCheckInterval"))  stateCheckInterval = atoi(Value);
    else if (!strcasecmp(Name, "ttyDeviceSvc"))        sstrcpy(ttyDeviceSvc, Value, sizeof(ttyDeviceSvc));
+   else if (!strcasecmp(Name, "ttyLowLatency"))       ttyLowLatency = atoi(Value);
+   else if (!strcasecmp(Name, "ttyLatencyTimer"))     ttyLatencyTimer = atoi(Value);
+   else if (!strcasecmp(Name, "ttyTimeoutFloor"))     ttyTimeoutFloor = atoi(Value);
+   else if (!strcasecmp(Name, "ttyTimeoutCeiling"))   ttyTimeoutCeiling = atoi(Value);
+   else if (!strcasecmp(Name, "ttyRetries"))          ttyRetries = atoi(Value);
+   else if (!strcasecmp(Name, "brokerSocket"))        sstrcpy(brokerSocket, Value, sizeof(brokerSocket));
+   else if (!strcasecmp(Name, "brokerGroup"))         sstrcpy(brokerGroup, Value, sizeof(brokerGroup));
+   else if (!strcasecmp(Name, "ttyDeviceCom2"))       sstrcpy(ttyDeviceCom2, Value, sizeof(ttyDeviceCom2));
+   else if (!strcasecmp(Name, "writerQueueSize"))     writerQueueSize = atoi(Value);
+   else if (!strcasecmp(Name, "writerPolicy"))        sstrcpy(writerPolicy, Value, sizeof(writerPolicy));
+   else if (!strcasecmp(Name, "writerSpool"))         sstrcpy(writerSpool, Value, sizeof(writerSpool));
+   else if (!strcasecmp(Name, "writerSpoolSize"))     writerSpoolSize = atoi(Value);
+   else if (!strcasecmp(Name, "writerWal"))           writerWal = atoi(Value);
+   else if (!strcasecmp(Name, "writerFlushInterval")) writerFlushInterval = atoi(Value);
+   else if (!strcasecmp(Name, "writerFlushRows"))     writerFlushRows = atoi(Value);
+   else if (!strcasecmp(Name, "sampleStore"))         sstrcpy(sampleStore, Value, sizeof(sampleStore));
+   else if (!strcasecmp(Name, "tsdbPath"))            sstrcpy(tsdbPath, Value, sizeof(tsdbPath));
 
    else if (!strcasecmp(Name, "aggregateInterval"))  aggregateInterval = atoi(Value);
    else if (!strcasecmp(Name, "aggregateHistory"))   aggregateHistory = atoi(Value);
+   else if (!strcasecmp(Name, "aggregateTiers"))     sstrcpy(aggregateTiers, Value, sizeof(aggregateTiers));
+   else if (!strcasecmp(Name, "archiveHistory"))     archiveHistory = atoi(Value);
+   else if (!strcasecmp(Name, "compressAnalog"))     sstrcpy(compressAnalog, Value, sizeof(compressAnalog));
+   else if (!strcasecmp(Name, "ioEvents"))           ioEvents = atoi(Value);
 
    return success;
 }
@@ -137,6 +179,7 @@ void showUsage(const char* bin)
    printf("    -s              setup\n");
    printf("    -i              update configuration tables\n");
    printf("    -I              truncate and initialze configuration tables\n");
+   printf("    -m              migrate the samples of the former table layout and partition them\n");
    printf("    -c <config-dir> use config in <config-dir>\n");
    printf("    -l <log-level>  set log level\n");
 }
@@ -153,6 +196,7 @@ int main(int argc, char** argv)
    int setup = no;
    int init = no;
    int truncOnInit = no;
+   int migrate = no;
    int _stdout = na;
    int _level = na;
 
@@ -182,6 +226,7 @@ int main(int argc, char** argv)
          case 's': setup = yes;                             break;
          case 'i': init = yes;                              break;
          case 'I': truncOnInit = yes; init = yes;           break;
+         case 'm': migrate = yes;                           break;
          case 'v': printf("Version %s\n", VERSION);         return 1;
       }
    }
@@ -213,6 +258,9 @@ int main(int argc, char** argv)
    if (init)
       return job->initialize(truncOnInit);
 
+   if (migrate)
+      return job->migrate() == fail;
+
    // fork daemon
 
    if (!nofork)
@@ -0,0 +1,513 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4archive.c
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+
+#include <zlib.h>
+#include <math.h>
+
+#include <map>
+#include <algorithm>
+
+#include "p4archive.h"
+
+//***************************************************************************
+// Little Endian Helpers
+//***************************************************************************
+
+static void putUInt32(std::string* s, uint32_t v)
+{
+   char b[4] = { (char)(v & 0xff), (char)((v >> 8) & 0xff), (char)((v >> 16) & 0xff), (char)(v >> 24) };
+
+   s->append(b, 4);
+}
+
+static void putUInt64(std::string* s, uint64_t v)
+{
+   putUInt32(s, (uint32_t)(v & 0xffffffff));
+   putUInt32(s, (uint32_t)(v >> 32));
+}
+
+static uint32_t getUInt32(const byte* p)
+{
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t getUInt64(const byte* p)
+{
+   return getUInt32(p) | ((uint64_t)getUInt32(p + 4) << 32);
+}
+
+static bool byTime(const SampleArchive::Point& a, const SampleArchive::Point& b)
+{
+   return a.time < b.time;
+}
+
+static bool sameTime(const SampleArchive::Point& a, const SampleArchive::Point& b)
+{
+   return a.time == b.time;
+}
+
+//***************************************************************************
+// Sample Archive
+//***************************************************************************
+
+cDbFieldDef archiveRangeEndDef("time", "time", cDBS::ffUInt, 10, cDBS::ftData);
+
+SampleArchive::SampleArchive()
+{
+   connection = 0;
+   tableSamples = 0;
+   tableArchive = 0;
+   selectDay = 0;
+   selectChunks = 0;
+}
+
+SampleArchive::~SampleArchive()
+{
+   close();
+}
+
+//***************************************************************************
+// Open / Close
+//***************************************************************************
+
+int SampleArchive::open(cDbConnection* aConnection)
+{
+   int status = success;
+
+   close();
+
+   connection = aConnection;
+   tableSamples = new cDbTable(connection, "sampledata");
+   tableArchive = new cDbTable(connection, "samplearchive");
+
+   if (tableSamples->open() != success || tableArchive->open() != success)
+   {
+      close();
+      return fail;
+   }
+
+   // select seriesid, time, value, textid from sampledata
+   //   where aggregate = ? and time >= ? and time < ?
+   //   order by seriesid, time for update
+
+   rangeEnd.setField(&archiveRangeEndDef);
+   selectDay = new cDbStatement(tableSamples);
+
+   selectDay->build("select ");
+   selectDay->bind("SERIESID", cDBS::bndOut);
+   selectDay->bind("TIME", cDBS::bndOut, ", ");
+   selectDay->bind("VALUE", cDBS::bndOut, ", ");
+   selectDay->bind("TEXTID", cDBS::bndOut, ", ");
+   selectDay->build(" from %s where ", tableSamples->TableName());
+   selectDay->bind("AGGREGATE", cDBS::bndIn | cDBS::bndSet);
+   selectDay->bindCmp(0, "TIME", 0, ">=", " and ");
+   selectDay->bindCmp(0, &rangeEnd, "<", " and ");
+   selectDay->build(" order by seriesid, time for update");
+
+   status += selectDay->prepare();
+
+   // select day, size, data from samplearchive
+   //   where seriesid = ? and lasttime >= ? and day <= ?
+   //   order by day
+
+   selectChunks = new cDbStatement(tableArchive);
+
+   selectChunks->build("select ");
+   selectChunks->bind("DAY", cDBS::bndOut);
+   selectChunks->bind("SIZE", cDBS::bndOut, ", ");
+   selectChunks->bind("DATA", cDBS::bndOut, ", ");
+   selectChunks->build(" from %s where ", tableArchive->TableName());
+   selectChunks->bind("SERIESID", cDBS::bndIn | cDBS::bndSet);
+   selectChunks->bindCmp(0, "LASTTIME", 0, ">=", " and ");
+   selectChunks->bindCmp(0, "DAY", 0, "<=", " and ");
+   selectChunks->build(" order by day");
+
+   status += selectChunks->prepare();
+
+   if (status != success)
+      close();
+
+   return status;
+}
+
+void SampleArchive::close()
+{
+   delete selectDay;     selectDay = 0;
+   delete selectChunks;  selectChunks = 0;
+   delete tableSamples;  tableSamples = 0;
+   delete tableArchive;  tableArchive = 0;
+   connection = 0;
+}
+
+//***************************************************************************
+// Day Of / Next Day
+//   begin of the local day, the chunks follow the days of the web interface
+//***************************************************************************
+
+time_t SampleArchive::dayOf(time_t t)
+{
+   struct tm tm = {0};
+
+   localtime_r(&t, &tm);
+   tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+   tm.tm_isdst = -1;
+
+   return mktime(&tm);
+}
+
+time_t SampleArchive::nextDay(time_t day)
+{
+   return dayOf(day + 36 * tmeSecondsPerHour);     // 23 or 25 hours at the dst switch
+}
+
+//***************************************************************************
+// Archive Day
+//   the raw samples of the day are added to the chunks of their series
+//   and deleted from sampledata, in one transaction. The select locks the
+//   range, a late sample of the writer waits for the commit instead of
+//   being deleted unseen
+//***************************************************************************
+
+int SampleArchive::archiveDay(time_t day, int& chunks)
+{
+   std::map<int, std::vector<Point> > series;
+   std::map<int, std::vector<Point> >::iterator it;
+   time_t to = nextDay(day);
+
+   chunks = 0;
+
+   if (!selectDay)
+      return fail;
+
+   connection->startTransaction();
+
+   tableSamples->clear();
+   tableSamples->setValue("AGGREGATE", "S");
+   tableSamples->setValue("TIME", day);
+   rangeEnd.setValue(to);
+
+   for (int f = selectDay->find(); f; f = selectDay->fetch())
+   {
+      Point p;
+
+      p.time = tableSamples->getIntValue("TIME");
+      p.value = tableSamples->getFloatValue("VALUE");
+      p.textId = tableSamples->getIntValue("TEXTID");
+
+      series[tableSamples->getIntValue("SERIESID")].push_back(p);
+   }
+
+   selectDay->freeResult();
+
+   for (it = series.begin(); it != series.end(); ++it)
+   {
+      if (store(it->first, day, &it->second) != success)
+      {
+         connection->rollback();
+         return fail;
+      }
+
+      chunks++;
+   }
+
+   if (tableSamples->deleteWhere("aggregate = 'S' and time >= %ld and time < %ld",
+                                 (long)day, (long)to) != success)
+   {
+      connection->rollback();
+      return fail;
+   }
+
+   return connection->commit();
+}
+
+//***************************************************************************
+// Store
+//   a chunk archived before (samples written late) is merged, if it can't
+//   be decoded the day is left as it is
+//***************************************************************************
+
+int SampleArchive::store(int seriesId, time_t day, std::vector<Point>* points)
+{
+   std::string chunk;
+   uLongf size;
+
+   tableArchive->clear();
+   tableArchive->setValue("SERIESID", seriesId);
+   tableArchive->setValue("DAY", day);
+
+   if (tableArchive->find())
+   {
+      cDbValue* data = tableArchive->getValue("DATA");
+      std::vector<Point> archived;
+
+      if (decode(day, data->getStrValue(), data->getStrValueSize(), &archived) != success)
+      {
+         tell(eloAlways, "Error: Can't decode the archived chunk of series %d at %s, keeping it",
+              seriesId, l2pTime(day).c_str());
+         tableArchive->reset();
+         return fail;
+      }
+
+      points->insert(points->begin(), archived.begin(), archived.end());
+      std::stable_sort(points->begin(), points->end(), byTime);
+      points->erase(std::unique(points->begin(), points->end(), sameTime), points->end());
+   }
+
+   tableArchive->reset();
+
+   if (encode(day, points, &chunk) != success)
+      return fail;
+
+   // compress
+
+   size = compressBound(chunk.size());
+   std::vector<byte> compressed(size);
+
+   if (compress2(&compressed[0], &size, (const Bytef*)chunk.data(), chunk.size(), Z_BEST_COMPRESSION) != Z_OK)
+   {
+      tell(eloAlways, "Error: Compressing the chunk of series %d failed", seriesId);
+      return fail;
+   }
+
+   if (size > (uLongf)tableArchive->getField("DATA")->getSize())
+   {
+      tell(eloAlways, "Error: Chunk of series %d with %lu bytes too big for the archive", seriesId, (unsigned long)size);
+      return fail;
+   }
+
+   tableArchive->clear();
+   tableArchive->setValue("SERIESID", seriesId);
+   tableArchive->setValue("DAY", day);
+   tableArchive->setValue("SAMPLES", (long)points->size());
+   tableArchive->setValue("FIRSTTIME", points->front().time);
+   tableArchive->setValue("LASTTIME", points->back().time);
+   tableArchive->setValue("SIZE", (long)chunk.size());
+   tableArchive->setValue("DATA", (const char*)&compressed[0], size);
+
+   return tableArchive->upsert();
+}
+
+//***************************************************************************
+// Encode
+//***************************************************************************
+
+int SampleArchive::encode(time_t day, const std::vector<Point>* points, std::string* chunk)
+{
+   int scale = 0;
+   double factor = 1;
+   time_t last = day;
+
+   // the smallest scale all values survive (as float, like the value column)
+
+   for (; scale <= maxScale; scale++, factor *= 10)
+   {
+      unsigned int i = 0;
+
+      for (; i < points->size(); i++)
+      {
+         double v = (*points)[i].value * factor;
+
+         if (fabs(v) >= (1 << 30) || (float)(llround(v) / factor) != (float)(*points)[i].value)
+            break;
+      }
+
+      if (i == points->size())
+         break;
+   }
+
+   if (scale > maxScale)
+      scale = rawScale;
+
+   chunk->clear();
+   chunk->append(1, (char)version);
+   chunk->append(1, (char)scale);
+   chunk->append(2, '\0');
+   putUInt32(chunk, points->size());
+
+   for (unsigned int i = 0; i < points->size(); i++)
+   {
+      putUInt32(chunk, (uint32_t)(int32_t)((*points)[i].time - last));
+      last = (*points)[i].time;
+   }
+
+   if (scale == rawScale)
+   {
+      for (unsigned int i = 0; i < points->size(); i++)
+      {
+         uint64_t bits;
+
+         memcpy(&bits, &(*points)[i].value, sizeof(bits));
+         putUInt64(chunk, bits);
+      }
+   }
+   else
+   {
+      int32_t lastValue = 0;
+
+      for (unsigned int i = 0; i < points->size(); i++)
+      {
+         int32_t value = (int32_t)llround((*points)[i].value * factor);
+
+         putUInt32(chunk, (uint32_t)(value - lastValue));
+         lastValue = value;
+      }
+   }
+
+   for (unsigned int i = 0; i < points->size(); i++)
+      putUInt32(chunk, (uint32_t)(*points)[i].textId);
+
+   return success;
+}
+
+//***************************************************************************
+// Decode
+//   'chunk' is the compressed chunk, the points are appended
+//***************************************************************************
+
+int SampleArchive::decode(time_t day, const char* chunk, unsigned long size, std::vector<Point>* points)
+{
+   std::vector<byte> raw;
+   uLongf rawSize;
+   z_stream stream;
+   int res;
+
+   // inflate, the size of the chunk is not known here
+
+   memset(&stream, 0, sizeof(stream));
+   stream.next_in = (Bytef*)chunk;
+   stream.avail_in = size;
+
+   if (inflateInit(&stream) != Z_OK)
+      return fail;
+
+   do
+   {
+      raw.resize(raw.size() + std::max(4 * size, 4096UL));
+      stream.next_out = &raw[stream.total_out];
+      stream.avail_out = raw.size() - stream.total_out;
+      res = inflate(&stream, Z_NO_FLUSH);
+   } while (res == Z_OK);
+
+   rawSize = stream.total_out;
+   inflateEnd(&stream);
+
+   if (res != Z_STREAM_END || rawSize < 8 || raw[0] != version)
+   {
+      tell(eloAlways, "Error: Archive chunk of day %ld is corrupt", (long)day);
+      return fail;
+   }
+
+   int scale = raw[1];
+   uint32_t count = getUInt32(&raw[4]);
+   size_t valueSize = scale == rawScale ? 8 : 4;
+
+   if (rawSize < 8 + count * (8 + valueSize))
+   {
+      tell(eloAlways, "Error: Archive chunk of day %ld is truncated", (long)day);
+      return fail;
+   }
+
+   const byte* times = &raw[8];
+   const byte* values = times + 4 * count;
+   const byte* texts = values + valueSize * count;
+   double factor = scale == rawScale ? 1 : pow(10, scale);
+   time_t t = day;
+   int32_t v = 0;
+
+   for (uint32_t i = 0; i < count; i++)
+   {
+      Point p;
+
+      t += (int32_t)getUInt32(times + 4 * i);
+      p.time = t;
+
+      if (scale == rawScale)
+      {
+         uint64_t bits = getUInt64(values + 8 * i);
+         memcpy(&p.value, &bits, sizeof(double));
+      }
+      else
+      {
+         v += (int32_t)getUInt32(values + 4 * i);
+         p.value = v / factor;
+      }
+
+      p.textId = getUInt32(texts + 4 * i);
+      points->push_back(p);
+   }
+
+   return success;
+}
+
+//***************************************************************************
+// Query
+//***************************************************************************
+
+int SampleArchive::query(int seriesId, time_t from, time_t to, std::vector<Point>* points)
+{
+   if (!selectChunks)
+      return fail;
+
+   tableArchive->clear();
+   tableArchive->setValue("SERIESID", seriesId);
+   tableArchive->setValue("LASTTIME", from);
+   tableArchive->setValue("DAY", to);
+
+   for (int f = selectChunks->find(); f; f = selectChunks->fetch())
+   {
+      cDbValue* data = tableArchive->getValue("DATA");
+      std::vector<Point> chunk;
+
+      if (decode(tableArchive->getIntValue("DAY"), data->getStrValue(), data->getStrValueSize(), &chunk) != success)
+         continue;
+
+      for (unsigned int i = 0; i < chunk.size(); i++)
+      {
+         if (chunk[i].time >= from && chunk[i].time <= to)
+            points->push_back(chunk[i]);
+      }
+   }
+
+   selectChunks->freeResult();
+
+   return success;
+}
+
+//***************************************************************************
+// First
+//   the value of the first sample in (from, to]
+//***************************************************************************
+
+int SampleArchive::first(int seriesId, time_t from, time_t to, double& value)
+{
+   std::vector<Point> points;
+
+   if (query(seriesId, from + 1, to, &points) != success || points.empty())
+      return fail;
+
+   value = points.front().value;
+
+   return success;
+}
+
+//***************************************************************************
+// Purge
+//   the chunks of the days before 'before'
+//***************************************************************************
+
+int SampleArchive::purge(time_t before, int& count)
+{
+   count = 0;
+
+   if (!tableArchive || tableArchive->deleteWhere("day < %ld", (long)dayOf(before)) != success)
+      return fail;
+
+   count = mysql_affected_rows(connection->getMySql());
+
+   return success;
+}
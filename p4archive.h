@@ -0,0 +1,82 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4archive.h
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+
+#ifndef _P4ARCHIVE_H_
+#define _P4ARCHIVE_H_
+
+#include <stdint.h>
+
+#include <vector>
+#include <string>
+
+#include "lib/db.h"
+
+//***************************************************************************
+// Sample Archive
+//   the raw samples older than archiveHistory are moved from sampledata to
+//   samplearchive, one zlib compressed chunk per series and (local) day.
+//   Chunk layout before compression, little endian:
+//     byte    version (1)
+//     byte    scale, the values are stored as integers of value * 10^scale,
+//             0xff -> as doubles
+//     uint16  0
+//     uint32  count
+//     int32   times[count]     delta to the previous one, the first to the day
+//     int32   values[count]    delta to the previous one (or double[count])
+//     int32   textids[count]
+//   The web interface decodes the chunks too (htdocs/detail.php).
+//***************************************************************************
+
+class SampleArchive
+{
+   public:
+
+      enum Misc
+      {
+         version = 1,
+         maxScale = 2,             // decimals of the value column
+         rawScale = 0xff
+      };
+
+      struct Point
+      {
+         time_t time;
+         double value;
+         int textId;
+      };
+
+      SampleArchive();
+      ~SampleArchive();
+
+      int open(cDbConnection* aConnection);
+      void close();
+
+      int archiveDay(time_t day, int& chunks);   // the raw samples of the day, in one transaction
+      int query(int seriesId, time_t from, time_t to, std::vector<Point>* points);   // in [from, to]
+      int first(int seriesId, time_t from, time_t to, double& value);                 // in (from, to]
+      int purge(time_t before, int& count);
+
+      static time_t dayOf(time_t t);
+      static time_t nextDay(time_t day);
+      static int encode(time_t day, const std::vector<Point>* points, std::string* chunk);
+      static int decode(time_t day, const char* chunk, unsigned long size, std::vector<Point>* points);
+
+   protected:
+
+      int store(int seriesId, time_t day, std::vector<Point>* points);
+
+      cDbConnection* connection;
+      cDbTable* tableSamples;
+      cDbTable* tableArchive;
+      cDbStatement* selectDay;
+      cDbStatement* selectChunks;
+      cDbValue rangeEnd;
+};
+
+//***************************************************************************
+#endif // _P4ARCHIVE_H_
@@ -0,0 +1,376 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4bench.c
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+// Micro benchmark of the frame codec
+//   - the byte by byte unmasking loop against P4Request::unmask()
+//   - reading reply frames from a pipe, the former path (one read() and
+//     look() per byte, readByte() decoding, as up to version 0.x) against
+//     the buffered Serial and P4Request::readHeader()
+//***************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "p4io.h"
+
+//***************************************************************************
+// Unmask Bytewise (reference)
+//***************************************************************************
+
+int unmaskBytewise(const byte* in, int size, byte* out)
+{
+   int produced = 0;
+
+   for (int i = 0; i < size; i++)
+   {
+      byte b = in[i];
+
+      if (b != 0x02 && b != 0x2b && b != 0xfe)
+      {
+         out[produced++] = b;
+         continue;
+      }
+
+      if (++i >= size)
+         return fail;
+
+      if (b == 0x02 || b == 0x2b)
+      {
+         if (in[i] != 0x00)
+            return fail;
+
+         out[produced++] = b;
+      }
+      else if (in[i] == 0x12)
+         out[produced++] = 0x11;
+      else if (in[i] == 0x14)
+         out[produced++] = 0x13;
+      else if (in[i] == 0x00)
+         out[produced++] = 0xfe;
+      else
+         return fail;
+   }
+
+   return produced;
+}
+
+//***************************************************************************
+// Former Line
+//   Serial::look()/read() and P4Request::readHeader()/readByte() as they
+//   were before the buffered line, one system call per byte
+//***************************************************************************
+
+class FormerLine
+{
+   public:
+
+      FormerLine(int aFd)  { fd = aFd; size = 0; }
+
+      int read(void* buf, unsigned int count, int timeout)
+      {
+         int res;
+         uint64_t start = cTimeMs::Now();
+
+         while ((res = ::read(fd, buf, count)) == 0)
+         {
+            if (cTimeMs::Now() > start + timeout)
+               return Serial::wrnTimeout;
+         };
+
+         if (res > 0)
+         {
+            for (int i = 0; i < res; i++)
+            {
+               byte b = ((byte*)buf)[i];
+               tell(eloDebug3, "got %2.2X", b);
+            }
+         }
+
+         return res;
+      }
+
+      int look(byte& b, int timeout)
+      {
+         int res;
+         b = 0;
+
+         while ((res = read(&b, 1, timeout)) < 0)
+         {
+            if (res == Serial::wrnTimeout)
+               return Serial::wrnTimeout;
+
+            if (errno == EINTR)
+               continue;
+
+            return fail;
+         }
+
+         return res != 1 ? fail : success;
+      }
+
+      int readByte(byte& v, int decode, int tms)
+      {
+         byte b;
+         byte b1;
+         int status;
+
+         if ((status = look(b, tms)) != success)
+            return status;
+
+         if (!decode || (b != 0x02 && b != 0x2b && b != 0xfe))
+         {
+            v = b;
+         }
+         else if (b == 0x02 || b == 0x2b)
+         {
+            if ((status = look(b1, tms)) != success || b1 != 0x00)
+               return fail;
+
+            v = b;
+         }
+         else
+         {
+            if ((status = look(b1, tms)) != success)
+               return status;
+
+            if (b1 == 0x12)
+               v = 0x11;
+            else if (b1 == 0x14)
+               v = 0x13;
+            else if (b1 == 0x00)
+               v = 0xfe;
+            else
+               return fail;
+         }
+
+         decoded[size++] = v;
+
+         return success;
+      }
+
+      int readWord(word& v, int decode, int tms)
+      {
+         byte b1, b2;
+
+         if (readByte(b1, decode, tms) != success || readByte(b2, decode, tms) != success)
+            return fail;
+
+         v = (b1 << 8) | b2;
+
+         return success;
+      }
+
+      int readFrame(int tms)
+      {
+         word id, sizeData;
+         byte command, b;
+
+         size = 0;
+
+         if (readWord(id, no, tms) != success || id != Fs::commId)
+            return fail;
+
+         if (readWord(sizeData, yes, tms) != success || readByte(command, yes, tms) != success)
+            return fail;
+
+         for (int i = 0; i < sizeData; i++)
+            if (readByte(b, yes, tms) != success)
+               return fail;
+
+         return success;
+      }
+
+      int getSize()  { return size; }
+
+   protected:
+
+      int fd;
+      int size;
+      byte decoded[Fs::sizeMaxReply*2+TB];
+};
+
+//***************************************************************************
+// Pipe Line
+//   the buffered Serial on a pipe instead of the tty
+//***************************************************************************
+
+class PipeLine : public Serial
+{
+   public:
+
+      void attach(int fd)  { fdDevice = fd; opened = yes; }
+};
+
+//***************************************************************************
+// Now
+//***************************************************************************
+
+double nowNs()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return ts.tv_sec * 1000000000.0 + ts.tv_nsec;
+}
+
+//***************************************************************************
+// Main
+//***************************************************************************
+
+int main(int argc, char** argv)
+{
+   enum { frameCount = 1000, sizeFrame = 250, sizeData = sizeFrame - Fs::sizeId - Fs::sizeSize - Fs::sizeCommand - Fs::sizeCrc };
+
+   static byte plain[frameCount][sizeFrame];
+   static byte masked[frameCount][2*sizeFrame];
+   static int sizeMasked[frameCount];
+   byte out[2*sizeFrame];
+   int rounds = argc > 1 ? atoi(argv[1]) : 200;
+   int markerRate = argc > 2 ? atoi(argv[2]) : 5;      // percent of bytes to be masked
+   long total = 0;
+   double start, bytewise, runs, former, buffered;
+   int produced;
+   int fds[2];
+
+   logstdout = yes;
+   srand(1);
+
+   // reply frames like the values the s 3200 sends, mostly plain with some
+   // masked bytes: id, size, command, data and crc
+
+   for (int f = 0; f < frameCount; f++)
+   {
+      static const byte markers[] = { 0x02, 0x2b, 0xfe, 0x11, 0x13 };
+
+      plain[f][0] = Fs::commId >> 8;
+      plain[f][1] = Fs::commId & 0xff;
+      plain[f][2] = (sizeData + Fs::sizeCrc) >> 8;
+      plain[f][3] = (sizeData + Fs::sizeCrc) & 0xff;
+      plain[f][4] = 0x30;
+
+      for (int i = 5; i < sizeFrame; i++)
+         plain[f][i] = rand() % 100 < markerRate ? markers[rand() % 5] : 0x30 + rand() % 0x40;
+
+      plain[f][sizeFrame-1] = crc(plain[f], sizeFrame-1);
+
+      memcpy(masked[f], plain[f], Fs::sizeId);
+      sizeMasked[f] = Fs::sizeId + P4Request::mask(plain[f]+Fs::sizeId, sizeFrame-Fs::sizeId, masked[f]+Fs::sizeId);
+      total += sizeMasked[f];
+   }
+
+   // check, the id is not masked
+
+   for (int f = 0; f < frameCount; f++)
+   {
+      const byte* in = masked[f] + Fs::sizeId;
+      int size = sizeMasked[f] - Fs::sizeId;
+      int sizePlain = sizeFrame - Fs::sizeId;
+
+      if (unmaskBytewise(in, size, out) != sizePlain || memcmp(out, plain[f]+Fs::sizeId, sizePlain) != 0)
+      {
+         tell(eloAlways, "Bytewise decoding of frame %d failed", f);
+         return 1;
+      }
+
+      if (P4Request::unmask(in, size, out, sizeof(out), produced) != size
+          || produced != sizePlain || memcmp(out, plain[f]+Fs::sizeId, sizePlain) != 0)
+      {
+         tell(eloAlways, "Decoding of frame %d failed", f);
+         return 1;
+      }
+   }
+
+   // codec
+
+   start = nowNs();
+
+   for (int r = 0; r < rounds; r++)
+      for (int f = 0; f < frameCount; f++)
+         unmaskBytewise(masked[f]+Fs::sizeId, sizeMasked[f]-Fs::sizeId, out);
+
+   bytewise = nowNs() - start;
+   start = nowNs();
+
+   for (int r = 0; r < rounds; r++)
+      for (int f = 0; f < frameCount; f++)
+         P4Request::unmask(masked[f]+Fs::sizeId, sizeMasked[f]-Fs::sizeId, out, sizeof(out), produced);
+
+   runs = nowNs() - start;
+
+   // reading the frames, all frames of a round are in the pipe before
+
+   if (pipe(fds) != 0 || fcntl(fds[1], F_SETPIPE_SZ, 1024*1024) < total)
+   {
+      tell(eloAlways, "Can't create a pipe for %ld bytes, errno (%d) '%s'", total, errno, strerror(errno));
+      return 1;
+   }
+
+   FormerLine formerLine(fds[0]);
+   PipeLine line;
+   P4Request request(&line);
+
+   line.attach(fds[0]);
+   former = buffered = 0;
+
+   for (int r = 0; r < rounds / 10 + 1; r++)
+   {
+      for (int f = 0; f < frameCount; f++)
+         if (::write(fds[1], masked[f], sizeMasked[f]) != sizeMasked[f])
+            return 1;
+
+      start = nowNs();
+
+      for (int f = 0; f < frameCount; f++)
+      {
+         if (formerLine.readFrame(1000) != success || formerLine.getSize() != sizeFrame)
+         {
+            tell(eloAlways, "Former reading of frame %d failed", f);
+            return 1;
+         }
+      }
+
+      former += nowNs() - start;
+
+      for (int f = 0; f < frameCount; f++)
+         if (::write(fds[1], masked[f], sizeMasked[f]) != sizeMasked[f])
+            return 1;
+
+      start = nowNs();
+
+      for (int f = 0; f < frameCount; f++)
+      {
+         if (request.readHeader(1000) != success)
+         {
+            tell(eloAlways, "Reading of frame %d failed", f);
+            return 1;
+         }
+      }
+
+      buffered += nowNs() - start;
+   }
+
+   tell(eloAlways, "%d frames of %d bytes, %d%% masked, %d rounds", frameCount, sizeFrame, markerRate, rounds);
+   tell(eloAlways, "  unmask bytewise:    %7.1f ns/frame, %7.1f MB/s", bytewise / (rounds * frameCount),
+        total * rounds / (bytewise / 1000.0));
+   tell(eloAlways, "  unmask runs:        %7.1f ns/frame, %7.1f MB/s", runs / (rounds * frameCount),
+        total * rounds / (runs / 1000.0));
+
+   rounds = rounds / 10 + 1;
+
+   tell(eloAlways, "  read former (look): %7.1f ns/frame, %7.1f MB/s", former / (rounds * frameCount),
+        total * rounds / (former / 1000.0));
+   tell(eloAlways, "  read buffered:      %7.1f ns/frame, %7.1f MB/s", buffered / (rounds * frameCount),
+        total * rounds / (buffered / 1000.0));
+
+   return 0;
+}
@@ -35,18 +35,21 @@ enum UserCommand
    ucGetAo,
    ucUser,
    ucShowW1,
+   ucStatistic,
    ucUnkonownList
 };
 
 void showUsage(const char* bin)
 {
-   printf("Usage: %s <command> [-a <address> [-v <value>]] [-o <offset>] [-l <log-level>] [-d <device>]\n", bin);
+   printf("Usage: %s <command> [-a <address> [-v <value>]] [-o <offset>] [-l <log-level>] [-d <device>] [-s <socket>]\n", bin);
    printf("\n");
    printf("  options:\n");
    printf("     -a <address>    address of parameter or value\n");
    printf("     -v <value>      new value\n");
    printf("     -l <log-level>  set log level\n");
-   printf("     -d <device>     serial device file (defaults to /dev/ttyUSB0)\n");
+   printf("     -d <device>     use the serial device directly (default: the line of the running p4d,\n");
+   printf("                     without p4d /dev/ttyUSB0)\n");
+   printf("     -s <socket>     socket of the running p4d (defaults to %s)\n", P4Broker::defaultPath);
    printf("     -o <offset>     optional offset for time sync in seconds\n");
 
    printf("\n");
@@ -63,6 +66,7 @@ void showUsage(const char* bin)
    printf("     getdo    show digital output at <addr>\n");
    printf("     getao    show analog output at <addr>\n");
    printf("     w1       show data of all connected one wire sensors\n");
+   printf("     stats    show the serial link statistic of the running p4d\n");
 }
 
 //***************************************************************************
@@ -72,6 +76,8 @@ void showUsage(const char* bin)
 int main(int argc, char** argv)
 {
    Serial serial;
+   P4Client client;
+   Serial* line = &serial;
    int status;
    byte b;
    word addr = Fs::addrUnknown;
@@ -79,6 +85,9 @@ int main(int argc, char** argv)
    word value = Fs::addrUnknown;
    UserCommand cmd = ucUnknown;
    const char* device = "/dev/ttyUSB0";
+   const char* socketPath = P4Broker::defaultPath;
+   int direct = no;
+   int viaBroker = no;
 
 //    {
 //       md5Buf defaultPwd;
@@ -109,6 +118,8 @@ int main(int argc, char** argv)
       cmd = ucGetValue;
    else if (strcasecmp(argv[1], "w1") == 0)
       cmd = ucShowW1;
+   else if (strcasecmp(argv[1], "stats") == 0)
+      cmd = ucStatistic;
    else if (strcasecmp(argv[1], "getp") == 0)
       cmd = ucGetParameter;
    else if (strcasecmp(argv[1], "setp") == 0)
@@ -154,6 +165,22 @@ int main(int argc, char** argv)
       return 0;
    }
 
+   if (cmd == ucStatistic)
+   {
+      LinkStatistic* statistic = LinkStatistic::attach(no);
+
+      if (!statistic)
+      {
+         tell(eloAlways, "No statistic available, p4d not running?");
+         return 1;
+      }
+
+      statistic->show();
+      LinkStatistic::detach(statistic);
+
+      return 0;
+   }
+
    // parse options
 
    for (int i = 1; argv[i]; i++)
@@ -167,7 +194,8 @@ int main(int argc, char** argv)
          case 'a': if (argv[i+1]) addr = strtol(argv[++i], 0, 0);    break;
          case 'v': if (argv[i+1]) value = strtol(argv[++i], 0, 0);   break;
          case 'l': if (argv[i+1]) loglevel = atoi(argv[++i]);        break;
-         case 'd': if (argv[i+1]) device = argv[++i];                break;
+         case 'd': if (argv[i+1]) device = argv[++i]; direct = yes;  break;
+         case 's': if (argv[i+1]) socketPath = argv[++i];            break;
       }
    }
 
@@ -179,23 +207,40 @@ int main(int argc, char** argv)
 
    int debugMode = strcmp(device, "-") == 0;
 
-   P4Request request(&serial);
+   // prefer the line of a running p4d, it's scheduled between its requests
+
+   if (!debugMode && !direct && client.open(socketPath) == success)
+   {
+      line = &client;
+      viaBroker = yes;
+   }
+
+   P4Request request(line);
 
    if (!debugMode)
    {
-      sem.p();
+      if (!viaBroker)
+      {
+         // a p4d which owns the line but has no broker holds the lock as long as it runs
 
-      if (serial.open(device) != success)
-         return 1;
+         if (sem.p(10000) != success)
+         {
+            tell(eloAlways, "Error: Serial line is locked, a p4d without broker at '%s' running?", socketPath);
+            return 1;
+         }
 
-      while (serial.look(b, 100) == success)
-         tell(eloDebug, "-> 0x%2.2x", b);
+         if (serial.open(device) != success)
+            return 1;
+
+         while (serial.look(b, 100) == success)
+            tell(eloDebug, "-> 0x%2.2x", b);
+      }
 
       // connection check
 
       if (request.check() != success)
       {
-         serial.close();
+         line->close();
          return 1;
       }
    }
@@ -416,8 +461,10 @@ int main(int argc, char** argv)
 
    if (!debugMode)
    {
-      serial.close();
-      sem.v();
+      line->close();
+
+      if (!viaBroker)
+         sem.v();
    }
 
    return 0;
@@ -13,6 +13,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <math.h>
 #include <libxml/parser.h>
 
 #include "p4d.h"
@@ -45,6 +46,7 @@ P4d::P4d()
    selectAllMenuItems = 0;
    selectSensorAlerts = 0;
    selectSampleInRange = 0;
+   selectSampleBefore = 0;
    selectPendingErrors = 0;
    selectMaxTime = 0;
    selectHmSysVarByAddr = 0;
@@ -54,8 +56,13 @@ P4d::P4d()
 
    nextAt = time(0);           // intervall for 'reading values'
    startedAt = time(0);
-   nextAggregateAt = 0;
+   nextPurgeAt = 0;
+   lastJobCheckAt = 0;
+   purging = no;
+   recomputedUntil = 0;
+   samplesPartitioned = no;
    nextTimeSyncAt = 0;
+   publishedMaxGap = na;
 
    mailBody = "";
    mailBodyHtml = "";
@@ -68,6 +75,7 @@ P4d::P4d()
    tSync = no;
    maxTimeLeak = 10;
    errorsPending = 0;
+   valueBatching = na;
 
    cDbConnection::init();
    cDbConnection::setEncoding("utf8");
@@ -80,7 +88,28 @@ P4d::P4d()
    sem = new Sem(0x3da00001);
    serial = new Serial;
    request = new P4Request(serial);
+   queue = new P4Queue(request);
+   broker = new P4Broker(request);
    curl = new cCurl();
+   writer = new SampleWriter(writerQueueSize, writerPolicy, writerSpool,
+                             writerSpoolSize * 1024 * 1024, writerWal);
+   writer->setFlushPolicy(writerFlushInterval * tmeSecondsPerMinute, writerFlushRows);
+
+   if (aggregateHistory)
+      SampleRollup::parseTiers(aggregateTiers, aggregateInterval, &rollupTiers);
+
+   writer->setRollup(&rollupTiers);
+   mysqlSamples = strcasecmp(sampleStore, "tsdb") != 0;
+   tsdb = strcasecmp(sampleStore, "mysql") != 0 ? new TsStore(tsdbPath) : 0;
+   ioLog.setMaxGap(3 * interval);
+   com2 = !isEmpty(ttyDeviceCom2) ? new P4Packet : 0;
+   com2At = 0;
+   com2OpenAt = 0;
+   com2FactsChecked = no;
+
+   Serial::Tuning tuning = { ttyLowLatency, ttyLatencyTimer };
+   serial->setTuning(&tuning);
+   request->setTimeouts(ttyTimeoutFloor, ttyTimeoutCeiling, ttyRetries);
 }
 
 P4d::~P4d()
@@ -92,7 +121,12 @@ P4d::~P4d()
    free(stateMailTo);
    free(errorMailTo);
 
+   delete writer;
+   delete tsdb;
+   delete queue;
+   delete broker;
    delete serial;
+   delete com2;
    delete request;
    delete sem;
    delete curl;
@@ -127,13 +161,29 @@ int P4d::init()
 
    w1.scan();
 
+   if (tsdb && tsdb->open() != success)
+      tell(eloAlways, "Warning: Time series store '%s' not available", tsdbPath);
+
    return success;
 }
 
 int P4d::exit()
 {
+   flushFilters();
+   writer->stop();
+
+   if (tsdb)
+      tsdb->close();
+
+   if (dbConnected())
+      ioLog.write();
+
    exitDb();
    serial->close();
+
+   if (com2)
+      com2->close();
+
    curl->exit();
 
    return success;
@@ -143,7 +193,7 @@ int P4d::exit()
 // Init/Exit Database
 //***************************************************************************
 
-cDbFieldDef rangeEndDef("time", "time", cDBS::ffDateTime, 0, cDBS::ftData);
+cDbFieldDef rangeEndDef("time", "time", cDBS::ffUInt, 10, cDBS::ftData);
 
 int P4d::initDb()
 {
@@ -196,6 +246,8 @@ int P4d::initDb()
          delete table;
       }
 
+      status += initSamplesView();
+
       connection->detachConnection();
 
       if (status != success)
@@ -217,8 +269,16 @@ int P4d::initDb()
    tableMenu = new cDbTable(connection, "menu");
    if (tableMenu->open() != success) return fail;
 
-   tableSamples = new cDbTable(connection, "samples");
+   tableSamples = new cDbTable(connection, "sampledata");
    if (tableSamples->open() != success) return fail;
+   samplesPartitioned = tableSamples->isPartitioned();
+
+   if (tableSamples->getTableDef()->getPartition() && !samplesPartitioned)
+      tell(eloAlways, "Info: Table 'sampledata' not partitioned yet, partition it by 'p4d -m'");
+
+   if (seriesDict.open(connection) != success) return fail;
+   if (archive.open(connection) != success) return fail;
+   if (ioLog.open(connection, &seriesDict) != success) return fail;
 
    tableJobs = new cDbTable(connection, "jobs");
    if (tableJobs->open() != success) return fail;
@@ -302,8 +362,8 @@ int P4d::initDb()
    status += selectSensorAlerts->prepare();
 
    // ------------------
-   // select * from samples
-   //    where type = ? and address = ?
+   // select * from sampledata
+   //    where seriesid = ? and aggregate = ?
    //     and time <= ?
    //     and time > ?
 
@@ -312,19 +372,34 @@ int P4d::initDb()
    selectSampleInRange = new cDbStatement(tableSamples);
 
    selectSampleInRange->build("select ");
-   selectSampleInRange->bind("ADDRESS", cDBS::bndOut);
-   selectSampleInRange->bind("TYPE", cDBS::bndOut, ", ");
+   selectSampleInRange->bind("SERIESID", cDBS::bndOut);
    selectSampleInRange->bind("TIME", cDBS::bndOut, ", ");
    selectSampleInRange->bind("VALUE", cDBS::bndOut, ", ");
    selectSampleInRange->build(" from %s where ", tableSamples->TableName());
-   selectSampleInRange->bind("ADDRESS", cDBS::bndIn | cDBS::bndSet);
-   selectSampleInRange->bind("TYPE", cDBS::bndIn | cDBS::bndSet, " and ");
+   selectSampleInRange->bind("SERIESID", cDBS::bndIn | cDBS::bndSet);
+   selectSampleInRange->bind("AGGREGATE", cDBS::bndIn | cDBS::bndSet, " and ");
    selectSampleInRange->bindCmp(0, &rangeEnd, "<=", " and ");
    selectSampleInRange->bindCmp(0, "TIME", 0, ">", " and ");
    selectSampleInRange->build(" order by time");
 
    status += selectSampleInRange->prepare();
 
+   // the last sample up to a time, the one before a gap of a compressed series
+
+   selectSampleBefore = new cDbStatement(tableSamples);
+
+   selectSampleBefore->build("select ");
+   selectSampleBefore->bind("SERIESID", cDBS::bndOut);
+   selectSampleBefore->bind("TIME", cDBS::bndOut, ", ");
+   selectSampleBefore->bind("VALUE", cDBS::bndOut, ", ");
+   selectSampleBefore->build(" from %s where ", tableSamples->TableName());
+   selectSampleBefore->bind("SERIESID", cDBS::bndIn | cDBS::bndSet);
+   selectSampleBefore->bind("AGGREGATE", cDBS::bndIn | cDBS::bndSet, " and ");
+   selectSampleBefore->bindCmp(0, "TIME", 0, "<=", " and ");
+   selectSampleBefore->build(" order by time desc limit 1");
+
+   status += selectSampleBefore->prepare();
+
    // ------------------
 
    selectPendingErrors = new cDbStatement(tableErrors);
@@ -340,13 +415,13 @@ int P4d::initDb()
    status += selectPendingErrors->prepare();
 
    // --------------------
-   // select max(time) from samples
+   // select max(time) from sampledata where aggregate = 'S'
 
    selectMaxTime = new cDbStatement(tableSamples);
 
    selectMaxTime->build("select ");
    selectMaxTime->bind("TIME", cDBS::bndOut, "max(");
-   selectMaxTime->build(") from %s", tableSamples->TableName());
+   selectMaxTime->build(") from %s where aggregate = 'S'", tableSamples->TableName());
 
    status += selectMaxTime->prepare();
 
@@ -406,6 +481,10 @@ int P4d::initDb()
 
 int P4d::exitDb()
 {
+   ioLog.close();
+   seriesDict.close();
+   archive.close();
+
    delete tableSamples;            tableSamples = 0;
    delete tableValueFacts;         tableValueFacts = 0;
    delete tableMenu;               tableMenu = 0;
@@ -425,6 +504,7 @@ int P4d::exitDb()
    delete selectAllMenuItems;      selectAllMenuItems = 0;
    delete selectSensorAlerts;      selectSensorAlerts = 0;
    delete selectSampleInRange;     selectSampleInRange = 0;
+   delete selectSampleBefore;      selectSampleBefore = 0;
    delete selectPendingErrors;     selectPendingErrors = 0;
    delete selectMaxTime;           selectMaxTime = 0;
    delete selectScriptByName;      selectScriptByName = 0;
@@ -436,6 +516,37 @@ int P4d::exitDb()
    return done;
 }
 
+//***************************************************************************
+// Init Samples View
+//   a samples table of the former layout is renamed to samplesold (to be
+//   migrated by 'p4d -m'), the view 'samples' shows sampledata in the
+//   former layout to the scripts and other readers
+//***************************************************************************
+
+int P4d::initSamplesView()
+{
+   int count = 0;
+
+   connection->query(count, "select count(*) from information_schema.tables"
+                     " where table_schema = '%s' and table_name = 'samples' and table_type = 'BASE TABLE'",
+                     connection->getName());
+
+   if (count)
+   {
+      tell(eloAlways, "Renaming table 'samples' of the former layout to 'samplesold', migrate it by 'p4d -m'");
+
+      if (connection->query("rename table samples to samplesold") != success)
+         return connection->errorSql(connection, "initSamplesView()");
+   }
+
+   cDbView view(connection, "samples");
+
+   if (!view.exist() && view.create(confDir, "samples.sql") != success)
+      return fail;
+
+   return success;
+}
+
 //***************************************************************************
 // Read Configuration
 //***************************************************************************
@@ -467,6 +578,24 @@ int P4d::readConfiguration()
    getConfigItem("tsync", tSync, no);
    getConfigItem("maxTimeLeak", maxTimeLeak, 10);
 
+   // publish the rollup tiers for the web interface, 'code:seconds,...'
+
+   std::string tiers;
+
+   for (unsigned int t = 0; t < rollupTiers.size(); t++)
+   {
+      char tier[50];
+
+      sprintf(tier, "%s%s:%d", t ? "," : "", rollupTiers[t].aggregate, rollupTiers[t].interval);
+      tiers += tier;
+   }
+
+   setConfigItem("rollupTiers", tiers.c_str());
+
+   // the charts of DI/DO read the events if their rows are not stored
+
+   setConfigItem("ioEvents", ioEvents);
+
    return done;
 }
 
@@ -491,24 +620,50 @@ int P4d::initialize(int truncate)
       tableMenu->truncate();
    }
 
-   sem->p();
+   // use the line of a running p4d if possible
+
+   P4Client client;
+   int viaBroker = client.open(brokerSocket) == success;
 
-   if (serial->open(ttyDeviceSvc) != success)
+   if (viaBroker)
    {
-      sem->v();
-      return fail;
+      tell(eloAlways, "Using the serial line of the running p4d");
+      request->setSerial(&client);
+   }
+   else
+   {
+      // a p4d which owns the line but has no broker holds the lock as long as it runs
+
+      if (sem->p(10000) != success)
+      {
+         tell(eloAlways, "Error: Serial line is locked, a p4d without broker at '%s' running?", brokerSocket);
+         return fail;
+      }
+
+      if (serial->open(ttyDeviceSvc) != success)
+      {
+         sem->v();
+         return fail;
+      }
    }
 
    tell(eloAlways, "Requesting value facts from s 3200");
-   updateValueFacts();
+   updateValueFacts(truncate);
    tell(eloAlways, "Update html schema configuration");
    updateSchemaConfTable();
    tell(eloAlways, "Requesting menu structure from s 3200");
-   initMenu();
+   initMenu(truncate);
 
-   serial->close();
-
-   sem->v();
+   if (viaBroker)
+   {
+      request->setSerial(serial);
+      client.close();
+   }
+   else
+   {
+      serial->close();
+      sem->v();
+   }
 
    return done;
 }
@@ -543,7 +698,7 @@ int P4d::setup()
       if (state != oldState && tableValueFacts->find())
       {
          tableValueFacts->setCharValue("STATE", state);
-         tableValueFacts->store();
+         tableValueFacts->upsert();
       }
    }
 
@@ -555,6 +710,163 @@ int P4d::setup()
    return done;
 }
 
+//***************************************************************************
+// Migrate
+//   the samples of the former layout, then the partitions of sampledata
+//***************************************************************************
+
+int P4d::migrate()
+{
+   if (!connection && initDb() != success)
+      return fail;
+
+   if (migrateSamples() == fail)
+      return fail;
+
+   if (doShutDown())
+      return done;
+
+   return partitionSamples();
+}
+
+//***************************************************************************
+// Migrate Samples
+//   the rows of samplesold (the samples table of the former layout) are
+//   moved to sampledata day by day, each day in one transaction, so the
+//   migration can be stopped and continued any time, also while p4d is
+//   running. The series and state texts are added to their tables first.
+//***************************************************************************
+
+int P4d::migrateSamples()
+{
+   int count = 0;
+   int days = 0;
+   int rows = 0;
+   int oldest = 0;
+   int status = success;
+   const char* rollupColumns = "null, null, null, null";
+
+   connection->query(count, "select count(*) from information_schema.tables"
+                     " where table_schema = '%s' and table_name = 'samplesold'",
+                     connection->getName());
+
+   if (!count)
+   {
+      tell(eloAlways, "Nothing to migrate, table 'samplesold' not found");
+      return done;
+   }
+
+   // min, max, first and last came with the rollup tiers
+
+   connection->query(count, "select count(*) from information_schema.columns"
+                     " where table_schema = '%s' and table_name = 'samplesold' and column_name = 'first'",
+                     connection->getName());
+
+   if (count)
+      rollupColumns = "o.min, o.max, o.first, o.last";
+
+   // 'ignore' - the running p4d may add the same series meanwhile, they are unique
+
+   if (connection->query("insert ignore into series (address, type, inssp, updsp)"
+                         "  select distinct o.address, o.type, unix_timestamp(), unix_timestamp()"
+                         "  from samplesold o"
+                         "  where not exists (select 1 from series s where s.address = o.address and s.type = o.type)") != success)
+      return connection->errorSql(connection, "migrateSamples()");
+
+   while (status == success && !doShutDown())
+   {
+      if (connection->query(oldest, "select coalesce(unix_timestamp(min(time)), 0) from samplesold") != success)
+         return connection->errorSql(connection, "migrateSamples()");
+
+      if (!oldest)
+         break;
+
+      time_t from = SampleRollup::bucketStart(oldest, migrateWindow);
+      time_t to = SampleRollup::bucketEnd(from, migrateWindow);
+
+      // the texts of the day not known yet
+
+      if (connection->query("insert ignore into statetexts (text, inssp, updsp)"
+                            "  select distinct o.text, unix_timestamp(), unix_timestamp()"
+                            "  from samplesold o"
+                            "  where o.time >= from_unixtime(%ld) and o.time < from_unixtime(%ld) and o.text <> ''"
+                            "    and not exists (select 1 from statetexts t where t.text = o.text)",
+                            (long)from, (long)to) != success)
+         return connection->errorSql(connection, "migrateSamples()");
+
+      connection->startTransaction();
+
+      status = connection->query(
+         "insert into sampledata (seriesid, aggregate, time, value, textid, min, max, first, last, samples)"
+         "  select s.id, o.aggregate, unix_timestamp(o.time), o.value,"
+         "    (select min(t.id) from statetexts t where t.text = o.text), %s, o.samples"
+         "  from samplesold o join series s on s.address = o.address and s.type = o.type"
+         "  where o.time >= from_unixtime(%ld) and o.time < from_unixtime(%ld)"
+         "  on duplicate key update samples = sampledata.samples",
+         rollupColumns, (long)from, (long)to);
+
+      if (status == success)
+      {
+         count = mysql_affected_rows(connection->getMySql());
+         status = connection->query("delete from samplesold where time >= from_unixtime(%ld) and time < from_unixtime(%ld)",
+                                    (long)from, (long)to);
+      }
+
+      if (status != success)
+      {
+         connection->rollback();
+         return connection->errorSql(connection, "migrateSamples()");
+      }
+
+      connection->commit();
+
+      days++;
+      rows += count;
+      tell(eloAlways, "Migrated the samples of %s, %d rows", l2pTime(from).c_str(), count);
+   }
+
+   if (!oldest)
+   {
+      tell(eloAlways, "Migration done, dropping table 'samplesold'");
+      connection->query("drop table samplesold");
+   }
+
+   tell(eloAlways, "Migrated %d day(s) with %d rows", days, rows);
+
+   return done;
+}
+
+//***************************************************************************
+// Partition Samples
+//   an unpartitioned sampledata (of a former version) is partitioned and
+//   the rows in the catch all partitions are split to monthly partitions
+//   from their oldest row on. Both copy the rows, the main loop only adds
+//   months to empty catch all partitions therefore.
+//***************************************************************************
+
+int P4d::partitionSamples()
+{
+   if (!tableSamples->getTableDef()->getPartition())
+      return done;
+
+   if (!samplesPartitioned)
+   {
+      tell(eloAlways, "Partitioning table 'sampledata', it's locked meanwhile");
+
+      if (tableSamples->partitionTable() == fail)
+         return fail;
+
+      samplesPartitioned = yes;
+   }
+
+   if (addPartitions(yes) == fail)
+      return fail;
+
+   tell(eloAlways, "Partitions of 'sampledata' up to date");
+
+   return done;
+}
+
 //***************************************************************************
 // Update Conf Tables
 //***************************************************************************
@@ -583,7 +895,7 @@ int P4d::updateSchemaConfTable()
          tableSchemaConf->setValue("XPOS", 12);
          tableSchemaConf->setValue("YPOS", y);
 
-         tableSchemaConf->store();
+         tableSchemaConf->upsert();
          added++;
       }
 
@@ -599,7 +911,7 @@ int P4d::updateSchemaConfTable()
          tableSmartConf->setValue("XPOS", 12);
          tableSmartConf->setValue("YPOS", y);
 
-         tableSmartConf->store();
+         tableSmartConf->upsert();
       }
    }
 
@@ -613,13 +925,16 @@ int P4d::updateSchemaConfTable()
 // Update Value Facts
 //***************************************************************************
 
-int P4d::updateValueFacts()
+int P4d::updateValueFacts(int force)
 {
-   int status;
+   int status = fail;
    Fs::ValueSpec v;
    int count;
    int added;
    int modified;
+   int errors = 0;
+   int errorsInRow = 0;
+   char firmware[12+TB] = "";
 
    // check serial communication
 
@@ -631,16 +946,40 @@ int P4d::updateValueFacts()
 
    // ---------------------------------
    // Add the sensor definitions delivered by the S 3200
+   //   the crawl is skipped if the facts of this firmware are already stored,
+   //   it's only cached if complete (end of list without errors)
 
    count = 0;
    added = 0;
    modified = 0;
 
-   for (status = request->getFirstValueSpec(&v); status != Fs::wrnLast;
+   getFirmware(firmware);
+
+   if (!force && isCrawlCached("valueFactsCrawl", firmware))
+      tell(eloAlways, "Value facts of firmware '%s' already stored, skipping request", firmware);
+
+   else for (status = request->getFirstValueSpec(&v); status != Fs::wrnLast;
         status = request->getNextValueSpec(&v))
    {
+      if (status == Fs::wrnEmpty)
+         continue;
+
       if (status != success)
+      {
+         errors++;
+
+         // the line is dead, don't crawl on
+
+         if (++errorsInRow >= 3)
+         {
+            tell(eloAlways, "Aborting the value facts request after %d errors in a row", errorsInRow);
+            break;
+         }
+
          continue;
+      }
+
+      errorsInRow = 0;
 
       tell(eloDebug, "%3d) 0x%04x %4d '%s' (%04d) '%s'",
            count, v.address, v.factor, v.unit, v.unknown, v.description);
@@ -660,14 +999,20 @@ int P4d::updateValueFacts()
          tableValueFacts->setValue("TITLE", v.description);
          tableValueFacts->setValue("RES1", v.unknown);
 
-         tableValueFacts->store();
+         tableValueFacts->upsert();
          added++;
       }
 
       count++;
    }
 
-   tell(eloAlways, "Read %d value facts, added %d", count, added);
+   if (count)
+      tell(eloAlways, "Read %d value facts, added %d", count, added);
+
+   if (status == Fs::wrnLast && !errors)
+      storeCrawlCache("valueFactsCrawl", firmware);
+   else if (count || errors)
+      tell(eloAlways, "Value facts request incomplete (%d errors), requesting again at next start", errors);
 
    // ---------------------------------
    // add default for digital outputs
@@ -717,7 +1062,7 @@ int P4d::updateValueFacts()
 
       if (tableValueFacts->getChanges())
       {
-         tableValueFacts->store();
+         tableValueFacts->upsert();
          modified++;
       }
 
@@ -747,7 +1092,7 @@ int P4d::updateValueFacts()
       tableValueFacts->setValue("FACTOR", 1);
       tableValueFacts->setValue("TITLE", "Heizungsstatus");
 
-      tableValueFacts->store();
+      tableValueFacts->upsert();
       added++;
    }
 
@@ -763,7 +1108,7 @@ int P4d::updateValueFacts()
       tableValueFacts->setValue("FACTOR", 1);
       tableValueFacts->setValue("TITLE", "Betriebsmodus");
 
-      tableValueFacts->store();
+      tableValueFacts->upsert();
       added++;
    }
 
@@ -779,7 +1124,7 @@ int P4d::updateValueFacts()
       tableValueFacts->setValue("FACTOR", 1);
       tableValueFacts->setValue("TITLE", "Datum Uhrzeit der Heizung");
 
-      tableValueFacts->store();
+      tableValueFacts->upsert();
       added++;
    }
 
@@ -814,7 +1159,7 @@ int P4d::updateValueFacts()
             tableValueFacts->setValue("FACTOR", 1);
             tableValueFacts->setValue("TITLE", it->first.c_str());
 
-            tableValueFacts->store();
+            tableValueFacts->upsert();
             added++;
          }
 
@@ -942,7 +1287,7 @@ int P4d::hmSyncSysVars()
       tableHmSysVars->setValue("MAX", (const char*)max);
       tableHmSysVars->setValue("TIME", atol((const char*)time));
       tableHmSysVars->setValue("VALUE", (const char*)value);
-      tableHmSysVars->store();
+      tableHmSysVars->upsert();
 
       xmlFree(id);
       xmlFree(name);
@@ -966,11 +1311,12 @@ int P4d::hmSyncSysVars()
 // Initialize Menu Structure
 //***************************************************************************
 
-int P4d::initMenu()
+int P4d::initMenu(int force)
 {
    int status;
    Fs::MenuItem m;
    int count = 0;
+   char firmware[12+TB] = "";
 
    // check serial communication
 
@@ -980,6 +1326,16 @@ int P4d::initMenu()
       return fail;
    }
 
+   // the menu tree only changes with the firmware, reuse it if possible
+
+   getFirmware(firmware);
+
+   if (!force && isCrawlCached("menuCrawl", firmware))
+   {
+      tell(eloAlways, "Menu structure of firmware '%s' already stored, skipping request", firmware);
+      return done;
+   }
+
    tableMenu->truncate();
    tableMenu->clear();
 
@@ -1020,6 +1376,9 @@ int P4d::initMenu()
 
    tell(eloAlways, "Read %d menu items", count);
 
+   if (status == Fs::wrnLast)
+      storeCrawlCache("menuCrawl", firmware);
+
    return success;
 }
 
@@ -1032,23 +1391,56 @@ int P4d::store(time_t now, const char* type, int address, double value,
 {
    static time_t lastHmFailAt = 0;
 
+   char key[50];
+   int rolledUp = no;
+   int rowFlag = Sample::sfRow;
+   std::vector<SampleFilter::Point> stored;
    double theValue = value / (double)factor;
 
-   tableSamples->clear();
+   // the digital values as events, with ioEvents without rows
+
+   if (strcmp(type, "DO") == 0 || strcmp(type, "DI") == 0)
+   {
+      ioLog.add(address, type, now, (int)theValue);
+
+      if (ioEvents)
+         rowFlag = 0;
+   }
+
+   // the compression decides which samples become rows, the rollups see all
+   // of them - also with the time series store only, they feed the webif
+
+   if (!mysqlSamples)
+      rowFlag = 0;
+
+   sprintf(key, "%s:%d", type, address);
+   lastValues[key].time = now;
+   lastValues[key].value = theValue;
+   filters[key].add(now, theValue, &stored);
 
-   tableSamples->setValue("TIME", now);
-   tableSamples->setValue("ADDRESS", address);
-   tableSamples->setValue("TYPE", type);
-   tableSamples->setValue("AGGREGATE", "S");
+   for (unsigned int i = 0; i < stored.size(); i++)
+   {
+      SampleFilter::Point* p = &stored[i];
+      int current = p->time == now && p->value == theValue;
+
+      if (rowFlag || current)                     // written at the end of the cycle
+         writer->push(p->time, address, type, p->value, current ? text : 0,
+                      current ? rowFlag | Sample::sfRollup : rowFlag);
 
-   tableSamples->setValue("VALUE", theValue);
-   tableSamples->setValue("TEXT", text);
-   tableSamples->setValue("SAMPLES", 1);
+      if (tsdb)
+         tsdb->append(address, type, p->time, p->value);
+
+      rolledUp = rolledUp || current;
+   }
 
-   tableSamples->store();
+   if (!rolledUp)
+      writer->push(now, address, type, theValue, text, Sample::sfRollup);
 
    // HomeMatic
 
+   if (!dbConnected())
+      return success;
+
    if (lastHmFailAt < time(0) - 3*tmeSecondsPerMinute)  // on fail retry not before 3 minutes
    {
       char* hmHost = 0;
@@ -1101,6 +1493,130 @@ int P4d::store(time_t now, const char* type, int address, double value,
    return success;
 }
 
+//***************************************************************************
+// Flush Filters
+//   the samples held back by the compression, at shutdown
+//***************************************************************************
+
+void P4d::flushFilters()
+{
+   std::map<std::string, SampleFilter>::iterator it;
+
+   for (it = filters.begin(); it != filters.end(); ++it)
+   {
+      std::vector<SampleFilter::Point> stored;
+      char type[2+TB];
+      int address;
+
+      it->second.flush(&stored);
+
+      if (stored.empty() || sscanf(it->first.c_str(), "%2[^:]:%d", type, &address) != 2)
+         continue;
+
+      for (unsigned int i = 0; i < stored.size(); i++)
+      {
+         if (mysqlSamples)
+            writer->push(stored[i].time, address, type, stored[i].value, 0, Sample::sfRow);
+
+         if (tsdb)
+            tsdb->append(address, type, stored[i].time, stored[i].value);
+      }
+   }
+}
+
+//***************************************************************************
+// Value At
+//   of a compressed series, the samples between two stored ones are
+//   dropped, their value is the linear interpolation - at least one
+//   sample per heartbeat (maxGap) is stored. The latest sample stands in
+//   for the one not stored yet.
+//***************************************************************************
+
+int P4d::valueAt(int addr, const char* type, int seriesId, time_t t, double& value)
+{
+   char key[50];
+   SampleFilter::Point before = { 0, 0 };
+   SampleFilter::Point after = { 0, 0 };
+   int hasBefore = no;
+   int hasAfter = no;
+
+   sprintf(key, "%s:%d", type, addr);
+   std::map<std::string, SampleFilter>::iterator f = filters.find(key);
+
+   if (f == filters.end() || f->second.getPolicy()->kind == SampleFilter::fkNone)
+      return fail;
+
+   int maxGap = f->second.getPolicy()->maxGap;
+
+   if (tsdb)
+   {
+      std::vector<TsSeries::Point> points;
+
+      tsdb->query(addr, type, t - maxGap, t + maxGap, &points);
+
+      for (unsigned int i = 0; i < points.size(); i++)
+      {
+         if (points[i].time <= t)
+         {
+            before.time = points[i].time;
+            before.value = points[i].value;
+            hasBefore = yes;
+         }
+         else if (!hasAfter)
+         {
+            after.time = points[i].time;
+            after.value = points[i].value;
+            hasAfter = yes;
+         }
+      }
+   }
+   else if (seriesId != na)
+   {
+      tableSamples->clear();
+      tableSamples->setValue("SERIESID", seriesId);
+      tableSamples->setValue("AGGREGATE", "S");
+      tableSamples->setValue("TIME", t);
+
+      if ((hasBefore = selectSampleBefore->find()))
+      {
+         before.time = tableSamples->getIntValue("TIME");
+         before.value = tableSamples->getFloatValue("VALUE");
+      }
+
+      selectSampleBefore->freeResult();
+
+      tableSamples->clear();
+      tableSamples->setValue("SERIESID", seriesId);
+      tableSamples->setValue("AGGREGATE", "S");
+      tableSamples->setValue("TIME", t);
+      rangeEnd.setValue(t + maxGap);
+
+      if ((hasAfter = selectSampleInRange->find()))
+      {
+         after.time = tableSamples->getIntValue("TIME");
+         after.value = tableSamples->getFloatValue("VALUE");
+      }
+
+      selectSampleInRange->freeResult();
+      tableSamples->reset();
+   }
+
+   std::map<std::string, SampleFilter::Point>::iterator last = lastValues.find(key);
+
+   if (!hasAfter && last != lastValues.end() && last->second.time > t)
+   {
+      after = last->second;
+      hasAfter = yes;
+   }
+
+   if (!hasBefore || !hasAfter || t - before.time > maxGap)
+      return fail;
+
+   value = SampleFilter::interpolate(&before, &after, t);
+
+   return success;
+}
+
 //***************************************************************************
 // Schedule Time Sync In
 //***************************************************************************
@@ -1133,7 +1649,8 @@ int P4d::standby(int t)
    while (time(0) < end && !doShutDown())
    {
       meanwhile();
-      usleep(50000);
+      broker->serve(50);
+      ingestCom2(0);
    }
 
    return done;
@@ -1144,7 +1661,8 @@ int P4d::standbyUntil(time_t until)
    while (time(0) < until && !doShutDown())
    {
       meanwhile();
-      usleep(50000);
+      broker->serve(50);
+      ingestCom2(0);
    }
 
    return done;
@@ -1180,6 +1698,7 @@ int P4d::loop()
 {
    int status;
    time_t nextStateAt = 0;
+   time_t dbRetryAt = 0;
    int lastState = na;
 
    // info
@@ -1192,25 +1711,45 @@ int P4d::loop()
 
    // init
 
-   scheduleAggregate();
+   queue->setHook(betweenRequests, this);
+   writer->start();
+
+   // serial link statistic, readable by 'p4 stats' - only the daemon shares
+   // (and resets) it, 'p4d -i/-s/-m' count in their local one
+
+   request->shareStatistic();
+
+   // we own the serial line as long as we are running, other processes
+   // use it via the broker
 
    sem->p();
    serial->open(ttyDeviceSvc);
-   sem->v();
+
+   if (broker->open(brokerSocket, brokerGroup, ttyDeviceSvc) != success)
+      tell(eloAlways, "Error: Broker not available, 'p4' and 'p4d -i' can't use the serial line while p4d is running");
 
    while (!doShutDown())
    {
       int stateChanged = no;
 
-      // check db connection
+      // check db connection, once the value facts are known the samples
+      // are collected (and spooled by the writer) while it is lost
 
-      while (!doShutDown() && (!connection || !connection->isConnected()))
+      while (!doShutDown() && !dbConnected() && time(0) >= dbRetryAt)
       {
          if (initDb() == success)
             break;
          else
             exitDb();
 
+         dbRetryAt = time(0) + 10;
+
+         if (activeFacts.size())
+         {
+            tell(eloAlways, "Database not available, collecting the samples anyway, retrying in 10 seconds");
+            break;
+         }
+
          tell(eloAlways, "Retrying in 10 seconds");
          standby(10);
       }
@@ -1222,10 +1761,10 @@ int P4d::loop()
 
       standbyUntil(min(nextStateAt, nextAt));
 
-      // aggregate
+      // purge samples, the rollups are build by the writer
 
-      if (aggregateHistory && nextAggregateAt <= time(0))
-         aggregate();
+      if ((aggregateHistory || archiveHistory || samplesPartitioned) && nextPurgeAt <= time(0) && dbConnected())
+         purgeSamples();
 
       // update/check state
 
@@ -1233,11 +1772,13 @@ int P4d::loop()
 
       if (status != success)
       {
-         sem->p();
-         serial->close();
-         tell(eloAlways, "Error reading serial interface, reopen now!");
-         status = serial->open(ttyDeviceSvc);
-         sem->v();
+         if ((status = request->resync()) != success)
+         {
+            request->getStatistic()->reopens++;
+            serial->close();
+            tell(eloAlways, "Error reading serial interface, reopen now!");
+            status = serial->open(ttyDeviceSvc);
+         }
 
          if (status != success)
          {
@@ -1267,12 +1808,12 @@ int P4d::loop()
 
       // check serial connection
 
-      sem->p();
-      status = request->check();
-      sem->v();
+      if ((status = request->check()) != success)
+         status = request->resync();
 
       if (status != success)
       {
+         request->getStatistic()->reopens++;
          serial->close();
          tell(eloAlways, "Error reading serial interface, reopen now");
          serial->open(ttyDeviceSvc);
@@ -1287,10 +1828,18 @@ int P4d::loop()
       mailBody = "";
       mailBodyHtml = "";
 
-      sem->p();
+      struct rusage ruStart;
+      uint64_t startMs = cTimeMs::Now();
+
+      getrusage(RUSAGE_SELF, &ruStart);
+      serial->resetStatistic();
+
       update();
 
-      updateErrors();
+      if (dbConnected())
+         updateErrors();
+
+      logCycleStatistic(&ruStart, startMs);
       afterUpdate();
 
       // mail
@@ -1298,13 +1847,13 @@ int P4d::loop()
       if (mail && stateChanged)
          sendStateMail();
 
-      if (errorsPending)
+      if (errorsPending && dbConnected())    // the errors are read from the database
          sendErrorMail();
+   }
 
-      sem->v();
-   }
-
+   broker->close();
    serial->close();
+   sem->v();
 
    return success;
 }
@@ -1322,11 +1871,9 @@ int P4d::updateState(Status* state)
 
    // get state
 
-   sem->p();
    tell(eloDetail, "Checking state ...");
    status = request->getStatus(state);
    now = time(0);
-   sem->v();
 
    if (status != success)
       return status;
@@ -1354,8 +1901,6 @@ int P4d::updateState(Status* state)
 
          tell(eloAlways, "Time drift is %ld seconds, syncing now", state->time - now);
 
-         sem->p();
-
          if (request->syncTime() == success)
             tell(eloAlways, "Time sync succeeded");
          else
@@ -1366,8 +1911,6 @@ int P4d::updateState(Status* state)
          status = request->getStatus(state);
          now = time(0);
 
-         sem->v();
-
          tell(eloAlways, "Time drift now %ld seconds", state->time - now);
       }
    }
@@ -1381,97 +1924,133 @@ int P4d::updateState(Status* state)
 
 int P4d::update()
 {
-   int status;
    int count = 0;
    time_t now = time(0);
    char num[100];
+   std::vector<ValueFact> facts;
 
    w1.update();
 
    tell(eloDetail, "Reading values ...");
 
-   tableValueFacts->clear();
-   tableValueFacts->setValue("STATE", "A");
+   // collect the active value facts, without database the ones of the last cycle
 
-   for (int f = selectActiveValueFacts->find(); f; f = selectActiveValueFacts->fetch())
+   if (!dbConnected())
+      tell(eloAlways, "Database not available, using the %d value facts of the last cycle", (int)activeFacts.size());
+   else
    {
-      int addr = tableValueFacts->getIntValue("ADDRESS");
-      double factor = tableValueFacts->getIntValue("FACTOR");
-      const char* title = tableValueFacts->getStrValue("TITLE");
-      const char* type = tableValueFacts->getStrValue("TYPE");
-      const char* unit = tableValueFacts->getStrValue("UNIT");
-      const char* name = tableValueFacts->getStrValue("NAME");
+      activeFacts.clear();
+      tableValueFacts->clear();
+      tableValueFacts->setValue("STATE", "A");
+   }
+
+   for (int f = dbConnected() ? selectActiveValueFacts->find() : no; f; f = selectActiveValueFacts->fetch())
+   {
+      ValueFact fact;
+
+      fact.address = tableValueFacts->getIntValue("ADDRESS");
+      fact.factor = tableValueFacts->getIntValue("FACTOR");
+      fact.title = tableValueFacts->getStrValue("TITLE");
+      fact.type = tableValueFacts->getStrValue("TYPE");
+      fact.unit = tableValueFacts->getStrValue("UNIT");
+      fact.name = tableValueFacts->getStrValue("NAME");
+      fact.compression = tableValueFacts->getStrValue("COMPRESSION");
+      fact.com2Index = tableValueFacts->getValue("COM2INDEX")->isNull() ? na : tableValueFacts->getIntValue("COM2INDEX");
+      fact.fromCom2 = no;
+      fact.status = success;
+      fact.value.address = fact.address;
+      fact.io.address = fact.address;
 
       if (!tableValueFacts->getValue("USRTITLE")->isEmpty())
-         title = tableValueFacts->getStrValue("USRTITLE");
+         fact.title = tableValueFacts->getStrValue("USRTITLE");
 
-      if (tableValueFacts->hasValue("TYPE", "VA"))
-      {
-         Value v(addr);
+      activeFacts.push_back(fact);
+   }
 
-         if ((status = request->getValue(&v)) != success)
-         {
-            tell(eloAlways, "Getting value 0x%04x failed, error %d", addr, status);
-            continue;
-         }
+   if (dbConnected())
+      selectActiveValueFacts->freeResult();
 
-         store(now, type, v.address, v.value, factor);
-         sprintf(num, "%.2f", v.value / factor);
+   facts = activeFacts;
 
-         if (strcmp(unit, "°") == 0)
-            strcat(num, "°C");
-         else
-            strcat(num, unit);
+   // compression policies, the analog values default to compressAnalog
 
-         addParameter2Mail(title, num);
-      }
+   int maxGap = 0;
 
-      else if (tableValueFacts->hasValue("TYPE", "DO"))
-      {
-         Fs::IoValue v(addr);
+   for (std::vector<ValueFact>::iterator it = facts.begin(); it != facts.end(); ++it)
+   {
+      const char* spec = it->compression.c_str();
+      SampleFilter::Policy policy;
+      char key[50];
 
-         if (request->getDigitalOut(&v) != success)
-         {
-            tell(eloAlways, "Getting digital out 0x%04x failed, error %d", addr, status);
-            continue;
-         }
+      if (isEmpty(spec) && (it->type == "VA" || it->type == "AO" || it->type == "W1"))
+         spec = compressAnalog;
 
-         store(now, type, v.address, v.state, factor);
-         sprintf(num, "%d", v.state);
-         addParameter2Mail(title, num);
+      SampleFilter::parsePolicy(spec, &policy);
+      sprintf(key, "%s:%d", it->type.c_str(), it->address);
+      filters[key].setPolicy(&policy);
+
+      if (policy.kind != SampleFilter::fkNone)
+         maxGap = std::max(maxGap, policy.maxGap);
+   }
+
+   // the web interface interpolates the gaps up to the largest heartbeat
+
+   if (maxGap != publishedMaxGap && dbConnected() && setConfigItem("compressMaxGap", maxGap) == success)
+      publishedMaxGap = maxGap;
+
+   // request the values of the s 3200, webif jobs are served between the requests
+
+   if (valueBatching == na)
+      probeValueBatching(&facts);
+
+   // pick up the latest COM2 telegram, the values it carries are not requested
+
+   ingestCom2(0);
+
+   if (int taken = takeCom2Values(&facts, now))
+      tell(eloDetail, "Took %d value(s) from the COM2 telegram", taken);
+
+   queueRequests(&facts, valueBatching == yes);
+   queue->perform();
+
+   // store
+
+   for (std::vector<ValueFact>::iterator it = facts.begin(); it != facts.end(); ++it)
+   {
+      int addr = it->address;
+      double factor = it->factor;
+      const char* title = it->title.c_str();
+      const char* type = it->type.c_str();
+      const char* unit = it->unit.c_str();
+      const char* name = it->name.c_str();
+
+      if (it->status != success)
+      {
+         tell(eloAlways, "Getting %s 0x%04x failed, error %d", type, addr, it->status);
+         continue;
       }
 
-      else if (tableValueFacts->hasValue("TYPE", "DI"))
+      if (it->type == "VA")
       {
-         Fs::IoValue v(addr);
+         store(now, type, addr, it->value.value, factor);
+         sprintf(num, "%.2f", it->value.value / factor);
 
-         if (request->getDigitalIn(&v) != success)
-         {
-            tell(eloAlways, "Getting digital in 0x%04x failed, error %d", addr, status);
-            continue;
-         }
+         if (strcmp(unit, "°") == 0)
+            strcat(num, "°C");
+         else
+            strcat(num, unit);
 
-         store(now, type, v.address, v.state, factor);
-         sprintf(num, "%d", v.state);
          addParameter2Mail(title, num);
       }
 
-      else if (tableValueFacts->hasValue("TYPE", "AO"))
+      else if (it->type == "DO" || it->type == "DI" || it->type == "AO")
       {
-         Fs::IoValue v(addr);
-
-         if (request->getAnalogOut(&v) != success)
-         {
-            tell(eloAlways, "Getting analog out 0x%04x failed, error %d", addr, status);
-            continue;
-         }
-
-         store(now, type, v.address, v.state, factor);
-         sprintf(num, "%d", v.state);
+         store(now, type, addr, it->io.state, factor);
+         sprintf(num, "%d", it->io.state);
          addParameter2Mail(title, num);
       }
 
-      else if (tableValueFacts->hasValue("TYPE", "W1"))
+      else if (it->type == "W1")
       {
          double value = w1.valueOf(name);
 
@@ -1486,9 +2065,30 @@ int P4d::update()
          addParameter2Mail(title, num);
       }
 
-      else if (tableValueFacts->hasValue("TYPE", "UD"))
+      else if (it->type == "C2")
       {
-         switch (tableValueFacts->getIntValue("ADDRESS"))
+         Parameter* p = com2At >= now - 10 ? com2->getParameter(addr) : 0;
+
+         if (!p)
+         {
+            tell(eloAlways, "No current COM2 telegram for parameter %d, skipping", addr);
+            continue;
+         }
+
+         store(now, type, addr, p->value * factor, factor, *p->text ? p->text : 0);
+
+         if (*p->text)
+            addParameter2Mail(title, p->text);
+         else
+         {
+            sprintf(num, "%.2f%s", p->value, unit);
+            addParameter2Mail(title, num);
+         }
+      }
+
+      else if (it->type == "UD")
+      {
+         switch (addr)
          {
             case udState:
             {
@@ -1523,10 +2123,376 @@ int P4d::update()
       count++;
    }
 
-   selectActiveValueFacts->freeResult();
    tell(eloAlways, "Processed %d samples, state is '%s'", count, currentState.stateinfo);
 
-   sensorAlertCheck(now);
+   // the writer thread stores the samples in one transaction, at the
+   // end of this cycle or later (flush policy)
+
+   writer->commit();
+
+   if (tsdb)
+      tsdb->sync();
+
+   if (dbConnected() && ioLog.write() != success)
+      tell(eloAlways, "Warning: Writing the io events failed, retrying next cycle");
+
+   logWriterStatistic();
+
+   if (dbConnected())
+      sensorAlertCheck(now);
+
+   return success;
+}
+
+//***************************************************************************
+// Log Writer Statistic
+//***************************************************************************
+
+void P4d::logWriterStatistic()
+{
+   SampleWriter::Statistic stat;
+
+   writer->getStatistic(&stat);
+
+   tell(eloDetail, "Writer: queue %d/%d (max %d), queued %lu, written %lu, lag %lu ms (max %lu)",
+        stat.depth, stat.size, stat.maxDepth, stat.queued, stat.written, stat.lagMs, stat.maxLagMs);
+
+   if (stat.flushes)
+      tell(eloDetail, "Writer: %lu flushes, %lu commits, flush took %lu ms (avg %lu, max %lu)",
+           stat.flushes, stat.commits, stat.flushMs, stat.avgFlushMs, stat.maxFlushMs);
+
+   // per hour, to tune the flush policy
+
+   if (stat.seconds >= tmeSecondsPerMinute)
+      tell(eloDetail, "Writer: %.1f commits/h, %.1f spool syncs/h, %.1f kB spooled/h",
+           stat.commits * 3600.0 / stat.seconds, stat.spoolSyncs * 3600.0 / stat.seconds,
+           stat.spoolBytes * 3.6 / stat.seconds);
+
+   if (stat.serverSeconds >= tmeSecondsPerMinute)
+      tell(eloDetail, "Database server: %.1f fsyncs/h, %.1f kB written/h",
+           stat.serverFsyncs * 3600.0 / stat.serverSeconds, stat.serverBytes * 3.6 / stat.serverSeconds);
+
+   if (stat.spoolSize)
+      tell(eloDetail, "Writer: spool %d/%d, %lu syncs", stat.spoolPending, stat.spoolSize, stat.spoolSyncs);
+
+   if (stat.dropped || stat.spilled || stat.failed)
+      tell(eloAlways, "Writer: %lu samples dropped, %lu spooled (%lu replayed), %lu failed",
+           stat.dropped, stat.spilled, stat.replayed, stat.failed);
+
+   if (tsdb)
+   {
+      TsStore::Statistic ts;
+
+      tsdb->getStatistic(&ts);
+
+      tell(eloDetail, "Time series store: %d series, %lu points in %zu kB, appended %lu, rejected %lu",
+           ts.series, ts.points, ts.usedBytes / 1024, ts.appended, ts.rejected);
+   }
+}
+
+//***************************************************************************
+// Log Cycle Statistic
+//***************************************************************************
+
+void P4d::logCycleStatistic(struct rusage* ruStart, uint64_t startMs)
+{
+   struct rusage ruEnd;
+   const Serial::Statistic* stat = serial->getStatistic();
+
+   getrusage(RUSAGE_SELF, &ruEnd);
+
+   uint64_t elapsed = cTimeMs::Now() - startMs;
+   long cpuMs = (ruEnd.ru_utime.tv_sec - ruStart->ru_utime.tv_sec) * 1000
+      + (ruEnd.ru_utime.tv_usec - ruStart->ru_utime.tv_usec) / 1000
+      + (ruEnd.ru_stime.tv_sec - ruStart->ru_stime.tv_sec) * 1000
+      + (ruEnd.ru_stime.tv_usec - ruStart->ru_stime.tv_usec) / 1000;
+
+   tell(eloDetail, "Cycle took %lu ms (cpu %ld ms) for %lu transactions, %.1f ms per transaction",
+        elapsed, cpuMs, stat->writes, stat->writes ? elapsed / (double)stat->writes : 0.0);
+
+   tell(eloDetail, "Serial: received %lu bytes with %lu reads and %lu polls, waited %lu ms",
+        stat->bytes, stat->reads, stat->polls, (unsigned long)stat->waitMs);
+}
+
+//***************************************************************************
+// Probe Value Batching
+//   check once if the firmware supports multi value requests
+//***************************************************************************
+
+int P4d::probeValueBatching(std::vector<ValueFact>* facts)
+{
+   int status;
+   std::vector<Value> probe;
+
+   for (std::vector<ValueFact>::iterator it = facts->begin(); it != facts->end() && probe.size() < 5; ++it)
+   {
+      if (it->type == "VA")
+         probe.push_back(Value(it->address));
+   }
+
+   if (probe.size() < 2)
+      return done;
+
+   status = request->probeValues(probe);
+
+   if (status != success && status != errNotSupported)
+      return fail;                    // communication error, probe again next cycle
+
+   valueBatching = status == success;
+
+   tell(eloAlways, "Multi value requests %ssupported by the firmware, %s",
+        valueBatching ? "" : "not ", valueBatching ? "using them" : "falling back to single requests");
+
+   return success;
+}
+
+//***************************************************************************
+// Queue Requests
+//   one request per digital/analog line, the 'VA' values as one multi value
+//   request if 'batch' is set. Requests not performed within the interval
+//   are dropped.
+//***************************************************************************
+
+int P4d::queueRequests(std::vector<ValueFact>* facts, int batch)
+{
+   int timeout = interval * 1000;
+
+   valueBatch.clear();
+
+   for (std::vector<ValueFact>::iterator it = facts->begin(); it != facts->end(); ++it)
+   {
+      ValueFact* fact = &(*it);
+
+      if (fact->fromCom2)
+         continue;
+
+      if (fact->type == "VA" && batch)
+         valueBatch.push_back(Value(fact->address));
+      else if (fact->type == "VA")
+         queue->enqueue(P4Queue::jtValue, &fact->value, requestDone, this, fact, P4Queue::prioNormal, timeout);
+      else if (fact->type == "DO")
+         queue->enqueue(P4Queue::jtDigitalOut, &fact->io, requestDone, this, fact, P4Queue::prioNormal, timeout);
+      else if (fact->type == "DI")
+         queue->enqueue(P4Queue::jtDigitalIn, &fact->io, requestDone, this, fact, P4Queue::prioNormal, timeout);
+      else if (fact->type == "AO")
+         queue->enqueue(P4Queue::jtAnalogOut, &fact->io, requestDone, this, fact, P4Queue::prioNormal, timeout);
+   }
+
+   if (valueBatch.size())
+      queue->enqueue(P4Queue::jtValues, &valueBatch, valuesDone, this, facts, P4Queue::prioHigh, timeout);
+
+   return done;
+}
+
+//***************************************************************************
+// Request Callbacks
+//***************************************************************************
+
+void P4d::requestDone(P4Queue::Job* job, void* context)
+{
+   ValueFact* fact = (ValueFact*)job->data;
+
+   fact->status = job->status;
+}
+
+void P4d::valuesDone(P4Queue::Job* job, void* context)
+{
+   P4d* p4d = (P4d*)context;
+   std::vector<ValueFact>* facts = (std::vector<ValueFact>*)job->data;
+   std::vector<Value>* values = (std::vector<Value>*)job->object;
+
+   if (job->status == success)
+   {
+      std::map<int,sword> result;
+
+      for (std::vector<Value>::iterator it = values->begin(); it != values->end(); ++it)
+         result[it->address] = it->value;
+
+      for (std::vector<ValueFact>::iterator it = facts->begin(); it != facts->end(); ++it)
+      {
+         if (it->type != "VA" || it->fromCom2)
+            continue;
+
+         if (result.find(it->address) != result.end())
+            it->value.value = result[it->address];
+         else
+            it->status = fail;
+      }
+
+      return;
+   }
+
+   tell(eloAlways, "Getting %d values with multi value request failed, error %d",
+        (int)values->size(), job->status);
+
+   if (job->status == errNotSupported)
+      p4d->valueBatching = no;
+
+   // the values of the batch are missing, don't store them unless the fallback gets them
+
+   for (std::vector<ValueFact>::iterator it = facts->begin(); it != facts->end(); ++it)
+   {
+      if (it->type == "VA" && !it->fromCom2)
+         it->status = job->status;
+   }
+
+   // fallback to single requests for this cycle
+
+   if (job->status != abrt)
+   {
+      for (std::vector<ValueFact>::iterator it = facts->begin(); it != facts->end(); ++it)
+      {
+         if (it->type == "VA" && !it->fromCom2)
+            p4d->queue->enqueue(P4Queue::jtValue, &it->value, requestDone, p4d, &(*it),
+                                P4Queue::prioHigh, interval * 1000);
+      }
+   }
+}
+
+//***************************************************************************
+// Between Requests
+//   look for pending webif jobs, not more than twice a second. Only the
+//   short ones the webif waits for, the values of the cycle are half
+//   collected - the others wait for the end of update()
+//***************************************************************************
+
+void P4d::betweenRequests(void* context)
+{
+   P4d* p4d = (P4d*)context;
+
+   // requests of other processes go ahead
+
+   p4d->broker->serve(0);
+   p4d->ingestCom2(0);
+
+   if (cTimeMs::Now() < p4d->lastJobCheckAt + 500)
+      return;
+
+   p4d->lastJobCheckAt = cTimeMs::Now();
+
+   if (p4d->dbConnected())
+      p4d->performWebifRequests(yes);
+}
+
+//***************************************************************************
+// Ingest COM2
+//   take the telegrams the s 3200 sends every second at COM2, called from
+//   the standby loops and between the requests, therefore with timeout 0
+//***************************************************************************
+
+int P4d::ingestCom2(int timeout)
+{
+   int status;
+
+   if (!com2)
+      return done;
+
+   if (!com2->isOpen())
+   {
+      if (com2OpenAt > time(0) - 30)
+         return fail;
+
+      com2OpenAt = time(0);
+
+      if (com2->open(ttyDeviceCom2) != success)
+      {
+         tell(eloAlways, "Opening COM2 line '%s' failed, retrying in 30 seconds", ttyDeviceCom2);
+         return fail;
+      }
+
+      tell(eloAlways, "Receiving COM2 telegrams at '%s'", ttyDeviceCom2);
+   }
+
+   while ((status = com2->read(timeout)) == success)
+   {
+      com2At = time(0);
+      timeout = 0;
+
+      if (!com2FactsChecked && connection && connection->isConnected())
+         com2FactsChecked = updateCom2Facts() == success;
+   }
+
+   if (status == Serial::wrnTimeout)
+      return success;
+
+   // a broken packet is dropped, a failed line reopened later
+
+   if (status != P4Packet::wrnCorrupt)
+   {
+      tell(eloAlways, "Reading COM2 line failed, closing");
+      com2->close();
+   }
+
+   return fail;
+}
+
+//***************************************************************************
+// Take COM2 Values
+//   the 'VA' facts with a com2index get their value from a current
+//   telegram instead of a request at COM1
+//***************************************************************************
+
+int P4d::takeCom2Values(std::vector<ValueFact>* facts, time_t now)
+{
+   int count = 0;
+
+   for (std::vector<ValueFact>::iterator it = facts->begin(); it != facts->end(); ++it)
+   {
+      Parameter* p = 0;
+
+      if (it->type != "VA" || it->com2Index == na)
+         continue;
+
+      if (com2 && com2At >= now - 10)
+         p = com2->getParameter(it->com2Index);
+
+      if ((it->fromCom2 = p != 0))
+      {
+         it->value.value = (sword)round(p->value * it->factor);
+         count++;
+      }
+   }
+
+   return count;
+}
+
+//***************************************************************************
+// Update COM2 Facts
+//   one value fact of type 'C2' per parameter of the telegram
+//***************************************************************************
+
+int P4d::updateCom2Facts()
+{
+   int added = 0;
+   std::vector<Parameter>* parameters = com2->getParameters();
+
+   for (std::vector<Parameter>::iterator it = parameters->begin(); it != parameters->end(); ++it)
+   {
+      char* name = 0;
+      string sname = it->name;
+
+      tableValueFacts->clear();
+      tableValueFacts->setValue("ADDRESS", it->index);
+      tableValueFacts->setValue("TYPE", "C2");
+
+      if (tableValueFacts->find())
+         continue;
+
+      removeCharsExcept(sname, nameChars);
+      asprintf(&name, "%s_c2_%d", sname.c_str(), it->index);
+
+      tableValueFacts->setValue("NAME", name);
+      tableValueFacts->setValue("STATE", "D");
+      tableValueFacts->setValue("UNIT", it->unit);
+      tableValueFacts->setValue("FACTOR", 1);
+      tableValueFacts->setValue("TITLE", it->name);
+
+      tableValueFacts->upsert();
+      free(name);
+      added++;
+   }
+
+   tell(eloAlways, "Checked %zd COM2 parameters, added %d", parameters->size(), added);
 
    return success;
 }
@@ -1556,6 +2522,8 @@ void P4d::afterUpdate()
 
 void P4d::sensorAlertCheck(time_t now)
 {
+   int flushed = no;
+
    tableSensorAlert->clear();
    tableSensorAlert->setValue("KIND", "M");
 
@@ -1563,6 +2531,13 @@ void P4d::sensorAlertCheck(time_t now)
 
    for (int f = selectSensorAlerts->find(); f; f = selectSensorAlerts->fetch())
    {
+      // the rules are checked against the samples table, force the
+      // writer to store the samples kept by its flush policy
+
+      if (!flushed && !tsdb && writer->sync(syncTimeout) != success)
+         tell(eloAlways, "Warning: Samples not written within %d ms, checking alerts anyway", syncTimeout);
+
+      flushed = yes;
       alertMailBody = "";
       alertMailSubject = "";
 
@@ -1598,29 +2573,54 @@ int P4d::performAlertCheck(cDbRow* alertRow, time_t now, int recurse, int force)
    int range = alertRow->getIntValue("RANGEM");
    int delta = alertRow->getIntValue("DELTA");
 
+   int maxRuntime = alertRow->getIntValue("MAXRUNTIME");
+   int maxSwitches = alertRow->getIntValue("MAXSWITCHES");
+
    // lookup value facts
 
    tableValueFacts->clear();
    tableValueFacts->setValue("ADDRESS", addr);
    tableValueFacts->setValue("TYPE", type);
 
-   // lookup samples
+   // lookup samples, the one of this cycle may be dropped by the
+   // compression -> the latest one first, then the time series store
+   // if configured
+
+   int seriesId = tsdb ? na : seriesDict.seriesIdOf(addr, type, no);
+   int found = no;
+   double value = 0;
+   char key[50];
+
+   sprintf(key, "%s:%d", type, addr);
+   std::map<std::string, SampleFilter::Point>::iterator last = lastValues.find(key);
+
+   if (last != lastValues.end() && last->second.time == now)
+   {
+      found = yes;
+      value = last->second.value;
+   }
+   else if (tsdb)
+   {
+      found = tsdb->first(addr, type, now-1, now, value) == success;
+   }
+   else if (seriesId != na)
+   {
+      tableSamples->clear();
+      tableSamples->setValue("SERIESID", seriesId);
+      tableSamples->setValue("AGGREGATE", "S");
+      tableSamples->setValue("TIME", now);
 
-   tableSamples->clear();
-   tableSamples->setValue("ADDRESS", addr);
-   tableSamples->setValue("TYPE", type);
-   tableSamples->setValue("AGGREGATE", "S");
-   tableSamples->setValue("TIME", now);
+      if ((found = tableSamples->find()))
+         value = tableSamples->getFloatValue("VALUE");
+   }
 
-   if (!tableSamples->find() || !tableValueFacts->find())
+   if (!found || !tableValueFacts->find())
    {
       tell(eloAlways, "Info: Can't perform sensor check for %s/%d '%s'", type, addr, l2pTime(now).c_str());
       return 0;
    }
 
-   // data from samples and value facts
-
-   double value = tableSamples->getFloatValue("VALUE");
+   // data from value facts
 
    const char* title = tableValueFacts->getStrValue("TITLE");
    const char* unit = tableValueFacts->getStrValue("UNIT");
@@ -1655,17 +2655,48 @@ int P4d::performAlertCheck(cDbRow* alertRow, time_t now, int recurse, int force)
       time_t rangeStartAt = time(0) - range*tmeSecondsPerMinute;
       time_t rangeEndAt = rangeStartAt + interval;
 
-      tableSamples->clear();
-      tableSamples->setValue("ADDRESS", addr);
-      tableSamples->setValue("TYPE", type);
-      tableSamples->setValue("AGGREGATE", "S");
-      tableSamples->setValue("TIME", rangeStartAt);
-      rangeEnd.setValue(rangeEndAt);
+      double oldValue = 0;
+      int oldFound = no;
+
+      if (tsdb)
+      {
+         oldFound = tsdb->first(addr, type, rangeStartAt, rangeEndAt, oldValue) == success;
+      }
+      else
+      {
+         tableSamples->clear();
+         tableSamples->setValue("SERIESID", seriesId);
+         tableSamples->setValue("AGGREGATE", "S");
+         tableSamples->setValue("TIME", rangeStartAt);
+         rangeEnd.setValue(rangeEndAt);
 
-      if (selectSampleInRange->find())
+         if ((oldFound = selectSampleInRange->find()))
+            oldValue = tableSamples->getFloatValue("VALUE");
+
+         selectSampleInRange->freeResult();
+         tableSamples->reset();
+
+         // range reaching into the archive
+
+         if (!oldFound && archiveHistory)
+            oldFound = archive.first(seriesId, rangeStartAt, rangeEndAt, oldValue) == success;
+      }
+
+      // no sample stored in the range (compression, io events)
+
+      if (!oldFound)
+         oldFound = valueAt(addr, type, seriesId, rangeStartAt, oldValue) == success;
+
+      if (!oldFound && (strcmp(type, "DO") == 0 || strcmp(type, "DI") == 0))
       {
-         double oldValue = tableSamples->getFloatValue("VALUE");
+         int state;
+
+         if ((oldFound = ioLog.stateAt(addr, type, rangeStartAt, state) == success))
+            oldValue = state;
+      }
 
+      if (oldFound)
+      {
          if (force || labs(value - oldValue) > delta)
          {
             tell(eloAlways, "%d) Alert for sensor %s/0x%x , value %.2f changed more than %d in %d minutes",
@@ -1680,9 +2711,29 @@ int P4d::performAlertCheck(cDbRow* alertRow, time_t now, int recurse, int force)
             }
          }
       }
+   }
 
-      selectSampleInRange->freeResult();
-      tableSamples->reset();
+   // -------------------------------
+   // check runtime and switches of today (DI/DO)
+
+   IoLog::Day day;
+
+   if ((maxRuntime || maxSwitches) && ioLog.today(addr, type, &day) == success)
+   {
+      if (force || (maxRuntime && day.onTime > maxRuntime * tmeSecondsPerMinute)
+          || (maxSwitches && day.switches > maxSwitches))
+      {
+         tell(eloAlways, "%d) Alert for sensor %s/0x%x, runtime %d minutes / %d switches today (max %d / %d)",
+              id, type, addr, day.onTime / tmeSecondsPerMinute, day.switches, maxRuntime, maxSwitches);
+
+         // max one alert mail per maxRepeat [minutes]
+
+         if (force || !lastAlert || lastAlert < time(0)- maxRepeat * tmeSecondsPerMinute)
+         {
+            alert = 1;
+            add2AlertMail(alertRow, title, value, unit);
+         }
+      }
    }
 
    // ---------------------------
@@ -1753,93 +2804,343 @@ void P4d::addParameter2Mail(const char* name, const char* value)
 }
 
 //***************************************************************************
-// Schedule Aggregate
+// Purge Samples
+//   the rollups are maintained by the writer, here the raw samples older
+//   than archiveHistory are moved to the archive, the raw samples (and
+//   archived days) older than aggregateHistory and the rows of tiers with
+//   a history of their own are removed, as long as the time budget of a
+//   call allows. If the table is partitioned whole months are dropped,
+//   otherwise the rows are deleted in chunks. At the begin of each round
+//   the partitions of the next months are created.
 //***************************************************************************
 
-int P4d::scheduleAggregate()
+int P4d::purgeSamples()
 {
-   struct tm tm = { 0 };
-   time_t now;
+   cTimeMs budget(purgeBudget);
+   int status = done;
 
-   if (!aggregateHistory)
-      return done;
+   if (!purging)
+   {
+      if (samplesPartitioned)
+         addPartitions();
 
-   // calc today at 01:00:00
+      purging = yes;
+   }
 
-   now = time(0);
-   localtime_r(&now, &tm);
+   if (archiveHistory)
+      status = archiveSamples(&budget);
 
-   tm.tm_sec = 0;
-   tm.tm_min = 0;
-   tm.tm_hour = 1;
-   tm.tm_isdst = -1;               // force DST auto detect
+   if (aggregateHistory && status == done)
+      status = samplesPartitioned ? dropRawPartitions(&budget) : deleteRawSamples(&budget);
 
-   nextAggregateAt = mktime(&tm);
+   if (aggregateHistory && archiveHistory && status == done)
+   {
+      int count = 0;
 
-   // if in the past ... skip to next day ...
+      if (archive.purge(time(0) - aggregateHistory * tmeSecondsPerDay, count) != success)
+         status = fail;
+      else if (count)
+         tell(eloAlways, "Purged %d archived day(s) of samples", count);
+   }
 
-   if (nextAggregateAt <= time(0))
-      nextAggregateAt += tmeSecondsPerDay;
+   if (status == done)
+      status = purgeTiers(&budget);
 
-   tell(eloAlways, "Scheduled aggregation for '%s' with interval of %d minutes",
-        l2pTime(nextAggregateAt).c_str(), aggregateInterval);
+   if (status != success)           // done or failed, next round in one hour
+   {
+      nextPurgeAt = time(0) + tmeSecondsPerHour;
+      purging = no;
+   }
 
-   return success;
+   return status == fail ? fail : success;
 }
 
 //***************************************************************************
-// Aggregate
+// Archive Samples
+//   day by day, the raw samples of the days ending before archiveHistory
+//   are compressed to one chunk per series and day
 //***************************************************************************
 
-int P4d::aggregate()
+int P4d::archiveSamples(cTimeMs* budget)
 {
-   char* stmt = 0;
-   time_t history = time(0) - (aggregateHistory * tmeSecondsPerDay);
-   int aggCount = 0;
+   time_t history = SampleArchive::dayOf(time(0) - archiveHistory * tmeSecondsPerDay);
+   int status = success;
+   int days = 0;
+   int chunks = 0;
+
+   while (status == success && !budget->TimedOut() && !doShutDown())
+   {
+      int oldest = 0;
+      int count = 0;
+
+      tableSamples->countWhere("aggregate = 'S'", oldest, "min(time)");
+
+      time_t day = SampleArchive::dayOf(oldest);
+
+      if (!oldest || SampleArchive::nextDay(day) > history)
+         status = done;
+
+      else if (archive.archiveDay(day, count) != success)
+         status = fail;
 
-   asprintf(&stmt,
-            "replace into samples "
-            "  select address, type, 'A' as aggregate, "
-            "    CONCAT(DATE(time), ' ', SEC_TO_TIME((TIME_TO_SEC(time) DIV %d) * %d)) + INTERVAL %d MINUTE time, "
-            "    unix_timestamp(sysdate()) as inssp, unix_timestamp(sysdate()) as updsp, "
-            "    round(sum(value)/count(*), 2) as value, text, count(*) samples "
-            "  from "
-            "    samples "
-            "  where "
-            "    aggregate != 'A' and "
-            "    time <= from_unixtime(%ld) "
-            "  group by "
-            "    CONCAT(DATE(time), ' ', SEC_TO_TIME((TIME_TO_SEC(time) DIV %d) * %d)) + INTERVAL %d MINUTE, address, type;",
-            aggregateInterval * tmeSecondsPerMinute, aggregateInterval * tmeSecondsPerMinute, aggregateInterval,
-            history,
-            aggregateInterval * tmeSecondsPerMinute, aggregateInterval * tmeSecondsPerMinute, aggregateInterval);
+      else
+      {
+         days++;
+         chunks += count;
+      }
+   }
+
+   if (days)
+      tell(eloAlways, "Archived the samples of %d day(s) in %d chunk(s)%s", days, chunks,
+           status == success ? ", continuing with the next loop" : "");
+
+   return status;
+}
 
-   tell(eloAlways, "Starting aggregation ...");
+//***************************************************************************
+// Delete Raw Samples
+//   hour by hour, before a window is deleted the tier buckets starting
+//   in it which the writer missed (crash, samples from before the update)
+//   are computed from the raw samples. The rows of the writer are kept,
+//   it has seen all samples - of a compressed series the raw rows are a
+//   part of them only
+//***************************************************************************
+
+int P4d::deleteRawSamples(cTimeMs* budget)
+{
+   time_t history = SampleRollup::bucketStart(time(0) - aggregateHistory * tmeSecondsPerDay, purgeWindow);
+   int windows = 0;
+   int oldest = 0;
+   int status = success;
 
-   if (connection->query(aggCount, "%s", stmt) == success)
+   while (status == success && !budget->TimedOut() && !doShutDown())
    {
-      int delCount = 0;
+      tableSamples->countWhere("aggregate = 'S'", oldest, "min(time)");
 
-      tell(eloDebug, "Aggregation: [%s]", stmt);
-      free(stmt);
+      time_t from = SampleRollup::bucketStart(oldest, purgeWindow);
+      time_t to = std::min((time_t)(from + purgeWindow), history);
+
+      if (!oldest || to <= from)
+         status = done;
+
+      else if (recomputeTiers(from, to) != success ||
+               tableSamples->deleteWhere("aggregate = 'S' and time >= %ld and time < %ld",
+                                         (long)from, (long)to) != success)
+         status = fail;
+
+      else
+         windows++;
+   }
+
+   if (windows)
+      tell(eloAlways, "Purged the samples of %d hour(s)%s", windows,
+           status == success ? ", continuing with the next loop" : "");
+
+   return status;
+}
+
+//***************************************************************************
+// Drop Raw Partitions
+//   the months ending before the history, before they are dropped the tier
+//   buckets are recomputed hour by hour (see deleteRawSamples())
+//***************************************************************************
+
+int P4d::dropRawPartitions(cTimeMs* budget)
+{
+   time_t history = time(0) - aggregateHistory * tmeSecondsPerDay;
+   struct tm tm = {0};
+   int status = success;
+   int windows = 0;
+   int count = 0;
+
+   // begin of the month of the history
+
+   localtime_r(&history, &tm);
+   tm.tm_mday = 1;
+   tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+   tm.tm_isdst = -1;
+   history = mktime(&tm);
+
+   if (!recomputedUntil)
+   {
+      int oldest = 0;
+
+      tableSamples->countWhere("aggregate = 'S'", oldest, "min(time)");
+      recomputedUntil = oldest ? SampleRollup::bucketStart(oldest, purgeWindow) : history;
+   }
+
+   while (status == success && recomputedUntil < history && !budget->TimedOut() && !doShutDown())
+   {
+      time_t to = std::min((time_t)(recomputedUntil + purgeWindow), history);
+
+      if (recomputeTiers(recomputedUntil, to) != success)
+         status = fail;
+      else
+         recomputedUntil = to;
+
+      windows++;
+   }
+
+   if (status == success && recomputedUntil >= history)
+   {
+      if (tableSamples->dropPartitions("S", history, count) == fail)
+         status = fail;
+      else
+         status = done;
+   }
 
-      // Einzelmesspunkte löschen ...
+   if (windows || count)
+      tell(eloAlways, "Recomputed the rollups of %d hour(s), dropped %d month(s) of samples%s", windows, count,
+           status == success ? ", continuing with the next loop" : "");
 
-      asprintf(&stmt, "aggregate != 'A' and time <= from_unixtime(%ld)", history);
+   return status;
+}
+
+//***************************************************************************
+// Purge Tiers
+//   the rows of the tiers with a history of their own
+//***************************************************************************
+
+int P4d::purgeTiers(cTimeMs* budget)
+{
+   int rows = 0;
+   int months = 0;
+   int status = done;
+
+   for (unsigned int t = 0; t < rollupTiers.size() && status == done; t++)
+   {
+      SampleRollup::Tier* tier = &rollupTiers[t];
+      time_t before = time(0) - tier->history * tmeSecondsPerDay;
+      int affected = purgeRows;
+
+      if (!tier->history)
+         continue;
+
+      if (samplesPartitioned && isPartitionKey(tier->aggregate))
+      {
+         int count = 0;
+
+         if (tableSamples->dropPartitions(tier->aggregate, before, count) == fail)
+            status = fail;
+
+         months += count;
+         continue;
+      }
+
+      while (affected >= purgeRows && status == done)
+      {
+         if (budget->TimedOut())
+            status = success;
+
+         else if (tableSamples->deleteWhere("aggregate = '%s' and time < %ld limit %d",
+                                            tier->aggregate, (long)before, purgeRows) != success)
+            status = fail;
+
+         else
+         {
+            affected = mysql_affected_rows(connection->getMySql());
+            rows += affected;
+         }
+      }
+   }
+
+   if (rows || months)
+      tell(eloAlways, "Purged %d rollup rows and %d month(s) of rollups%s", rows, months,
+           status == success ? ", continuing with the next loop" : "");
+
+   return status;
+}
+
+//***************************************************************************
+// Add Partitions
+//   of the raw samples and the tiers with a history up to partitionsAhead
+//   months ahead. With 'all' (p4d -m) from the oldest row of the key on,
+//   otherwise from now on and only if the catch all partition is empty,
+//   the split of its rows would copy them within the main loop.
+//***************************************************************************
+
+int P4d::addPartitions(int all)
+{
+   std::vector<std::string> keys;
+   time_t until = time(0) + partitionsAhead * 31 * tmeSecondsPerDay;
+   int status = success;
+
+   keys.push_back("S");
+
+   for (unsigned int t = 0; t < rollupTiers.size(); t++)
+   {
+      if (rollupTiers[t].history)
+         keys.push_back(rollupTiers[t].aggregate);
+   }
 
-      if (tableSamples->deleteWhere(stmt, delCount) == success)
+   for (unsigned int k = 0; k < keys.size(); k++)
+   {
+      char where[100];
+      int oldest = 0;
+
+      if (!isPartitionKey(keys[k].c_str()))
+         continue;
+
+      if (!all && !tableSamples->isCatchAllEmpty(keys[k].c_str()))
       {
-         tell(eloAlways, "Aggregation with interval of %d minutes done; "
-              "Created %d aggregation rows, deleted %d sample rows",
-              aggregateInterval, aggCount, delCount);
+         tell(eloAlways, "Info: Catch all partition of '%s' in 'sampledata' holds rows, "
+              "split it to months by 'p4d -m'", keys[k].c_str());
+         continue;
       }
+
+      sprintf(where, "aggregate = '%s'", keys[k].c_str());
+
+      if (all)
+         tableSamples->countWhere(where, oldest, "min(time)");
+
+      if (tableSamples->createPartitions(keys[k].c_str(), oldest ? oldest : time(0), until) == fail)
+         status = fail;
    }
 
-   free(stmt);
+   return status;
+}
+
+int P4d::isPartitionKey(const char* key)
+{
+   cDbPartitionDef* def = tableSamples->getTableDef()->getPartition();
+
+   for (int i = 0; def && def->getKeyField() && i < def->keyCount(); i++)
+   {
+      if (strcmp(def->getKey(i), key) == 0)
+         return yes;
+   }
+
+   return no;
+}
+
+//***************************************************************************
+// Recompute Tiers
+//   the missing buckets of all tiers starting in [from, to), a bucket
+//   reaching beyond 'to' is completed from the samples behind the window
+//***************************************************************************
 
-   // schedule even in case of error!
+int P4d::recomputeTiers(time_t from, time_t to)
+{
+   for (unsigned int t = 0; t < rollupTiers.size(); t++)
+   {
+      SampleRollup::Tier* tier = &rollupTiers[t];
+      time_t rFrom = SampleRollup::bucketStart(from, tier->interval);
+      time_t rTo = SampleRollup::bucketEnd(SampleRollup::bucketStart(to - 1, tier->interval), tier->interval);
 
-   scheduleAggregate();
+      if (rFrom < from)            // starts before the window, parts of it are purged already
+         rFrom = SampleRollup::bucketEnd(rFrom, tier->interval);
+
+      if (rFrom >= rTo)
+         continue;
+
+      char* stmt = SampleRollup::recomputeStatement(tier->aggregate, tier->interval, rFrom, rTo, na, yes);
+      int status = connection->query("%s", stmt);
+
+      free(stmt);
+
+      if (status != success)
+         return fail;
+   }
 
    return success;
 }
@@ -2298,6 +3599,117 @@ int P4d::loadHtmlHeader()
    return success;
 }
 
+//***************************************************************************
+// Crawl Cache
+//   the menu tree and the value specs are fixed by the firmware of the s 3200,
+//   therefore the crawl result is keyed by the firmware version and a
+//   checksum of the stored rows ('<version>:<rows>:<checksum>')
+//***************************************************************************
+
+int P4d::getFirmware(char* version)
+{
+   Status s;
+
+   *version = 0;
+
+   if (request->getStatus(&s) != success || isEmpty(s.version))
+   {
+      tell(eloAlways, "Can't request firmware version of s 3200");
+      return fail;
+   }
+
+   strcpy(version, s.version);
+
+   return success;
+}
+
+int P4d::crawlChecksum(const char* name, int& rows, unsigned int& checksum)
+{
+   int isMenu = strcmp(name, "menuCrawl") == 0;
+   cDbStatement* select = isMenu ? selectAllMenuItems : selectAllValueFacts;
+   cDbTable* table = isMenu ? tableMenu : tableValueFacts;
+
+   rows = 0;
+   checksum = 0;
+
+   // sum of the row hashes since the selects are unordered
+
+   table->clear();
+
+   for (int f = select->find(); f; f = select->fetch())
+   {
+      char* row = 0;
+      unsigned int hash = 2166136261u;    // FNV-1a
+
+      if (isMenu)
+         asprintf(&row, "%ld:%ld:%ld:%ld:%s:%s", table->getIntValue("ADDRESS"),
+                  table->getIntValue("PARENT"), table->getIntValue("CHILD"),
+                  table->getIntValue("TYPE"), table->getStrValue("TITLE"),
+                  table->getStrValue("UNIT"));
+      else if (table->hasValue("TYPE", "VA"))
+         asprintf(&row, "%ld:%ld:%ld:%s:%s", table->getIntValue("ADDRESS"),
+                  table->getIntValue("FACTOR"), table->getIntValue("RES1"),
+                  table->getStrValue("UNIT"), table->getStrValue("TITLE"));
+      else
+         continue;
+
+      for (const char* p = row; *p; p++)
+         hash = (hash ^ (byte)*p) * 16777619u;
+
+      checksum += hash;
+      rows++;
+      free(row);
+   }
+
+   select->freeResult();
+
+   return success;
+}
+
+int P4d::isCrawlCached(const char* name, const char* firmware)
+{
+   char* stored = 0;
+   char* expected = 0;
+   int rows;
+   unsigned int checksum;
+   int cached;
+
+   if (isEmpty(firmware))
+      return no;
+
+   getConfigItem(name, stored, "");
+   crawlChecksum(name, rows, checksum);
+   asprintf(&expected, "%s:%d:%08x", firmware, rows, checksum);
+
+   cached = rows > 0 && strcmp(stored, expected) == 0;
+
+   if (!cached && !isEmpty(stored))
+      tell(eloAlways, "Stored '%s' is '%s', expected '%s'", name, stored, expected);
+
+   free(stored);
+   free(expected);
+
+   return cached;
+}
+
+int P4d::storeCrawlCache(const char* name, const char* firmware)
+{
+   char* value = 0;
+   int rows;
+   unsigned int checksum;
+   int status;
+
+   if (isEmpty(firmware))
+      return fail;
+
+   crawlChecksum(name, rows, checksum);
+   asprintf(&value, "%s:%d:%08x", firmware, rows, checksum);
+   status = setConfigItem(name, value);
+   free(value);
+
+   return status;
+}
+
 //***************************************************************************
 // Stored Parameters
 //***************************************************************************
@@ -2307,6 +3719,12 @@ int P4d::getConfigItem(const char* name, char*& value, const char* def)
    free(value);
    value = 0;
 
+   if (!dbConnected())             // database lost, we are collecting anyway
+   {
+      value = strdup(def);
+      return fail;
+   }
+
    tableConfig->clear();
    tableConfig->setValue("OWNER", "p4d");
    tableConfig->setValue("NAME", name);
@@ -2326,13 +3744,16 @@ int P4d::getConfigItem(const char* name, char*& value, const char* def)
 
 int P4d::setConfigItem(const char* name, const char* value)
 {
+   if (!dbConnected())
+      return fail;
+
    tell(eloAlways, "Storing '%s' with value '%s'", name, value);
    tableConfig->clear();
    tableConfig->setValue("OWNER", "p4d");
    tableConfig->setValue("NAME", name);
    tableConfig->setValue("VALUE", value);
 
-   return tableConfig->store();
+   return tableConfig->upsert();
 }
 
 int P4d::getConfigItem(const char* name, int& value, int def)
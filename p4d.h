@@ -13,10 +13,17 @@
 // Includes
 //***************************************************************************
 
+#include <sys/resource.h>
+
 #include "lib/db.h"
 
 #include "service.h"
 #include "p4io.h"
+#include "p4writer.h"
+#include "p4tsdb.h"
+#include "p4archive.h"
+#include "p4filter.h"
+#include "p4iolog.h"
 #include "w1.h"
 #include "lib/curl.h"
 #include "HISTORY.h"
@@ -30,10 +37,31 @@ extern char dbUser[];
 extern char dbPass[];
 
 extern char ttyDeviceSvc[];
+extern int ttyLowLatency;
+extern int ttyLatencyTimer;
+extern int ttyTimeoutFloor;
+extern int ttyTimeoutCeiling;
+extern int ttyRetries;
+extern char brokerSocket[];
+extern char brokerGroup[];
+extern char ttyDeviceCom2[];
+extern int writerQueueSize;
+extern char writerPolicy[];
+extern char writerSpool[];
+extern int writerSpoolSize;
+extern int writerWal;
+extern int writerFlushInterval;
+extern int writerFlushRows;
+extern char sampleStore[];
+extern char tsdbPath[];
 extern int interval;
 extern int stateCheckInterval;
 extern int aggregateInterval;        // aggregate interval in minutes
 extern int aggregateHistory;         // history in days
+extern char aggregateTiers[];
+extern int archiveHistory;           // days before the raw samples are archived
+extern char compressAnalog[];
+extern int ioEvents;
 extern char* confDir;
 
 //***************************************************************************
@@ -44,6 +72,35 @@ class P4d : public FroelingService
 {
    public:
 
+      enum Misc
+      {
+         syncTimeout = 5000,         // ms to wait for the writer before the alert check
+         purgeWindow = 3600,         // seconds of samples purged at once
+         purgeBudget = 1000,         // ms per call of purgeSamples()
+         purgeRows = 10000,          // rollup rows deleted at once
+         migrateWindow = 86400,      // seconds of the former samples table migrated at once
+         partitionsAhead = 3         // months
+      };
+
+      // active value fact, collected at the begin of each update cycle
+
+      struct ValueFact
+      {
+         int address;
+         string type;
+         double factor;
+         string title;
+         string unit;
+         string name;
+         string compression;       // policy, see p4filter.h
+         int com2Index;            // 'VA' in the COM2 telegram too, na if not
+         int fromCom2;             // taken from the telegram this cycle, no request
+
+         int status;               // status of the request
+         Value value;              // result for 'VA'
+         IoValue io;               // result for 'DO', 'DI' and 'AO'
+      };
+
       // object
 
       P4d();
@@ -53,6 +110,7 @@ class P4d : public FroelingService
 	   int loop();
 	   int setup();
 	   int initialize(int truncate = no);
+      int migrate();
 
       static void downF(int aSignal) { shutdown = yes; }
 
@@ -61,6 +119,9 @@ class P4d : public FroelingService
       int exit();
       int initDb();
       int exitDb();
+      int initSamplesView();
+      int migrateSamples();
+      int partitionSamples();
       int readConfiguration();
 
       int standby(int t);
@@ -68,17 +129,36 @@ class P4d : public FroelingService
       int meanwhile();
 
       int update();
+      int probeValueBatching(std::vector<ValueFact>* facts);
+      int queueRequests(std::vector<ValueFact>* facts, int batch);
+      static void requestDone(P4Queue::Job* job, void* context);
+      static void valuesDone(P4Queue::Job* job, void* context);
+      static void betweenRequests(void* context);
+      int ingestCom2(int timeout);
+      int updateCom2Facts();
+      int takeCom2Values(std::vector<ValueFact>* facts, time_t now);
+      void logCycleStatistic(struct rusage* ruStart, uint64_t startMs);
+      void logWriterStatistic();
       int updateState(Status* state);
       void scheduleTimeSyncIn(int offset = 0);
-      int scheduleAggregate();
-      int aggregate();
+      int purgeSamples();
+      int archiveSamples(cTimeMs* budget);
+      int deleteRawSamples(cTimeMs* budget);
+      int dropRawPartitions(cTimeMs* budget);
+      int purgeTiers(cTimeMs* budget);
+      int addPartitions(int all = no);
+      int isPartitionKey(const char* key);
+      int recomputeTiers(time_t from, time_t to);
 
       int updateErrors();
-      int performWebifRequests();
+      int performWebifRequests(int shortOnly = no);
+      static int isShortJob(const char* command);
       int cleanupWebifRequests();
 
       int store(time_t now, const char* type, int address, double value,
                 unsigned int factor, const char* text = 0);
+      void flushFilters();
+      int valueAt(int addr, const char* type, int seriesId, time_t t, double& value);
 
       void addParameter2Mail(const char* name, const char* value);
 
@@ -93,9 +173,9 @@ class P4d : public FroelingService
       int sendMail(const char* receiver, const char* subject, const char* body, const char* mimeType);
 
       int updateSchemaConfTable();
-      int updateValueFacts();
+      int updateValueFacts(int force = no);
       int updateTimeRangeData();
-      int initMenu();
+      int initMenu(int force = no);
       int updateScripts();
       int callScript(const char* scriptName, const char*& result);
       int hmUpdateSysVars();
@@ -104,12 +184,18 @@ class P4d : public FroelingService
       int isMailState();
       int loadHtmlHeader();
 
+      int getFirmware(char* version);
+      int crawlChecksum(const char* name, int& rows, unsigned int& checksum);
+      int isCrawlCached(const char* name, const char* firmware);
+      int storeCrawlCache(const char* name, const char* firmware);
+
       int getConfigItem(const char* name, char*& value, const char* def = "");
       int setConfigItem(const char* name, const char* value);
       int getConfigItem(const char* name, int& value, int def = na);
       int setConfigItem(const char* name, int value);
 
       int doShutDown() { return shutdown; }
+      int dbConnected() { return connection && connection->isConnected(); }
 
       // data
 
@@ -134,6 +220,7 @@ class P4d : public FroelingService
       cDbStatement* selectAllMenuItems;
       cDbStatement* selectSensorAlerts;
       cDbStatement* selectSampleInRange;
+      cDbStatement* selectSampleBefore;
       cDbStatement* selectPendingErrors;
       cDbStatement* selectMaxTime;
       cDbStatement* selectHmSysVarByAddr;
@@ -142,18 +229,36 @@ class P4d : public FroelingService
       cDbStatement* cleanupJobs;
 
       cDbValue rangeEnd;
+      SeriesDict seriesDict;
+      SampleArchive archive;
+      IoLog ioLog;                 // events and runtime of DI/DO
 
       time_t nextAt;
       time_t startedAt;
       Sem* sem;
 
       P4Request* request;
+      P4Queue* queue;
+      P4Broker* broker;
       Serial* serial;
+      SampleWriter* writer;        // writes the samples with its own connection
+      int mysqlSamples;            // samples stored by the writer (option sampleStore)
+      TsStore* tsdb;               // embedded time series store, 0 if not configured
+      std::map<std::string, SampleFilter> filters;            // compression, key 'type:address'
+      std::map<std::string, SampleFilter::Point> lastValues;  // latest sample, stored or not
+      int publishedMaxGap;         // compressMaxGap of the config table
+      P4Packet* com2;              // passive COM2 telegram, 0 if not configured
+      time_t com2At;               // time of the last complete telegram
+      time_t com2OpenAt;
+      int com2FactsChecked;
+      std::vector<Value> valueBatch;
+      std::vector<ValueFact> activeFacts;   // of the last cycle, used while the database is lost
 
       W1 w1;                       // for one wire sensors
       cCurl* curl;
 
       Status currentState;
+      int valueBatching;           // multi value requests supported (na -> not probed yet)
       string mailBody;
       string mailBodyHtml;
 
@@ -174,7 +279,12 @@ class P4d : public FroelingService
       string alertMailBody;
       string alertMailSubject;
 
-      time_t nextAggregateAt;
+      uint64_t lastJobCheckAt;     // of betweenRequests()
+      time_t nextPurgeAt;
+      int purging;                 // a round of purgeSamples() is running
+      time_t recomputedUntil;      // rollups recomputed before the samples are dropped
+      int samplesPartitioned;
+      std::vector<SampleRollup::Tier> rollupTiers;   // empty if aggregation is off
 
       //
 
@@ -0,0 +1,1341 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4emu.c
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+// S 3200 emulator
+//   provides a pty which speaks the framed COM1 service protocol,
+//   to test p4d and p4 without a boiler
+//***************************************************************************
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <iconv.h>
+#include <termios.h>
+
+#include <vector>
+#include <string>
+
+#include "lib/common.h"
+#include "service.h"
+
+//***************************************************************************
+// Class Emulator
+//***************************************************************************
+
+class Emulator : public FroelingService
+{
+   public:
+
+      enum Misc
+      {
+         sizeFrame = sizeMaxReply * 2 + TB
+      };
+
+      struct EmuValue
+      {
+         word address;
+         sword value;
+         word factor;
+         word unknown;
+         std::string unit;
+         std::string description;
+      };
+
+      struct EmuIo
+      {
+         byte type;            // cmdGetDigOut, cmdGetDigIn or cmdGetAnlOut
+         word address;
+         byte mode;
+         byte state;
+      };
+
+      struct EmuMenu
+      {
+         byte type;
+         word parent;
+         word child;
+         word address;
+         std::string unit;
+         std::string description;
+      };
+
+      struct EmuParameter
+      {
+         word address;
+         sword value;
+         sword min;
+         sword max;
+         sword def;
+         word factor;
+         byte digits;
+         std::string unit;
+      };
+
+      struct EmuError
+      {
+         word number;
+         byte info;
+         byte state;
+         time_t time;
+         std::string text;
+      };
+
+      struct EmuTimes
+      {
+         byte address;
+         byte timesFrom[4];
+         byte timesTo[4];
+      };
+
+      struct Exchange          // recorded request and its replies
+      {
+         std::vector<byte> request;
+         std::vector< std::vector<byte> > replies;
+      };
+
+      // object
+
+      Emulator();
+      ~Emulator();
+
+      int init(const char* link);
+      int exit();
+      int loop();
+
+      int readConfig(const char* file);
+      int readReplay(const char* file);
+      void setDefaults();
+
+      static void downF(int aSignal) { shutdown = yes; }
+
+      // injection
+
+      int latency;              // reply latency in ms
+      int dropRate;             // percent of replies with a dropped byte
+      int crcErrorRate;         // percent of replies with a wrong crc
+      int lossRate;             // percent of requests without reply
+      int multiValues;          // answer multi value requests
+
+   protected:
+
+      int getByte(byte& b, int tms);
+      int getDecoded(byte& b, int tms);
+      int readFrame(byte& command, std::vector<byte>& data);
+      int dispatch(byte command, std::vector<byte>& data);
+
+      int reply(byte command, std::vector<byte>& payload);
+      int send(std::vector<byte>& raw);
+      int replayRequest();
+
+      void addByte(std::vector<byte>& p, byte b)      { p.push_back(b); }
+      void addWord(std::vector<byte>& p, word w)      { p.push_back(w >> 8); p.push_back(w & 0xff); }
+      void addText(std::vector<byte>& p, const char* text, int size = na);
+      void addTimeDate(std::vector<byte>& p, time_t t, int ext);
+
+      EmuIo* findIo(byte type, word address);
+      EmuParameter* findParameter(word address);
+
+      // data
+
+      int fdMaster;
+      int fdSlave;
+      char* linkName;
+
+      byte rBuffer[1024];
+      int rCount;
+      int rPos;
+
+      std::vector<byte> rawRequest;
+
+      char version[4];
+      byte mode;
+      byte state;
+      std::string modeInfo;
+      std::string stateInfo;
+      time_t timeOffset;
+
+      std::vector<EmuValue> values;
+      std::vector<EmuIo> ios;
+      std::vector<EmuMenu> menu;
+      std::vector<EmuParameter> parameters;
+      std::vector<EmuError> errors;
+      std::vector<EmuTimes> times;
+      std::vector<Exchange> exchanges;
+
+      unsigned int valueListPos;
+      unsigned int menuPos;
+      unsigned int errorPos;
+      unsigned int timesPos;
+      unsigned int replayPos;
+
+      static int shutdown;
+};
+
+int Emulator::shutdown = no;
+
+//***************************************************************************
+// Object
+//***************************************************************************
+
+Emulator::Emulator()
+{
+   fdMaster = na;
+   fdSlave = na;
+   linkName = 0;
+   rCount = 0;
+   rPos = 0;
+
+   latency = 0;
+   dropRate = 0;
+   crcErrorRate = 0;
+   lossRate = 0;
+   multiValues = yes;
+
+   memset(version, 0, sizeof(version));
+   mode = 0;
+   state = 0;
+   timeOffset = 0;
+
+   valueListPos = 0;
+   menuPos = 0;
+   errorPos = 0;
+   timesPos = 0;
+   replayPos = 0;
+}
+
+Emulator::~Emulator()
+{
+   exit();
+}
+
+//***************************************************************************
+// Init
+//***************************************************************************
+
+int Emulator::init(const char* link)
+{
+   struct termios tio;
+   const char* name;
+
+   if ((fdMaster = posix_openpt(O_RDWR | O_NOCTTY)) < 0)
+   {
+      tell(eloAlways, "Error: Opening pty failed, errno was (%d) '%s'", errno, strerror(errno));
+      return fail;
+   }
+
+   if (grantpt(fdMaster) != 0 || unlockpt(fdMaster) != 0 || !(name = ptsname(fdMaster)))
+   {
+      tell(eloAlways, "Error: Preparing pty failed, errno was (%d) '%s'", errno, strerror(errno));
+      return fail;
+   }
+
+   // hold the slave open, otherwise we get a hangup each time the client closes it
+
+   if ((fdSlave = ::open(name, O_RDWR | O_NOCTTY)) < 0)
+   {
+      tell(eloAlways, "Error: Opening '%s' failed, errno was (%d) '%s'", name, errno, strerror(errno));
+      return fail;
+   }
+
+   tcgetattr(fdSlave, &tio);
+   cfmakeraw(&tio);
+   tcsetattr(fdSlave, TCSANOW, &tio);
+
+   if (!isEmpty(link))
+   {
+      unlink(link);
+
+      if (symlink(name, link) != 0)
+      {
+         tell(eloAlways, "Error: Creating link '%s' failed, errno was (%d) '%s'", link, errno, strerror(errno));
+         return fail;
+      }
+
+      linkName = strdup(link);
+   }
+
+   tell(eloAlways, "S 3200 emulator listening at '%s'%s%s", name,
+        linkName ? " linked to " : "", linkName ? linkName : "");
+
+   return success;
+}
+
+int Emulator::exit()
+{
+   if (linkName)
+      unlink(linkName);
+
+   free(linkName);
+   linkName = 0;
+
+   if (fdSlave >= 0)  ::close(fdSlave);
+   if (fdMaster >= 0) ::close(fdMaster);
+
+   fdSlave = fdMaster = na;
+
+   return done;
+}
+
+//***************************************************************************
+// Defaults
+//***************************************************************************
+
+void Emulator::setDefaults()
+{
+   EmuValue v;
+   EmuIo io;
+   EmuMenu m;
+   EmuParameter p;
+   EmuError e;
+   EmuTimes t;
+
+   version[0] = 0x50; version[1] = 0x04; version[2] = 0x05; version[3] = 0x03;
+   mode = 1;
+   state = 3;
+   modeInfo = "Automatik";
+   stateInfo = "Heizen";
+
+   v.unknown = 0;
+
+   v.address = 0x0000; v.value = 142; v.factor = 2;  v.unit = "°"; v.description = "Kesseltemperatur";  values.push_back(v);
+   v.address = 0x0001; v.value = 155; v.factor = 1;  v.unit = "°"; v.description = "Abgastemperatur";   values.push_back(v);
+   v.address = 0x0003; v.value = 65;  v.factor = 10; v.unit = "%"; v.description = "Restsauerstoff";    values.push_back(v);
+   v.address = 0x0004; v.value = 78;  v.factor = 2;  v.unit = "°"; v.description = "Pufferoben";        values.push_back(v);
+   v.address = 0x0005; v.value = 24;  v.factor = 2;  v.unit = "°"; v.description = "Aussentemperatur";  values.push_back(v);
+
+   io.type = cmdGetDigOut; io.address = 0x0000; io.mode = 'A'; io.state = 1; ios.push_back(io);
+   io.type = cmdGetDigOut; io.address = 0x0001; io.mode = 'A'; io.state = 0; ios.push_back(io);
+   io.type = cmdGetDigIn;  io.address = 0x0000; io.mode = 'A'; io.state = 1; ios.push_back(io);
+   io.type = cmdGetAnlOut; io.address = 0x0000; io.mode = 0xff; io.state = 55; ios.push_back(io);
+
+   m.type = mstPar;    m.parent = 0x0000; m.child = 0x0001; m.address = 0x0010; m.unit = "°"; m.description = "Kesselsolltemperatur"; menu.push_back(m);
+   m.type = mstDigOut; m.parent = 0x0000; m.child = 0x0002; m.address = 0x0000; m.unit = "";  m.description = "Heizkreispumpe 1";     menu.push_back(m);
+   m.type = mstDigOut; m.parent = 0x0000; m.child = 0x0003; m.address = 0x0001; m.unit = "";  m.description = "Heizkreispumpe 2";     menu.push_back(m);
+   m.type = mstDigIn;  m.parent = 0x0000; m.child = 0x0004; m.address = 0x0000; m.unit = "";  m.description = "Kesselthermostat";     menu.push_back(m);
+   m.type = mstAnlOut; m.parent = 0x0000; m.child = 0x0005; m.address = 0x0000; m.unit = "%"; m.description = "Saugzuggeblaese";      menu.push_back(m);
+
+   p.address = 0x0010; p.value = 75; p.min = 60; p.max = 90; p.def = 75; p.factor = 1; p.digits = 0; p.unit = "°";
+   parameters.push_back(p);
+
+   e.number = 12; e.info = 0; e.state = 1; e.time = time(0) - tmeSecondsPerDay; e.text = "Fuellstand zu gering";
+   errors.push_back(e);
+   e.state = 4; e.time = time(0) - tmeSecondsPerHour;
+   errors.push_back(e);
+
+   memset(&t, 0xff, sizeof(t));
+   t.address = 0x00; t.timesFrom[0] = 55; t.timesTo[0] = 220;
+   times.push_back(t);
+   memset(&t, 0xff, sizeof(t));
+   t.address = 0xdf;
+   times.push_back(t);
+}
+
+//***************************************************************************
+// Count Fields
+//***************************************************************************
+
+static int countFields(const char* s)
+{
+   int count = 0;
+
+   while (*s)
+   {
+      while (*s == ' ' || *s == '\t')
+         s++;
+
+      if (!*s)
+         break;
+
+      count++;
+
+      while (*s && *s != ' ' && *s != '\t')
+         s++;
+   }
+
+   return count;
+}
+
+//***************************************************************************
+// Read Config
+//   one item per line, texts are the rest of the line
+//
+//   version   <v1.v2.v3.v4>               (hex)
+//   state     <mode> <state> <mode text>;<state text>
+//   value     <addr> <value> <factor> <unit> <description>
+//   digout    <addr> <mode> <state>
+//   digin     <addr> <mode> <state>
+//   anlout    <addr> <mode> <state>
+//   menu      <type> <parent> <child> <addr> <unit> <description>
+//   parameter <addr> <value> <min> <max> <default> <factor> <digits> <unit>
+//   error     <number> <info> <state> <seconds ago> <text>
+//   times     <addr> <from>-<to> <from>-<to> <from>-<to> <from>-<to>
+//   multi     <0|1>
+//***************************************************************************
+
+int Emulator::readConfig(const char* file)
+{
+   FILE* fp;
+   char* line = 0;
+   size_t size = 0;
+   int count = 0;
+   int lineNo = 0;
+
+   if (!(fp = fopen(file, "r")))
+   {
+      tell(eloAlways, "Error: Can't open '%s', errno was (%d) '%s'", file, errno, strerror(errno));
+      return fail;
+   }
+
+   while (getline(&line, &size, fp) > 0)
+   {
+      char* p;
+      char* item;
+      char* rest = 0;
+      int fields = 0;
+
+      lineNo++;
+
+      if ((p = strchr(line, '#')))
+         *p = 0;
+
+      allTrim(line);
+
+      if (isEmpty(line))
+         continue;
+
+      if (!(item = strtok_r(line, " \t", &rest)))
+         continue;
+
+      // the fields each item needs at least
+
+      if (strcasecmp(item, "value") == 0 || strcasecmp(item, "error") == 0)
+         fields = 4;
+      else if (strcasecmp(item, "digout") == 0 || strcasecmp(item, "digin") == 0 || strcasecmp(item, "anlout") == 0)
+         fields = 3;
+      else if (strcasecmp(item, "state") == 0)
+         fields = 2;
+      else if (strcasecmp(item, "menu") == 0)
+         fields = 5;
+      else if (strcasecmp(item, "parameter") == 0)
+         fields = 8;
+      else if (strcasecmp(item, "version") == 0 || strcasecmp(item, "times") == 0 || strcasecmp(item, "multi") == 0)
+         fields = 1;
+
+      if (countFields(rest) < fields)
+      {
+         tell(eloAlways, "Warning: Ignoring malformed '%s' at line %d of '%s', expected %d fields",
+              item, lineNo, file, fields);
+         continue;
+      }
+
+      if (strcasecmp(item, "version") == 0)
+      {
+         unsigned int v[4] = { 0, 0, 0, 0 };
+
+         sscanf(rest, "%x.%x.%x.%x", &v[0], &v[1], &v[2], &v[3]);
+
+         for (int i = 0; i < 4; i++)
+            version[i] = v[i];
+      }
+      else if (strcasecmp(item, "state") == 0)
+      {
+         mode = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         state = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         lTrim(rest);
+
+         modeInfo = rest;
+         stateInfo = "";
+
+         if ((p = strchr(rest, ';')))
+         {
+            modeInfo = std::string(rest, p - rest);
+            stateInfo = p+1;
+         }
+      }
+      else if (strcasecmp(item, "value") == 0)
+      {
+         EmuValue v;
+
+         v.address = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         v.value = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         v.factor = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         v.unit = strtok_r(0, " \t", &rest);
+         v.unknown = 0;
+         lTrim(rest);
+         v.description = rest;
+
+         values.push_back(v);
+      }
+      else if (strcasecmp(item, "digout") == 0 || strcasecmp(item, "digin") == 0 || strcasecmp(item, "anlout") == 0)
+      {
+         EmuIo io;
+
+         io.type = strcasecmp(item, "digout") == 0 ? cmdGetDigOut :
+            strcasecmp(item, "digin") == 0 ? cmdGetDigIn : cmdGetAnlOut;
+
+         io.address = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         p = strtok_r(0, " \t", &rest);
+         io.mode = isdigit(*p) ? strtol(p, 0, 0) : *p;
+         io.state = strtol(strtok_r(0, " \t", &rest), 0, 0);
+
+         ios.push_back(io);
+      }
+      else if (strcasecmp(item, "menu") == 0)
+      {
+         EmuMenu m;
+
+         m.type = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         m.parent = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         m.child = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         m.address = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         m.unit = strtok_r(0, " \t", &rest);
+         lTrim(rest);
+         m.description = rest;
+
+         if (m.unit == "-")
+            m.unit = "";
+
+         menu.push_back(m);
+      }
+      else if (strcasecmp(item, "parameter") == 0)
+      {
+         EmuParameter par;
+
+         par.address = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         par.value = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         par.min = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         par.max = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         par.def = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         par.factor = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         par.digits = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         par.unit = strtok_r(0, " \t", &rest);
+
+         parameters.push_back(par);
+      }
+      else if (strcasecmp(item, "error") == 0)
+      {
+         EmuError e;
+
+         e.number = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         e.info = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         e.state = strtol(strtok_r(0, " \t", &rest), 0, 0);
+         e.time = time(0) - strtol(strtok_r(0, " \t", &rest), 0, 0);
+         lTrim(rest);
+         e.text = rest;
+
+         errors.push_back(e);
+      }
+      else if (strcasecmp(item, "times") == 0)
+      {
+         EmuTimes t;
+
+         memset(&t, 0xff, sizeof(t));
+         t.address = strtol(strtok_r(0, " \t", &rest), 0, 0);
+
+         for (int n = 0; n < 4 && (p = strtok_r(0, " \t", &rest)); n++)
+         {
+            int hF, mF, hT, mT;
+
+            if (sscanf(p, "%d:%d-%d:%d", &hF, &mF, &hT, &mT) == 4)
+            {
+               t.timesFrom[n] = hF*10 + mF/10;
+               t.timesTo[n] = hT*10 + mT/10;
+            }
+         }
+
+         times.push_back(t);
+      }
+      else if (strcasecmp(item, "multi") == 0)
+      {
+         multiValues = atoi(rest);
+      }
+      else
+      {
+         tell(eloAlways, "Warning: Ignoring unexpected item '%s' in '%s'", item, file);
+         continue;
+      }
+
+      count++;
+   }
+
+   free(line);
+   fclose(fp);
+
+   tell(eloAlways, "Read %d items from '%s'", count, file);
+
+   return success;
+}
+
+//***************************************************************************
+// Read Replay
+//   parse the '-> ' and '<- ' frame dumps of a p4d/p4 log (log level 2)
+//***************************************************************************
+
+int Emulator::readReplay(const char* file)
+{
+   FILE* fp;
+   char* line = 0;
+   size_t size = 0;
+
+   if (!(fp = fopen(file, "r")))
+   {
+      tell(eloAlways, "Error: Can't open '%s', errno was (%d) '%s'", file, errno, strerror(errno));
+      return fail;
+   }
+
+   while (getline(&line, &size, fp) > 0)
+   {
+      std::vector<byte> frame;
+      char* p;
+      int out;
+
+      if ((p = strstr(line, "-> ")))
+         out = yes;
+      else if ((p = strstr(line, "<- ")))
+         out = no;
+      else
+         continue;
+
+      // hex bytes up to the ascii dump
+
+      for (p += 3; isxdigit(p[0]) && isxdigit(p[1]) && p[2] == ' '; p += 3)
+         frame.push_back(strtol(std::string(p, 2).c_str(), 0, 16));
+
+      if (frame.size() < sizeof(Header))
+         continue;
+
+      if (out)
+      {
+         Exchange ex;
+
+         ex.request = frame;
+         exchanges.push_back(ex);
+      }
+      else if (exchanges.size())
+      {
+         exchanges.back().replies.push_back(frame);
+      }
+   }
+
+   free(line);
+   fclose(fp);
+
+   tell(eloAlways, "Read %d recorded requests from '%s'", (int)exchanges.size(), file);
+
+   return exchanges.size() ? success : fail;
+}
+
+//***************************************************************************
+// Get Byte
+//***************************************************************************
+
+int Emulator::getByte(byte& b, int tms)
+{
+   if (rPos >= rCount)
+   {
+      struct pollfd fds;
+      int res;
+
+      fds.fd = fdMaster;
+      fds.events = POLLIN;
+
+      if ((res = poll(&fds, 1, tms)) < 0 && errno != EINTR)
+         return fail;
+
+      if (res <= 0)
+         return wrnTimeout;
+
+      if ((rCount = ::read(fdMaster, rBuffer, sizeof(rBuffer))) <= 0)
+      {
+         rCount = 0;
+         usleep(10000);
+         return wrnTimeout;
+      }
+
+      rPos = 0;
+   }
+
+   b = rBuffer[rPos++];
+   rawRequest.push_back(b);
+
+   return success;
+}
+
+int Emulator::getDecoded(byte& b, int tms)
+{
+   byte b1;
+
+   if (getByte(b, tms) != success)
+      return fail;
+
+   if (b == 0x02 || b == 0x2b)
+   {
+      if (getByte(b1, tms) != success || b1 != 0x00)
+         return fail;
+   }
+   else if (b == 0xfe)
+   {
+      if (getByte(b1, tms) != success)
+         return fail;
+
+      if (b1 == 0x12)      b = 0x11;
+      else if (b1 == 0x14) b = 0x13;
+      else if (b1 == 0x00) b = 0xfe;
+      else return fail;
+   }
+
+   return success;
+}
+
+//***************************************************************************
+// Read Frame
+//***************************************************************************
+
+int Emulator::readFrame(byte& command, std::vector<byte>& data)
+{
+   byte b = 0;
+   byte sh, sl;
+   byte frameCrc;
+   byte tmp[sizeFrame];
+   int size;
+   int status;
+
+   rawRequest.clear();
+   data.clear();
+
+   // hunt for the frame start 0x02 0xfd
+
+   while (true)
+   {
+      if ((status = getByte(b, 500)) != success)
+         return status;
+
+      if (b != 0x02)
+         continue;
+
+      if (getByte(b, 100) != success)
+         return fail;
+
+      if (b == 0xfd)
+         break;
+   }
+
+   rawRequest.clear();
+   rawRequest.push_back(0x02);
+   rawRequest.push_back(0xfd);
+
+   if (getDecoded(sh, 100) != success || getDecoded(sl, 100) != success || getDecoded(command, 100) != success)
+      return fail;
+
+   size = sh << 8 | sl;
+
+   if (size < sizeCrc || size > sizeDataMax + sizeCrc)
+   {
+      tell(eloAlways, "Got frame with invalid size %d", size);
+      return fail;
+   }
+
+   for (int i = 0; i < size - sizeCrc; i++)
+   {
+      if (getDecoded(b, 100) != success)
+         return fail;
+
+      data.push_back(b);
+   }
+
+   if (getDecoded(frameCrc, 100) != success)
+      return fail;
+
+   // check crc
+
+   tmp[0] = 0x02; tmp[1] = 0xfd; tmp[2] = sh; tmp[3] = sl; tmp[4] = command;
+   memcpy(tmp+5, &data[0], data.size());
+
+   if (crc(tmp, 5 + data.size()) != frameCrc)
+   {
+      tell(eloAlways, "Got frame 0x%2.2x with invalid crc", command);
+      return fail;
+   }
+
+   return success;
+}
+
+//***************************************************************************
+// Loop
+//***************************************************************************
+
+int Emulator::loop()
+{
+   byte command;
+   std::vector<byte> data;
+
+   while (!shutdown)
+   {
+      int status = readFrame(command, data);
+
+      if (status == wrnTimeout)
+         continue;
+
+      if (status != success)
+      {
+         tell(eloDetail, "Discarding %d bytes", (int)rawRequest.size());
+         continue;
+      }
+
+      if (lossRate && rand() % 100 < lossRate)
+      {
+         tell(eloAlways, "Injecting loss of reply to 0x%2.2x", command);
+         continue;
+      }
+
+      if (latency)
+         usleep(latency * 1000);
+
+      if (exchanges.size())
+         replayRequest();
+      else
+         dispatch(command, data);
+   }
+
+   return done;
+}
+
+//***************************************************************************
+// Replay Request
+//   send the recorded replies of the next matching request, exact matches
+//   first, then the next request with the same command
+//***************************************************************************
+
+int Emulator::replayRequest()
+{
+   unsigned int count = exchanges.size();
+   int match = na;
+
+   for (unsigned int i = 0; i < count && match == na; i++)
+   {
+      unsigned int n = (replayPos + i) % count;
+
+      if (exchanges[n].request == rawRequest)
+         match = n;
+   }
+
+   for (unsigned int i = 0; i < count && match == na; i++)
+   {
+      unsigned int n = (replayPos + i) % count;
+
+      if (exchanges[n].request[posSize+sizeSize] == rawRequest[posSize+sizeSize])
+         match = n;
+   }
+
+   if (match == na)
+   {
+      tell(eloAlways, "No recorded reply for command 0x%2.2x", rawRequest[posSize+sizeSize]);
+      return fail;
+   }
+
+   replayPos = (match + 1) % count;
+
+   for (unsigned int r = 0; r < exchanges[match].replies.size(); r++)
+   {
+      std::vector<byte> raw = exchanges[match].replies[r];
+      send(raw);
+   }
+
+   return success;
+}
+
+//***************************************************************************
+// Dispatch
+//***************************************************************************
+
+int Emulator::dispatch(byte command, std::vector<byte>& data)
+{
+   std::vector<byte> p;
+
+   tell(eloDetail, "Got command 0x%2.2x with %d data bytes", command, (int)data.size());
+
+   switch (command)
+   {
+      case cmdCheck:
+      {
+         p = data;
+         break;
+      }
+
+      case cmdGetValue:
+      {
+         unsigned int count = multiValues ? data.size() / sizeAddress : 1;
+
+         for (unsigned int i = 0; i < count && i*sizeAddress+1 < data.size(); i++)
+         {
+            word addr = data[i*sizeAddress] << 8 | data[i*sizeAddress+1];
+            sword value = 0;
+
+            for (unsigned int n = 0; n < values.size(); n++)
+               if (values[n].address == addr)
+                  value = values[n].value;
+
+            addWord(p, value);
+         }
+
+         break;
+      }
+
+      case cmdGetValueListFirst:
+      case cmdGetValueListNext:
+      {
+         if (command == cmdGetValueListFirst)
+            valueListPos = 0;
+
+         if (valueListPos >= values.size())
+         {
+            addByte(p, 0);
+            break;
+         }
+
+         EmuValue* v = &values[valueListPos++];
+
+         addByte(p, 1);
+         addWord(p, v->factor);
+         addWord(p, v->unknown);
+         addText(p, v->unit.c_str(), 2);
+         addWord(p, v->address);
+         addText(p, v->description.c_str());
+         addByte(p, 0);
+
+         break;
+      }
+
+      case cmdGetMenuListFirst:
+      case cmdGetMenuListNext:
+      {
+         if (command == cmdGetMenuListFirst)
+            menuPos = 0;
+
+         if (menuPos >= menu.size())
+         {
+            addByte(p, 0);
+            break;
+         }
+
+         EmuMenu* m = &menu[menuPos++];
+
+         addByte(p, 1);
+         addByte(p, m->type);
+         addByte(p, 0);                    // unknown1
+         addWord(p, m->parent);
+         addWord(p, m->child);
+
+         for (int i = 0; i < 18; i++)      // spare
+            addByte(p, 0);
+
+         addWord(p, m->address);
+         addWord(p, 0);                    // unknown2
+         addText(p, m->description.c_str());
+         addByte(p, 0);
+
+         break;
+      }
+
+      case cmdGetVersion:
+      {
+         for (int i = 0; i < 4; i++)
+            addByte(p, version[i]);
+
+         addTimeDate(p, time(0) + timeOffset, yes);
+
+         break;
+      }
+
+      case cmdGetState:
+      {
+         std::string info = modeInfo + ";" + stateInfo;
+
+         addByte(p, mode);
+         addByte(p, state);
+         addText(p, info.c_str());
+
+         break;
+      }
+
+      case cmdSetDateTime:
+      {
+         struct tm tm = {0};
+
+         if (data.size() >= 7)
+         {
+            tm.tm_sec = data[0];
+            tm.tm_min = data[1];
+            tm.tm_hour = data[2];
+            tm.tm_mday = data[3];
+            tm.tm_mon = data[4] - 1;
+            tm.tm_year = data[6] + 100;
+            tm.tm_isdst = -1;
+
+            timeOffset = mktime(&tm) - time(0);
+            tell(eloAlways, "Time set, offset now %ld seconds", timeOffset);
+         }
+
+         addByte(p, 0);
+
+         break;
+      }
+
+      case cmdGetDigOut:
+      case cmdGetDigIn:
+      case cmdGetAnlOut:
+      {
+         EmuIo* io = data.size() >= 2 ? findIo(command, data[0] << 8 | data[1]) : 0;
+
+         addByte(p, io ? io->mode : 0);
+         addByte(p, io ? io->state : 0);
+
+         break;
+      }
+
+      case cmdGetErrorFirst:
+      case cmdGetErrorNext:
+      {
+         if (command == cmdGetErrorFirst)
+            errorPos = 0;
+
+         if (errorPos >= errors.size())
+         {
+            addByte(p, 0);
+            break;
+         }
+
+         EmuError* e = &errors[errorPos++];
+
+         addByte(p, 1);
+         addWord(p, e->number);
+         addByte(p, e->info);
+         addByte(p, e->state);
+         addTimeDate(p, e->time, no);
+         addText(p, e->text.c_str());
+
+         break;
+      }
+
+      case cmdGetTimesFirst:
+      case cmdGetTimesNext:
+      {
+         if (command == cmdGetTimesFirst)
+            timesPos = 0;
+
+         if (!times.size())
+            break;
+
+         EmuTimes* t = &times[min(timesPos++, (unsigned int)times.size()-1)];
+
+         addWord(p, 0x0100);
+         addByte(p, t->address);
+
+         for (int n = 0; n < 4; n++)
+         {
+            addByte(p, t->timesFrom[n]);
+            addByte(p, t->timesTo[n]);
+         }
+
+         break;
+      }
+
+      case cmdSetTimes:
+      {
+         if (data.size() < 10)
+            break;
+
+         for (unsigned int i = 0; i < times.size(); i++)
+         {
+            if (times[i].address == data[1])
+            {
+               for (int n = 0; n < 4; n++)
+               {
+                  times[i].timesFrom[n] = data[2+2*n];
+                  times[i].timesTo[n] = data[3+2*n];
+               }
+            }
+         }
+
+         addByte(p, 0);
+         p.insert(p.end(), data.begin(), data.end());
+
+         break;
+      }
+
+      case cmdGetParameter:
+      {
+         EmuParameter* par = data.size() >= 2 ? findParameter(data[0] << 8 | data[1]) : 0;
+
+         if (!par)
+            break;
+
+         addByte(p, 0);
+         addWord(p, par->address);
+         addText(p, par->unit.c_str(), 1);
+         addByte(p, par->digits);
+         addWord(p, par->factor);
+         addWord(p, par->value * par->factor);
+         addWord(p, par->min * par->factor);
+         addWord(p, par->max * par->factor);
+         addWord(p, par->def * par->factor);
+         addWord(p, 0);
+         addByte(p, 0);
+
+         break;
+      }
+
+      case cmdSetParameter:
+      {
+         EmuParameter* par = data.size() >= 4 ? findParameter(data[0] << 8 | data[1]) : 0;
+
+         if (!par)
+            break;
+
+         par->value = (sword)(data[2] << 8 | data[3]) / (par->factor ? par->factor : 1);
+
+         // the s 3200 confirms twice
+
+         addWord(p, par->address);
+         addWord(p, par->value);
+         reply(command, p);
+
+         break;
+      }
+
+      default:
+      {
+         tell(eloAlways, "Command 0x%2.2x not emulated, sending empty reply", command);
+         break;
+      }
+   }
+
+   return reply(command, p);
+}
+
+//***************************************************************************
+// Reply
+//***************************************************************************
+
+int Emulator::reply(byte command, std::vector<byte>& payload)
+{
+   std::vector<byte> frame;
+   std::vector<byte> raw;
+   word size = payload.size() + sizeCrc;
+
+   frame.push_back(0x02);
+   frame.push_back(0xfd);
+   frame.push_back(size >> 8);
+   frame.push_back(size & 0xff);
+   frame.push_back(command);
+   frame.insert(frame.end(), payload.begin(), payload.end());
+   frame.push_back(crc(&frame[0], frame.size()));
+
+   if (crcErrorRate && rand() % 100 < crcErrorRate)
+   {
+      tell(eloAlways, "Injecting crc error");
+      frame.back() ^= 0x55;
+   }
+
+   // mask all bytes behind the id
+
+   raw.push_back(0x02);
+   raw.push_back(0xfd);
+
+   for (unsigned int i = sizeId; i < frame.size(); i++)
+   {
+      switch (frame[i])
+      {
+         case 0x02: raw.push_back(0x02); raw.push_back(0x00); break;
+         case 0x2b: raw.push_back(0x2b); raw.push_back(0x00); break;
+         case 0xfe: raw.push_back(0xfe); raw.push_back(0x00); break;
+         case 0x11: raw.push_back(0xfe); raw.push_back(0x12); break;
+         case 0x13: raw.push_back(0xfe); raw.push_back(0x14); break;
+         default:   raw.push_back(frame[i]);
+      }
+   }
+
+   return send(raw);
+}
+
+int Emulator::send(std::vector<byte>& raw)
+{
+   if (dropRate && rand() % 100 < dropRate)
+   {
+      int pos = rand() % raw.size();
+
+      tell(eloAlways, "Injecting drop of byte %d", pos);
+      raw.erase(raw.begin() + pos);
+   }
+
+   if (::write(fdMaster, &raw[0], raw.size()) != (int)raw.size())
+   {
+      tell(eloAlways, "Error: Write failed, errno was (%d) '%s'", errno, strerror(errno));
+      return fail;
+   }
+
+   return success;
+}
+
+//***************************************************************************
+// Add Text
+//   texts are send in ISO8859-1 like the s 3200 does
+//***************************************************************************
+
+void Emulator::addText(std::vector<byte>& p, const char* text, int size)
+{
+   char out[500+TB];
+   char* in = (char*)text;
+   char* to = out;
+   size_t inLen = strlen(text);
+   size_t outLen = 500;
+   iconv_t cd = iconv_open("ISO8859-1", "UTF-8");
+
+   if (cd == (iconv_t)-1 || iconv(cd, &in, &inLen, &to, &outLen) == (size_t)-1)
+   {
+      strcpy(out, text);
+      to = out + strlen(out);
+   }
+
+   if (cd != (iconv_t)-1)
+      iconv_close(cd);
+
+   int len = to - out;
+
+   for (int i = 0; size == na ? i < len : i < size; i++)
+      p.push_back(i < len ? out[i] : 0);
+}
+
+void Emulator::addTimeDate(std::vector<byte>& p, time_t t, int ext)
+{
+   struct tm tm = {0};
+
+   localtime_r(&t, &tm);
+
+   addByte(p, tm.tm_sec);
+   addByte(p, tm.tm_min);
+   addByte(p, tm.tm_hour);
+   addByte(p, tm.tm_mday);
+   addByte(p, tm.tm_mon + 1);
+
+   if (ext)
+      addByte(p, tm.tm_wday);
+
+   addByte(p, tm.tm_year - 100);
+}
+
+//***************************************************************************
+// Find
+//***************************************************************************
+
+Emulator::EmuIo* Emulator::findIo(byte type, word address)
+{
+   for (unsigned int i = 0; i < ios.size(); i++)
+      if (ios[i].type == type && ios[i].address == address)
+         return &ios[i];
+
+   return 0;
+}
+
+Emulator::EmuParameter* Emulator::findParameter(word address)
+{
+   for (unsigned int i = 0; i < parameters.size(); i++)
+      if (parameters[i].address == address)
+         return &parameters[i];
+
+   return 0;
+}
+
+//***************************************************************************
+// Usage
+//***************************************************************************
+
+void showUsage(const char* bin)
+{
+   printf("Usage: %s [-c <config>] [-r <replay-log>] [-L <link>] [-t <ms>] [-d <%%>] [-e <%%>] [-n <%%>] [-l <log-level>]\n", bin);
+   printf("\n");
+   printf("  options:\n");
+   printf("     -c <config>      values, menu, errors, ... to serve (default: built-in set)\n");
+   printf("     -r <replay-log>  replay the frames recorded in a p4d/p4 log (log level 2)\n");
+   printf("     -L <link>        create symlink <link> to the pty (e.g. /tmp/ttyS3200)\n");
+   printf("     -t <ms>          reply latency in ms\n");
+   printf("     -d <percent>     drop one byte of <percent> of the replies\n");
+   printf("     -e <percent>     send a wrong crc with <percent> of the replies\n");
+   printf("     -n <percent>     don't answer <percent> of the requests\n");
+   printf("     -s <seed>        seed of the random generator\n");
+   printf("     -l <log-level>   set log level\n");
+}
+
+//***************************************************************************
+// Main
+//***************************************************************************
+
+int main(int argc, char** argv)
+{
+   Emulator emu;
+   const char* config = 0;
+   const char* replay = 0;
+   const char* link = 0;
+
+   loglevel = 1;
+   logstdout = yes;
+   logstamp = yes;
+
+   if (argc > 1 && (argv[1][0] == '?' || (strcmp(argv[1], "-h") == 0) || (strcmp(argv[1], "--help") == 0)))
+   {
+      showUsage(argv[0]);
+      return 0;
+   }
+
+   for (int i = 1; argv[i]; i++)
+   {
+      if (argv[i][0] != '-' || strlen(argv[i]) != 2)
+         continue;
+
+      switch (argv[i][1])
+      {
+         case 'c': if (argv[i+1]) config = argv[++i];                    break;
+         case 'r': if (argv[i+1]) replay = argv[++i];                    break;
+         case 'L': if (argv[i+1]) link = argv[++i];                      break;
+         case 't': if (argv[i+1]) emu.latency = atoi(argv[++i]);         break;
+         case 'd': if (argv[i+1]) emu.dropRate = atoi(argv[++i]);        break;
+         case 'e': if (argv[i+1]) emu.crcErrorRate = atoi(argv[++i]);    break;
+         case 'n': if (argv[i+1]) emu.lossRate = atoi(argv[++i]);        break;
+         case 's': if (argv[i+1]) srand(atoi(argv[++i]));                break;
+         case 'l': if (argv[i+1]) loglevel = atoi(argv[++i]);            break;
+      }
+   }
+
+   if (config)
+   {
+      if (emu.readConfig(config) != success)
+         return 1;
+   }
+   else
+      emu.setDefaults();
+
+   if (replay && emu.readReplay(replay) != success)
+      return 1;
+
+   if (emu.init(link) != success)
+      return 1;
+
+   ::signal(SIGINT, Emulator::downF);
+   ::signal(SIGTERM, Emulator::downF);
+
+   emu.loop();
+   emu.exit();
+
+   tell(eloAlways, "shutdown");
+
+   return 0;
+}
@@ -0,0 +1,243 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4filter.c
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "p4filter.h"
+
+//***************************************************************************
+// Sample Filter
+//***************************************************************************
+
+SampleFilter::SampleFilter()
+{
+   policy.kind = fkNone;
+   policy.limit = 0;
+   policy.maxGap = 0;
+
+   hasArchived = no;
+   hasHeld = no;
+   slopeLow = -HUGE_VAL;
+   slopeHigh = HUGE_VAL;
+}
+
+//***************************************************************************
+// Set Policy
+//***************************************************************************
+
+void SampleFilter::setPolicy(const Policy* aPolicy)
+{
+   if (aPolicy->kind == policy.kind && aPolicy->limit == policy.limit && aPolicy->maxGap == policy.maxGap)
+      return;
+
+   // the held sample is lost, at most one per change of the policy
+
+   policy = *aPolicy;
+   hasArchived = no;
+   hasHeld = no;
+}
+
+//***************************************************************************
+// Parse Policy
+//   'kind[:limit[:gap]]', see p4filter.h
+//***************************************************************************
+
+int SampleFilter::parsePolicy(const char* spec, Policy* policy)
+{
+   char* end = 0;
+
+   policy->kind = fkNone;
+   policy->limit = 0;
+   policy->maxGap = defaultGap;
+
+   if (isEmpty(spec) || toupper(*spec) == 'N')
+      return success;
+
+   switch (toupper(*spec))
+   {
+      case 'D': policy->kind = fkDeadband;     break;
+      case 'R': policy->kind = fkRelDeadband;  break;
+      case 'S': policy->kind = fkSwingingDoor; break;
+      default:
+      {
+         tell(eloAlways, "Error: Unknown compression '%s', ignoring", spec);
+         return fail;
+      }
+   }
+
+   if (spec[1] != ':' || (policy->limit = strtod(spec + 2, &end)) < 0 || end == spec + 2)
+   {
+      tell(eloAlways, "Error: Missing limit in compression '%s', ignoring", spec);
+      policy->kind = fkNone;
+      return fail;
+   }
+
+   if (*end == ':' && atoi(end + 1) > 0)
+      policy->maxGap = atoi(end + 1);
+
+   return success;
+}
+
+//***************************************************************************
+// Archive
+//***************************************************************************
+
+void SampleFilter::archive(const Point* p, std::vector<Point>* store)
+{
+   store->push_back(*p);
+   archived = *p;
+   hasArchived = yes;
+   hasHeld = no;
+   slopeLow = -HUGE_VAL;
+   slopeHigh = HUGE_VAL;
+}
+
+//***************************************************************************
+// On Door
+//   the value of the sample moved onto the line from the last stored one
+//   with the slope closest to it inside the door, the samples in between
+//   stay within the limit of this line (the sample itself too)
+//***************************************************************************
+
+double SampleFilter::onDoor(const Point* p)
+{
+   double dt = p->time - archived.time;
+   double slope = std::min(std::max((p->value - archived.value) / dt, slopeLow), slopeHigh);
+
+   return archived.value + slope * dt;
+}
+
+//***************************************************************************
+// Add
+//***************************************************************************
+
+void SampleFilter::add(time_t time, double value, std::vector<Point>* store)
+{
+   Point p = { time, value };
+
+   if (policy.kind == fkNone || !hasArchived || time <= archived.time)
+   {
+      archive(&p, store);
+      return;
+   }
+
+   if (policy.kind == fkSwingingDoor)
+   {
+      double dt = time - archived.time;
+      double low = std::max(slopeLow, (value - policy.limit - archived.value) / dt);
+      double high = std::min(slopeHigh, (value + policy.limit - archived.value) / dt);
+
+      if (low > high && hasHeld)
+      {
+         // the door closed, the held sample ends the segment, the
+         // next one starts there
+
+         held.value = onDoor(&held);
+         archive(&held, store);
+
+         dt = time - archived.time;
+         low = (value - policy.limit - archived.value) / dt;
+         high = (value + policy.limit - archived.value) / dt;
+      }
+
+      slopeLow = low;
+      slopeHigh = high;
+
+      if (time - archived.time >= policy.maxGap)
+      {
+         p.value = onDoor(&p);
+         archive(&p, store);
+         return;
+      }
+   }
+   else
+   {
+      double band = policy.kind == fkDeadband ? policy.limit : fabs(archived.value) * policy.limit / 100;
+
+      if (fabs(value - archived.value) > band)
+      {
+         // end of the flat part
+
+         if (hasHeld)
+            store->push_back(held);
+
+         archive(&p, store);
+         return;
+      }
+
+      if (time - archived.time >= policy.maxGap)
+      {
+         archive(&p, store);
+         return;
+      }
+   }
+
+   held = p;
+   hasHeld = yes;
+}
+
+//***************************************************************************
+// Flush
+//***************************************************************************
+
+void SampleFilter::flush(std::vector<Point>* store)
+{
+   if (hasHeld)
+      archive(&held, store);
+}
+
+//***************************************************************************
+// Interpolate
+//***************************************************************************
+
+double SampleFilter::interpolate(const Point* a, const Point* b, time_t t)
+{
+   if (b->time <= a->time || t <= a->time)
+      return a->value;
+
+   if (t >= b->time)
+      return b->value;
+
+   return a->value + (b->value - a->value) * (t - a->time) / (double)(b->time - a->time);
+}
+
+//***************************************************************************
+// Reconstruct
+//   the values at from, from + step, ... to from the stored samples
+//   (sorted by time), before the first and behind the last the value is
+//   held
+//***************************************************************************
+
+void SampleFilter::reconstruct(const std::vector<Point>* stored, time_t from, time_t to, int step,
+                               std::vector<Point>* grid)
+{
+   unsigned int i = 0;
+
+   if (stored->empty() || step <= 0)
+      return;
+
+   for (time_t t = from; t <= to; t += step)
+   {
+      Point p;
+
+      while (i + 1 < stored->size() && (*stored)[i+1].time <= t)
+         i++;
+
+      p.time = t;
+
+      if (i + 1 < stored->size())
+         p.value = interpolate(&(*stored)[i], &(*stored)[i+1], t);
+      else
+         p.value = (*stored)[i].value;
+
+      grid->push_back(p);
+   }
+}
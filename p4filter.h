@@ -0,0 +1,93 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4filter.h
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+
+#ifndef _P4FILTER_H_
+#define _P4FILTER_H_
+
+#include <time.h>
+
+#include <vector>
+
+#include "lib/common.h"
+
+//***************************************************************************
+// Sample Filter
+//   compression of the samples of one series at ingest, a sample is
+//   stored only if the stored ones don't describe it within the limit
+//   of the policy:
+//     D:<limit>[:<gap>]   deadband, absolute change to the last stored value
+//     R:<limit>[:<gap>]   deadband, change in percent of the last stored value
+//     S:<limit>[:<gap>]   swinging door, max error of the linear interpolation
+//     N                   none, every sample is stored
+//   <gap> is the heartbeat, at least one sample per gap seconds is stored
+//   (default 3600). The last sample not stored yet is held back, it is
+//   stored as soon as a later one shows the end of the flat part or of
+//   the door, so the linear interpolation between the stored samples
+//   (see reconstruct()) stays within the limit - for the deadband within
+//   twice the limit.
+//***************************************************************************
+
+class SampleFilter
+{
+   public:
+
+      enum Kind
+      {
+         fkNone,
+         fkDeadband,
+         fkRelDeadband,
+         fkSwingingDoor
+      };
+
+      enum Misc
+      {
+         defaultGap = 3600
+      };
+
+      struct Policy
+      {
+         int kind;
+         double limit;
+         int maxGap;               // seconds
+      };
+
+      struct Point
+      {
+         time_t time;
+         double value;
+      };
+
+      SampleFilter();
+
+      void setPolicy(const Policy* aPolicy);       // the state is reset if it changed
+      const Policy* getPolicy()      { return &policy; }
+
+      void add(time_t time, double value, std::vector<Point>* store);   // adds the samples to store
+      void flush(std::vector<Point>* store);       // the held sample, at shutdown
+
+      static int parsePolicy(const char* spec, Policy* policy);
+      static double interpolate(const Point* a, const Point* b, time_t t);
+      static void reconstruct(const std::vector<Point>* stored, time_t from, time_t to, int step,
+                              std::vector<Point>* grid);
+
+   protected:
+
+      void archive(const Point* p, std::vector<Point>* store);
+      double onDoor(const Point* p);
+
+      Policy policy;
+      int hasArchived;
+      int hasHeld;
+      Point archived;              // last stored sample
+      Point held;                  // last sample, not stored yet
+      double slopeLow;             // of the swinging door, per second
+      double slopeHigh;
+};
+
+//***************************************************************************
+#endif // _P4FILTER_H_
@@ -0,0 +1,118 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4frame.h
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+// Reply layouts of the s 3200
+//   a reply is described once as a list of fields, the decoder and the
+//   size of the frame are generated at compile time, e.g.
+//
+//     typedef FrameLayout<FWord, FByte, FSkip<1> > Reply;
+//     status = readFields<Reply>(address, value);
+//***************************************************************************
+
+#ifndef _P4FRAME_H_
+#define _P4FRAME_H_
+
+#include <time.h>
+
+#include "lib/common.h"
+
+//***************************************************************************
+// Field Types
+//***************************************************************************
+
+time_t toTime(const byte* p);             // s, m, h
+time_t toDate(const byte* p, int ext);    // d, m, [dow,] y
+int toText(const byte* p, int size, char*& s);
+
+struct FByte
+{
+   enum { size = 1, values = 1 };
+
+   template <class T> static void get(const byte* p, T& v) { v = p[0]; }
+};
+
+struct FWord                          // big endian, word or sword
+{
+   enum { size = 2, values = 1 };
+
+   template <class T> static void get(const byte* p, T& v) { v = (T)((p[0] << 8) | p[1]); }
+};
+
+struct FTimeDate                      // time followed by date
+{
+   enum { size = 6, values = 1 };
+
+   static void get(const byte* p, time_t& t) { t = toDate(p+3, no) + toTime(p); }
+};
+
+struct FTimeDateExt                   // time followed by date with day of week
+{
+   enum { size = 7, values = 1 };
+
+   static void get(const byte* p, time_t& t) { t = toDate(p+3, yes) + toTime(p); }
+};
+
+template <int N> struct FText         // fixed size text, converted to UTF-8
+{
+   enum { size = N, values = 1 };
+
+   static void get(const byte* p, char*& s) { toText(p, N, s); }
+};
+
+template <int N> struct FSkip         // unknown or unused bytes (like the crc)
+{
+   enum { size = N, values = 0 };
+};
+
+//***************************************************************************
+// Frame Layout
+//***************************************************************************
+
+template <class... Fields> struct FrameLayout;
+
+template <> struct FrameLayout<>
+{
+   enum { size = 0, values = 0 };
+
+   static void get(const byte* p) {}
+};
+
+template <class Field, class... Fields> struct FrameLayout<Field, Fields...>
+{
+   typedef FrameLayout<Fields...> Next;
+
+   enum
+   {
+      size = Field::size + Next::size,
+      values = Field::values + Next::values
+   };
+
+   template <class T, class... Ts> static void get(const byte* p, T& v, Ts&... vs)
+   {
+      Field::get(p, v);
+      Next::get(p + Field::size, vs...);
+   }
+};
+
+template <int N, class... Fields> struct FrameLayout<FSkip<N>, Fields...>
+{
+   typedef FrameLayout<Fields...> Next;
+
+   enum
+   {
+      size = N + Next::size,
+      values = Next::values
+   };
+
+   template <class... Ts> static void get(const byte* p, Ts&... vs)
+   {
+      Next::get(p + N, vs...);
+   }
+};
+
+//***************************************************************************
+#endif // _P4FRAME_H_
@@ -10,6 +10,23 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <grp.h>
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#endif
 
 #include "p4io.h"
 
@@ -23,25 +40,39 @@ P4Packet::P4Packet()
 {
    *buffer = 0;
    pBuf = 0;
+   rPos = 0;
+   inPacket = no;
+   skipped = 0;
 }
 
 //***************************************************************************
 // Set
+//   the controller sends ISO8859-1, converted in place to UTF-8
+//   (without iconv, the telegram arrives once a second)
 //***************************************************************************
 
 int P4Packet::set(const char* data)
 {
+   char* out = buffer;
+   char* end = buffer + sizeof(buffer) - TB;
+
    if (!data || strlen(data) > sizeMaxPacket)
       return fail;
 
-   // convert charset ...
-
-   if (toUTF8(buffer, sizeMaxPacket, data) != success)
+   for (const byte* in = (const byte*)data; *in && out < end - 1; in++)
    {
-      tell(eloAlways, "Warning: Converting of charset failed");
-      strcpy(buffer, data);
+      if (*in < 0x80)
+      {
+         *out++ = *in;
+      }
+      else
+      {
+         *out++ = 0xc0 | (*in >> 6);
+         *out++ = 0x80 | (*in & 0x3f);
+      }
    }
 
+   *out = 0;
    pBuf = buffer;
 
    return evaluate();
@@ -56,7 +87,7 @@ int P4Packet::evaluate()
    Parameter p;
    int status;
 
-   parameters.clear();
+   parameters.clear();           // keeps the capacity, no allocation for the next packets
 
    //
 
@@ -76,6 +107,18 @@ int P4Packet::evaluate()
    return status == wrnEndOfPacket ? success : status;
 }
 
+//***************************************************************************
+// Copy Token
+//***************************************************************************
+
+static void copyToken(char* dest, int size, const char* token)
+{
+   int len = strnlen(token, size);
+
+   memcpy(dest, token, len);
+   dest[len] = 0;
+}
+
 //***************************************************************************
 // Get Item
 // Format Example: 'Kesseltemp.;0161;2;2;°C;'
@@ -83,12 +126,16 @@ int P4Packet::evaluate()
 
 int P4Packet::getItem(Parameter* p)
 {
-   char lastToken[sizeMaxPacket+TB];
+   const char* token;
 
    if (!p)
       return fail;
 
-   memset(p, 0, sizeof(Parameter));
+   p->index = 0;
+   p->value = 0;
+   *p->name = 0;
+   *p->text = 0;
+   *p->unit = 0;
 
    // get parameter parts
 
@@ -96,24 +143,30 @@ int P4Packet::getItem(Parameter* p)
    {
       int status;
 
-      if ((status = getToken(lastToken)) != success)
+      if ((status = getToken(token)) != success)
          return status;
 
-      // tell(eloAlways, "got token '%s'", lastToken);
-
       switch (part)
       {
-         case partName:  sprintf(p->name, "%.*s", sizeName, lastToken);  break;
-         case partIndex: p->index = atoi(lastToken);                     break;
-         case partDiv:   p->value /= atoi(lastToken);                    break;
-         case partUnit:  sprintf(p->unit, "%.*s", sizeUnit, lastToken);  break;
+         case partName:  copyToken(p->name, sizeName, token);  break;
+         case partIndex: p->index = atoi(token);               break;
+         case partUnit:  copyToken(p->unit, sizeUnit, token);  break;
 
-         case partValue:
-            p->value = atof(lastToken);
-            sprintf(p->text, "%.*s", sizeText, lastToken);
+         case partDiv:
+         {
+            int div = atoi(token);
+
+            if (div)
+               p->value /= div;
 
             break;
+         }
+
+         case partValue:
+            p->value = atof(token);
+            copyToken(p->text, sizeText, token);
 
+            break;
       }
    }
 
@@ -121,8 +174,8 @@ int P4Packet::getItem(Parameter* p)
 
    if (p->index == parState)
    {
-      sprintf(p->name, "%.*s", sizeName, "Status");
-      sprintf(p->text, "%.*s", sizeText, toTitle((int)p->value));
+      copyToken(p->name, sizeName, "Status");
+      copyToken(p->text, sizeText, toTitle((int)p->value));
    }
 
    // drop text for all except parameters 'state' and 'error'
@@ -134,12 +187,13 @@ int P4Packet::getItem(Parameter* p)
 }
 
 //***************************************************************************
-// Get Value
+// Get Token
+//   terminates the token in place, 'token' points into the buffer
 //***************************************************************************
 
-int P4Packet::getToken(char* token)
+int P4Packet::getToken(const char*& token)
 {
-   char* t = token;
+   char* end;
 
    if (isEmpty(pBuf))
       return wrnEndOfPacket;
@@ -151,52 +205,53 @@ int P4Packet::getToken(char* token)
 
    // get next token ..
 
-   while (*pBuf && *pBuf != delimiter)
-      *t++ = *pBuf++;
-
-   *t = 0;
-
-   if (*pBuf != delimiter)
+   if (!(end = strchr(pBuf, delimiter)))
    {
       tell(eloAlways, "Error: Missing delimiter at (%p/%p) [%s] [%s]",
            pBuf, buffer, pBuf, buffer);
       return fail;
    }
 
-   pBuf++;
+   *end = 0;
+   token = pBuf;
+   pBuf = end + 1;
 
    return success;
 }
 
 //***************************************************************************
 // Read Packet
+//   collects the bytes of one packet enclosed by 'seqStart' and 'seqEnd',
+//   a partial packet is kept until the next call. With a timeout of 0 only
+//   the already received bytes are processed.
 //***************************************************************************
 
-int P4Packet::readPacket(const char*& packet)
+int P4Packet::readPacket(const char*& packet, int timeout)
 {
+   uint64_t deadline = cTimeMs::Now() + timeout;
    byte b = 0;
-   int pos = 0;
-   long startAt = time(0);
-   int foundStart = no;
-   int skipped = 0;
-   int looks = 0;
-
-   // read one data packet ended by 'seqEnd'
 
-   while (pos < sizeMaxPacket && time(0) < startAt + readTimeout)
+   while (true)
    {
-      if (look(b) != success)
+      uint64_t now = cTimeMs::Now();
+      int status = look(b, now < deadline ? deadline - now : 0);
+
+      if (status == Serial::wrnTimeout)
       {
-         looks++;
-         usleep(100000);         // take a breath
-         continue;
+         if (timeout)
+            tell(eloAlways, "Timeout of %d ms with %d bytes while reading packet", timeout, rPos);
+
+         return Serial::wrnTimeout;
       }
 
-      if (!foundStart)
-      {
-         foundStart = (b == seqStart);
+      if (status != success)
+         return fail;
 
-         if (!foundStart)
+      if (!inPacket)
+      {
+         if ((inPacket = (b == seqStart)))
+            rPos = 0;
+         else
             skipped++;
 
          continue;
@@ -205,27 +260,26 @@ int P4Packet::readPacket(const char*& packet)
       if (b == seqEnd)
          break;
 
-      rbuffer[pos++] = b;
-   }
-
-   // check ..
-
-   if (b != seqEnd)
-   {
-      tell(eloAlways, "Timeout of %ld seconds after %d reads and %d bytes while reading packet",
-           time(0)-startAt, looks, pos);
+      if (rPos >= sizeMaxPacket)
+      {
+         tell(eloAlways, "Packet exceeds %d bytes, dropping it", sizeMaxPacket);
+         inPacket = no;
+         continue;
+      }
 
-      return fail;
+      rbuffer[rPos++] = b;
    }
 
-   tell(eloDebug, "Debug: Detected eop, read (%d) bytes", pos);
+   tell(eloDebug, "Debug: Detected eop, read (%d) bytes", rPos);
 
    if (skipped)
-      tell(eloDetail, "Info: Skipped (%d) bytes waste in front", pos);
+      tell(eloDetail, "Info: Skipped (%d) bytes waste in front", skipped);
 
    // terminate buffer
 
-   rbuffer[pos] = 0;
+   rbuffer[rPos] = 0;
+   inPacket = no;
+   skipped = 0;
    packet = rbuffer;
 
    return success;
@@ -235,21 +289,24 @@ int P4Packet::readPacket(const char*& packet)
 // Read
 //***************************************************************************
 
-int P4Packet::read()
+int P4Packet::read(int timeout)
 {
 #ifndef __TEST
 
+   if (timeout == na)
+      timeout = readTimeout * 1000;
+
    if (isOpen())
    {
       int status;
       const char* line;
 
-      if ((status = readPacket(line)) != success)
+      if ((status = readPacket(line, timeout)) != success)
          return status;
 
       tell(eloDebug, "Read line [%s]", line);
 
-      return set(line);
+      return set(line) == success ? success : (int)wrnCorrupt;
    }
 
 #else
@@ -294,781 +351,908 @@ int P4Packet::read()
 
 
 //***************************************************************************
-// Class P4 Request
-//***************************************************************************
-//***************************************************************************
-// Prepare Request
+// Class Link Statistic
 //***************************************************************************
 
-int P4Request::prepareRequest()
-{
-   byte tmp[sizeMaxRequest+TB];
-   int sizeNetto = 0;
-   byte* p;
-
-   sizeBufferContent = 0;
-   sizeDecodedContent = 0;
+const unsigned int LinkStatistic::histogramLimits[histogramSize] =
+   { 5, 10, 20, 50, 100, 200, 500, 1000, 2000, UINT_MAX };
 
-   if (addressCount)
-      header.size = htons((addressCount * sizeAddress) + sizeCrc);
-   else if (byteCount)
-      header.size = htons(byteCount + sizeCrc);
-   else if (!isEmpty(text))
-      header.size = htons(strlen(text) + sizeCrc);
-   else
-      header.size = htons(sizeCrc);
-
-   // add header
+void LinkStatistic::addRoundTrip(byte command, unsigned int ms, int sample)
+{
+   Command* c = &commands[command];
+   int b = 0;
 
-   memcpy(tmp+sizeNetto, &header, sizeof(Header));
-   sizeNetto += sizeof(Header);
+   while (ms > histogramLimits[b])
+      b++;
 
-   // add text, bytes or addresses, a combination is not implemented (needed?)
+   c->histogram[b]++;
+   c->sumMs += ms;
+   c->maxMs = max(c->maxMs, ms);
 
-   if (addressCount)
-   {
-      // add addresses
+   // update the estimate, but not with round trips of retried
+   // requests, they are ambiguous (Karn's algorithm)
 
-      memcpy(tmp+sizeNetto, addresses, addressCount*sizeAddress);
-      sizeNetto += addressCount*sizeAddress;
-   }
-   else if (byteCount)
-   {
-      // add bytes
+   if (!sample)
+      return;
 
-      memcpy(tmp+sizeNetto, bytes, byteCount);
-      sizeNetto += byteCount;
-   }
-   else if (!isEmpty(text))
+   if (!c->samples++)
    {
-      // add text without TB
-
-      memcpy(tmp+sizeNetto, text, strlen(text));
-      sizeNetto += strlen(text);
+      c->srtt = ms;
+      c->rttvar = ms / 2.0;
    }
-
-   // add crc
-
-   tmp[sizeNetto] = crc(tmp, sizeNetto);
-   sizeNetto++;
-
-   // convert (mask) all bytes behind id
-
-   sizeBufferContent = sizeNetto;
-
-   memcpy(buffer, &header.id, sizeId);
-   p = buffer + sizeId;
-
-   for (int i = posSize; i < sizeNetto; i++)
+   else
    {
-      switch (tmp[i])
-      {
-         case 0x02: *p++ = tmp[i]; *p++ = 0;    sizeBufferContent++; break; // 02 -> 02 00
-         case 0x2b: *p++ = tmp[i]; *p++ = 0;    sizeBufferContent++; break; // 2B -> 2B 00
-         case 0xfe: *p++ = tmp[i]; *p++ = 0;    sizeBufferContent++; break; // FE -> FE 00
-
-         case 0x11: *p++ = 0xfe;   *p++ = 0x12; sizeBufferContent++; break; // 11 -> FE 12
-         case 0x13: *p++ = 0xfe;   *p++ = 0x14; sizeBufferContent++; break; // 13 -> FE 14
-
-         default: *p++ = tmp[i];
-      }
+      c->rttvar = 0.75 * c->rttvar + 0.25 * fabs(c->srtt - ms);
+      c->srtt = 0.875 * c->srtt + 0.125 * ms;
    }
 
-   return sizeBufferContent;
+   c->backoff = 0;
 }
 
 //***************************************************************************
-// Read Byte
+// Attach
+//   the segment is created by p4d, others just attach (create = no).
+//   A segment of another size (left by a former version) is removed and
+//   created again, the readers check the version of the layout
 //***************************************************************************
 
-int P4Request::readByte(byte& v, int decode, int tms)
+LinkStatistic* LinkStatistic::attach(int create)
 {
-   byte b;
-   byte b1;
-   int status;
+   int id;
+   void* p;
+   struct shmid_ds ds;
 
-   if ((status = s->look(b, tms)) != success)
-      return status == Serial::wrnTimeout ? (int)wrnTimeout : fail;
+   if (create && (id = shmget(shmKey, 0, 0)) != -1
+       && shmctl(id, IPC_STAT, &ds) == 0 && ds.shm_segsz != sizeof(LinkStatistic))
+   {
+      tell(eloAlways, "Shared memory of another version (%ld bytes instead of %ld), creating it again",
+           (long)ds.shm_segsz, (long)sizeof(LinkStatistic));
 
-   buffer[sizeBufferContent++] = b;
+      if (shmctl(id, IPC_RMID, 0) != 0)
+         tell(eloAlways, "Error: Can't remove shared memory, errno (%d) '%s'", errno, strerror(errno));
+   }
 
-   if (!decode)
+   if ((id = shmget(shmKey, sizeof(LinkStatistic), create ? 0644 | IPC_CREAT : 0)) == -1)
    {
-      v = b;
-      decoded[sizeDecodedContent++] = v;
+      if (!create && errno == EINVAL)
+         tell(eloAlways, "Error: Shared memory of another version, restart p4d");
+      else if (create || errno != ENOENT)
+         tell(eloAlways, "Error: Can't get shared memory, errno (%d) '%s'", errno, strerror(errno));
 
-      return success;
+      return 0;
    }
 
-   // decode ...
-
-   if (b != 0x02 && b != 0x2b && b != 0x0fe)
+   if ((p = shmat(id, 0, create ? 0 : SHM_RDONLY)) == (void*)-1)
    {
-      v = b;
+      tell(eloAlways, "Error: Can't attach shared memory, errno (%d) '%s'", errno, strerror(errno));
+      return 0;
    }
-   else if (b == 0x02 || b == 0x2b)
-   {
-      if ((status = s->look(b1, tms)) != success || b1 != 0x00)
-         return status == Serial::wrnTimeout ? (int)wrnTimeout : fail;
 
-      buffer[sizeBufferContent++] = b1;
+   LinkStatistic* statistic = (LinkStatistic*)p;
 
-      v = b;
-   }
-   else if (b == 0x0fe)
+   if (!create && (statistic->version != layoutVersion || statistic->size != (int)sizeof(LinkStatistic)))
    {
-      if ((status = s->look(b1, tms)) != success)
-         return status == Serial::wrnTimeout ? (int)wrnTimeout : fail;
-
-      buffer[sizeBufferContent++] = b1;
-
-      if (b1 == 0x12)
-         v = 0x11;
-      else if (b1 == 0x14)
-         v = 0x13;
-      else if (b1 == 0x00)
-         v = 0x0fe;
-      else
-         return fail;
+      tell(eloAlways, "Error: Shared memory of another version, restart p4d");
+      shmdt(p);
+      return 0;
    }
-   else
-      return fail;
 
-   decoded[sizeDecodedContent++] = v;
+   return statistic;
+}
 
-   return success;
+void LinkStatistic::detach(LinkStatistic* statistic)
+{
+   if (statistic)
+      shmdt(statistic);
 }
 
 //***************************************************************************
-// Read Word
+// Show
 //***************************************************************************
 
-int P4Request::readWord(word& v, int decode, int tms)
+void LinkStatistic::show()
 {
-   byte b1;
-   byte b2;
-   int status;
+   char line[500];
+   char since[50];
+   struct tm tim = {0};
 
-   if ((status = readByte(b1, decode, tms)) != success)
-      return status;
+   localtime_r(&this->since, &tim);
+   strftime(since, sizeof(since), "%d.%m.%Y %H:%M:%S", &tim);
 
-   if ((status = readByte(b2, decode, tms)) != success)
-      return status;
+   tell(eloAlways, "Link statistic since %s; reopens %lu, resyncs %lu, skipped bytes %lu",
+        since, reopens, resyncs, skippedBytes);
 
-   v = (b1 << 8) | b2;
+   sprintf(line, "%-16s %8s %8s %6s %5s %5s %5s %9s %9s %6s %5s %6s %5s |", "command", "requests",
+           "replies", "tmout", "retry", "crc", "skip", "out", "in", "mask%", "avg", "max", "rto");
 
-   return success;
-}
+   for (int b = 0; b < histogramSize-1; b++)
+      sprintf(line+strlen(line), " <=%-4u", histogramLimits[b]);
 
-int P4Request::readWord(sword& v, int decode, int tms)
-{
-   byte b1;
-   byte b2;
-   int status;
+   sprintf(line+strlen(line), " >%-5u", histogramLimits[histogramSize-2]);
+   tell(eloAlways, "%s", line);
 
-   if ((status = readByte(b1, decode, tms)) != success)
-      return status;
+   for (int cmd = 0; cmd < 256; cmd++)
+   {
+      Command* c = &commands[cmd];
 
-   if ((status = readByte(b2, decode, tms)) != success)
-      return status;
+      if (!c->requests)
+         continue;
 
-   v = (signed short)(b1 << 8) | b2;
+      sprintf(line, "%-16s %8lu %8lu %6lu %5lu %5lu %5lu %9lu %9lu %6.1f %5lu %6u %5.0f |",
+              FroelingService::toCommandName(cmd), c->requests, c->replies,
+              c->timeouts, c->retries, c->crcErrors, c->skippedFrames, c->bytesOut, c->bytesIn,
+              c->bytesOut + c->bytesIn ? 100.0 * c->bytesMasked / (c->bytesOut + c->bytesIn) : 0.0,
+              c->replies ? (unsigned long)(c->sumMs / c->replies) : 0, c->maxMs,
+              c->srtt + 4 * c->rttvar);
 
-   return success;
+      for (int b = 0; b < histogramSize; b++)
+         sprintf(line+strlen(line), " %-6lu", c->histogram[b]);
+
+      tell(eloAlways, "%s", line);
+   }
 }
+
 //***************************************************************************
-// Read Time
+// Summary
+//   short form for the web interface
 //***************************************************************************
 
-int P4Request::readTime(time_t& t)
+void LinkStatistic::summary(char* buf, int size)
 {
-   byte s, m, h;
+   unsigned long requests = 0, replies = 0, timeouts = 0, crcErrors = 0;
+   uint64_t sumMs = 0;
 
-   if (readByte(s) != success)
-      return fail;
+   for (int cmd = 0; cmd < 256; cmd++)
+   {
+      requests += commands[cmd].requests;
+      replies += commands[cmd].replies;
+      timeouts += commands[cmd].timeouts;
+      crcErrors += commands[cmd].crcErrors;
+      sumMs += commands[cmd].sumMs;
+   }
 
-   if (readByte(m) != success)
-      return fail;
+   snprintf(buf, size, "%lu requests, %lu ms avg, %lu timeouts, %lu crc errors, %lu reopens",
+            requests, replies ? (unsigned long)(sumMs / replies) : 0, timeouts, crcErrors, reopens);
+}
 
-   if (readByte(h) != success)
-      return fail;
+//***************************************************************************
+// Class P4 Request
+//***************************************************************************
+//***************************************************************************
+// Reply Layouts
+//   the fields behind the header, 'more' bytes of list replies and
+//   variable texts are read separately
+//***************************************************************************
 
-   t = s + tmeSecondsPerMinute*m + tmeSecondsPerHour*h;
+typedef FrameLayout<FByte, FSkip<Fs::sizeCrc> > AckReply;                   // result
+typedef FrameLayout<FByte, FByte> StateReply;                               // mode, state, text
+typedef FrameLayout<FByte, FByte, FByte, FByte, FTimeDateExt> VersionReply; // version, time
+typedef FrameLayout<FWord, FSkip<Fs::sizeCrc> > ValueReply;                 // value
+typedef FrameLayout<FByte, FByte, FSkip<Fs::sizeCrc> > IoReply;             // mode, state
+typedef FrameLayout<FWord, FWord, FSkip<Fs::sizeCrc> > SetParameterReply;   // address, value
+typedef FrameLayout<FWord, FByte, FByte, FTimeDate> ErrorReply;             // number, info, state, time, text
+typedef FrameLayout<FWord, FWord, FText<2>, FWord> ValueSpecReply;          // factor, unknown, unit, address, text
+typedef FrameLayout<FSkip<1>, FSkip<Fs::sizeCrc> > TextEnd;                 // termination byte, crc
 
-   return success;
-}
+typedef FrameLayout<FSkip<1>,                    // what ever
+                    FWord, FText<1>, FByte,      // address, unit, decimal digits
+                    FWord, FWord,                // factor, current value
+                    FWord, FWord, FWord,         // min, max, default value
+                    FSkip<3>,                    // what ever
+                    FSkip<Fs::sizeCrc> > ParameterReply;
+
+typedef FrameLayout<FByte, FByte, FWord, FWord,  // type, unknown1, parent, child
+                    FSkip<18>,                   // unknown
+                    FWord, FWord> MenuItemReply; // address, unknown2, text
+
+typedef FrameLayout<FSkip<2>, FByte,             // what ever (always 01 00 ?), address (here only a byte!!)
+                    FByte, FByte, FByte, FByte,  // from/to of the 4 ranges
+                    FByte, FByte, FByte, FByte,
+                    FSkip<Fs::sizeCrc> > GetTimesReply;
+
+typedef FrameLayout<FSkip<1>, FWord,             // always 00 ?, address
+                    FByte, FByte, FByte, FByte,  // from/to of the 4 ranges
+                    FByte, FByte, FByte, FByte,
+                    FSkip<Fs::sizeCrc> > SetTimesReply;
 
 //***************************************************************************
-// Read Date
+// Share Statistic
 //***************************************************************************
 
-int P4Request::readDate(time_t& t)
+int P4Request::shareStatistic(int share)
 {
-   byte d, m, y;
-   struct tm tm;
+   if (statistic != &localStatistic)
+   {
+      LinkStatistic::detach(statistic);
+      statistic = &localStatistic;
+   }
 
-   if (readByte(d) != success)
-      return fail;
+   if (!share)
+      return success;
 
-   if (readByte(m) != success)
-      return fail;
+   LinkStatistic* shared = LinkStatistic::attach(yes);
 
-   if (readByte(y) != success)
+   if (!shared)
       return fail;
 
-   memset(&tm, 0, sizeof(tm));
-
-   tm.tm_mday = d;
-   tm.tm_mon = m - 1;
-   tm.tm_year = y + 100;
-   tm.tm_isdst = -1;               // force DST auto detect
-
-   t = mktime(&tm);
+   statistic = shared;
+   statistic->clear();
 
    return success;
 }
 
 //***************************************************************************
-// Read Date
+// Scan Mask
+//   position of the first byte which is masked on the line (0x02, 0x2b
+//   and 0xfe start a masked sequence) or 'size' if there is none,
+//   checks 16 bytes at once where SSE2 or NEON is available
 //***************************************************************************
 
-int P4Request::readDateExt(time_t& t)
+int P4Request::scanMask(const byte* p, int size)
 {
-   byte d, m, y, dow;
-   struct tm tm;
-
-   if (readByte(d) != success)
-      return fail;
-
-   if (readByte(m) != success)
-      return fail;
-
-   if (readByte(dow) != success)  // day of week
-      return fail;
+   int i = 0;
 
-   if (readByte(y) != success)
-      return fail;
+#if defined(__SSE2__)
 
-   memset(&tm, 0, sizeof(tm));
+   const __m128i c02 = _mm_set1_epi8(0x02);
+   const __m128i c2b = _mm_set1_epi8(0x2b);
+   const __m128i cfe = _mm_set1_epi8((char)0xfe);
 
-   tm.tm_mday = d;
-   tm.tm_mon = m - 1;
-   tm.tm_year = y + 100;
-   tm.tm_isdst = -1;               // force DST auto detect
+   for (; i + 16 <= size; i += 16)
+   {
+      __m128i v = _mm_loadu_si128((const __m128i*)(p+i));
+      __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, c02), _mm_cmpeq_epi8(v, c2b)),
+                               _mm_cmpeq_epi8(v, cfe));
+      int bits = _mm_movemask_epi8(m);
 
-   t = mktime(&tm);
+      if (bits)
+         return i + __builtin_ctz(bits);
+   }
 
-   return success;
-}
+#elif defined(__ARM_NEON)
 
-//***************************************************************************
-// Read Time-Date
-//***************************************************************************
+   const uint8x16_t c02 = vdupq_n_u8(0x02);
+   const uint8x16_t c2b = vdupq_n_u8(0x2b);
+   const uint8x16_t cfe = vdupq_n_u8(0xfe);
 
-int P4Request::readTimeDate(time_t& t)
-{
-   time_t ti, dt;
+   for (; i + 16 <= size; i += 16)
+   {
+      uint8x16_t v = vld1q_u8(p+i);
+      uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v, c02), vceqq_u8(v, c2b)), vceqq_u8(v, cfe));
+      uint64x2_t m64 = vreinterpretq_u64_u8(m);
 
-   if (readTime(ti) != success)    // first the time !
-      return fail;
+      if (vgetq_lane_u64(m64, 0) | vgetq_lane_u64(m64, 1))
+         break;                      // the scalar loop below locates it
+   }
 
-   if (readDate(dt) != success)    // second the date!
-      return fail;
+#endif
 
-   t = dt + ti;
+   for (; i < size; i++)
+      if (p[i] == 0x02 || p[i] == 0x2b || p[i] == 0xfe)
+         return i;
 
-   return success;
+   return size;
 }
 
 //***************************************************************************
-// Read Time-Date Ext
+// Mask
+//   02 -> 02 00, 2B -> 2B 00, FE -> FE 00, 11 -> FE 12, 13 -> FE 14
+//   returns the size of the masked data
 //***************************************************************************
 
-int P4Request::readTimeDateExt(time_t& t)
+int P4Request::mask(const byte* in, int size, byte* out)
 {
-   time_t ti, dt;
+   byte* p = out;
 
-   if (readTime(ti) != success)       // first the time !
-      return fail;
+   for (int i = 0; i < size; i++)
+   {
+      switch (in[i])
+      {
+         case 0x02: *p++ = in[i]; *p++ = 0;    break; // 02 -> 02 00
+         case 0x2b: *p++ = in[i]; *p++ = 0;    break; // 2B -> 2B 00
+         case 0xfe: *p++ = in[i]; *p++ = 0;    break; // FE -> FE 00
 
-   if (readDateExt(dt) != success)    // second the date!
-      return fail;
+         case 0x11: *p++ = 0xfe;  *p++ = 0x12; break; // 11 -> FE 12
+         case 0x13: *p++ = 0xfe;  *p++ = 0x14; break; // 13 -> FE 14
 
-   t = dt + ti;
+         default: *p++ = in[i];
+      }
+   }
 
-   return success;
+   return p - out;
 }
 
 //***************************************************************************
-// Read Text
+// Unmask
+//   decode up to 'max' bytes of 'in' to 'out', unmasked runs are copied
+//   as a whole. Returns the number of consumed bytes of 'in' (a masked
+//   sequence cut at the end is left over) or fail on a invalid sequence
 //***************************************************************************
 
-int P4Request::readText(char*& s, int size)
+int P4Request::unmask(const byte* in, int size, byte* out, int max, int& produced)
 {
-   byte b;
-   int i;
-   int p = 0;
-   char* tmp = (char*)malloc(size+1);
+   int i = 0;
 
-   s = 0;
+   produced = 0;
 
-   for (i = 0; i < size; i++)
+   while (produced < max && i < size)
    {
-      if (readByte(b) != success)
+      int span = min(size - i, max - produced);
+      int n = 0;
+
+      // short runs (dense masking) are cheaper to copy bytewise
+
+      while (n < span && n < 8 && in[i+n] != 0x02 && in[i+n] != 0x2b && in[i+n] != 0xfe)
       {
-         free(tmp);
+         out[produced+n] = in[i+n];
+         n++;
+      }
 
-         return fail;
+      if (n == 8)
+      {
+         n += scanMask(in+i+n, span-n);
+         memcpy(out+produced+8, in+i+8, n-8);
       }
 
-      if (b)
-         tmp[p++] = b;
-   }
+      i += n;
+      produced += n;
 
-   tmp[p] = 0;
-   s = (char*)malloc(2*size);
+      if (n == span || i + 1 >= size)
+         break;
 
-   if (toUTF8(s, 2*size, tmp) != success)
-   {
-      tell(eloDetail, "Warning: Converting of charset failed [%s]", tmp);
-      strcpy(s, tmp);
-   }
+      byte b = in[i];
+      byte b1 = in[i+1];
 
-   free(tmp);
+      if (b == 0x02 || b == 0x2b)
+      {
+         if (b1 != 0x00)
+            return fail;
 
-   return success;
+         out[produced++] = b;
+      }
+      else if (b1 == 0x12)
+         out[produced++] = 0x11;
+      else if (b1 == 0x14)
+         out[produced++] = 0x13;
+      else if (b1 == 0x00)
+         out[produced++] = 0xfe;
+      else
+         return fail;
+
+      i += 2;
+   }
+
+   return i;
 }
 
 //***************************************************************************
-// Read Text
+// Prepare Request
 //***************************************************************************
 
-int P4Request::check()
+int P4Request::prepareRequest()
 {
-   RequestClean clean(this);
+   if (addressCount)
+      header.size = htons((addressCount * sizeAddress) + sizeCrc);
+   else if (byteCount)
+      header.size = htons(byteCount + sizeCrc);
+   else if (!isEmpty(text))
+      header.size = htons(strlen(text) + sizeCrc);
+   else
+      header.size = htons(sizeCrc);
 
-   int status = fail;
-   char* s = 0;
-   byte b;
+   // build the plain frame in 'decoded', starting with the header
 
-   clear();
-   addText("Tescht ;-)");
-   request(cmdCheck);
+   memcpy(decoded, &header, sizeof(Header));
+   sizeDecodedContent = sizeof(Header);
 
-   if (readHeader() == success)
+   // add text, bytes or addresses, a combination is not implemented (needed?)
+
+   if (addressCount)
    {
-      if (readText(s, getHeader()->size - sizeCrc) == success)
-         if (readByte(b) == success)   // read crc ..
-            status = success;
+      // add addresses
 
-      free(s);
+      memcpy(decoded+sizeDecodedContent, addresses, addressCount*sizeAddress);
+      sizeDecodedContent += addressCount*sizeAddress;
+   }
+   else if (byteCount)
+   {
+      // add bytes
 
-      show("<- ");
+      memcpy(decoded+sizeDecodedContent, bytes, byteCount);
+      sizeDecodedContent += byteCount;
+   }
+   else if (!isEmpty(text))
+   {
+      // add text without TB
+
+      memcpy(decoded+sizeDecodedContent, text, strlen(text));
+      sizeDecodedContent += strlen(text);
    }
 
-   return status;
+   // add crc
+
+   decoded[sizeDecodedContent] = crc(decoded, sizeDecodedContent);
+   sizeDecodedContent++;
+
+   // mask all bytes behind id
+
+   memcpy(buffer, decoded, sizeId);
+   sizeBufferContent = sizeId + mask(decoded+sizeId, sizeDecodedContent-sizeId, buffer+sizeId);
+
+   return sizeBufferContent;
 }
 
 //***************************************************************************
-// Get State
+// Read Header
+//   read the reply frame of the last request, frames with a other command
+//   (e.g. late replies of a timed out request) are skipped by their size.
+//   Only the first reply of a exchange waits the adaptive timeout, further
+//   frames of it the ceiling
 //***************************************************************************
 
-int P4Request::getStatus(Status* s)
+int P4Request::readHeader(int tms)
 {
-   RequestClean clean(this);
+   int status;
+   LinkStatistic::Command* c = &statistic->commands[expected];
 
-   int status = success;
-   byte b;
+   for (int skipped = 0; skipped < 3; )
+   {
+      int timeout = tms ? tms : framesReceived ? timeoutCeiling : timeoutFor(expected);
 
-   // cmdGetState
+      if ((status = readFrame(timeout)) != success)
+      {
+         if (status == wrnTimeout)
+         {
+            c->timeouts++;
 
-   clear();
-   request(cmdGetState);
-   s->clear();
-
-   if ((status += readHeader()) == success)
-   {
-      char* text = 0;
-      char* p;
-      int size = getHeader()->size;
-
-      status += readByte(s->mode);
-      size--;
-      status += readByte(s->state);
-      size--;
-
-      status += readText(text, size-sizeCrc);
-      status += readByte(b);
+            // the timeout is estimated for the first reply of the exchange only
 
-      if ((p = strchr(text, ';')))
-      {
-         *p = 0;
+            if (!framesReceived)
+               c->backoff = min(c->backoff+1, (int)maxBackoff);
 
-         s->modeinfo = strcasecmp(text, "Übergangsbetr") != 0 ? strdup(text) : strdup("Übergangsbetrieb");
-         s->stateinfo = strdup(p+1);
+            // nothing received at all, send the request again
 
-         free(text);
-         show("<- ");
-      }
-      else
-      {
-         s->stateinfo = strdup("Communication error");
-         tell(eloAlways, "Communication error while reading state, got size %d, status was %d", size, status);
+            if (!sizeBufferContent && !framesReceived && retried < maxRetries
+                && isRetryable(expected) && s->write(lastRequest, sizeLastRequest) == success)
+            {
+               c->retries++;
+               retried++;
+               tell(eloDetail, "Timeout waiting for 0x%2.2x, retry %d with %d ms",
+                    expected, retried, timeoutFor(expected));
+               continue;
+            }
+         }
 
-         status = fail;
-         show("<- ", eloAlways);
+         corrupt = yes;
+         return status;
       }
-   }
 
-   if (status != success)
-      return status;
+      if (!expected || header.command == expected)
+      {
+         c = &statistic->commands[header.command];
 
-   // cmdGetVersion
+         c->replies++;
+         c->bytesIn += sizeBufferContent;
+         c->bytesMasked += sizeBufferContent - sizeDecodedContent;
 
-   clear();
-   request(cmdGetVersion);
+         // one round trip per exchange, from the send to the first complete
+         // reply frame - further frames (e.g. the second confirmation of
+         // setParameter) would add the time the s 3200 needs to perform it
 
-   if ((status += readHeader()) == success)
-   {
-      int size = getHeader()->size;
-      byte v1, v2, v3, v4;
+         if (!framesReceived)
+            statistic->addRoundTrip(header.command, cTimeMs::Now() - requestAt, !retried);
 
-      status += readByte(v1);
-      size--;
-      status += readByte(v2);
-      size--;
-      status += readByte(v3);
-      size--;
-      status += readByte(v4);
-      size--;
+         framesReceived++;
 
-      if (status == success)
-         sprintf(s->version, "%2.2x.%2.2x.%2.2x.%2.2x", v1, v2, v3, v4);
+         // a answered retry may be followed by the late first reply
 
-      status += readTimeDateExt(s->time);
-      size -= 7;
+         if (retried)
+            corrupt = yes;
 
-      int max = 0;
+         return success;
+      }
 
-      while (size-- > 0 && max++ < 10)
-         status += readByte(b);
+      statistic->commands[expected].skippedFrames++;
+      skipped++;
 
-      show("<- ");
+      tell(eloAlways, "Skipping unexpected frame 0x%2.2x, waiting for 0x%2.2x",
+           header.command, expected);
+      show("<- ", eloAlways);
    }
 
-   return status;
+   corrupt = yes;
+
+   return fail;
 }
 
 //***************************************************************************
-// Sync Time
+// Read Frame
+//   read the complete frame, unmask it and check the crc, the read...
+//   functions below are cursor reads on the decoded frame
 //***************************************************************************
 
-int P4Request::syncTime(int offset)
+int P4Request::readFrame(int tms)
 {
-   RequestClean clean(this);
+   int need = sizeId;
+   int consumed = 0;
+   int produced;
+   int skipped = 0;
+   int res;
 
-   struct tm tim = {0};
-   int status = success;
-   byte b;
-   time_t now = time(0);
+   clear();
 
-   if (offset)
+   if (!s || !s->isOpen())
    {
-      now += offset;
-      tell(eloAlways, "Syncing time with offset of %d seconds", offset);
+      tell(eloAlways, "Line not open, aborting read");
+      return fail;
    }
 
-   clear();
+   // the id is not masked
 
-   localtime_r(&now, &tim);
+   while (sizeBufferContent < sizeId)
+   {
+      if ((res = s->read(buffer+sizeBufferContent, sizeId-sizeBufferContent, tms)) <= 0)
+      {
+         if (tms || res != Serial::wrnTimeout)     // tms 0 -> only a look for pending data
+            tell(eloAlways, "Read word failed, aborting");
 
-   addByte(tim.tm_sec+1);  // s-3200 is NOT the fastest ;-)
-   addByte(tim.tm_min);
-   addByte(tim.tm_hour);
+         return res == Serial::wrnTimeout ? (int)wrnTimeout : fail;
+      }
 
-   addByte(tim.tm_mday);
-   addByte(tim.tm_mon + 1);
-   addByte(tim.tm_wday);
-   addByte(tim.tm_year - 100);
+      sizeBufferContent += res;
+   }
 
-   request(cmdSetDateTime);
+   // hunt for the frame start, since 0x02 is masked inside of a
+   // frame the sequence 02 FD can't appear elsewhere
 
-   if ((status += readHeader()) == success)
+   while (buffer[0] != (commId >> 8) || buffer[1] != (commId & 0xff))
    {
-      status += readByte(b);
-
-      if (b != 0)
-         status = fail;
+      if (skipped >= sizeMaxReply*2)
+      {
+         tell(eloAlways, "Got no frame start within %d bytes, aborting", skipped);
+         return fail;
+      }
 
-      status += readByte(b); // crc
-   }
+      buffer[0] = buffer[1];
 
-   show("<- ");
+      if ((res = s->read(buffer+1, 1, tms)) <= 0)
+      {
+         tell(eloAlways, "Missing frame start after %d skipped bytes", skipped+1);
+         return res == Serial::wrnTimeout ? (int)wrnTimeout : fail;
+      }
 
-   return status;
-}
+      skipped++;
+   }
 
-//***************************************************************************
-// Get Parameter
-//***************************************************************************
+   if (skipped)
+   {
+      statistic->skippedBytes += skipped;
+      tell(eloAlways, "Skipped %d bytes in front of frame", skipped);
+   }
 
-int P4Request::getParameter(ConfigParameter* p)
-{
-   RequestClean clean(this);
-   int status = fail;
+   memcpy(decoded, buffer, sizeId);
+   sizeDecodedContent = consumed = sizeId;
+   header.id = commId;
 
-   if (!p || p->address == addrUnknown)
-      return errWrongAddress;
+   // each decoded byte takes at least one byte on the line, therefore
+   // we never read more than 'need' bytes and don't touch the next frame
 
-   clear();
-   addAddress(p->address);
-   request(cmdGetParameter);
+   need = sizeof(Header);
 
-   if (readHeader() == success)
+   while (sizeDecodedContent < need)
    {
-      byte b;
-      word w;
+      int want = need - sizeDecodedContent;
 
-      status = readByte(b)            // what ever
+      if ((res = s->read(buffer+sizeBufferContent, want, tms)) <= 0)
+      {
+         tell(eloAlways, "Read frame failed after %d of %d bytes, status was %d",
+              sizeDecodedContent, need, res);
+         return res == Serial::wrnTimeout ? (int)wrnTimeout : fail;
+      }
 
-         + readWord(p->address)       // address
-         + readText(p->unit, 1)       // unit
-         + readByte(p->digits)        // decimal digits
-         + readWord(p->factor)        // factor
-         + readWord(p->value)         // current value
-         + readWord(p->min)           // min value
-         + readWord(p->max)           // max value
-         + readWord(p->def)           // default value
+      sizeBufferContent += res;
 
-         + readWord(w)                // what ever
-         + readByte(b)                // what ever
+      if ((res = unmask(buffer+consumed, sizeBufferContent-consumed,
+                        decoded+sizeDecodedContent, need-sizeDecodedContent, produced)) < 0)
+      {
+         tell(eloAlways, "Got invalid masked sequence at offset %d", consumed);
+         return fail;
+      }
 
-         + readByte(b);               // crc
+      consumed += res;
+      sizeDecodedContent += produced;
 
-      if (status == success)
+      if (need == sizeof(Header) && sizeDecodedContent == need)
       {
-         if (p->factor)
-            p->value /= p->factor;
-
-         if (strcmp(p->unit, "°") == 0)
-            p->setUnit("°C");
+         header.size = decoded[posSize] << 8 | decoded[posSize+1];
+         header.command = decoded[posSize+sizeSize];
+         need += header.size;
+
+         if (header.size < sizeCrc || need > sizeMaxReply)
+         {
+            tell(eloAlways, "Got frame with invalid size %d", header.size);
+            return fail;
+         }
       }
+   }
 
-      show("<- ");
+   if (crc(decoded, need-sizeCrc) != decoded[need-sizeCrc])
+   {
+      statistic->commands[expected].crcErrors++;
+      tell(eloAlways, "Got frame 0x%2.2x with invalid crc", header.command);
+      show("<- ", eloAlways);
+      return fail;
    }
 
-   return status == success ? success : fail;
+   cursor = sizeof(Header);
+
+   return success;
 }
 
 //***************************************************************************
-// Set Parameter
+// Timeout For
+//   smoothed round trip plus four times its deviation, doubled for
+//   each timeout in a row and limited to floor and ceiling
 //***************************************************************************
 
-int P4Request::setParameter(ConfigParameter* p)
+int P4Request::timeoutFor(byte command)
 {
-   RequestClean clean(this);
-   byte crc;
+   LinkStatistic::Command* c = &statistic->commands[command];
+   int rto;
 
-   if (!p || p->address == addrUnknown)
-      return errWrongAddress;
+   if (!c->samples)
+      return timeoutCeiling;
 
-   ConfigParameter pActual(p->address);
+   rto = (int)(c->srtt + 4 * c->rttvar) << c->backoff;
 
-   if (getParameter(&pActual) != success)
-      return fail;
+   return max(timeoutFloor, min(rto, timeoutCeiling));
+}
 
-   if (p->value == pActual.value)
-      return wrnNonUpdate;
+//***************************************************************************
+// Is Retryable
+//   the ...Next requests move the list position of the s 3200, sending
+//   them again may skip a item
+//***************************************************************************
 
-   if (p->value < pActual.min || p->value > pActual.max)
+int P4Request::isRetryable(byte command)
+{
+   switch (command)
    {
-      tell(eloAlways, "value %d out of range %d-%d",
-           p->value, pActual.min, pActual.max);
-
-      return wrnOutOfRange;
+      case cmdGetValueListNext:
+      case cmdGetMenuListNext:
+      case cmdGetErrorNext:
+      case cmdGetTimesNext:
+      case cmdGetUnknownNext:
+         return no;
    }
 
-   clear();
-   addAddress(p->address);
-   addAddress(p->value * pActual.factor);
+   return yes;
+}
 
-   if (request(cmdSetParameter) != success)
-      return errRequestFailed;
+//***************************************************************************
+// Drain
+//   read unexpected bytes behind the frame, without waiting (tms = 0)
+//   only the bytes which are already received are taken
+//***************************************************************************
 
-   if (readHeader() + readWord(p->address) + readWord(p->value) + readByte(crc) != success)
-      return fail;
+int P4Request::drain(int tms)
+{
+   byte b;
+   int count = 0;
 
-   show("<- ");
+   while (s && s->isOpen() && s->look(b, tms) == success)
+   {
+      if (sizeBufferContent < (int)sizeof(buffer))
+         buffer[sizeBufferContent++] = b;
 
-   if (p->value == pActual.value)
-      return errTransmissionFailed;
+      count++;
+   }
 
-   if (readHeader() + readWord(p->address) + readWord(p->value) + readByte(crc) != success)
-      return fail;
+   return count;
+}
 
-   show("<- ");
+//***************************************************************************
+// Resync
+//   drop all garbage and check the communication with a echo request,
+//   only if this fails too the line has to be reopened
+//***************************************************************************
 
-   return getParameter(p);
+int P4Request::resync()
+{
+   int count = drain(50);
+
+   statistic->resyncs++;
+   tell(eloAlways, "Resync, dropped %d bytes", count);
+
+   return check();
 }
 
 //***************************************************************************
-// Get Time Ranges
+// Relay
+//   the frames are passed as they are on the line, the client decodes them.
+//   The command of the request is taken to skip foreign (late) frames like
+//   readHeader() does
 //***************************************************************************
 
-int P4Request::getTimeRanges(TimeRanges* t, int first)
+int P4Request::relayRequest(const byte* frame, int size)
 {
-   static int last = no;
+   byte plain[sizeSize+sizeCommand];
+   int produced = 0;
 
-   RequestClean clean(this);
-   int status = fail;
+   if (!s || !s->isOpen())
+      return fail;
 
-   if (!first && last)
-      return wrnLast;
+   expected = 0;
+   corrupt = no;
 
-   if (!t)
-      return fail;
+   if (size > sizeId && unmask(frame+sizeId, size-sizeId, plain, sizeof(plain), produced) != fail
+       && produced == sizeof(plain))
+      expected = plain[sizeSize];
 
-   clear();
-   request(first ? cmdGetTimesFirst : cmdGetTimesNext);
+   return s->write((void*)frame, size);
+}
 
-   if (readHeader() == success)
-   {
-      byte crc;
-      sword w;
+int P4Request::relayReply(int tms, const byte*& raw, int& size)
+{
+   int status;
 
-      status = readWord(w)            // what ever (always 01 00 ?)
-         + readByte(t->address);       // address  (here only a byte!!)
+   raw = buffer;
+   size = 0;
 
-      for (int n = 0; n < 4; n++)
+   for (int skipped = 0; skipped < 3; skipped++)
+   {
+      if ((status = readFrame(tms)) != success)
       {
-         // read time range 'n'
+         corrupt = yes;
+         size = sizeBufferContent;
+         return status;
+      }
 
-         status += readByte(t->timesFrom[n]);
-         status += readByte(t->timesTo[n]);
+      if (!expected || header.command == expected)
+      {
+         size = sizeBufferContent;
+         return success;
       }
 
-      status += readByte(crc);
+      statistic->commands[expected].skippedFrames++;
 
-      show("<- ");
+      tell(eloAlways, "Broker: Skipping unexpected frame 0x%2.2x, waiting for 0x%2.2x",
+           header.command, expected);
+      show("<- ", eloAlways);
    }
 
-   last = t->address == 0xdf;
+   corrupt = yes;
 
-   return status == success ? success : fail;
+   return fail;
 }
 
 //***************************************************************************
-// Set Time Ranges
+// Read Byte
 //***************************************************************************
 
-int P4Request::setTimeRanges(TimeRanges* t)
+int P4Request::readByte(byte& v)
 {
-   RequestClean clean(this);
-   int status;
-   byte crc;
-   byte tmp;
-   sword addr;
-
-   if (!t || t->address == 0xFF)
-      return errWrongAddress;
-
-   clear();
-   addAddress(t->address);
+   if (cursor >= sizeDecodedContent)
+      return fail;
 
-   for (int n = 0; n < 4; n++)
-   {
-      sword value;
+   v = decoded[cursor++];
 
-      if ((t->timesFrom[n] > 0xeb && t->timesFrom[n] != 0xff) ||
-          (t->timesTo[n] > 0xeb && t->timesTo[n] != 0xff))            // 0xeb => 235 => 23:50
-      {
-         tell(eloAlways, "Value '%s' isn't a valid time range!", t->getTimeRange(n));
-         return wrnOutOfRange;
-      }
+   return success;
+}
 
-      value = t->timesFrom[n] << 8 | t->timesTo[n];
-      addAddress(value);
-   }
+//***************************************************************************
+// Read Word
+//***************************************************************************
 
-   if (request(cmdSetTimes) != success)
-      return errRequestFailed;
+int P4Request::readWord(word& v)
+{
+   if (cursor + 2 > sizeDecodedContent)
+      return fail;
 
-   tell(eloAlways, "Stored successfully, try to reading response");
+   v = (decoded[cursor] << 8) | decoded[cursor+1];
+   cursor += 2;
 
-   // reas response
+   return success;
+}
 
-   status = readHeader();
-   status += readByte(tmp);   // always 00 ?
-   status += readWord(addr);
+int P4Request::readWord(sword& v)
+{
+   if (cursor + 2 > sizeDecodedContent)
+      return fail;
 
-   for (int n = 0; n < 4; n++)
-   {
-      // read time range 'n'
+   v = (signed short)((decoded[cursor] << 8) | decoded[cursor+1]);
+   cursor += 2;
 
-      status += readByte(t->timesFrom[n]);
-      status += readByte(t->timesTo[n]);
-   }
+   return success;
+}
+//***************************************************************************
+// Read Text
+//***************************************************************************
 
-   status += readByte(crc);
+int P4Request::readText(char*& s, int size)
+{
+   s = 0;
 
-   if (status != success)
-     return errTransmissionFailed;
+   if (size < 0 || cursor + size > sizeDecodedContent)
+      return fail;
 
-   show("<- ");
+   toText(decoded + cursor, size, s);
+   cursor += size;
 
    return success;
 }
 
 //***************************************************************************
-// Get Value
+// Field Decoding (see p4frame.h)
 //***************************************************************************
 
-int P4Request::getValue(Value* v)
+time_t toTime(const byte* p)
 {
-   RequestClean clean(this);
-   int status = fail;
-   byte crc;
+   return p[0] + tmeSecondsPerMinute*p[1] + tmeSecondsPerHour*p[2];
+}
 
-   if (!v || v->address == addrUnknown)
-      return errWrongAddress;
+time_t toDate(const byte* p, int ext)
+{
+   struct tm tm;
 
-   clear();
-   addAddress(v->address);
-   request(cmdGetValue);
+   memset(&tm, 0, sizeof(tm));
 
-   if (readHeader() == success)
+   tm.tm_mday = p[0];
+   tm.tm_mon = p[1] - 1;
+   tm.tm_year = p[ext ? 3 : 2] + 100;   // the ext variant has the day of week in front of the year
+   tm.tm_isdst = -1;                    // force DST auto detect
+
+   return mktime(&tm);
+}
+
+int toText(const byte* p, int size, char*& s)
+{
+   int n = 0;
+   char* tmp = (char*)malloc(size+TB);
+
+   for (int i = 0; i < size; i++)
    {
-      status = readWord(v->value)
-         + readByte(crc);
+      if (p[i])
+         tmp[n++] = p[i];
+   }
 
-      show("<- ");
+   tmp[n] = 0;
+   s = (char*)malloc(2*size+TB);
+
+   if (toUTF8(s, 2*size+TB, tmp) != success)
+   {
+      tell(eloDetail, "Warning: Converting of charset failed [%s]", tmp);
+      strcpy(s, tmp);
    }
 
-   return status;
+   free(tmp);
+
+   return success;
 }
 
 //***************************************************************************
-// Get Digital Out
+// Read Text
 //***************************************************************************
 
-int P4Request::getDigitalOut(IoValue* v)
+int P4Request::check()
 {
    RequestClean clean(this);
-   int status = fail;
-   byte crc;
 
-   if (!v || v->address == addrUnknown)
-      return errWrongAddress;
+   int status = fail;
+   char* s = 0;
+   byte b;
 
    clear();
-   addAddress(v->address);
-   request(cmdGetDigOut);
+   addText("Tescht ;-)");
+   request(cmdCheck);
 
    if (readHeader() == success)
    {
-      status = readByte(v->mode)
-         + readByte(v->state)
-         + readByte(crc);
+      if (readText(s, getHeader()->size - sizeCrc) == success)
+         if (readByte(b) == success)   // read crc ..
+            status = success;
+
+      free(s);
 
       show("<- ");
    }
@@ -1077,56 +1261,74 @@ int P4Request::getDigitalOut(IoValue* v)
 }
 
 //***************************************************************************
-// Get Digital In
+// Get State
 //***************************************************************************
 
-int P4Request::getDigitalIn(IoValue* v)
+int P4Request::getStatus(Status* s)
 {
    RequestClean clean(this);
-   int status = fail;
-   byte crc;
 
-   if (!v || v->address == addrUnknown)
-      return errWrongAddress;
+   int status = success;
+   byte b;
+
+   // cmdGetState
 
    clear();
-   addAddress(v->address);
-   request(cmdGetDigIn);
+   request(cmdGetState);
+   s->clear();
 
-   if (readHeader() == success)
+   if ((status += readHeader()) == success)
    {
-      status = readByte(v->mode)
-         + readByte(v->state)
-         + readByte(crc);
+      char* text = 0;
+      char* p;
 
-      show("<- ");
-   }
+      status += readFields<StateReply>(s->mode, s->state);
+      status += readText(text, pendingBytes()-sizeCrc);
+      status += readByte(b);
 
-   return status;
-}
+      if (text && (p = strchr(text, ';')))
+      {
+         *p = 0;
 
-//***************************************************************************
-// Get Analog Out
-//***************************************************************************
+         s->modeinfo = strcasecmp(text, "Übergangsbetr") != 0 ? strdup(text) : strdup("Übergangsbetrieb");
+         s->stateinfo = strdup(p+1);
 
-int P4Request::getAnalogOut(IoValue* v)
-{
-   RequestClean clean(this);
-   int status = fail;
-   byte crc;
+         show("<- ");
+      }
+      else
+      {
+         s->stateinfo = strdup("Communication error");
+         tell(eloAlways, "Communication error while reading state, got size %d, status was %d",
+              getHeader()->size, status);
 
-   if (!v || v->address == addrUnknown)
-      return errWrongAddress;
+         status = fail;
+         show("<- ", eloAlways);
+      }
+
+      free(text);
+   }
+
+   if (status != success)
+      return status;
+
+   // cmdGetVersion
 
    clear();
-   addAddress(v->address);
-   request(cmdGetAnlOut);
+   request(cmdGetVersion);
 
-   if (readHeader() == success)
+   if ((status += readHeader()) == success)
    {
-      status = readByte(v->mode)
-         + readByte(v->state)
-         + readByte(crc);
+      byte v1, v2, v3, v4;
+
+      status += readFields<VersionReply>(v1, v2, v3, v4, s->time);
+
+      if (status == success)
+         sprintf(s->version, "%2.2x.%2.2x.%2.2x.%2.2x", v1, v2, v3, v4);
+
+      int max = 0;
+
+      while (pendingBytes() > 0 && max++ < 10)
+         status += readByte(b);
 
       show("<- ");
    }
@@ -1135,300 +1337,469 @@ int P4Request::getAnalogOut(IoValue* v)
 }
 
 //***************************************************************************
-// Get Error
+// Sync Time
 //***************************************************************************
 
-int P4Request::getError(ErrorInfo* e, int first)
+int P4Request::syncTime(int offset)
 {
    RequestClean clean(this);
+
+   struct tm tim = {0};
    int status = success;
-   int size = 0;
-   byte crc;
-   byte more;
+   byte b = 0xff;
+   time_t now = time(0);
 
-   if (!e)
-      return fail;
+   if (offset)
+   {
+      now += offset;
+      tell(eloAlways, "Syncing time with offset of %d seconds", offset);
+   }
 
    clear();
-   request(first ? cmdGetErrorFirst : cmdGetErrorNext);
 
-   if (readHeader() != success)
-      return fail;
+   localtime_r(&now, &tim);
 
-   size = getHeader()->size;
+   addByte(tim.tm_sec+1);  // s-3200 is NOT the fastest ;-)
+   addByte(tim.tm_min);
+   addByte(tim.tm_hour);
 
-   status += readByte(more);
-   size--;
+   addByte(tim.tm_mday);
+   addByte(tim.tm_mon + 1);
+   addByte(tim.tm_wday);
+   addByte(tim.tm_year - 100);
 
-   if (!more)
+   request(cmdSetDateTime);
+
+   if ((status += readHeader()) == success)
    {
-      readByte(crc);
-      show("<- ");
-      tell(eloDebug, "Got 'end of list'");
+      status += readFields<AckReply>(b);
 
-      return wrnLast;
+      if (b != 0)
+         status = fail;
    }
 
-   status += readWord(e->number);
-   size -= 2;
-   status += readByte(e->info);
-   size--;
-   status += readByte(e->state);
-   size--;
-   status += readTimeDate(e->time);
-   size -= 6;
-   status += readText(e->text, size-sizeCrc);
-   size -= size-sizeCrc;
-
-   status += readByte(crc);
    show("<- ");
 
    return status;
 }
 
 //***************************************************************************
-// Get Value Spec
+// Get Parameter
 //***************************************************************************
 
-int P4Request::getValueSpec(ValueSpec* v, int first)
+int P4Request::getParameter(ConfigParameter* p)
 {
    RequestClean clean(this);
-   int status = success;
-   int size = 0;
-   byte crc, tb, b;
-   byte more;
+   int status = fail;
+
+   if (!p || p->address == addrUnknown)
+      return errWrongAddress;
 
    clear();
-   request(first ? cmdGetValueListFirst : cmdGetValueListNext);
+   addAddress(p->address);
+   request(cmdGetParameter);
 
-   if (readHeader() != success)
-      return fail;
+   if (readHeader() == success)
+   {
+      status = readFields<ParameterReply>(p->address, p->unit, p->digits, p->factor,
+                                          p->value, p->min, p->max, p->def);
 
-   size = getHeader()->size;
+      if (status == success)
+      {
+         if (p->factor)
+            p->value /= p->factor;
 
-   status += readByte(more);
-   size--;
+         if (strcmp(p->unit, "°") == 0)
+            p->setUnit("°C");
+      }
 
-   if (!more)
-   {
-      readByte(crc);
       show("<- ");
-      tell(eloDebug, "Got 'end of list'");
-
-      return wrnLast;
    }
 
-   if (size < 11)
+   return status == success ? success : fail;
+}
+
+//***************************************************************************
+// Set Parameter
+//***************************************************************************
+
+int P4Request::setParameter(ConfigParameter* p)
+{
+   RequestClean clean(this);
+
+   if (!p || p->address == addrUnknown)
+      return errWrongAddress;
+
+   ConfigParameter pActual(p->address);
+
+   if (getParameter(&pActual) != success)
+      return fail;
+
+   if (p->value == pActual.value)
+      return wrnNonUpdate;
+
+   if (p->value < pActual.min || p->value > pActual.max)
    {
-      while (size--)
-         readByte(b);
+      tell(eloAlways, "value %d out of range %d-%d",
+           p->value, pActual.min, pActual.max);
 
-      show("<- ");
-      return wrnEmpty;
+      return wrnOutOfRange;
    }
 
-   status += readWord(v->factor);
-   size -= 2;
-   status += readWord(v->unknown);
-   size -= 2;
-   status += readText(v->unit, 2);
-   size -= 2;
-   status += readWord(v->address);
-   size -= 2;
-   status += readText(v->description, size-sizeCrc-1);
-   size -= size-sizeCrc-1;
-   status += readByte(tb);  // termination byte
-   size--;
-
-   status += readByte(crc);
-   show("<- ");
+   clear();
+   addAddress(p->address);
+   addAddress(p->value * pActual.factor);
 
-   // create sensor name
+   if (request(cmdSetParameter) != success)
+      return errRequestFailed;
 
-   string name = v->description;
+   if (readHeader() != success || readFields<SetParameterReply>(p->address, p->value) != success)
+      return fail;
 
-   removeCharsExcept(name, nameChars);
-   asprintf(&v->name, "%s_0x%x", name.c_str(), v->address);
+   show("<- ");
 
-   // patch unit
+   if (p->value == pActual.value)
+      return errTransmissionFailed;
 
-   for (int i = 0; v->unit[i]; i++)
-      if (!isprint(v->unit[i]))
-         v->unit[i] = ' ';
+   if (readHeader() != success || readFields<SetParameterReply>(p->address, p->value) != success)
+      return fail;
 
-   allTrim(v->unit);
+   show("<- ");
 
-   return status;
+   return getParameter(p);
 }
 
 //***************************************************************************
-// Get Menu Item
+// Get Time Ranges
 //***************************************************************************
 
-int P4Request::getMenuItem(MenuItem* m, int first)
+int P4Request::getTimeRanges(TimeRanges* t, int first)
 {
+   static int last = no;
+
    RequestClean clean(this);
-   int status;
-   int size = 0;
-   byte crc, tb, b;
-   byte more;
+   int status = fail;
 
-   memset(m, 0, sizeof(MenuItem));
+   if (!first && last)
+      return wrnLast;
+
+   if (!t)
+      return fail;
 
    clear();
-   request(first ? cmdGetMenuListFirst : cmdGetMenuListNext);
+   request(first ? cmdGetTimesFirst : cmdGetTimesNext);
 
-   if ((status = readHeader()) != success)
-      return status;
+   if (readHeader() == success)
+   {
+      status = readFields<GetTimesReply>(t->address,
+                                         t->timesFrom[0], t->timesTo[0], t->timesFrom[1], t->timesTo[1],
+                                         t->timesFrom[2], t->timesTo[2], t->timesFrom[3], t->timesTo[3]);
 
-   size = getHeader()->size;
+      show("<- ");
+   }
 
-   if ((status = readByte(more)) != success)
-      return status;
+   last = t->address == 0xdf;
 
-   size--;
+   return status == success ? success : fail;
+}
 
-   if (!more)
+//***************************************************************************
+// Set Time Ranges
+//***************************************************************************
+
+int P4Request::setTimeRanges(TimeRanges* t)
+{
+   RequestClean clean(this);
+   int status;
+   sword addr;
+
+   if (!t || t->address == 0xFF)
+      return errWrongAddress;
+
+   clear();
+   addAddress(t->address);
+
+   for (int n = 0; n < 4; n++)
    {
-      readByte(crc);
-      show("<- ");
+      sword value;
 
-      tell(eloDebug, "Got 'end of list'");
-      return wrnLast;
+      if ((t->timesFrom[n] > 0xeb && t->timesFrom[n] != 0xff) ||
+          (t->timesTo[n] > 0xeb && t->timesTo[n] != 0xff))            // 0xeb => 235 => 23:50
+      {
+         tell(eloAlways, "Value '%s' isn't a valid time range!", t->getTimeRange(n));
+         return wrnOutOfRange;
+      }
+
+      value = t->timesFrom[n] << 8 | t->timesTo[n];
+      addAddress(value);
    }
 
-   if (size < 30)
-   {
-      tell(eloDebug, "At least 30 byte more expected but only %d pending, skipping item", size);
+   if (request(cmdSetTimes) != success)
+      return errRequestFailed;
 
-      while (size-- > 0 && status == success)
-         status = readByte(b);
+   tell(eloAlways, "Stored successfully, try to reading response");
 
-      show("<- ");
+   // reas response
 
-      return wrnSkip;
-   }
+   if ((status = readHeader()) == success)
+      status = readFields<SetTimesReply>(addr,
+                                         t->timesFrom[0], t->timesTo[0], t->timesFrom[1], t->timesTo[1],
+                                         t->timesFrom[2], t->timesTo[2], t->timesFrom[3], t->timesTo[3]);
+
+   if (status != success)
+     return errTransmissionFailed;
+
+   show("<- ");
+
+   return success;
+}
+
+//***************************************************************************
+// Get Value
+//***************************************************************************
+
+int P4Request::getValue(Value* v)
+{
+   RequestClean clean(this);
+   int status = fail;
 
-   if ((status = readByte(m->type)) != success)
+   if (!v || v->address == addrUnknown)
+      return errWrongAddress;
+
+   clear();
+   addAddress(v->address);
+   request(cmdGetValue);
+
+   if (readHeader() == success)
    {
-      tell(eloAlways, "Missing at least %d bytes at reading type (byte)", size);
+      status = readFields<ValueReply>(v->value);
       show("<- ");
-      return status;
    }
 
-   size -= 1;
+   return status;
+}
+
+//***************************************************************************
+// Get Values
+//   request up to 'maxAddresses' values with one frame, the reply
+//   contains the values in order of the requested addresses
+//***************************************************************************
+
+int P4Request::getValues(std::vector<Value>& values)
+{
+   int status;
 
-   if ((status = readByte(m->unknown1)) != success)
+   for (unsigned int first = 0; first < values.size(); first += maxAddresses)
    {
-      tell(eloAlways, "Missing at least %d bytes at reading unknown1 (byte)", size);
-      show("<- ");
-      return status;
+      unsigned int count = values.size() - first;
+
+      if (count > maxAddresses)
+         count = maxAddresses;
+
+      if ((status = getValueChunk(values, first, count)) != success)
+         return status;
    }
 
-   size -= 1;
+   return success;
+}
+
+int P4Request::getValueChunk(std::vector<Value>& values, unsigned int first, unsigned int count)
+{
+   RequestClean clean(this);
+   int status = success;
+   byte crc;
+
+   clear();
 
-   if ((status = readWord(m->parent)) != success)
+   for (unsigned int i = first; i < first + count; i++)
    {
-      tell(eloAlways, "Missing at least %d bytes at reading parent (word)", size);
-      show("<- ");
-      return status;
+      if (values[i].address == addrUnknown)
+         return errWrongAddress;
+
+      addAddress(values[i].address);
    }
 
-   size -= 2;
+   request(cmdGetValue);
+
+   if (readHeader() != success)
+      return fail;
 
-   if ((status = readWord(m->child)) != success)
+   if (getHeader()->size != count * sizeof(sword) + sizeCrc)
    {
-      tell(eloAlways, "Missing at least %d bytes at reading child (word)", size);
+      tell(eloDetail, "Got %d bytes for %d requested values, multi value request not supported",
+           getHeader()->size, count);
       show("<- ");
-      return status;
+
+      return errNotSupported;
    }
 
-   size -= 2;
+   for (unsigned int i = first; i < first + count; i++)
+      status += readWord(values[i].value);
 
-   // 18 noch unbekannte byte lesen ...
+   status += readByte(crc);
+   show("<- ");
+
+   return status == success ? success : fail;
+}
+
+//***************************************************************************
+// Probe Values
+//   check if the firmware answers multi value requests by comparing
+//   the reply with single requests of the same addresses before and after
+//   it. The sensors are live, a value has to lie between both reads (give
+//   or take probeTolerance) - in one of probeTries rounds
+//***************************************************************************
 
-   for (int i = 0; i < 18; i++)
+int P4Request::probeValues(std::vector<Value>& values)
+{
+   int status;
+   std::vector<Value> batch = values;
+
+   if (values.size() < 2)
+      return errNotSupported;
+
+   for (int t = 0; t < probeTries; t++)
    {
-      if ((status = readByte(b)) != success)
+      std::vector<Value> before = values;
+      std::vector<Value> after = values;
+      unsigned int i;
+
+      for (i = 0; i < before.size(); i++)
       {
-         tell(eloAlways, "Missing at least %d of %d bytes at reading spare bytes", size, getHeader()->size);
-         show("<- ");
+         if ((status = getValue(&before[i])) != success)
+            return status;
+      }
+
+      if ((status = getValues(batch)) != success)
          return status;
+
+      for (i = 0; i < after.size(); i++)
+      {
+         if ((status = getValue(&after[i])) != success)
+            return status;
       }
 
-      size--;
-   }
+      for (i = 0; i < batch.size(); i++)
+      {
+         int low = std::min(before[i].value, after[i].value) - probeTolerance;
+         int high = std::max(before[i].value, after[i].value) + probeTolerance;
 
-   if ((status = readWord(m->address)) != success)
-   {
-      tell(eloAlways, "Missing at least %d bytes at reading address", size);
-      show("<- ");
-      return status;
+         if (batch[i].address != before[i].address || batch[i].value < low || batch[i].value > high)
+         {
+            tell(eloDetail, "Value of 0x%04x differs (%d not in %d..%d), round %d of the probe",
+                 batch[i].address, batch[i].value, before[i].value, after[i].value, t+1);
+            break;
+         }
+      }
+
+      if (i == batch.size())
+      {
+         values = batch;
+         return success;
+      }
    }
 
-   size -= 2;
+   tell(eloAlways, "Multi value request differs in %d rounds, not supported", (int)probeTries);
 
-   if ((status = readWord(m->unknown2)) != success)
-   {
-      tell(eloAlways, "Missing at least %d bytes at reading unknown2 (word)", size);
-      show("<- ");
-      return status;
-   }
+   return errNotSupported;
+}
+
+//***************************************************************************
+// Get Digital Out
+//***************************************************************************
+
+int P4Request::getDigitalOut(IoValue* v)
+{
+   RequestClean clean(this);
+   int status = fail;
 
-   size -= 2;
+   if (!v || v->address == addrUnknown)
+      return errWrongAddress;
 
-   // Rest als text lesen
+   clear();
+   addAddress(v->address);
+   request(cmdGetDigOut);
 
-   if ((status = readText(m->description, size-sizeCrc-1)) != success)
+   if (readHeader() == success)
    {
-      tell(eloAlways, "Missing at least %d bytes at reading text", size);
+      status = readFields<IoReply>(v->mode, v->state);
       show("<- ");
-      return status;
    }
 
-   size -= size-sizeCrc-1;
+   return status;
+}
+
+//***************************************************************************
+// Get Digital In
+//***************************************************************************
+
+int P4Request::getDigitalIn(IoValue* v)
+{
+   RequestClean clean(this);
+   int status = fail;
+
+   if (!v || v->address == addrUnknown)
+      return errWrongAddress;
+
+   clear();
+   addAddress(v->address);
+   request(cmdGetDigIn);
 
-   if ((status = readByte(tb)) != success)
+   if (readHeader() == success)
    {
-      tell(eloAlways, "Missing at least %d bytes at reading tb", size);
+      status = readFields<IoReply>(v->mode, v->state);
       show("<- ");
-      return status;
    }
 
-   size--;
+   return status;
+}
+
+//***************************************************************************
+// Get Analog Out
+//***************************************************************************
+
+int P4Request::getAnalogOut(IoValue* v)
+{
+   RequestClean clean(this);
+   int status = fail;
+
+   if (!v || v->address == addrUnknown)
+      return errWrongAddress;
+
+   clear();
+   addAddress(v->address);
+   request(cmdGetAnlOut);
 
-   if ((status = readByte(crc)) != success)
+   if (readHeader() == success)
    {
-      tell(eloAlways, "Missing at least %d bytes at reading crc", size);
+      status = readFields<IoReply>(v->mode, v->state);
       show("<- ");
-      return status;
    }
 
-   show("<- ");
-   showDecoded("DEBUG: ");
-
    return status;
 }
 
-int P4Request::getItem(int first)
+//***************************************************************************
+// Get Error
+//***************************************************************************
+
+int P4Request::getError(ErrorInfo* e, int first)
 {
    RequestClean clean(this);
+   int status = success;
+   byte crc;
    byte more;
-   clear();
 
-   request(first ? cmdGetUnknownFirst : cmdGetUnknownNext);
+   if (!e)
+      return fail;
+
+   clear();
+   request(first ? cmdGetErrorFirst : cmdGetErrorNext);
 
    if (readHeader() != success)
-   {
-      tell(eloAlways, "request failed");
       return fail;
-   }
 
-   int size = getHeader()->size;
-   byte b, crc;
-
-   readByte(more);
-   size--;
+   status += readByte(more);
 
    if (!more)
    {
@@ -1439,33 +1810,863 @@ int P4Request::getItem(int first)
       return wrnLast;
    }
 
-   while (size > 0 && readByte(b) == success)
-      size--;
-
+   status += readFields<ErrorReply>(e->number, e->info, e->state, e->time);
+   status += readText(e->text, pendingBytes()-sizeCrc);
+   status += readByte(crc);
    show("<- ");
 
-   return done;
+   return status;
 }
 
-int P4Request::getUser(byte cmd)
+//***************************************************************************
+// Get Value Spec
+//***************************************************************************
+
+int P4Request::getValueSpec(ValueSpec* v, int first)
 {
    RequestClean clean(this);
+   int status = success;
+   byte crc, b;
+   byte more;
+
    clear();
-   request(cmd);
+   request(first ? cmdGetValueListFirst : cmdGetValueListNext);
 
    if (readHeader() != success)
-   {
-      tell(eloAlways, "request of %d failed", cmd);
       return fail;
-   }
-
-   int size = getHeader()->size;
-   byte b;
 
-   while (size > 0 && readByte(b) == success)
-      size--;
+   status += readByte(more);
+
+   if (!more)
+   {
+      readByte(crc);
+      show("<- ");
+      tell(eloDebug, "Got 'end of list'");
+
+      return wrnLast;
+   }
+
+   if (pendingBytes() < ValueSpecReply::size + TextEnd::size + 1)
+   {
+      while (pendingBytes() > 0)
+         readByte(b);
+
+      show("<- ");
+      return wrnEmpty;
+   }
+
+   status += readFields<ValueSpecReply>(v->factor, v->unknown, v->unit, v->address);
+   status += readText(v->description, pendingBytes()-TextEnd::size);
+   status += readFields<TextEnd>();
+   show("<- ");
+
+   // create sensor name
+
+   string name = v->description;
+
+   removeCharsExcept(name, nameChars);
+   asprintf(&v->name, "%s_0x%x", name.c_str(), v->address);
+
+   // patch unit
+
+   for (int i = 0; v->unit[i]; i++)
+      if (!isprint(v->unit[i]))
+         v->unit[i] = ' ';
+
+   allTrim(v->unit);
+
+   return status;
+}
+
+//***************************************************************************
+// Get Menu Item
+//***************************************************************************
+
+int P4Request::getMenuItem(MenuItem* m, int first)
+{
+   RequestClean clean(this);
+   int status;
+   byte crc, b;
+   byte more;
+
+   memset(m, 0, sizeof(MenuItem));
+
+   clear();
+   request(first ? cmdGetMenuListFirst : cmdGetMenuListNext);
+
+   if ((status = readHeader()) != success)
+      return status;
+
+   if ((status = readByte(more)) != success)
+      return status;
+
+   if (!more)
+   {
+      readByte(crc);
+      show("<- ");
+
+      tell(eloDebug, "Got 'end of list'");
+      return wrnLast;
+   }
+
+   if (pendingBytes() < 30)
+   {
+      tell(eloDebug, "At least 30 byte more expected but only %d pending, skipping item", pendingBytes());
+
+      while (pendingBytes() > 0 && status == success)
+         status = readByte(b);
+
+      show("<- ");
+
+      return wrnSkip;
+   }
+
+   if ((status = readFields<MenuItemReply>(m->type, m->unknown1, m->parent, m->child,
+                                           m->address, m->unknown2)) != success)
+   {
+      tell(eloAlways, "Missing bytes at reading menu item of %d bytes", getHeader()->size);
+      show("<- ");
+      return status;
+   }
+
+   // rest as text
+
+   if ((status = readText(m->description, pendingBytes()-TextEnd::size)) != success
+       || (status = readFields<TextEnd>()) != success)
+   {
+      tell(eloAlways, "Missing bytes at reading text of %d bytes", getHeader()->size);
+      show("<- ");
+      return status;
+   }
+
+   show("<- ");
+   showDecoded("DEBUG: ");
+
+   return status;
+}
+
+int P4Request::getItem(int first)
+{
+   RequestClean clean(this);
+   byte more;
+   clear();
+
+   request(first ? cmdGetUnknownFirst : cmdGetUnknownNext);
+
+   if (readHeader() != success)
+   {
+      tell(eloAlways, "request failed");
+      return fail;
+   }
+
+   int size = getHeader()->size;
+   byte b, crc;
+
+   readByte(more);
+   size--;
+
+   if (!more)
+   {
+      readByte(crc);
+      show("<- ");
+      tell(eloDebug, "Got 'end of list'");
+
+      return wrnLast;
+   }
+
+   while (size > 0 && readByte(b) == success)
+      size--;
 
    show("<- ");
 
    return done;
 }
+
+int P4Request::getUser(byte cmd)
+{
+   RequestClean clean(this);
+   clear();
+   request(cmd);
+
+   if (readHeader() != success)
+   {
+      tell(eloAlways, "request of %d failed", cmd);
+      return fail;
+   }
+
+   int size = getHeader()->size;
+   byte b;
+
+   while (size > 0 && readByte(b) == success)
+      size--;
+
+   show("<- ");
+
+   return done;
+}
+
+//***************************************************************************
+// Class P4 Queue
+//***************************************************************************
+
+P4Queue::P4Queue(P4Request* aRequest)
+{
+   request = aRequest;
+   hook = 0;
+   hookContext = 0;
+}
+
+P4Queue::~P4Queue()
+{
+   clear();
+}
+
+//***************************************************************************
+// Enqueue
+//   timeout in ms, jobs not performed until then are finished with
+//   wrnTimeout without touching the line
+//***************************************************************************
+
+int P4Queue::enqueue(int type, void* object, Callback callback, void* context,
+                     void* data, int priority, int timeout)
+{
+   Job* job;
+
+   if (!object || priority < 0 || priority >= prioCount)
+      return fail;
+
+   job = new Job;
+
+   job->type = type;
+   job->priority = priority;
+   job->deadline = timeout ? cTimeMs::Now() + timeout : 0;
+   job->status = na;
+   job->object = object;
+   job->data = data;
+   job->callback = callback;
+   job->context = context;
+
+   jobs[priority].push_back(job);
+
+   return success;
+}
+
+//***************************************************************************
+// Pending
+//***************************************************************************
+
+int P4Queue::pending()
+{
+   int count = 0;
+
+   for (int p = 0; p < prioCount; p++)
+      count += jobs[p].size();
+
+   return count;
+}
+
+//***************************************************************************
+// Clear
+//***************************************************************************
+
+int P4Queue::clear()
+{
+   for (int p = 0; p < prioCount; p++)
+   {
+      while (!jobs[p].empty())
+      {
+         Job* job = jobs[p].front();
+
+         jobs[p].pop_front();
+         finish(job, abrt);
+      }
+   }
+
+   return done;
+}
+
+//***************************************************************************
+// Perform
+//   work off the queue until it is empty or 'maxTime' (ms) is reached,
+//   returns the number of performed jobs
+//***************************************************************************
+
+int P4Queue::perform(int maxTime)
+{
+   int count = 0;
+   uint64_t endAt = maxTime ? cTimeMs::Now() + maxTime : 0;
+
+   while (pending())
+   {
+      if (endAt && cTimeMs::Now() > endAt)
+         break;
+
+      if (performNext() == success)
+         count++;
+
+      // give others the chance to use the line between two transactions
+
+      if (hook && pending())
+         hook(hookContext);
+   }
+
+   return count;
+}
+
+//***************************************************************************
+// Perform Next
+//***************************************************************************
+
+int P4Queue::performNext()
+{
+   for (int p = 0; p < prioCount; p++)
+   {
+      if (jobs[p].empty())
+         continue;
+
+      Job* job = jobs[p].front();
+      jobs[p].pop_front();
+
+      if (job->deadline && cTimeMs::Now() > job->deadline)
+      {
+         tell(eloDetail, "Dropping request of type %d, deadline exceeded", job->type);
+         finish(job, wrnTimeout);
+         return wrnTimeout;
+      }
+
+      int status = execute(job);
+      finish(job, status);
+
+      return status;
+   }
+
+   return done;
+}
+
+//***************************************************************************
+// Execute
+//***************************************************************************
+
+int P4Queue::execute(Job* job)
+{
+   switch (job->type)
+   {
+      case jtValue:        return request->getValue((Value*)job->object);
+      case jtValues:       return request->getValues(*(std::vector<Value>*)job->object);
+      case jtDigitalOut:   return request->getDigitalOut((IoValue*)job->object);
+      case jtDigitalIn:    return request->getDigitalIn((IoValue*)job->object);
+      case jtAnalogOut:    return request->getAnalogOut((IoValue*)job->object);
+      case jtParameter:    return request->getParameter((ConfigParameter*)job->object);
+      case jtSetParameter: return request->setParameter((ConfigParameter*)job->object);
+      case jtStatus:       return request->getStatus((Status*)job->object);
+   }
+
+   tell(eloAlways, "Unexpected request type %d", job->type);
+
+   return fail;
+}
+
+//***************************************************************************
+// Finish
+//***************************************************************************
+
+void P4Queue::finish(Job* job, int status)
+{
+   job->status = status;
+
+   if (job->callback)
+      job->callback(job, job->context);
+
+   delete job;
+}
+
+//***************************************************************************
+// Class P4 Broker
+//***************************************************************************
+
+const char* P4Broker::defaultPath = "/var/run/p4d.sock";
+
+P4Broker::P4Broker(P4Request* aRequest)
+{
+   request = aRequest;
+   path = 0;
+   fdListen = na;
+   fdPending = na;
+   pendingAt = 0;
+}
+
+P4Broker::~P4Broker()
+{
+   close();
+}
+
+//***************************************************************************
+// Open / Close
+//   the socket is accessible for the owner and the group, by name or (if
+//   empty) the one of the device - like the tty before
+//***************************************************************************
+
+int P4Broker::open(const char* aPath, const char* aGroup, const char* aDevice)
+{
+   struct sockaddr_un addr;
+   struct stat st;
+   gid_t gid = (gid_t)-1;
+
+   close();
+
+   if (!isEmpty(aGroup))
+   {
+      struct group* g = getgrnam(aGroup);
+
+      if (!g)
+      {
+         tell(eloAlways, "Error: Unknown group '%s' for '%s'", aGroup, aPath);
+         return fail;
+      }
+
+      gid = g->gr_gid;
+   }
+   else if (!isEmpty(aDevice) && stat(aDevice, &st) == 0)
+   {
+      gid = st.st_gid;
+   }
+
+   if (isEmpty(aPath) || strlen(aPath) >= sizeof(addr.sun_path))
+      return fail;
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strcpy(addr.sun_path, aPath);
+
+   unlink(aPath);
+
+   if ((fdListen = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+       || bind(fdListen, (struct sockaddr*)&addr, sizeof(addr)) != 0
+       || listen(fdListen, 5) != 0)
+   {
+      tell(eloAlways, "Error: Can't listen at '%s', errno was (%d) '%s'", aPath, errno, strerror(errno));
+      close();
+      return fail;
+   }
+
+   if (gid != (gid_t)-1 && chown(aPath, (uid_t)-1, gid) != 0)
+      tell(eloAlways, "Warning: Can't set the group of '%s', errno was (%d) '%s'", aPath, errno, strerror(errno));
+
+   chmod(aPath, 0660);
+   path = strdup(aPath);
+
+   tell(eloAlways, "Serial line available for other processes at '%s'", path);
+
+   return success;
+}
+
+int P4Broker::close()
+{
+   for (unsigned int i = 0; i < clients.size(); i++)
+      ::close(clients[i].fd);
+
+   clients.clear();
+
+   if (fdListen >= 0)
+      ::close(fdListen);
+
+   if (path)
+      unlink(path);
+
+   free(path);
+   path = 0;
+   fdListen = na;
+   fdPending = na;
+
+   return done;
+}
+
+//***************************************************************************
+// Accept / Drop
+//***************************************************************************
+
+void P4Broker::accept()
+{
+   int fd;
+
+   if ((fd = ::accept(fdListen, 0, 0)) < 0)
+      return;
+
+   if (clients.size() >= maxClients)
+   {
+      tell(eloAlways, "Broker: Too many clients (%d), rejecting", (int)clients.size());
+      ::close(fd);
+      return;
+   }
+
+   Client c = { fd, cTimeMs::Now() };
+
+   clients.push_back(c);
+   tell(eloDetail, "Broker: Client connected (%d now)", (int)clients.size());
+}
+
+void P4Broker::drop(unsigned int i)
+{
+   if (clients[i].fd == fdPending)
+      fdPending = na;
+
+   ::close(clients[i].fd);
+   clients.erase(clients.begin() + i);
+   tell(eloDetail, "Broker: Client disconnected (%d left)", (int)clients.size());
+}
+
+void P4Broker::dropIdle()
+{
+   uint64_t now = cTimeMs::Now();
+
+   for (unsigned int i = clients.size(); i > 0; i--)
+   {
+      if (clients[i-1].fd != fdPending && now - clients[i-1].lastAt > maxIdle)
+      {
+         tell(eloDetail, "Broker: Client idle for more than %d seconds", maxIdle / 1000);
+         drop(i-1);
+      }
+   }
+}
+
+//***************************************************************************
+// Serve
+//   handle the requests of the clients, waits up to 'wait' ms for the
+//   first one. From the first request of a client's transaction until it
+//   ends it ('E') only this one is served, otherwise the listen socket and
+//   all clients are polled. Returns the number of handled requests
+//***************************************************************************
+
+int P4Broker::serve(int wait)
+{
+   int served = 0;
+
+   if (fdListen < 0)
+   {
+      if (wait > 0)
+         usleep(wait * 1000);
+
+      return 0;
+   }
+
+   dropIdle();
+
+   while (true)
+   {
+      struct pollfd fds[maxClients+1];
+      int count = 0;
+
+      if (fdPending >= 0 && cTimeMs::Now() - pendingAt > sessionTimeout)
+      {
+         tell(eloAlways, "Broker: Client didn't end its transaction, releasing the line");
+         fdPending = na;
+      }
+
+      if (fdPending >= 0)
+      {
+         fds[count].fd = fdPending;
+         fds[count++].events = POLLIN;
+      }
+      else
+      {
+         fds[count].fd = fdListen;
+         fds[count++].events = POLLIN;
+
+         for (unsigned int i = 0; i < clients.size(); i++)
+         {
+            fds[count].fd = clients[i].fd;
+            fds[count++].events = POLLIN;
+         }
+      }
+
+      if (poll(fds, count, wait) <= 0)
+         return served;
+
+      // one ready client per round, the first one accepted is served first
+
+      int fd = na;
+
+      for (int f = 0; f < count && fd == na; f++)
+         if (fds[f].revents)
+            fd = fds[f].fd;
+
+      if (fd == fdListen)
+      {
+         accept();
+         wait = idleTimeout;
+         continue;
+      }
+
+      unsigned int i = 0;
+
+      while (i < clients.size() && clients[i].fd != fd)
+         i++;
+
+      if (i >= clients.size())
+         return served;
+
+      if (handle(fd) != success)
+      {
+         drop(i);
+         return served;
+      }
+
+      clients[i].lastAt = cTimeMs::Now();
+      served++;
+      wait = fdPending >= 0 ? (int)sessionTimeout : (int)idleTimeout;
+   }
+}
+
+//***************************************************************************
+// Handle
+//***************************************************************************
+
+int P4Broker::handle(int fd)
+{
+   Message m;
+   byte data[P4Request::sizeMaxRequest*2+TB];
+
+   if (receiveMessage(fd, &m, data, sizeof(data), sessionTimeout) != success)
+      return fail;
+
+   switch (m.type)
+   {
+      case 'W':
+      {
+         int status = request->relayRequest(data, m.size);
+
+         // the line belongs to this client until it ends the transaction
+
+         fdPending = fd;
+         pendingAt = cTimeMs::Now();
+
+         return sendMessage(fd, 'F', status);
+      }
+
+      case 'R':
+      {
+         const byte* raw;
+         int size;
+         int status = request->relayReply(m.value, raw, size);
+
+         pendingAt = cTimeMs::Now();
+
+         return sendMessage(fd, 'F', status, raw, size);
+      }
+
+      case 'E':
+      {
+         // end of the transaction, the line is free for the others
+
+         fdPending = na;
+
+         return success;
+      }
+   }
+
+   tell(eloAlways, "Broker: Got unexpected message type '%c'", m.type);
+
+   return fail;
+}
+
+//***************************************************************************
+// Send / Receive Message
+//***************************************************************************
+
+int P4Broker::sendMessage(int fd, byte type, int value, const byte* data, int size)
+{
+   byte msg[sizeof(Message) + P4Request::sizeMaxReply*2+TB];
+   Message* m = (Message*)msg;
+
+   if (size > P4Request::sizeMaxReply*2)
+      return fail;
+
+   m->type = type;
+   m->value = value;
+   m->size = size;
+
+   if (size)
+      memcpy(msg+sizeof(Message), data, size);
+
+   if (::send(fd, msg, sizeof(Message)+size, MSG_NOSIGNAL) != (int)(sizeof(Message)+size))
+      return fail;
+
+   return success;
+}
+
+int P4Broker::receiveMessage(int fd, Message* m, byte* data, int max, int timeout)
+{
+   int status;
+
+   if ((status = receive(fd, m, sizeof(Message), timeout)) != success)
+      return status;
+
+   if (m->size > max)
+      return fail;
+
+   return receive(fd, data, m->size, timeout);
+}
+
+int P4Broker::receive(int fd, void* buf, int size, int timeout)
+{
+   int got = 0;
+
+   while (got < size)
+   {
+      struct pollfd fds;
+      int res;
+
+      fds.fd = fd;
+      fds.events = POLLIN;
+
+      if ((res = poll(&fds, 1, timeout)) < 0 && errno == EINTR)
+         continue;
+
+      if (res == 0)
+         return Serial::wrnTimeout;
+
+      if (res < 0 || (res = ::recv(fd, (char*)buf+got, size-got, 0)) <= 0)
+         return fail;
+
+      got += res;
+   }
+
+   return success;
+}
+
+//***************************************************************************
+// Class P4 Client
+//***************************************************************************
+
+int P4Client::open(const char* path)
+{
+   struct sockaddr_un addr;
+   int fd;
+
+   close();
+
+   if (!path)
+      path = P4Broker::defaultPath;
+
+   if (strlen(path) >= sizeof(addr.sun_path))
+      return fail;
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strcpy(addr.sun_path, path);
+
+   if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+      return fail;
+
+   if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+   {
+      tell(eloDetail, "No p4d listening at '%s'", path);
+      ::close(fd);
+      return fail;
+   }
+
+   tell(eloDetail, "Using serial line of p4d at '%s'", path);
+
+   sstrcpy(deviceName, path, sizeof(deviceName));
+   fdDevice = fd;
+   opened = yes;
+   flush();
+
+   return success;
+}
+
+int P4Client::close()
+{
+   if (fdDevice)
+      ::close(fdDevice);
+
+   fdDevice = 0;
+   opened = no;
+
+   return done;
+}
+
+//***************************************************************************
+// Write
+//***************************************************************************
+
+int P4Client::write(void* line, int size)
+{
+   P4Broker::Message m;
+   byte dummy[1];
+
+   if (!isOpen())
+      return fail;
+
+   statistic.writes++;
+   flush();
+
+   if (P4Broker::sendMessage(fdDevice, 'W', 0, (byte*)line, size) != success
+       || P4Broker::receiveMessage(fdDevice, &m, dummy, 0, P4Broker::clientTimeout) != success)
+   {
+      tell(eloAlways, "Error: Lost connection to p4d");
+      return fail;
+   }
+
+   return m.value;
+}
+
+//***************************************************************************
+// Release
+//   end of the transaction (see P4Request::RequestClean)
+//***************************************************************************
+
+int P4Client::release()
+{
+   if (!isOpen())
+      return fail;
+
+   if (P4Broker::sendMessage(fdDevice, 'E', 0) != success)
+   {
+      tell(eloAlways, "Error: Lost connection to p4d");
+      return fail;
+   }
+
+   return success;
+}
+
+//***************************************************************************
+// Read
+//   the broker replies with a complete frame, it's served from here
+//***************************************************************************
+
+int P4Client::read(void* buf, unsigned int count, int timeout)
+{
+   unsigned int n = 0;
+
+   if (!isOpen())
+      return fail;
+
+   if (pos >= sizeFrame)
+   {
+      P4Broker::Message m;
+
+      sizeFrame = pos = 0;
+
+      if (P4Broker::sendMessage(fdDevice, 'R', timeout) != success
+          || P4Broker::receiveMessage(fdDevice, &m, frame, sizeof(frame),
+                                      timeout + P4Broker::clientTimeout) != success)
+      {
+         tell(eloAlways, "Error: Lost connection to p4d");
+         return fail;
+      }
+
+      statistic.reads++;
+      statistic.bytes += m.size;
+
+      if (!m.size)
+         return m.value == FroelingService::wrnTimeout ? (int)wrnTimeout : fail;
+
+      sizeFrame = m.size;
+   }
+
+   while (n < count && pos < sizeFrame)
+      ((byte*)buf)[n++] = frame[pos++];
+
+   return n;
+}
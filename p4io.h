@@ -16,10 +16,12 @@
 #include <stdio.h>
 
 #include <vector>
+#include <list>
 
 #include "lib/serial.h"
 
 #include "service.h"
+#include "p4frame.h"
 
 //***************************************************************************
 // Class P4 Packet
@@ -33,14 +35,15 @@ class P4Packet : public FroelingService, public Serial
 
       enum Error
       {
-         wrnEndOfPacket = -100
+         wrnEndOfPacket = -100,
+         wrnCorrupt                    // packet received but not parseable
       };
 
       // object
 
       P4Packet();
 
-		int read();
+      int read(int timeout = na);       // ms, na -> the read timeout of the line
       int set(const char* data);
       int evaluate();
       std::vector<Parameter>* getParameters() { return &parameters; }
@@ -62,17 +65,77 @@ class P4Packet : public FroelingService, public Serial
 
       // functions
 
-      int readPacket(const char*& p);
+      int readPacket(const char*& p, int timeout);
 
       int getItem(Parameter* p);
-      int getToken(char* token);
+      int getToken(const char*& token);
 
       // data
 
-      char buffer[sizeMaxPacket+TB];
-      const char* pBuf;
+      char buffer[2*sizeMaxPacket+TB];  // UTF-8, up to two bytes per character
+      char* pBuf;
       std::vector<Parameter> parameters;
       char rbuffer[sizeMaxPacket+TB];
+      int rPos;                         // state of a partially received packet
+      int inPacket;
+      int skipped;
+};
+
+//***************************************************************************
+// Link Statistic
+//   per command counters of the serial link, p4d keeps them in a shared
+//   memory segment where 'p4 stats' can read them
+//***************************************************************************
+
+struct LinkStatistic
+{
+   enum Misc
+   {
+      shmKey = 0x3da00002,
+      layoutVersion = 2,             // increase on each change of the struct
+      histogramSize = 10
+   };
+
+   struct Command
+   {
+      unsigned long requests;
+      unsigned long replies;
+      unsigned long timeouts;
+      unsigned long retries;
+      unsigned long crcErrors;
+      unsigned long skippedFrames;   // unexpected frames (late replies)
+      unsigned long bytesOut;        // bytes on the wire
+      unsigned long bytesIn;
+      unsigned long bytesMasked;     // masking overhead of in- and outgoing frames
+      uint64_t sumMs;                // round trip, request to reply
+      unsigned int maxMs;
+      unsigned long histogram[histogramSize];
+
+      // round trip estimate for the timeout (like TCP's RTO)
+
+      unsigned long samples;
+      double srtt;                   // smoothed round trip in ms
+      double rttvar;                 // its mean deviation
+      int backoff;                   // doubled after each timeout
+   };
+
+   int version;                    // layoutVersion and size of the writer
+   int size;
+   time_t since;
+   unsigned long reopens;
+   unsigned long resyncs;
+   unsigned long skippedBytes;     // garbage in front of a frame
+   Command commands[256];
+
+   static const unsigned int histogramLimits[histogramSize];
+
+   void clear()       { memset(this, 0, sizeof(LinkStatistic)); version = layoutVersion; size = sizeof(LinkStatistic); since = time(0); }
+   void addRoundTrip(byte command, unsigned int ms, int sample = yes);
+   void show();
+   void summary(char* buf, int size);
+
+   static LinkStatistic* attach(int create);
+   static void detach(LinkStatistic* statistic);
 };
 
 //***************************************************************************
@@ -83,8 +146,31 @@ class P4Request : public FroelingService
 {
    public:
 
-      P4Request(Serial* aSerial)    { s = aSerial; text = 0; clear(); }
-      virtual ~P4Request()          { clear(); }
+      enum Timeouts
+      {
+         defTimeoutFloor = 100,             // ms
+         defTimeoutCeiling = 2000,          // ms, also used until a round trip is known
+         defRetries = 1,
+         maxBackoff = 4
+      };
+
+      enum Probe
+      {
+         probeTries = 3,                    // of probeValues() until a mismatch counts
+         probeTolerance = 5                 // raw units a live value may move between the reads
+      };
+
+      P4Request(Serial* aSerial)
+      {
+         s = aSerial; text = 0; expected = 0; corrupt = no; requestAt = 0;
+         framesReceived = 0; sizeLastRequest = 0; transactionDepth = 0;
+         setTimeouts(defTimeoutFloor, defTimeoutCeiling, defRetries);
+         statistic = &localStatistic;
+         statistic->clear();
+         clear();
+      }
+
+      virtual ~P4Request()          { shareStatistic(no); clear(); }
 
       class RequestClean
       {
@@ -93,21 +179,27 @@ class P4Request : public FroelingService
             RequestClean(P4Request* aReq)
             {
                req = aReq;
+               req->transactionDepth++;
             }
 
             ~RequestClean()
             {
-               int count = 0;
-               byte b;
+               // the reply is consumed by its size, only a corrupted
+               // transaction is worth to wait for more garbage
 
-               while (req->readByte(b, yes, 10) == success)
-                  count++;
+               int count = req->drain(req->corrupt ? req->timeoutFor(req->expected) : 0);
 
                if (count)
                {
                   tell(eloAlways, "Got %d unexpected bytes", count);
                   req->show("<- ");
                }
+
+               // end of the outermost transaction (e.g. setParameter() around
+               // its getParameter() calls), a broker may serve others now
+
+               if (!--req->transactionDepth && req->s)
+                  req->s->release();
             }
 
          private:
@@ -121,6 +213,7 @@ class P4Request : public FroelingService
          text = 0;
          sizeBufferContent = 0;
          sizeDecodedContent = 0;
+         cursor = 0;
          memset(&header, 0, sizeof(Header));
          memset(buffer, 0, sizeof(buffer));
          memset(decoded, 0, sizeof(buffer));
@@ -170,6 +263,8 @@ class P4Request : public FroelingService
       {
          header.id = htons(commId);
          header.command = command;
+         expected = command;
+         corrupt = no;
 
          prepareRequest();
 
@@ -178,6 +273,18 @@ class P4Request : public FroelingService
          if (!s || !s->isOpen())
             return fail;
 
+         statistic->commands[command].requests++;
+         statistic->commands[command].bytesOut += sizeBufferContent;
+         statistic->commands[command].bytesMasked += sizeBufferContent - sizeDecodedContent;
+         requestAt = cTimeMs::Now();
+         framesReceived = 0;
+         retried = 0;
+
+         // keep the frame for a retry
+
+         memcpy(lastRequest, buffer, sizeBufferContent);
+         sizeLastRequest = sizeBufferContent;
+
          return s->write(buffer, sizeBufferContent);
       }
 
@@ -186,6 +293,9 @@ class P4Request : public FroelingService
          char tmp[1000];
          *tmp = 0;
 
+         if (loglevel < elo)
+            return;
+
          sprintf(tmp+strlen(tmp), "%s", prefix);
 
          for (int i = 0; i < sizeBufferContent; i++)
@@ -204,6 +314,9 @@ class P4Request : public FroelingService
          char tmp[1000];
          *tmp = 0;
 
+         if (loglevel < eloDebug2)
+            return;
+
          sprintf(tmp+strlen(tmp), "%s", prefix);
 
          for (int i = 0; i < sizeDecodedContent; i++)
@@ -219,46 +332,34 @@ class P4Request : public FroelingService
 
       Header* getHeader() { return &header; }
 
-      int readHeader(int tms = 2000)
-      {
-         int status;
+      int readHeader(int tms = 0);           // 0 -> timeout by round trip estimate
+      int drain(int tms);
+      int resync();
+      int isCorrupt()     { return corrupt; }
 
-         clear();
+      void setSerial(Serial* aSerial)  { s = aSerial; }
 
-         if (!s || !s->isOpen())
-         {
-            tell(eloAlways, "Line not open, aborting read");
-            return fail;
-         }
-
-         if ((status = readWord(header.id, no, tms)) != success)
-         {
-            tell(eloAlways, "Read word failed, aborting");
-            return status;
-         }
-
-         if (header.id != commId)
-         {
-            tell(eloAlways, "Got wrong communication id %4.4x "
-                 "expected %4.4x", header.id, commId);
-            return fail;
-         }
+      // forward frames of other processes (see P4Broker)
 
-         if ((status = readWord(header.size, yes, tms)) != success)
-         {
-            tell(eloAlways, "Read size failed, status was %d", status);
-            return status;
-         }
+      int relayRequest(const byte* frame, int size);
+      int relayReply(int tms, const byte*& raw, int& size);
 
-         if ((status = readByte(header.command, yes, tms)) != success)
-         {
-            tell(eloAlways, "Read command failed, status was %d", status);
-            return status;
-         }
+      // timeouts
 
-         return success;
+      void setTimeouts(int floor, int ceiling, int retries)
+      {
+         timeoutFloor = floor;
+         timeoutCeiling = max(ceiling, floor);
+         maxRetries = retries;
       }
 
+      int timeoutFor(byte command);
+
+      // statistic
+
+      int shareStatistic(int share = yes);
+      LinkStatistic* getStatistic()  { return statistic; }
+
       // interface
 
       int getStatus(Status* s);
@@ -273,6 +374,8 @@ class P4Request : public FroelingService
       int setTimeRanges(TimeRanges* t);
 
       int getValue(Value* v);
+      int getValues(std::vector<Value>& values);
+      int probeValues(std::vector<Value>& values);
       int getDigitalOut(IoValue* v);
       int getDigitalIn(IoValue* v);
       int getAnalogOut(IoValue* v);
@@ -290,23 +393,43 @@ class P4Request : public FroelingService
 
       int check();
 
+      // frame codec
+
+      static int scanMask(const byte* p, int size);
+      static int mask(const byte* in, int size, byte* out);
+      static int unmask(const byte* in, int size, byte* out, int max, int& produced);
+
    protected:
 
       int prepareRequest();
+      int readFrame(int tms);
+      int isRetryable(byte command);
       int getError(ErrorInfo* e, int first);
       int getValueSpec(ValueSpec* v, int first);
       int getMenuItem(MenuItem* m, int first);
       int getTimeRanges(TimeRanges* t, int first);
+      int getValueChunk(std::vector<Value>& values, unsigned int first, unsigned int count);
 
-      int readByte(byte& v, int decode = yes, int tms = 1000);
-      int readWord(word& v, int decode = yes, int tms = 1000);
-      int readWord(sword& v, int decode = yes, int tms = 1000);
-      int readTime(time_t& t);         // 3 byte
-      int readDate(time_t& t);         // 3 byte
-      int readDateExt(time_t& t);      // 4 byte
-      int readTimeDate(time_t& t);     // 6 byte
-      int readTimeDateExt(time_t& t);  // 7 byte
+      int readByte(byte& v);
+      int readWord(word& v);
+      int readWord(sword& v);
       int readText(char*& s, int size);
+      int pendingBytes()               { return sizeDecodedContent - cursor; }
+
+      // decode the fields of 'Layout' (see p4frame.h) at once
+
+      template <class Layout, class... Ts> int readFields(Ts&... vs)
+      {
+         static_assert(sizeof...(Ts) == Layout::values, "Number of values doesn't match the layout");
+
+         if (cursor + Layout::size > sizeDecodedContent)
+            return fail;
+
+         Layout::get(decoded + cursor, vs...);
+         cursor += Layout::size;
+
+         return success;
+      }
 
       // data
 
@@ -320,11 +443,196 @@ class P4Request : public FroelingService
       byte buffer[sizeMaxRequest*2+TB];
       int sizeBufferContent;
 
-      byte decoded[sizeMaxRequest*2+TB];  // for debug
+      byte decoded[sizeMaxRequest*2+TB];  // unmasked frame
       int sizeDecodedContent;
+      int cursor;                         // read position in 'decoded'
+      byte expected;                      // command of the pending request
+      int corrupt;                        // last transaction was disturbed
+      uint64_t requestAt;
+      int framesReceived;                 // reply frames of the pending request
+      int transactionDepth;               // nested RequestClean scopes
+      int retried;
+
+      byte lastRequest[sizeMaxRequest*2+TB];
+      int sizeLastRequest;
+
+      int timeoutFloor;
+      int timeoutCeiling;
+      int maxRetries;
+
+      LinkStatistic* statistic;           // 'localStatistic' or the shared segment
+      LinkStatistic localStatistic;
 
       Serial* s;
 };
 
+//***************************************************************************
+// Request Queue
+//   typed requests with completion callback and deadline, performed one
+//   transaction at a time with an optional hook between the transactions
+//***************************************************************************
+
+class P4Queue : public FroelingService
+{
+   public:
+
+      enum Priority
+      {
+         prioHigh,
+         prioNormal,
+         prioLow,
+
+         prioCount
+      };
+
+      enum JobType
+      {
+         jtValue,              // object is Value*
+         jtValues,             // object is std::vector<Value>*
+         jtDigitalOut,         // object is IoValue*
+         jtDigitalIn,          // object is IoValue*
+         jtAnalogOut,          // object is IoValue*
+         jtParameter,          // object is ConfigParameter*
+         jtSetParameter,       // object is ConfigParameter*
+         jtStatus              // object is Status*
+      };
+
+      struct Job;
+
+      typedef void (*Callback)(Job* job, void* context);
+      typedef void (*Hook)(void* context);
+
+      struct Job
+      {
+         int type;
+         int priority;
+         uint64_t deadline;    // ms, 0 for none
+         int status;
+         void* object;         // request specific object, owned by the caller
+         void* data;           // user data
+         Callback callback;
+         void* context;
+      };
+
+      // object
+
+      P4Queue(P4Request* aRequest);
+      virtual ~P4Queue();
+
+      // interface
+
+      int enqueue(int type, void* object, Callback callback, void* context,
+                  void* data = 0, int priority = prioNormal, int timeout = 0);
+      int perform(int maxTime = 0);
+      int performNext();
+      int pending();
+      int clear();
+
+      void setHook(Hook fct, void* context)  { hook = fct; hookContext = context; }
+
+   protected:
+
+      int execute(Job* job);
+      void finish(Job* job, int status);
+
+      // data
+
+      P4Request* request;
+      std::list<Job*> jobs[prioCount];
+      Hook hook;
+      void* hookContext;
+};
+
+//***************************************************************************
+// Broker
+//   p4d owns the serial line and forwards the frames of other processes
+//   (p4, p4d -i) between its own transactions. Several clients may be
+//   connected, only a transaction (from the first request until the client
+//   ends it, e.g. setParameter with its two confirmations) is exclusive.
+//   Idle clients are disconnected after maxIdle
+//***************************************************************************
+
+class P4Broker
+{
+   public:
+
+      enum Misc
+      {
+         sessionTimeout = 1000,     // ms to wait for the next message of a client within its transaction
+         idleTimeout = 20,          // ms to wait for the next request of a client
+         clientTimeout = 60000,     // ms a client waits for the broker (p4d may be busy)
+         maxIdle = 300000,          // ms until an idle client is disconnected
+         maxClients = 8
+      };
+
+#pragma pack(1)
+      struct Message
+      {
+         byte type;                 // 'W' write frame, 'R' read frame, 'E' end of transaction, 'F' result
+         int value;                 // timeout of 'R' in ms, status of 'F'
+         word size;                 // size of the following data
+      };
+#pragma pack()
+
+      static const char* defaultPath;
+
+      P4Broker(P4Request* aRequest);
+      ~P4Broker();
+
+      int open(const char* aPath, const char* aGroup, const char* aDevice = 0);
+      int close();
+      int serve(int wait);
+
+      static int sendMessage(int fd, byte type, int value, const byte* data = 0, int size = 0);
+      static int receiveMessage(int fd, Message* m, byte* data, int max, int timeout);
+
+   protected:
+
+      struct Client
+      {
+         int fd;
+         uint64_t lastAt;           // latest request
+      };
+
+      int handle(int fd);
+      void accept();
+      void drop(unsigned int i);
+      void dropIdle();
+      static int receive(int fd, void* buf, int size, int timeout);
+
+      P4Request* request;
+      char* path;
+      int fdListen;
+      std::vector<Client> clients;
+      int fdPending;               // client wrote a frame and will ask for the reply
+      uint64_t pendingAt;
+};
+
+//***************************************************************************
+// Client
+//   serial line of a running p4d, used instead of the tty
+//***************************************************************************
+
+class P4Client : public Serial
+{
+   public:
+
+      P4Client()              { fdDevice = 0; sizeFrame = pos = 0; }
+      ~P4Client()             { close(); }
+
+      int open(const char* path = 0);
+      int close();
+      int flush()             { sizeFrame = pos = 0; return done; }
+      int write(void* line, int size = 0);
+      int release();
+      int read(void* buf, unsigned int count, int timeout = 0);
+
+   protected:
+
+      byte frame[P4Request::sizeMaxReply*2+TB];
+      int sizeFrame;
+      int pos;
+};
+
 //***************************************************************************
 #endif // _IO_P4_H_
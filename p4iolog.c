@@ -0,0 +1,371 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4iolog.c
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+
+#include "p4iolog.h"
+#include "p4archive.h"
+
+//***************************************************************************
+// Io Log
+//***************************************************************************
+
+IoLog::IoLog()
+{
+   connection = 0;
+   dict = 0;
+   tableEvents = 0;
+   tableRuntime = 0;
+   selectLastEvent = 0;
+   maxGap = 600;
+}
+
+IoLog::~IoLog()
+{
+   close();
+}
+
+//***************************************************************************
+// Open / Close
+//***************************************************************************
+
+int IoLog::open(cDbConnection* aConnection, SeriesDict* aDict)
+{
+   int status = success;
+
+   close();
+
+   connection = aConnection;
+   dict = aDict;
+   tableEvents = new cDbTable(connection, "ioevents");
+   tableRuntime = new cDbTable(connection, "ioruntime");
+
+   if (tableEvents->open() != success || tableRuntime->open() != success)
+   {
+      close();
+      return fail;
+   }
+
+   // select state, time from ioevents
+   //   where seriesid = ? and time <= ?
+   //   order by time desc limit 1
+
+   selectLastEvent = new cDbStatement(tableEvents);
+
+   selectLastEvent->build("select ");
+   selectLastEvent->bind("STATE", cDBS::bndOut);
+   selectLastEvent->bind("TIME", cDBS::bndOut, ", ");
+   selectLastEvent->build(" from %s where ", tableEvents->TableName());
+   selectLastEvent->bind("SERIESID", cDBS::bndIn | cDBS::bndSet);
+   selectLastEvent->bindCmp(0, "TIME", 0, "<=", " and ");
+   selectLastEvent->build(" order by time desc limit 1");
+
+   status += selectLastEvent->prepare();
+
+   if (status != success)
+      close();
+
+   return status;
+}
+
+void IoLog::close()
+{
+   delete selectLastEvent;  selectLastEvent = 0;
+   delete tableEvents;      tableEvents = 0;
+   delete tableRuntime;     tableRuntime = 0;
+
+   connection = 0;
+   dict = 0;
+}
+
+//***************************************************************************
+// Load
+//   the counters of the day written by a former run and the latest state,
+//   merged into the ones accumulated since
+//***************************************************************************
+
+int IoLog::load(Day* day)
+{
+   int seriesId;
+
+   if (!connection || !connection->isConnected())
+      return fail;
+
+   day->loaded = yes;
+
+   if ((seriesId = dict->seriesIdOf(day->address, day->type, no)) == na)
+      return done;
+
+   tableRuntime->clear();
+   tableRuntime->setValue("SERIESID", seriesId);
+   tableRuntime->setValue("DAY", day->day);
+
+   if (tableRuntime->find())
+   {
+      day->onTime += tableRuntime->getIntValue("ONTIME");
+      day->switches += tableRuntime->getIntValue("SWITCHES");
+      day->observed += tableRuntime->getIntValue("OBSERVED");
+
+      if (day->state == na)
+      {
+         day->state = tableRuntime->getIntValue("STATE");
+         day->lastAt = tableRuntime->getIntValue("LASTTIME");
+      }
+   }
+   else if (day->state == na)
+   {
+      tableEvents->clear();
+      tableEvents->setValue("SERIESID", seriesId);
+      tableEvents->setValue("TIME", time(0));
+
+      if (selectLastEvent->find())
+         day->state = tableEvents->getIntValue("STATE");
+
+      selectLastEvent->freeResult();
+   }
+
+   tableRuntime->reset();
+
+   return success;
+}
+
+//***************************************************************************
+// Account
+//   the time from - to in the latest state
+//***************************************************************************
+
+void IoLog::account(Day* day, time_t from, time_t to)
+{
+   day->observed += to - from;
+
+   if (day->state)
+      day->onTime += to - from;
+}
+
+//***************************************************************************
+// Add
+//***************************************************************************
+
+int IoLog::add(int address, const char* type, time_t time, int state)
+{
+   char key[20];
+   std::map<std::string, Day>::iterator it;
+
+   sprintf(key, "%s:%d", type, address);
+
+   if ((it = days.find(key)) == days.end())
+   {
+      Day d = { address, "", SampleArchive::dayOf(time), na, 0, 0, 0, 0, no };
+
+      sstrcpy(d.type, type, sizeof(d.type));
+      load(&d);
+      it = days.insert(std::make_pair(std::string(key), d)).first;
+   }
+
+   Day* day = &it->second;
+
+   if (time <= day->lastAt)
+      return done;
+
+   // the time since the latest sample, split at midnight
+
+   int covered = day->lastAt && day->state != na && time - day->lastAt <= maxGap;
+   time_t from = day->lastAt;
+
+   while (day->day < SampleArchive::dayOf(time))
+   {
+      time_t end = SampleArchive::nextDay(day->day);
+
+      if (covered)
+      {
+         account(day, from, end);
+         from = end;
+      }
+
+      finished.push_back(*day);
+
+      day->day = covered ? end : SampleArchive::dayOf(time);
+      day->onTime = 0;
+      day->switches = 0;
+      day->observed = 0;
+      day->loaded = yes;
+   }
+
+   if (covered)
+      account(day, from, time);
+
+   // the change
+
+   if (state != day->state)
+   {
+      Event e = { address, "", time, state };
+
+      sstrcpy(e.type, type, sizeof(e.type));
+
+      if (day->state != na)
+         day->switches++;
+
+      if (pending.size() >= maxPending)
+      {
+         tell(eloAlways, "Warning: Too many io events pending, dropping the oldest");
+         pending.erase(pending.begin());
+      }
+
+      pending.push_back(e);
+   }
+
+   day->state = state;
+   day->lastAt = time;
+
+   return success;
+}
+
+//***************************************************************************
+// Store Day
+//***************************************************************************
+
+int IoLog::storeDay(const Day* day)
+{
+   int seriesId = dict->seriesIdOf(day->address, day->type);
+
+   if (seriesId == na)
+      return fail;
+
+   tableRuntime->clear();
+   tableRuntime->setValue("SERIESID", seriesId);
+   tableRuntime->setValue("DAY", day->day);
+   tableRuntime->setValue("STATE", day->state);
+   tableRuntime->setValue("LASTTIME", day->lastAt);
+   tableRuntime->setValue("ONTIME", day->onTime);
+   tableRuntime->setValue("SWITCHES", day->switches);
+   tableRuntime->setValue("OBSERVED", day->observed);
+
+   return tableRuntime->upsert();
+}
+
+//***************************************************************************
+// Write
+//   on failure everything stays in memory for the next cycle
+//***************************************************************************
+
+int IoLog::write()
+{
+   std::map<std::string, Day>::iterator it;
+
+   if (!connection || !connection->isConnected())
+      return fail;
+
+   // the days seen first while the database was lost
+
+   for (it = days.begin(); it != days.end(); ++it)
+      if (!it->second.loaded)
+         load(&it->second);
+
+   for (unsigned int i = 0; i < finished.size(); i++)
+      if (!finished[i].loaded)
+         load(&finished[i]);
+
+   // the ids of the series first, they may need a (committed) insert
+
+   for (unsigned int i = 0; i < pending.size(); i++)
+      if (dict->seriesIdOf(pending[i].address, pending[i].type) == na)
+         return fail;
+
+   for (it = days.begin(); it != days.end(); ++it)
+      if (dict->seriesIdOf(it->second.address, it->second.type) == na)
+         return fail;
+
+   connection->startTransaction();
+
+   for (unsigned int i = 0; i < pending.size(); i++)
+   {
+      int seriesId = dict->seriesIdOf(pending[i].address, pending[i].type);
+
+      tableEvents->clear();
+      tableEvents->setValue("SERIESID", seriesId);
+      tableEvents->setValue("TIME", pending[i].time);
+      tableEvents->setValue("STATE", pending[i].state);
+
+      if (seriesId == na || tableEvents->upsert() != success)
+      {
+         connection->rollback();
+         return fail;
+      }
+   }
+
+   for (unsigned int i = 0; i < finished.size(); i++)
+   {
+      if (storeDay(&finished[i]) != success)
+      {
+         connection->rollback();
+         return fail;
+      }
+   }
+
+   for (it = days.begin(); it != days.end(); ++it)
+   {
+      if (it->second.state != na && storeDay(&it->second) != success)
+      {
+         connection->rollback();
+         return fail;
+      }
+   }
+
+   if (connection->commit() != success)
+      return fail;
+
+   pending.clear();
+   finished.clear();
+
+   return success;
+}
+
+//***************************************************************************
+// Today
+//***************************************************************************
+
+int IoLog::today(int address, const char* type, Day* day)
+{
+   char key[20];
+   std::map<std::string, Day>::iterator it;
+
+   sprintf(key, "%s:%d", type, address);
+
+   if ((it = days.find(key)) == days.end() || it->second.state == na)
+      return fail;
+
+   *day = it->second;
+
+   return success;
+}
+
+//***************************************************************************
+// State At
+//   the state of the latest event up to t
+//***************************************************************************
+
+int IoLog::stateAt(int address, const char* type, time_t t, int& state)
+{
+   int seriesId;
+   int found;
+
+   if (!connection || !connection->isConnected())
+      return fail;
+
+   if ((seriesId = dict->seriesIdOf(address, type, no)) == na)
+      return fail;
+
+   tableEvents->clear();
+   tableEvents->setValue("SERIESID", seriesId);
+   tableEvents->setValue("TIME", t);
+
+   if ((found = selectLastEvent->find()))
+      state = tableEvents->getIntValue("STATE");
+
+   selectLastEvent->freeResult();
+
+   return found ? success : fail;
+}
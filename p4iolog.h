@@ -0,0 +1,93 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4iolog.h
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+
+#ifndef _P4IOLOG_H_
+#define _P4IOLOG_H_
+
+#include <vector>
+#include <map>
+#include <string>
+
+#include "lib/db.h"
+#include "p4writer.h"
+
+//***************************************************************************
+// Io Log
+//   the digital inputs/outputs (DI/DO) as events, one row in ioevents per
+//   change of the state. Per series and (local) day the time in state on,
+//   the switches and the time covered by samples are accumulated in memory
+//   and written to ioruntime each cycle, the runtime of a day is one row.
+//   A state holds from its sample to the next one, gaps longer than maxGap
+//   (p4d down) are not counted.
+//***************************************************************************
+
+class IoLog
+{
+   public:
+
+      enum Misc
+      {
+         maxPending = 10000        // events kept while the database is lost
+      };
+
+      struct Day
+      {
+         int address;
+         char type[2+TB];
+         time_t day;               // begin of the local day
+         int state;                // latest state, na if unknown
+         time_t lastAt;            // time of the latest sample
+         int onTime;               // seconds
+         int switches;
+         int observed;             // seconds
+         int loaded;               // merged with the row of a former run
+      };
+
+      struct Event
+      {
+         int address;
+         char type[2+TB];
+         time_t time;
+         int state;
+      };
+
+      IoLog();
+      ~IoLog();
+
+      int open(cDbConnection* aConnection, SeriesDict* aDict);
+      void close();                // the state in memory is kept
+
+      void setMaxGap(int seconds)  { maxGap = seconds; }
+
+      int add(int address, const char* type, time_t time, int state);
+      int write();                 // the events and days of the cycle, in one transaction
+      int today(int address, const char* type, Day* day);           // from memory
+      int stateAt(int address, const char* type, time_t t, int& state);
+
+      static double dutyCycle(const Day* day) { return day->observed ? day->onTime / (double)day->observed : 0; }
+
+   protected:
+
+      int load(Day* day);
+      void account(Day* day, time_t from, time_t to);
+      int storeDay(const Day* day);
+
+      cDbConnection* connection;
+      SeriesDict* dict;
+      cDbTable* tableEvents;
+      cDbTable* tableRuntime;
+      cDbStatement* selectLastEvent;
+
+      int maxGap;
+      std::map<std::string, Day> days;       // current day per series, key 'type:address'
+      std::vector<Day> finished;             // days ended, not written yet
+      std::vector<Event> pending;            // not written yet
+};
+
+//***************************************************************************
+#endif // _P4IOLOG_H_
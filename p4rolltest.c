@@ -0,0 +1,261 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4rolltest.c
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+// Test of the rollup tiers without raw samples (like sampleStore = tsdb)
+//   the rows of the tiers are written like SampleWriter::write() does to a
+//   store in memory, across a restart and failed writes, and compared with
+//   the aggregates calculated from all samples
+//
+//   p4rolltest
+//***************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "p4writer.h"
+
+typedef std::map<std::string, SampleRollup::Bucket> Rows;
+
+static SampleRollup::Tier tiers[] =
+{
+   { "A",   900, 0 },
+   { "H",  3600, 0 },
+   { "D", 86400, 0 }
+};
+
+static const int tierCount = sizeof(tiers) / sizeof(SampleRollup::Tier);
+static const int seriesCount = 3;
+
+//***************************************************************************
+// Samples
+//   one per series and minute, a cycle writes 'perWrite' minutes
+//***************************************************************************
+
+void createSamples(time_t from, int minutes, std::vector<Sample>* samples)
+{
+   srand(1);
+
+   for (int m = 0; m < minutes; m++)
+   {
+      for (int s = 1; s <= seriesCount; s++)
+      {
+         Sample sample;
+
+         memset(&sample, 0, sizeof(Sample));
+         sample.time = from + m * 60;
+         sample.seriesId = s;
+         sample.value = round((20 + 10 * sin(m / 50.0 + s) + (rand() % 100) / 100.0) * 100) / 100;
+         sample.flags = Sample::sfRollup;       // no raw row, like sampleStore = tsdb
+
+         samples->push_back(sample);
+      }
+   }
+}
+
+//***************************************************************************
+// Write
+//   the rollup part of SampleWriter::write() and addBuckets(), the store
+//   keeps the value rounded like the column
+//***************************************************************************
+
+int write(std::vector<SampleRollup>* rollups, std::vector<Sample>* samples, Rows* store, int fail)
+{
+   std::vector<SampleRollup> saved = *rollups;
+   std::vector<SampleRollup::Bucket> finished;
+   std::vector<SampleRollup::Bucket> partials;
+   Rows rows;
+
+   for (unsigned int i = 0; i < samples->size(); i++)
+      for (unsigned int t = 0; t < rollups->size(); t++)
+         rollups->at(t).add(&samples->at(i), &finished, &partials);
+
+   for (unsigned int t = 0; t < rollups->size(); t++)
+      rollups->at(t).closeStale(samples->back().time, &finished, &partials);
+
+   if (fail)
+   {
+      *rollups = saved;
+      return ::fail;
+   }
+
+   SampleRollup::combine(&finished, &partials, &rows);
+
+   for (Rows::iterator it = rows.begin(); it != rows.end(); it++)
+   {
+      SampleRollup::Bucket* b = &it->second;
+
+      if (!b->exact && store->find(it->first) != store->end())
+         SampleRollup::merge(b, &(*store)[it->first]);
+
+      b->sum = round(b->sum / b->count * 100) / 100 * b->count;
+      (*store)[it->first] = *b;
+   }
+
+   return success;
+}
+
+//***************************************************************************
+// Stop
+//***************************************************************************
+
+void stop(std::vector<SampleRollup>* rollups, Rows* store)
+{
+   std::vector<SampleRollup::Bucket> finished;
+   std::vector<SampleRollup::Bucket> open;
+   Rows rows;
+
+   for (unsigned int t = 0; t < rollups->size(); t++)
+      rollups->at(t).closeAll(&open);
+
+   SampleRollup::combine(&finished, &open, &rows);
+
+   for (Rows::iterator it = rows.begin(); it != rows.end(); it++)
+   {
+      SampleRollup::Bucket* b = &it->second;
+
+      if (store->find(it->first) != store->end())
+         SampleRollup::merge(b, &(*store)[it->first]);
+
+      b->sum = round(b->sum / b->count * 100) / 100 * b->count;
+      (*store)[it->first] = *b;
+   }
+}
+
+//***************************************************************************
+// Check
+//   the stored rows against the buckets of all samples
+//***************************************************************************
+
+int check(const char* title, std::vector<Sample>* samples, Rows* store)
+{
+   std::vector<SampleRollup::Bucket> finished;
+   std::vector<SampleRollup::Bucket> open;
+   std::vector<SampleRollup> rollups;
+   Rows expected;
+   int errors = 0;
+
+   for (int t = 0; t < tierCount; t++)
+      rollups.push_back(SampleRollup(&tiers[t], 1));
+
+   for (unsigned int i = 0; i < samples->size(); i++)
+      for (unsigned int t = 0; t < rollups.size(); t++)
+         rollups[t].add(&samples->at(i), &finished, &open);
+
+   for (unsigned int t = 0; t < rollups.size(); t++)
+      rollups[t].closeAll(&open);
+
+   SampleRollup::combine(&finished, &open, &expected);
+
+   if (expected.size() != store->size())
+   {
+      printf("%s: %d rows expected, %d stored\n", title, (int)expected.size(), (int)store->size());
+      errors++;
+   }
+
+   for (Rows::iterator it = expected.begin(); it != expected.end(); it++)
+   {
+      SampleRollup::Bucket* e = &it->second;
+      Rows::iterator s = store->find(it->first);
+
+      if (s == store->end())
+      {
+         printf("%s: row '%s' missing\n", title, it->first.c_str());
+         errors++;
+         continue;
+      }
+
+      SampleRollup::Bucket* b = &s->second;
+
+      if (b->count != e->count || fabs(b->sum / b->count - e->sum / e->count) > 0.01
+          || b->min != e->min || b->max != e->max || b->first != e->first || b->last != e->last)
+      {
+         printf("%s: row '%s' count %d/%d, avg %.2f/%.2f, min %.2f/%.2f, max %.2f/%.2f, "
+                "first %.2f/%.2f, last %.2f/%.2f (stored/expected)\n", title, it->first.c_str(),
+                b->count, e->count, b->sum / b->count, e->sum / e->count, b->min, e->min,
+                b->max, e->max, b->first, e->first, b->last, e->last);
+         errors++;
+      }
+   }
+
+   printf("%-40s %s (%d rows)\n", title, errors ? "failed" : "ok", (int)expected.size());
+
+   return errors ? ::fail : success;
+}
+
+//***************************************************************************
+// Run
+//   the samples in cycles of 'perWrite' minutes, a restart after
+//   'restartAt' minutes, each 'failEvery'th write fails once and its
+//   samples come again with the next one (replayed from the spool)
+//***************************************************************************
+
+int run(const char* title, int restartAt, int failEvery)
+{
+   enum { perWrite = 5 };
+
+   std::vector<Sample> samples;
+   std::vector<SampleRollup> rollups;
+   Rows store;
+   time_t from = SampleRollup::bucketStart(time(0) - 2 * tmeSecondsPerDay, tmeSecondsPerDay) + 1234;
+   int minutes = 2 * tmeSecondsPerDay / tmeSecondsPerMinute;
+   unsigned int pending = 0;             // first sample not yet written
+   int writes = 0;
+
+   createSamples(from, minutes, &samples);
+
+   for (int t = 0; t < tierCount; t++)
+      rollups.push_back(SampleRollup(&tiers[t], from));
+
+   while (pending < samples.size())
+   {
+      unsigned int end = std::min(pending + perWrite * seriesCount, (unsigned int)samples.size());
+
+      // restart in the middle of the buckets
+
+      if (restartAt && samples[pending].time >= from + restartAt * tmeSecondsPerMinute && rollups.size())
+      {
+         stop(&rollups, &store);
+         rollups.clear();
+
+         for (int t = 0; t < tierCount; t++)
+            rollups.push_back(SampleRollup(&tiers[t], samples[pending].time));
+
+         restartAt = 0;
+      }
+
+      std::vector<Sample> chunk(samples.begin() + pending, samples.begin() + end);
+
+      if (write(&rollups, &chunk, &store, failEvery && ++writes % failEvery == 0) == success)
+         pending = end;
+   }
+
+   stop(&rollups, &store);
+
+   return check(title, &samples, &store);
+}
+
+//***************************************************************************
+// Main
+//***************************************************************************
+
+int main(int argc, char** argv)
+{
+   int status = success;
+
+   logstdout = yes;
+   loglevel = 0;
+
+   status += run("without restart", 0, 0);
+   status += run("restart", 1000, 0);
+   status += run("failed writes", 0, 7);
+   status += run("restart and failed writes", 1000, 7);
+
+   return status == success ? 0 : 1;
+}
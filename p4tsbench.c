@@ -0,0 +1,211 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4tsbench.c
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+// Benchmark of the time series store
+//   appends synthetic samples (temperature like series, one cycle per
+//   interval) to the time series store and - if a database is given - to
+//   a copy of the sampledata table, compares the insert throughput and
+//   the size on disk
+//
+//   p4tsbench <path> [<series> [<days> [<interval> [<host> <db> <user> <pass>]]]]
+//***************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include <string>
+
+#include "lib/db.h"
+#include "p4tsdb.h"
+
+//***************************************************************************
+// Now
+//***************************************************************************
+
+double nowNs()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return ts.tv_sec * 1000000000.0 + ts.tv_nsec;
+}
+
+//***************************************************************************
+// Sample Value
+//   slow daily swing plus some noise, rounded to the resolution the
+//   s 3200 delivers (0.1), every 4th series is a state like value
+//***************************************************************************
+
+double sampleValue(int series, time_t t)
+{
+   if (series % 4 == 3)
+      return (t / 3600 + series) % 5 == 0 ? 1 : 0;
+
+   double v = 40 + 20 * sin((t % tmeSecondsPerDay) * 2 * M_PI / tmeSecondsPerDay + series)
+      + (rand() % 10) / 10.0;
+
+   return round(v * 10) / 10;
+}
+
+//***************************************************************************
+// Bench Tsdb
+//***************************************************************************
+
+int benchTsdb(const char* path, int seriesCount, time_t start, int cycles, int interval)
+{
+   TsStore store(path);
+   TsStore::Statistic stat;
+   std::vector<TsSeries::Point> points;
+   double begin, appendNs, queryNs;
+
+   srand(1);
+   begin = nowNs();
+
+   for (int c = 0; c < cycles; c++)
+   {
+      time_t t = start + c * interval;
+
+      for (int s = 0; s < seriesCount; s++)
+         store.append(s, "VA", t, sampleValue(s, t));
+
+      store.sync();
+   }
+
+   appendNs = nowNs() - begin;
+   store.getStatistic(&stat);
+
+   // one day of each series, as the web interface does for the charts
+
+   begin = nowNs();
+
+   for (int s = 0; s < seriesCount; s++)
+      store.query(s, "VA", start + (cycles * interval) / 2, start + (cycles * interval) / 2 + tmeSecondsPerDay, &points);
+
+   queryNs = nowNs() - begin;
+
+   tell(eloAlways, "tsdb:  %lu samples in %.1f s, %.0f samples/s, %zu kB (%.2f bytes/sample)",
+        stat.points, appendNs / 1000000000.0, stat.points / (appendNs / 1000000000.0),
+        stat.usedBytes / 1024, (double)stat.usedBytes / stat.points);
+   tell(eloAlways, "tsdb:  query of one day, %.2f ms/series (%zu points)",
+        queryNs / 1000000.0 / seriesCount, points.size());
+
+   return success;
+}
+
+//***************************************************************************
+// Bench MySQL
+//   the rows are inserted into a copy of sampledata, one transaction per
+//   cycle like the sample writer does
+//***************************************************************************
+
+int benchMySql(int seriesCount, time_t start, int cycles, int interval)
+{
+   cDbConnection* connection = new cDbConnection();
+   double begin, insertNs;
+   int kb = 0;
+
+   if (connection->attachConnection() != success)
+   {
+      delete connection;
+      return fail;
+   }
+
+   connection->query("drop table if exists tsbench");
+
+   if (connection->query("create table tsbench like sampledata") != success)
+   {
+      delete connection;
+      return fail;
+   }
+
+   srand(1);
+   begin = nowNs();
+
+   for (int c = 0; c < cycles; c++)
+   {
+      time_t t = start + c * interval;
+      std::string stmt = "insert into tsbench (seriesid, aggregate, time, value, samples) values ";
+
+      for (int s = 0; s < seriesCount; s++)
+      {
+         char row[100];
+
+         sprintf(row, "%s(%d, 'S', %ld, %.1f, 1)", s ? ", " : "", s + 1, (long)t, sampleValue(s, t));
+         stmt += row;
+      }
+
+      connection->startTransaction();
+      connection->query("%s", stmt.c_str());
+      connection->commit();
+   }
+
+   insertNs = nowNs() - begin;
+
+   connection->query("analyze table tsbench");
+   connection->queryReset();
+   connection->query(kb, "select (data_length + index_length) div 1024 from information_schema.tables"
+                     " where table_schema = database() and table_name = 'tsbench'");
+   connection->query("drop table tsbench");
+
+   tell(eloAlways, "mysql: %d samples in %.1f s, %.0f samples/s, %d kB (%.2f bytes/sample)",
+        seriesCount * cycles, insertNs / 1000000000.0, seriesCount * cycles / (insertNs / 1000000000.0),
+        kb, kb * 1024.0 / (seriesCount * cycles));
+
+   connection->detachConnection();
+   delete connection;
+
+   return success;
+}
+
+//***************************************************************************
+// Main
+//***************************************************************************
+
+int main(int argc, char** argv)
+{
+   if (argc < 2)
+   {
+      printf("Usage: p4tsbench <path> [<series> [<days> [<interval> [<host> <db> <user> <pass>]]]]\n");
+      return 1;
+   }
+
+   const char* path = argv[1];
+   int seriesCount = argc > 2 ? atoi(argv[2]) : 100;
+   int days = argc > 3 ? atoi(argv[3]) : 30;
+   int interval = argc > 4 ? atoi(argv[4]) : 60;
+   int cycles = days * tmeSecondsPerDay / interval;
+   time_t start = time(0) - days * tmeSecondsPerDay;
+
+   logstdout = yes;
+   start -= start % interval;
+
+   tell(eloAlways, "%d series, %d days, one sample per %d seconds", seriesCount, days, interval);
+
+   if (benchTsdb(path, seriesCount, start, cycles, interval) != success)
+      return 1;
+
+   if (argc > 8)
+   {
+      cDbConnection::init();
+      cDbConnection::setEncoding("utf8");
+      cDbConnection::setHost(argv[5]);
+      cDbConnection::setName(argv[6]);
+      cDbConnection::setUser(argv[7]);
+      cDbConnection::setPass(argv[8]);
+
+      if (benchMySql(seriesCount, start, cycles, interval) != success)
+         tell(eloAlways, "MySQL benchmark failed");
+
+      cDbConnection::exit();
+   }
+
+   return 0;
+}
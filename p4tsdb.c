@@ -0,0 +1,775 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4tsdb.c
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include "p4tsdb.h"
+
+//***************************************************************************
+// Bit Writer / Reader
+//***************************************************************************
+
+void BitWriter::write(uint64_t value, int bits)
+{
+   while (bits-- > 0)
+   {
+      byte mask = 0x80 >> (pos & 7);
+
+      // clear too, behind a torn point the block may hold garbage
+
+      if ((value >> bits) & 1)
+         buffer[pos >> 3] |= mask;
+      else
+         buffer[pos >> 3] &= ~mask;
+
+      pos++;
+   }
+}
+
+uint64_t BitReader::read(int bits)
+{
+   uint64_t value = 0;
+
+   if (pos + bits > end)
+   {
+      overrun = yes;
+      return 0;
+   }
+
+   while (bits-- > 0)
+   {
+      value = (value << 1) | ((buffer[pos >> 3] >> (7 - (pos & 7))) & 1);
+      pos++;
+   }
+
+   return value;
+}
+
+static int64_t signExtend(uint64_t value, int bits)
+{
+   uint64_t sign = 1ULL << (bits - 1);
+
+   return (int64_t)((value ^ sign) - sign);
+}
+
+//***************************************************************************
+// Ts Series
+//***************************************************************************
+
+const uint32_t TsSeries::payloadBits = (TsSeries::blockSize - sizeof(TsSeries::BlockHeader)) * 8;
+
+TsSeries::TsSeries()
+{
+   path = 0;
+   fd = na;
+   blocks = 0;
+   capacity = 0;
+   map = 0;
+   mapSize = 0;
+   window = 0;
+   windowStart = 0;
+   dirty = no;
+   points = 0;
+}
+
+TsSeries::~TsSeries()
+{
+   close();
+}
+
+//***************************************************************************
+// Open
+//***************************************************************************
+
+int TsSeries::open(const char* aPath, int aAddress, const char* aType)
+{
+   struct stat st;
+   FileHeader fh;
+
+   close();
+
+   path = strdup(aPath);
+
+   if ((fd = ::open(path, O_RDWR | O_CREAT, 0644)) < 0 || fstat(fd, &st) != 0)
+   {
+      tell(eloAlways, "Error: Can't open series '%s', error was '%s'", path, strerror(errno));
+      close();
+      return fail;
+   }
+
+   if (!st.st_size)
+   {
+      memset(&fh, 0, sizeof(FileHeader));
+      memcpy(fh.magic, "P4TSDB1", 8);
+      fh.blockSize = blockSize;
+      fh.address = aAddress;
+      sstrcpy(fh.type, aType, sizeof(fh.type));
+
+      if (pwrite(fd, &fh, sizeof(FileHeader), 0) != sizeof(FileHeader)
+          || ftruncate(fd, headerSize) != 0)
+      {
+         tell(eloAlways, "Error: Can't create series '%s', error was '%s'", path, strerror(errno));
+         close();
+         return fail;
+      }
+
+      st.st_size = headerSize;
+   }
+   else if (pread(fd, &fh, sizeof(FileHeader), 0) != sizeof(FileHeader)
+            || memcmp(fh.magic, "P4TSDB1", 8) != 0 || fh.blockSize != blockSize
+            || (size_t)st.st_size < headerSize + (size_t)fh.blocks * blockSize)
+   {
+      tell(eloAlways, "Error: '%s' is not a valid series file, ignoring series", path);
+      close();
+      return fail;
+   }
+
+   blocks = fh.blocks;
+   capacity = (st.st_size - headerSize) / blockSize;
+
+   // build the block index from the block headers
+
+   for (uint32_t b = 0; b < blocks; b++)
+   {
+      BlockHeader h;
+      IndexEntry e;
+
+      if (pread(fd, &h, sizeof(BlockHeader), headerSize + (off_t)b * blockSize) != sizeof(BlockHeader))
+      {
+         tell(eloAlways, "Error: Can't read block %u of series '%s'", b, path);
+         close();
+         return fail;
+      }
+
+      e.firstTime = h.firstTime;
+      e.lastTime = h.lastTime;
+      index.push_back(e);
+      points += h.count;
+   }
+
+   if (blocks && (mapWindow(blocks-1) != success || recover() != success))
+   {
+      close();
+      return fail;
+   }
+
+   return success;
+}
+
+int TsSeries::close()
+{
+   if (window)
+      sync();
+
+   unmapWindow();
+
+   if (fd >= 0)
+      ::close(fd);
+
+   fd = na;
+   free(path);
+   path = 0;
+   blocks = 0;
+   capacity = 0;
+   points = 0;
+   index.clear();
+
+   return success;
+}
+
+//***************************************************************************
+// Recover
+//   the state of the encoder in the header of the last block is rebuilt
+//   by decoding its counted points, a crash while appending may have left
+//   it half updated
+//***************************************************************************
+
+int TsSeries::recover()
+{
+   byte* block = blockAt(blocks-1);
+   BlockHeader* h = (BlockHeader*)block;
+   BlockHeader state;
+
+   points -= h->count;
+
+   if (decode(block, &state, 0, 0, 0) != success)
+   {
+      tell(eloAlways, "Error: Last block of series '%s' is corrupt, dropping it", path);
+      memset(&state, 0, sizeof(BlockHeader));
+      state.firstTime = state.lastTime = h->firstTime;
+      state.leading = 0xff;
+   }
+
+   *h = state;
+   index.back().firstTime = h->firstTime;
+   index.back().lastTime = h->lastTime;
+   points += h->count;
+
+   return success;
+}
+
+//***************************************************************************
+// Map Window
+//   the window holding the block is mapped, the file is extended (and the
+//   blocks allocated) before - a full disk must not hit us at a write to
+//   the map
+//***************************************************************************
+
+int TsSeries::mapWindow(uint32_t block)
+{
+   static long pageSize = sysconf(_SC_PAGESIZE);
+
+   uint32_t start = block - block % growBlocks;
+   off_t offset = headerSize + (off_t)start * blockSize;
+   off_t aligned = offset - offset % pageSize;
+
+   if (capacity < start + growBlocks)
+   {
+      off_t size = headerSize + (off_t)(start + growBlocks) * blockSize;
+
+      if (posix_fallocate(fd, 0, size) != 0)
+      {
+         tell(eloAlways, "Error: Can't allocate %ld bytes for series '%s'", (long)size, path);
+         return fail;
+      }
+
+      capacity = start + growBlocks;
+   }
+
+   unmapWindow();
+
+   mapSize = (offset - aligned) + (size_t)growBlocks * blockSize;
+
+   void* p = mmap(0, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, aligned);
+
+   if (p == MAP_FAILED)
+   {
+      tell(eloAlways, "Error: Can't map series '%s', error was '%s'", path, strerror(errno));
+      mapSize = 0;
+      return fail;
+   }
+
+   map = (byte*)p;
+   window = map + (offset - aligned);
+   windowStart = start;
+
+   return success;
+}
+
+void TsSeries::unmapWindow()
+{
+   if (map)
+      munmap(map, mapSize);
+
+   map = 0;
+   mapSize = 0;
+   window = 0;
+}
+
+//***************************************************************************
+// New Block
+//***************************************************************************
+
+int TsSeries::newBlock(time_t time)
+{
+   uint32_t b = blocks;
+   IndexEntry e;
+
+   if (!window || b >= windowStart + growBlocks)
+   {
+      if (window)
+         sync();
+
+      if (mapWindow(b) != success)
+         return fail;
+   }
+
+   BlockHeader* h = (BlockHeader*)blockAt(b);
+
+   memset(h, 0, blockSize);
+   h->firstTime = h->lastTime = time;
+   h->leading = 0xff;
+
+   // the block counts not before it is initialized
+
+   blocks++;
+
+   if (pwrite(fd, &blocks, sizeof(blocks), offsetof(FileHeader, blocks)) != sizeof(blocks))
+   {
+      tell(eloAlways, "Error: Can't update header of series '%s', error was '%s'", path, strerror(errno));
+      blocks--;
+      return fail;
+   }
+
+   e.firstTime = e.lastTime = time;
+   index.push_back(e);
+
+   return success;
+}
+
+//***************************************************************************
+// Append
+//***************************************************************************
+
+int TsSeries::append(time_t time, double value)
+{
+   if (fd < 0)
+      return fail;
+
+   if (blocks && time <= index.back().lastTime && ((BlockHeader*)blockAt(blocks-1))->count)
+      return wrnNotNewer;
+
+   if (!blocks || !encode(blockAt(blocks-1), time, value))
+   {
+      if (newBlock(time) != success)
+         return fail;
+
+      encode(blockAt(blocks-1), time, value);
+   }
+
+   BlockHeader* h = (BlockHeader*)blockAt(blocks-1);
+
+   index.back().firstTime = h->firstTime;
+   index.back().lastTime = h->lastTime;
+   points++;
+   dirty = yes;
+
+   return success;
+}
+
+//***************************************************************************
+// Encode
+//   timestamp: delta of delta in the buckets
+//      '0' | '10' + 7 | '110' + 9 | '1110' + 12 | '1111' + 32 bits
+//   value: xor against the previous value
+//      '0' -> same value
+//      '10' + meaningful bits inside the window of the previous xor
+//      '11' + 5 bits leading zeros + 6 bits length - 1 + meaningful bits
+//***************************************************************************
+
+int TsSeries::encode(byte* block, time_t time, double value)
+{
+   BlockHeader* h = (BlockHeader*)block;
+   BitWriter w(block + sizeof(BlockHeader), h->bits);
+   uint64_t bits;
+
+   memcpy(&bits, &value, sizeof(bits));
+
+   if (h->bits + maxPointBits > payloadBits)
+      return no;
+
+   if (!h->count)
+   {
+      w.write(bits, 64);
+      h->firstTime = time;
+      h->lastDelta = 0;
+      h->leading = 0xff;
+   }
+   else
+   {
+      int64_t delta = time - h->lastTime;
+      int64_t dod = delta - h->lastDelta;
+
+      if (!dod)
+         w.write(0x0, 1);
+      else if (dod >= -64 && dod < 64)
+         { w.write(0x2, 2); w.write(dod, 7); }
+      else if (dod >= -256 && dod < 256)
+         { w.write(0x6, 3); w.write(dod, 9); }
+      else if (dod >= -2048 && dod < 2048)
+         { w.write(0xe, 4); w.write(dod, 12); }
+      else
+         { w.write(0xf, 4); w.write(dod, 32); }
+
+      uint64_t x = bits ^ h->lastValue;
+
+      if (!x)
+      {
+         w.write(0x0, 1);
+      }
+      else
+      {
+         int leading = std::min(__builtin_clzll(x), 31);
+         int trailing = __builtin_ctzll(x);
+
+         if (h->leading != 0xff && leading >= h->leading && trailing >= h->trailing)
+         {
+            w.write(0x2, 2);
+            w.write(x >> h->trailing, 64 - h->leading - h->trailing);
+         }
+         else
+         {
+            int length = 64 - leading - trailing;
+
+            w.write(0x3, 2);
+            w.write(leading, 5);
+            w.write(length - 1, 6);
+            w.write(x >> trailing, length);
+
+            h->leading = leading;
+            h->trailing = trailing;
+         }
+      }
+
+      h->lastDelta = delta;
+   }
+
+   h->lastTime = time;
+   h->lastValue = bits;
+   h->bits = w.getPos();
+   h->count++;
+
+   return yes;
+}
+
+//***************************************************************************
+// Decode
+//   the points of the block inside [from, to] are added to 'points', the
+//   state of the encoder after the last point is returned in 'state'
+//***************************************************************************
+
+int TsSeries::decode(const byte* block, BlockHeader* state,
+                     std::vector<Point>* points, time_t from, time_t to)
+{
+   const BlockHeader* h = (const BlockHeader*)block;
+   BitReader r(block + sizeof(BlockHeader), payloadBits);
+   BlockHeader s;
+
+   memset(&s, 0, sizeof(BlockHeader));
+   s.leading = 0xff;
+   s.firstTime = s.lastTime = h->firstTime;
+
+   for (uint32_t i = 0; i < h->count; i++)
+   {
+      if (!i)
+      {
+         s.lastValue = r.read(64);
+      }
+      else
+      {
+         int64_t dod;
+
+         if (!r.readBit())
+            dod = 0;
+         else if (!r.readBit())
+            dod = signExtend(r.read(7), 7);
+         else if (!r.readBit())
+            dod = signExtend(r.read(9), 9);
+         else if (!r.readBit())
+            dod = signExtend(r.read(12), 12);
+         else
+            dod = signExtend(r.read(32), 32);
+
+         s.lastDelta += dod;
+         s.lastTime += s.lastDelta;
+
+         if (r.readBit())
+         {
+            if (!r.readBit())
+            {
+               if (s.leading == 0xff)
+                  return fail;
+
+               s.lastValue ^= r.read(64 - s.leading - s.trailing) << s.trailing;
+            }
+            else
+            {
+               s.leading = r.read(5);
+               int length = r.read(6) + 1;
+
+               if (s.leading + length > 64)
+                  return fail;
+
+               s.trailing = 64 - s.leading - length;
+               s.lastValue ^= r.read(length) << s.trailing;
+            }
+         }
+      }
+
+      if (r.failed())
+         return fail;
+
+      s.count++;
+
+      if (points && s.lastTime >= from && s.lastTime <= to)
+      {
+         Point p;
+
+         p.time = s.lastTime;
+         memcpy(&p.value, &s.lastValue, sizeof(double));
+         points->push_back(p);
+      }
+   }
+
+   s.bits = r.getPos();
+
+   if (state)
+      *state = s;
+
+   return success;
+}
+
+//***************************************************************************
+// Query
+//   the points inside [from, to], only the blocks the index points to
+//   are decoded
+//***************************************************************************
+
+int TsSeries::query(time_t from, time_t to, std::vector<Point>* points)
+{
+   uint32_t lo = 0, hi = blocks;
+   uint64_t buffer[blockSize / sizeof(uint64_t)];
+
+   if (fd < 0)
+      return fail;
+
+   // first block ending not before 'from'
+
+   while (lo < hi)
+   {
+      uint32_t mid = (lo + hi) / 2;
+
+      if (index[mid].lastTime < from)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   for (uint32_t b = lo; b < blocks && index[b].firstTime <= to; b++)
+   {
+      const byte* block = (byte*)buffer;
+
+      if (window && b >= windowStart && b < windowStart + growBlocks)
+         block = blockAt(b);
+      else if (pread(fd, buffer, blockSize, headerSize + (off_t)b * blockSize) != blockSize)
+      {
+         tell(eloAlways, "Error: Can't read block %u of series '%s'", b, path);
+         return fail;
+      }
+
+      if (decode(block, 0, points, from, to) != success)
+         tell(eloAlways, "Error: Block %u of series '%s' is corrupt", b, path);
+   }
+
+   return success;
+}
+
+//***************************************************************************
+// Sync
+//***************************************************************************
+
+int TsSeries::sync()
+{
+   if (!dirty || !map)
+      return success;
+
+   if (msync(map, mapSize, MS_SYNC) != 0)
+   {
+      tell(eloAlways, "Error: Syncing series '%s' failed, error was '%s'", path, strerror(errno));
+      return fail;
+   }
+
+   dirty = no;
+
+   return success;
+}
+
+//***************************************************************************
+// Ts Store
+//***************************************************************************
+
+TsStore::TsStore(const char* aPath)
+{
+   path = strdup(aPath);
+   opened = no;
+   appended = 0;
+   rejected = 0;
+}
+
+TsStore::~TsStore()
+{
+   close();
+   free(path);
+}
+
+//***************************************************************************
+// Open / Close
+//***************************************************************************
+
+int TsStore::open()
+{
+   if (mkdir(path, 0755) != 0 && errno != EEXIST)
+   {
+      tell(eloAlways, "Error: Can't create directory '%s', error was '%s'", path, strerror(errno));
+      return fail;
+   }
+
+   opened = yes;
+   tell(eloDetail, "Time series store '%s' opened", path);
+
+   return success;
+}
+
+int TsStore::close()
+{
+   std::map<std::string, TsSeries*>::iterator it;
+
+   for (it = series.begin(); it != series.end(); ++it)
+      delete it->second;
+
+   series.clear();
+   opened = no;
+
+   return success;
+}
+
+//***************************************************************************
+// Series Of
+//   the series are opened at their first use
+//***************************************************************************
+
+TsSeries* TsStore::seriesOf(int address, const char* type, int create)
+{
+   char key[100];
+   char* file = 0;
+   TsSeries* s;
+
+   snprintf(key, sizeof(key), "%s:%d", type, address);
+
+   std::map<std::string, TsSeries*>::iterator it = series.find(key);
+
+   if (it != series.end())
+      return it->second;
+
+   if (!opened && open() != success)
+      return 0;
+
+   asprintf(&file, "%s/%s-%d.ts", path, type, address);
+
+   if (!create && !fileExists(file))
+   {
+      free(file);
+      return 0;
+   }
+
+   s = new TsSeries;
+
+   if (s->open(file, address, type) != success)
+   {
+      delete s;
+      s = 0;
+   }
+   else
+   {
+      series[key] = s;
+   }
+
+   free(file);
+
+   return s;
+}
+
+//***************************************************************************
+// Append
+//***************************************************************************
+
+int TsStore::append(int address, const char* type, time_t time, double value)
+{
+   TsSeries* s = seriesOf(address, type, yes);
+   int status;
+
+   if (!s)
+      return fail;
+
+   if ((status = s->append(time, value)) == TsSeries::wrnNotNewer)
+   {
+      rejected++;
+      tell(eloDebug, "Debug: Ignoring sample %s:0x%x at %ld, not newer than the last one",
+           type, address, (long)time);
+   }
+   else if (status == success)
+      appended++;
+
+   return status;
+}
+
+//***************************************************************************
+// Query
+//***************************************************************************
+
+int TsStore::query(int address, const char* type, time_t from, time_t to,
+                   std::vector<TsSeries::Point>* points)
+{
+   TsSeries* s = seriesOf(address, type, no);
+
+   if (!s)
+      return done;
+
+   return s->query(from, to, points);
+}
+
+//***************************************************************************
+// First
+//   the value of the first point in (from, to]
+//***************************************************************************
+
+int TsStore::first(int address, const char* type, time_t from, time_t to, double& value)
+{
+   std::vector<TsSeries::Point> points;
+
+   if (query(address, type, from + 1, to, &points) != success || points.empty())
+      return fail;
+
+   value = points.front().value;
+
+   return success;
+}
+
+//***************************************************************************
+// Sync
+//***************************************************************************
+
+int TsStore::sync()
+{
+   int status = success;
+   std::map<std::string, TsSeries*>::iterator it;
+
+   for (it = series.begin(); it != series.end(); ++it)
+      if (it->second->sync() != success)
+         status = fail;
+
+   return status;
+}
+
+//***************************************************************************
+// Get Statistic
+//***************************************************************************
+
+void TsStore::getStatistic(Statistic* s)
+{
+   std::map<std::string, TsSeries*>::iterator it;
+
+   memset(s, 0, sizeof(Statistic));
+
+   s->series = series.size();
+   s->appended = appended;
+   s->rejected = rejected;
+
+   for (it = series.begin(); it != series.end(); ++it)
+   {
+      s->points += it->second->getPoints();
+      s->usedBytes += it->second->getUsedBytes();
+   }
+}
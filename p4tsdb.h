@@ -0,0 +1,209 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4tsdb.h
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+// Time Series Store
+//   embedded, append only store of the samples, one file per series of
+//   fixed size blocks. The points of a block are compressed like Gorilla
+//   does: delta of delta of the timestamps and xor of the values against
+//   the previous value. Only the block of the current appends is memory
+//   mapped, the others are read by the block index. Alternative to the
+//   sampledata table (option sampleStore), the state texts are not stored.
+//***************************************************************************
+
+#ifndef _P4TSDB_H_
+#define _P4TSDB_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <vector>
+#include <map>
+#include <string>
+
+#include "lib/common.h"
+
+//***************************************************************************
+// Bit Writer / Reader
+//***************************************************************************
+
+class BitWriter
+{
+   public:
+
+      BitWriter(byte* aBuffer, uint32_t aPos)   { buffer = aBuffer; pos = aPos; }
+
+      void write(uint64_t value, int bits);      // the lower 'bits' bits, msb first
+      void writeBit(int bit)                     { write(bit ? 1 : 0, 1); }
+      uint32_t getPos()                          { return pos; }
+
+   protected:
+
+      byte* buffer;
+      uint32_t pos;                              // in bits
+};
+
+class BitReader
+{
+   public:
+
+      BitReader(const byte* aBuffer, uint32_t aEnd)   { buffer = aBuffer; pos = 0; end = aEnd; overrun = no; }
+
+      uint64_t read(int bits);                   // 0 and failed behind the end
+      int readBit()                              { return (int)read(1); }
+      uint32_t getPos()                          { return pos; }
+      int failed()                               { return overrun; }
+
+   protected:
+
+      const byte* buffer;
+      uint32_t pos;                              // in bits
+      uint32_t end;
+      int overrun;
+};
+
+//***************************************************************************
+// Ts Series
+//   one file: a header page followed by the blocks, each block begins
+//   with its header holding the state of the encoder. A point is counted
+//   (and visible) not before it is completely written to the block.
+//***************************************************************************
+
+class TsSeries
+{
+   public:
+
+      enum Misc
+      {
+         blockSize = 4096,
+         headerSize = 4096,
+         growBlocks = 16,          // the file is extended (and mapped) by this
+         maxPointBits = 4 + 32 + 2 + 5 + 6 + 64,
+
+         wrnNotNewer = -1000       // append of a point not newer than the last one
+      };
+
+      static const uint32_t payloadBits;
+
+      struct FileHeader
+      {
+         char magic[8];
+         uint32_t blockSize;
+         uint32_t blocks;          // used blocks
+         int32_t address;
+         char type[2+TB];
+         char pad[1];
+      };
+
+      struct BlockHeader
+      {
+         int64_t firstTime;
+         int64_t lastTime;
+         int64_t lastDelta;
+         uint64_t lastValue;       // bits of the double
+         uint32_t count;
+         uint32_t bits;            // of the payload
+         uint8_t leading;          // of the last xor window, 0xff -> none yet
+         uint8_t trailing;
+         uint8_t pad[6];
+      };
+
+      struct Point
+      {
+         time_t time;
+         double value;
+      };
+
+      struct IndexEntry            // block index, one per block
+      {
+         time_t firstTime;
+         time_t lastTime;
+      };
+
+      TsSeries();
+      ~TsSeries();
+
+      int open(const char* aPath, int aAddress, const char* aType);
+      int close();
+
+      int append(time_t time, double value);
+      int query(time_t from, time_t to, std::vector<Point>* points);
+      int sync();
+
+      time_t getLastTime()         { return index.size() ? index.back().lastTime : 0; }
+      unsigned long getPoints()    { return points; }
+      size_t getUsedBytes()        { return headerSize + (size_t)blocks * blockSize; }
+
+      static int encode(byte* block, time_t time, double value);   // no if the block is full
+      static int decode(const byte* block, BlockHeader* state,
+                        std::vector<Point>* points, time_t from, time_t to);
+
+   protected:
+
+      int newBlock(time_t time);
+      int mapWindow(uint32_t block);
+      void unmapWindow();
+      int recover();
+      byte* blockAt(uint32_t block)  { return window + (size_t)(block - windowStart) * blockSize; }
+
+      char* path;
+      int fd;
+      uint32_t blocks;
+      uint32_t capacity;           // blocks the file has room for
+      byte* map;                   // page aligned mapping of the window
+      size_t mapSize;
+      byte* window;                // mapped blocks [windowStart, windowStart + growBlocks)
+      uint32_t windowStart;
+      int dirty;
+      unsigned long points;
+      std::vector<IndexEntry> index;
+};
+
+//***************************************************************************
+// Ts Store
+//***************************************************************************
+
+class TsStore
+{
+   public:
+
+      struct Statistic
+      {
+         int series;
+         unsigned long appended;
+         unsigned long rejected;   // not newer than the last point of the series
+         unsigned long points;
+         size_t usedBytes;
+      };
+
+      TsStore(const char* aPath);
+      ~TsStore();
+
+      int open();
+      int close();
+
+      int append(int address, const char* type, time_t time, double value);
+      int query(int address, const char* type, time_t from, time_t to,
+                std::vector<TsSeries::Point>* points);
+      int first(int address, const char* type, time_t from, time_t to, double& value);  // in (from, to]
+      int sync();                  // end of cycle
+
+      void getStatistic(Statistic* s);
+      const char* getPath()        { return path; }
+
+   protected:
+
+      TsSeries* seriesOf(int address, const char* type, int create);
+
+      char* path;
+      int opened;
+      std::map<std::string, TsSeries*> series;   // key 'type:address'
+      unsigned long appended;
+      unsigned long rejected;
+};
+
+//***************************************************************************
+#endif // _P4TSDB_H_
@@ -0,0 +1,1835 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4writer.c
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <libgen.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <math.h>
+#include <ctype.h>
+
+#include <algorithm>
+
+#include "p4writer.h"
+
+//***************************************************************************
+// Sample Ring
+//***************************************************************************
+
+SampleRing::SampleRing(int aSize)
+{
+   size = 1;
+
+   while (size < (unsigned int)aSize)
+      size <<= 1;
+
+   mask = size - 1;
+   ring = new Sample[size];
+   head = 0;
+   tail = 0;
+}
+
+SampleRing::~SampleRing()
+{
+   delete[] ring;
+}
+
+//***************************************************************************
+// Push (producer)
+//***************************************************************************
+
+int SampleRing::push(const Sample* sample)
+{
+   unsigned int h = head.load(std::memory_order_relaxed);
+
+   if (h - tail.load(std::memory_order_acquire) >= size)
+      return fail;
+
+   ring[h & mask] = *sample;
+   head.store(h + 1, std::memory_order_release);
+
+   return success;
+}
+
+//***************************************************************************
+// Pop (consumer)
+//***************************************************************************
+
+int SampleRing::pop(Sample* sample)
+{
+   unsigned int t = tail.load(std::memory_order_relaxed);
+
+   if (t == head.load(std::memory_order_acquire))
+      return fail;
+
+   *sample = ring[t & mask];
+   tail.store(t + 1, std::memory_order_release);
+
+   return success;
+}
+
+//***************************************************************************
+// Sample Spool
+//***************************************************************************
+
+SampleSpool::SampleSpool()
+{
+   path = 0;
+   fd = na;
+   map = 0;
+   mapSize = 0;
+   header = 0;
+   records = 0;
+   writePos = 0;
+   writeSeq = 0;
+   syncedPos = 0;
+   pending = 0;
+   syncs = 0;
+   bytesSynced = 0;
+}
+
+SampleSpool::~SampleSpool()
+{
+   close();
+}
+
+//***************************************************************************
+// Open
+//***************************************************************************
+
+int SampleSpool::open(const char* aPath, int aSize)
+{
+   struct stat st;
+   Header h;
+   int maxRecords = (aSize - headerSize) / (int)sizeof(Record);
+
+   close();
+
+   if (maxRecords <= 0)
+   {
+      tell(eloAlways, "Error: Spool size of %d bytes too small", aSize);
+      return fail;
+   }
+
+   path = strdup(aPath);
+
+   if ((fd = ::open(path, O_RDWR | O_CREAT, 0644)) < 0 && errno == ENOENT)
+   {
+      char* dir = strdup(path);
+
+      mkdir(dirname(dir), 0755);
+      free(dir);
+
+      fd = ::open(path, O_RDWR | O_CREAT, 0644);
+   }
+
+   if (fd < 0)
+   {
+      tell(eloAlways, "Error: Can't open spool '%s', error was '%s'", path, strerror(errno));
+      close();
+      return fail;
+   }
+
+   // an existing spool is taken as it is, as long as it holds records
+
+   if (fstat(fd, &st) == 0 && pread(fd, &h, sizeof(Header), 0) == sizeof(Header)
+       && memcmp(h.magic, "P4SPOOL", 8) == 0 && h.recordSize == sizeof(Record)
+       && h.check == checksum(&h, offsetof(Header, check)) && h.readPos <= h.maxRecords
+       && (size_t)st.st_size == headerSize + (size_t)h.maxRecords * sizeof(Record)
+       && attach(st.st_size) == success)
+   {
+      recover();
+
+      if (getPending() || (int)header->maxRecords == maxRecords)
+         return success;
+
+      detach();
+   }
+
+   return create(maxRecords);
+}
+
+int SampleSpool::close()
+{
+   if (map)
+      sync();
+
+   detach();
+
+   if (fd >= 0)
+      ::close(fd);
+
+   fd = na;
+   free(path);
+   path = 0;
+
+   return success;
+}
+
+//***************************************************************************
+// Create
+//***************************************************************************
+
+int SampleSpool::create(int maxRecords)
+{
+   size_t size = headerSize + (size_t)maxRecords * sizeof(Record);
+
+   // allocate the blocks now, a full disk must not hit us at a write to the map
+
+   if (ftruncate(fd, 0) != 0 || posix_fallocate(fd, 0, size) != 0)
+   {
+      tell(eloAlways, "Error: Can't allocate %ld bytes for spool '%s'", (long)size, path);
+      return fail;
+   }
+
+   if (attach(size) != success)
+      return fail;
+
+   memcpy(header->magic, "P4SPOOL", 8);
+   header->recordSize = sizeof(Record);
+   header->maxRecords = maxRecords;
+   header->readSeq = 1;
+   header->readPos = 0;
+
+   writePos = syncedPos = 0;
+   writeSeq = header->readSeq;
+   updatePending();
+
+   tell(eloAlways, "Created spool '%s' for %d samples", path, maxRecords);
+
+   return syncHeader();
+}
+
+//***************************************************************************
+// Attach / Detach
+//***************************************************************************
+
+int SampleSpool::attach(size_t size)
+{
+   void* p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+   if (p == MAP_FAILED)
+   {
+      tell(eloAlways, "Error: Can't map spool '%s', error was '%s'", path, strerror(errno));
+      return fail;
+   }
+
+   map = (byte*)p;
+   mapSize = size;
+   header = (Header*)map;
+   records = (Record*)(map + headerSize);
+
+   return success;
+}
+
+void SampleSpool::detach()
+{
+   if (map)
+      munmap(map, mapSize);
+
+   map = 0;
+   mapSize = 0;
+   header = 0;
+   records = 0;
+   updatePending();
+}
+
+//***************************************************************************
+// Recover
+//   the records behind the read position are valid as long as their
+//   sequence numbers continue and their check sums match, a record torn
+//   by a crash ends the spool
+//***************************************************************************
+
+int SampleSpool::recover()
+{
+   writePos = header->readPos;
+   writeSeq = header->readSeq;
+
+   while (writePos < header->maxRecords)
+   {
+      Record* r = &records[writePos];
+
+      if (r->seq != writeSeq || r->check != checksum(r, offsetof(Record, check)))
+         break;
+
+      writePos++;
+      writeSeq++;
+   }
+
+   syncedPos = writePos;
+   updatePending();
+
+   if (getPending())
+      tell(eloAlways, "Recovered %d spooled samples of '%s'", getPending(), path);
+
+   return success;
+}
+
+//***************************************************************************
+// Append
+//***************************************************************************
+
+int SampleSpool::append(const Sample* sample)
+{
+   Record* r;
+
+   mutex.Lock();
+
+   if (!map || writePos >= header->maxRecords)
+   {
+      mutex.Unlock();
+      return fail;
+   }
+
+   r = &records[writePos];
+   setRecord(r, sample, writeSeq);
+
+   writePos++;
+   writeSeq++;
+   updatePending();
+
+   if (writePos - syncedPos >= syncEvery)
+      syncRecords();
+
+   mutex.Unlock();
+
+   return success;
+}
+
+//***************************************************************************
+// Insert
+//   samples older than the pending records (the batch of a failed write),
+//   the pending records are moved behind them and numbered again
+//***************************************************************************
+
+int SampleSpool::insert(const std::vector<Sample>* samples)
+{
+   unsigned int pos;
+   unsigned int count;
+
+   mutex.Lock();
+
+   if (!map || !samples->size())
+   {
+      mutex.Unlock();
+      return 0;
+   }
+
+   pos = header->readPos;
+   count = min((unsigned int)samples->size(), header->maxRecords - writePos);
+
+   memmove(&records[pos+count], &records[pos], (writePos - pos) * sizeof(Record));
+
+   for (unsigned int i = 0; i < count; i++)
+      setRecord(&records[pos+i], &samples->at(i), 0);
+
+   writePos += count;
+   writeSeq = header->readSeq;
+
+   for (unsigned int p = pos; p < writePos; p++)
+   {
+      records[p].seq = writeSeq++;
+      records[p].check = checksum(&records[p], offsetof(Record, check));
+   }
+
+   syncedPos = min(syncedPos, pos);
+   updatePending();
+   syncRecords();
+
+   mutex.Unlock();
+
+   return count;
+}
+
+void SampleSpool::setRecord(Record* r, const Sample* sample, uint64_t seq)
+{
+   memset(r, 0, sizeof(Record));
+
+   r->seq = seq;
+   r->queuedAt = sample->queuedAt;
+   r->time = sample->time;
+   r->value = sample->value;
+   r->address = sample->address;
+   sstrcpy(r->type, sample->type, sizeof(r->type));
+   sstrcpy(r->text, sample->text, sizeof(r->text));
+   r->flags = sample->flags;
+   r->check = checksum(r, offsetof(Record, check));
+}
+
+//***************************************************************************
+// Read
+//   the oldest max records, they stay in the spool until ack()
+//***************************************************************************
+
+int SampleSpool::read(std::vector<Sample>* samples, int max)
+{
+   samples->clear();
+
+   mutex.Lock();
+
+   for (unsigned int pos = map ? header->readPos : 0; map && pos < writePos && (int)samples->size() < max; pos++)
+   {
+      Sample s;
+      Record* r = &records[pos];
+
+      s.time = r->time;
+      s.address = r->address;
+      s.value = r->value;
+      s.queuedAt = r->queuedAt;
+      s.flags = r->flags ? r->flags : Sample::sfRow | Sample::sfRollup;
+      sstrcpy(s.type, r->type, sizeof(s.type));
+      sstrcpy(s.text, r->text, sizeof(s.text));
+
+      samples->push_back(s);
+   }
+
+   mutex.Unlock();
+
+   return samples->size();
+}
+
+//***************************************************************************
+// Ack
+//***************************************************************************
+
+int SampleSpool::ack(int count)
+{
+   int status;
+
+   mutex.Lock();
+
+   if (!map)
+   {
+      mutex.Unlock();
+      return fail;
+   }
+
+   header->readPos += count;
+   header->readSeq += count;
+
+   // all committed, start over (the old records are out of sequence now)
+
+   if (header->readPos >= writePos)
+   {
+      header->readPos = 0;
+      writePos = syncedPos = 0;
+   }
+
+   updatePending();
+
+   status = syncHeader();
+
+   mutex.Unlock();
+
+   return status;
+}
+
+//***************************************************************************
+// Sync
+//***************************************************************************
+
+int SampleSpool::sync()
+{
+   int status;
+
+   mutex.Lock();
+   status = syncRecords();
+   mutex.Unlock();
+
+   return status;
+}
+
+int SampleSpool::syncRecords()
+{
+   long page = sysconf(_SC_PAGESIZE);
+   size_t start, end;
+
+   if (!map || writePos <= syncedPos)
+      return done;
+
+   start = headerSize + (size_t)syncedPos * sizeof(Record);
+   end = headerSize + (size_t)writePos * sizeof(Record);
+   start -= start % page;
+
+   if (msync(map + start, end - start, MS_SYNC) != 0)
+   {
+      tell(eloAlways, "Error: Syncing spool '%s' failed, error was '%s'", path, strerror(errno));
+      return fail;
+   }
+
+   syncedPos = writePos;
+   syncs++;
+   bytesSynced += end - start;
+
+   return success;
+}
+
+int SampleSpool::syncHeader()
+{
+   header->check = checksum(header, offsetof(Header, check));
+
+   if (msync(map, headerSize, MS_SYNC) != 0)
+   {
+      tell(eloAlways, "Error: Syncing spool '%s' failed, error was '%s'", path, strerror(errno));
+      return fail;
+   }
+
+   syncs++;
+   bytesSynced += headerSize;
+
+   return success;
+}
+
+//***************************************************************************
+// Checksum (FNV-1a)
+//***************************************************************************
+
+uint32_t SampleSpool::checksum(const void* p, int size)
+{
+   const byte* b = (const byte*)p;
+   uint32_t hash = 2166136261u;
+
+   for (int i = 0; i < size; i++)
+   {
+      hash ^= b[i];
+      hash *= 16777619u;
+   }
+
+   return hash;
+}
+
+//***************************************************************************
+// Series Dict
+//***************************************************************************
+
+SeriesDict::SeriesDict()
+{
+   tableSeries = 0;
+   tableTexts = 0;
+   selectSeries = 0;
+   selectText = 0;
+}
+
+SeriesDict::~SeriesDict()
+{
+   close();
+}
+
+//***************************************************************************
+// Open / Close
+//***************************************************************************
+
+int SeriesDict::open(cDbConnection* aConnection)
+{
+   int status = success;
+
+   close();
+
+   tableSeries = new cDbTable(aConnection, "series");
+   tableTexts = new cDbTable(aConnection, "statetexts");
+
+   if (tableSeries->open() != success || tableTexts->open() != success)
+   {
+      close();
+      return fail;
+   }
+
+   // select id from series where address = ? and type = ?
+
+   selectSeries = new cDbStatement(tableSeries);
+
+   selectSeries->build("select ");
+   selectSeries->bind("ID", cDBS::bndOut);
+   selectSeries->build(" from %s where ", tableSeries->TableName());
+   selectSeries->bind("ADDRESS", cDBS::bndIn | cDBS::bndSet);
+   selectSeries->bind("TYPE", cDBS::bndIn | cDBS::bndSet, " and ");
+   selectSeries->build(" order by id limit 1");
+
+   status += selectSeries->prepare();
+
+   // select id from statetexts where text = ?
+
+   selectText = new cDbStatement(tableTexts);
+
+   selectText->build("select ");
+   selectText->bind("ID", cDBS::bndOut);
+   selectText->build(" from %s where ", tableTexts->TableName());
+   selectText->bind("TEXT", cDBS::bndIn | cDBS::bndSet);
+   selectText->build(" order by id limit 1");
+
+   status += selectText->prepare();
+
+   if (status != success)
+      close();
+
+   // the ids are never reused, but the database may be a new one
+
+   seriesIds.clear();
+   textIds.clear();
+
+   return status;
+}
+
+void SeriesDict::close()
+{
+   delete selectSeries;  selectSeries = 0;
+   delete selectText;    selectText = 0;
+   delete tableSeries;   tableSeries = 0;
+   delete tableTexts;    tableTexts = 0;
+}
+
+//***************************************************************************
+// Series Id Of
+//   the dict of the writer, the one of p4d and 'p4d -m' may add the same
+//   series at once - (address, type) is unique, the id is selected again
+//   after the insert
+//***************************************************************************
+
+int SeriesDict::seriesIdOf(int address, const char* type, int create)
+{
+   char key[20];
+   int id = na;
+
+   sprintf(key, "%s:%d", type, address);
+
+   std::map<std::string, int>::iterator it = seriesIds.find(key);
+
+   if (it != seriesIds.end())
+      return it->second;
+
+   if (!selectSeries)
+      return na;
+
+   for (int tries = 0; tries < 2 && id == na; tries++)
+   {
+      if (tries)
+      {
+         // insert ... on duplicate key update
+
+         tableSeries->clear();
+         tableSeries->setValue("ADDRESS", address);
+         tableSeries->setValue("TYPE", type);
+
+         if (!create || tableSeries->upsert() != success)
+            break;
+      }
+
+      tableSeries->clear();
+      tableSeries->setValue("ADDRESS", address);
+      tableSeries->setValue("TYPE", type);
+
+      if (selectSeries->find())
+         id = tableSeries->getIntValue("ID");
+
+      selectSeries->freeResult();
+
+      if (tries && id != na)
+         tell(eloDetail, "Added series %d for %s:0x%x", id, type, address);
+   }
+
+   if (id != na)
+      seriesIds[key] = id;
+
+   return id;
+}
+
+//***************************************************************************
+// Text Id Of
+//***************************************************************************
+
+int SeriesDict::textIdOf(const char* text)
+{
+   int id = na;
+
+   if (isEmpty(text))
+      return 0;
+
+   std::map<std::string, int>::iterator it = textIds.find(text);
+
+   if (it != textIds.end())
+      return it->second;
+
+   if (!selectText)
+      return na;
+
+   // like the series, unique and selected again after the insert
+
+   for (int tries = 0; tries < 2 && id == na; tries++)
+   {
+      tableTexts->clear();
+      tableTexts->setValue("TEXT", text);
+
+      if (tries && tableTexts->upsert() != success)
+         break;
+
+      if (selectText->find())
+         id = tableTexts->getIntValue("ID");
+
+      selectText->freeResult();
+   }
+
+   if (id != na)
+      textIds[text] = id;
+
+   return id;
+}
+
+//***************************************************************************
+// Sample Rollup
+//***************************************************************************
+
+SampleRollup::SampleRollup(const Tier* aTier, time_t aStartedAt)
+{
+   tier = *aTier;
+   startedAt = aStartedAt ? aStartedAt : time(0);
+}
+
+//***************************************************************************
+// Parse Tiers
+//   'code:days,...' like "A:0,H:0,D:0", the interval of the codes is fixed
+//   (M 1 minute, H 1 hour, D 1 day) except of 'A' (aggregateInterval)
+//***************************************************************************
+
+static int tierOrder(const SampleRollup::Tier& a, const SampleRollup::Tier& b)
+{
+   return a.interval < b.interval;
+}
+
+int SampleRollup::parseTiers(const char* spec, int aggregateInterval, std::vector<Tier>* tiers)
+{
+   char* buf = strdup(spec ? spec : "");
+   char* save = 0;
+   int status = success;
+
+   tiers->clear();
+
+   for (char* p = strtok_r(buf, ",", &save); p; p = strtok_r(0, ",", &save))
+   {
+      Tier tier = {{0}};
+      char* days = strchr(p, ':');
+
+      if (days)
+         *days++ = 0;
+
+      p = allTrim(p);
+
+      switch (toupper(*p))
+      {
+         case 'M': tier.interval = tmeSecondsPerMinute;                     break;
+         case 'A': tier.interval = aggregateInterval * tmeSecondsPerMinute; break;
+         case 'H': tier.interval = tmeSecondsPerHour;                       break;
+         case 'D': tier.interval = tmeSecondsPerDay;                        break;
+      }
+
+      if (!tier.interval || strlen(p) != 1)
+      {
+         tell(eloAlways, "Warning: Ignoring unknown rollup tier '%s'", p);
+         status = fail;
+         continue;
+      }
+
+      tier.aggregate[0] = toupper(*p);
+      tier.history = days ? atoi(days) : 0;
+      tiers->push_back(tier);
+   }
+
+   free(buf);
+   std::sort(tiers->begin(), tiers->end(), tierOrder);
+
+   return status;
+}
+
+//***************************************************************************
+// Bucket Start / End
+//   buckets are aligned to the local day and the end is calculated on the
+//   wall clock, like the sql of recomputeStatement() does
+//***************************************************************************
+
+time_t SampleRollup::bucketStart(time_t t, int interval)
+{
+   struct tm tm = {0};
+
+   localtime_r(&t, &tm);
+
+   return t - (tm.tm_hour * tmeSecondsPerHour + tm.tm_min * tmeSecondsPerMinute + tm.tm_sec) % interval;
+}
+
+time_t SampleRollup::bucketEnd(time_t start, int interval)
+{
+   struct tm tm = {0};
+
+   localtime_r(&start, &tm);
+   tm.tm_sec += interval;
+   tm.tm_isdst = -1;
+
+   return mktime(&tm);
+}
+
+//***************************************************************************
+// Add
+//***************************************************************************
+
+void SampleRollup::add(const Sample* sample, std::vector<Bucket>* finished,
+                       std::vector<Bucket>* partial)
+{
+   char key[20];
+   time_t start;
+   Bucket* b;
+
+   start = bucketStart(sample->time, tier.interval);
+   sprintf(key, "%d", sample->seriesId);
+
+   std::map<std::string, Bucket>::iterator it = buckets.find(key);
+
+   if (it != buckets.end())
+   {
+      b = &it->second;
+
+      if (start < b->start)        // late (replayed) sample of a finished bucket
+      {
+         Bucket late = *b;
+
+         late.start = start;
+         late.end = bucketEnd(start, tier.interval);
+         late.count = 1;
+         late.sum = late.min = late.max = late.first = late.last = sample->value;
+         late.textId = sample->textId;
+         late.exact = no;
+         late.late = yes;
+         partial->push_back(late);
+
+         return;
+      }
+
+      if (start > b->start)
+         finish(b, finished, partial);
+   }
+   else
+   {
+      b = &buckets[key];
+      b->count = 0;
+   }
+
+   if (!b->count || start != b->start)
+   {
+      sstrcpy(b->aggregate, tier.aggregate, sizeof(b->aggregate));
+      b->interval = tier.interval;
+      b->seriesId = sample->seriesId;
+      b->start = start;
+      b->end = bucketEnd(start, tier.interval);
+      b->count = 0;
+      b->sum = 0;
+      b->min = sample->value;
+      b->max = sample->value;
+      b->first = sample->value;
+      b->exact = start >= startedAt;
+      b->late = no;
+   }
+
+   b->count++;
+   b->sum += sample->value;
+   b->min = std::min(b->min, sample->value);
+   b->max = std::max(b->max, sample->value);
+   b->last = sample->value;
+   b->textId = sample->textId;
+}
+
+//***************************************************************************
+// Finish
+//***************************************************************************
+
+void SampleRollup::finish(Bucket* b, std::vector<Bucket>* finished, std::vector<Bucket>* partial)
+{
+   if (b->exact)
+      finished->push_back(*b);
+   else
+      partial->push_back(*b);
+
+   b->count = 0;
+}
+
+//***************************************************************************
+// Close Stale
+//   buckets of series without samples since one interval
+//***************************************************************************
+
+void SampleRollup::closeStale(time_t now, std::vector<Bucket>* finished,
+                              std::vector<Bucket>* partial)
+{
+   std::map<std::string, Bucket>::iterator it = buckets.begin();
+
+   while (it != buckets.end())
+   {
+      if (it->second.end + tier.interval <= now)
+      {
+         finish(&it->second, finished, partial);
+         buckets.erase(it++);
+      }
+      else
+         it++;
+   }
+}
+
+//***************************************************************************
+// Close All
+//   at stop, the open buckets are stored partial, the next start merges
+//   its part of them
+//***************************************************************************
+
+void SampleRollup::closeAll(std::vector<Bucket>* partial)
+{
+   std::map<std::string, Bucket>::iterator it;
+
+   for (it = buckets.begin(); it != buckets.end(); it++)
+   {
+      it->second.exact = no;
+      partial->push_back(it->second);
+   }
+
+   buckets.clear();
+}
+
+//***************************************************************************
+// Merge
+//   two parts of one bucket, 'before' holds the samples in front of the
+//   ones of b - unless b is late, then first and last of 'before' are kept
+//***************************************************************************
+
+void SampleRollup::merge(Bucket* b, const Bucket* before)
+{
+   b->count += before->count;
+   b->sum += before->sum;
+   b->min = std::min(b->min, before->min);
+   b->max = std::max(b->max, before->max);
+   b->first = before->first;
+
+   if (b->late)
+   {
+      b->last = before->last;
+      b->textId = before->textId;
+      b->late = before->late;
+   }
+
+   b->exact = b->exact || before->exact;
+}
+
+//***************************************************************************
+// Combine
+//   the finished and partial buckets of a write by their row, a late
+//   sample may hit a bucket finished by the same write
+//***************************************************************************
+
+void SampleRollup::combine(std::vector<Bucket>* finished, std::vector<Bucket>* partial,
+                           std::map<std::string, Bucket>* rows)
+{
+   std::vector<Bucket>* lists[2] = { finished, partial };
+
+   for (int l = 0; l < 2; l++)
+   {
+      for (unsigned int i = 0; i < lists[l]->size(); i++)
+      {
+         Bucket b = lists[l]->at(i);
+         char key[50];
+
+         sprintf(key, "%s:%d:%ld", b.aggregate, b.seriesId, (long)b.start);
+
+         if (rows->find(key) != rows->end())
+            merge(&b, &(*rows)[key]);
+
+         (*rows)[key] = b;
+      }
+   }
+}
+
+//***************************************************************************
+// Recompute Statement
+//   the rows of one tier for the buckets in [from, to) from the raw
+//   samples, optionally of one series only. First and last are taken
+//   from the head of a group_concat, the truncation of group_concat
+//   (group_concat_max_len) only cuts its tail. TIME is in seconds since
+//   epoch, the buckets are calculated on the local wall clock. With
+//   missingOnly existing rows are kept as they are.
+//***************************************************************************
+
+char* SampleRollup::recomputeStatement(const char* aggregate, int interval, time_t from, time_t to,
+                                       int seriesId, int missingOnly)
+{
+   char* stmt = 0;
+   char* series = 0;
+   char* bucketEnd = 0;
+
+   if (seriesId != na)
+      asprintf(&series, " and seriesid = %d", seriesId);
+
+   asprintf(&bucketEnd,
+            "unix_timestamp(CONCAT(DATE(from_unixtime(time)), ' ', "
+            "SEC_TO_TIME((TIME_TO_SEC(from_unixtime(time)) DIV %d) * %d)) + INTERVAL %d SECOND)",
+            interval, interval, interval);
+
+   asprintf(&stmt,
+            "insert into sampledata (seriesid, aggregate, time, value, min, max, first, last, textid, samples) "
+            "  select seriesid, '%s', %s, "
+            "    round(sum(value)/count(*), 2), min(value), max(value), "
+            "    substring_index(group_concat(value order by time separator ','), ',', 1) + 0, "
+            "    substring_index(group_concat(value order by time desc separator ','), ',', 1) + 0, "
+            "    substring_index(group_concat(textid order by time desc separator ','), ',', 1) + 0, count(*) "
+            "  from sampledata "
+            "  where aggregate = 'S' and time >= %ld and time < %ld%s "
+            "  group by %s, seriesid "
+            "on duplicate key update %s;",
+            aggregate, bucketEnd,
+            (long)from, (long)to, series ? series : "",
+            bucketEnd,
+            missingOnly ? "samples = samples" :
+            "  value = values(value), min = values(min), max = values(max), "
+            "  first = values(first), last = values(last), "
+            "  textid = values(textid), samples = values(samples)");
+
+   free(bucketEnd);
+   free(series);
+
+   return stmt;
+}
+
+//***************************************************************************
+// Sample Writer
+//***************************************************************************
+
+SampleWriter::SampleWriter(int aQueueSize, const char* aPolicy, const char* aSpoolFile,
+                           int aSpoolSize, int aWal)
+   : ring(aQueueSize)
+{
+   policy = toPolicy(aPolicy);
+   wal = aWal;
+   spoolFile = !isEmpty(aSpoolFile) ? strdup(aSpoolFile) : 0;
+   spoolSize = aSpoolSize;
+
+   if (policy == na)
+   {
+      tell(eloAlways, "Warning: Unknown writer policy '%s', using 'drop'", aPolicy);
+      policy = wpDrop;
+   }
+
+   if ((policy == wpSpool || wal) && !spoolFile)
+   {
+      tell(eloAlways, "Warning: No spool configured, using writer policy 'drop'");
+      policy = wpDrop;
+      wal = no;
+   }
+
+   if (policy != wpSpool && !wal)
+   {
+      free(spoolFile);
+      spoolFile = 0;
+   }
+
+   running = no;
+   active = no;
+   wakeup = no;
+   pthread_mutex_init(&mutex, 0);
+   pthread_mutex_init(&spillMutex, 0);
+   pthread_cond_init(&wakeCond, 0);
+   pthread_cond_init(&doneCond, 0);
+
+   connection = 0;
+   table = 0;
+   batch = 0;
+   retryAt = 0;
+
+   queued = 0;
+   dropped = 0;
+   spilled = 0;
+   maxDepth = 0;
+   handled = 0;
+   written = 0;
+   replayed = 0;
+   failed = 0;
+   lagMs = 0;
+   maxLagMs = 0;
+
+   flushInterval = 0;
+   flushRows = 0;
+   nextFlushAt = 0;
+   forceFlush = no;
+   startedAt = time(0);
+   commits = 0;
+   flushes = 0;
+   flushMs = 0;
+   maxFlushMs = 0;
+   flushMsTotal = 0;
+   serverSince = 0;
+   serverFsyncsBase = 0;
+   serverBytesBase = 0;
+   serverFsyncs = 0;
+   serverBytes = 0;
+}
+
+SampleWriter::~SampleWriter()
+{
+   stop();
+
+   pthread_cond_destroy(&doneCond);
+   pthread_cond_destroy(&wakeCond);
+   pthread_mutex_destroy(&spillMutex);
+   pthread_mutex_destroy(&mutex);
+   free(spoolFile);
+}
+
+//***************************************************************************
+// Policy
+//***************************************************************************
+
+int SampleWriter::toPolicy(const char* name)
+{
+   if (strcasecmp(name, "block") == 0)  return wpBlock;
+   if (strcasecmp(name, "drop") == 0)   return wpDrop;
+   if (strcasecmp(name, "spool") == 0)  return wpSpool;
+
+   return na;
+}
+
+const char* SampleWriter::toName(int policy)
+{
+   switch (policy)
+   {
+      case wpBlock: return "block";
+      case wpDrop:  return "drop";
+      case wpSpool: return "spool";
+   }
+
+   return "unknown";
+}
+
+//***************************************************************************
+// Start / Stop
+//***************************************************************************
+
+int SampleWriter::start()
+{
+   if (running)
+      return done;
+
+   // samples of the spool are queued as well, they are still to be written
+
+   if (spoolFile)
+   {
+      if (spool.open(spoolFile, spoolSize) == success)
+         queued += spool.getPending();
+      else
+      {
+         tell(eloAlways, "Warning: Spool not available, using writer policy 'drop'");
+         policy = policy == wpSpool ? wpDrop : policy;
+         wal = no;
+      }
+   }
+
+   active = yes;
+
+   if (pthread_create(&thread, 0, threadFunc, this) != 0)
+   {
+      tell(eloAlways, "Error: Starting sample writer failed, error was '%s'", strerror(errno));
+      active = no;
+      return fail;
+   }
+
+   running = yes;
+
+   return success;
+}
+
+int SampleWriter::stop()
+{
+   if (!running)
+      return done;
+
+   active = no;
+   commit();
+   pthread_join(thread, 0);
+   running = no;
+
+   spool.close();
+
+   return success;
+}
+
+void* SampleWriter::threadFunc(void* arg)
+{
+   ((SampleWriter*)arg)->action();
+
+   return 0;
+}
+
+//***************************************************************************
+// Push
+//   called by the acquisition, never waits for the database
+//   except with policy 'block'
+//***************************************************************************
+
+int SampleWriter::push(time_t time, int address, const char* type, double value, const char* text,
+                       int flags)
+{
+   Sample sample;
+   int status = fail;
+
+   sample.time = time;
+   sample.address = address;
+   sstrcpy(sample.type, type, sizeof(sample.type));
+   sample.value = value;
+   sstrcpy(sample.text, text ? text : "", sizeof(sample.text));
+   sample.queuedAt = cTimeMs::Now();
+   sample.flags = flags;
+
+   if (wal)
+   {
+      if (spool.append(&sample) == success)
+      {
+         queued++;
+         return success;
+      }
+
+      dropped++;
+      tell(eloDetail, "Spool full, dropped sample %s:0x%x", sample.type, sample.address);
+
+      return fail;
+   }
+
+   // as long as the spool holds samples the new ones are appended
+   // there as well, to keep them in order
+
+   pthread_mutex_lock(&spillMutex);
+
+   if (!spool.getPending())
+      status = ring.push(&sample);
+
+   pthread_mutex_unlock(&spillMutex);
+
+   if (status != success && policy == wpBlock && running)
+   {
+      cTimeMs timeout(blockTimeout);
+
+      pthread_mutex_lock(&mutex);
+
+      while ((status = ring.push(&sample)) != success && !timeout.TimedOut())
+      {
+         struct timespec ts;
+
+         wakeup = yes;
+         pthread_cond_signal(&wakeCond);
+
+         clock_gettime(CLOCK_REALTIME, &ts);
+         ts.tv_nsec += 100 * 1000000;
+         ts.tv_sec += ts.tv_nsec / 1000000000;
+         ts.tv_nsec %= 1000000000;
+
+         pthread_cond_timedwait(&doneCond, &mutex, &ts);
+      }
+
+      pthread_mutex_unlock(&mutex);
+   }
+
+   if (status == success)
+   {
+      int depth = ring.getDepth();
+
+      queued++;
+
+      if (depth > maxDepth)
+         maxDepth = depth;
+
+      return success;
+   }
+
+   if (policy == wpSpool && spool.append(&sample) == success)
+   {
+      queued++;
+      spilled++;
+      return success;
+   }
+
+   dropped++;
+   tell(eloDetail, "Sample queue full, dropped sample %s:0x%x", sample.type, sample.address);
+
+   return fail;
+}
+
+//***************************************************************************
+// Commit
+//***************************************************************************
+
+int SampleWriter::commit(int force)
+{
+   spool.sync();
+
+   if (force)
+      forceFlush = yes;
+
+   pthread_mutex_lock(&mutex);
+   wakeup = yes;
+   pthread_cond_signal(&wakeCond);
+   pthread_mutex_unlock(&mutex);
+
+   return success;
+}
+
+//***************************************************************************
+// Sync
+//   wait until the samples queued so far are handled by the writer,
+//   e.g. before the alerts are checked against the samples table
+//***************************************************************************
+
+int SampleWriter::sync(int timeout)
+{
+   unsigned long target = queued;
+   cTimeMs wait(timeout);
+
+   if (!running)
+      return fail;
+
+   commit(yes);
+
+   pthread_mutex_lock(&mutex);
+
+   while (handled < target && !wait.TimedOut())
+   {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_nsec += 50 * 1000000;
+      ts.tv_sec += ts.tv_nsec / 1000000000;
+      ts.tv_nsec %= 1000000000;
+
+      pthread_cond_timedwait(&doneCond, &mutex, &ts);
+   }
+
+   pthread_mutex_unlock(&mutex);
+
+   return handled >= target ? success : fail;
+}
+
+//***************************************************************************
+// Get Statistic
+//***************************************************************************
+
+void SampleWriter::getStatistic(Statistic* s)
+{
+   s->size = ring.getSize();
+   s->depth = ring.getDepth();
+   s->maxDepth = maxDepth;
+   s->queued = queued;
+   s->written = written;
+   s->dropped = dropped;
+   s->spilled = spilled;
+   s->replayed = replayed;
+   s->failed = failed;
+   s->lagMs = lagMs;
+   s->maxLagMs = maxLagMs;
+   s->spoolPending = spool.getPending();
+   s->spoolSize = spool.getMaxRecords();
+   s->spoolSyncs = spool.getSyncs();
+   s->spoolBytes = spool.getBytesSynced();
+
+   s->seconds = time(0) - startedAt;
+   s->commits = commits;
+   s->flushes = flushes;
+   s->flushMs = flushMs;
+   s->maxFlushMs = maxFlushMs;
+   s->avgFlushMs = flushes ? flushMsTotal / flushes : 0;
+
+   s->serverSeconds = serverSince ? time(0) - serverSince : 0;
+   s->serverFsyncs = serverFsyncs;
+   s->serverBytes = serverBytes;
+}
+
+//***************************************************************************
+// Set Flush Policy
+//***************************************************************************
+
+void SampleWriter::setFlushPolicy(int aInterval, int aRows)
+{
+   flushInterval = aInterval;
+   flushRows = aRows;
+
+   if (flushRows > ring.getSize() / 2)
+      tell(eloAlways, "Warning: The writer queue holds %d samples only, flushing at %d samples",
+           ring.getSize(), ring.getSize() / 2);
+}
+
+//***************************************************************************
+// Set Rollup
+//***************************************************************************
+
+void SampleWriter::setRollup(const std::vector<SampleRollup::Tier>* tiers)
+{
+   rollups.clear();
+
+   for (unsigned int t = 0; t < tiers->size(); t++)
+      rollups.push_back(SampleRollup(&tiers->at(t)));
+}
+
+//***************************************************************************
+// Action (writer thread)
+//***************************************************************************
+
+void SampleWriter::action()
+{
+   tell(eloAlways, "Sample writer started, queue size %d, policy '%s'%s, flush every %d minutes / %d samples",
+        ring.getSize(), toName(policy), wal ? ", all samples spooled" : "",
+        flushInterval / tmeSecondsPerMinute, flushRows);
+
+   nextFlushAt = time(0) + flushInterval;
+
+   while (active)
+   {
+      if (!isFlushDue(wait(1000)))
+         continue;
+
+      if (!connection && connect() != success)
+         continue;                 // samples stay queued until the database is back
+
+      flush();
+   }
+
+   // write (or spool) what is left, the ring is gone with us
+
+   if (!connection)
+      connect();
+
+   flush();
+
+   if (connection && rollups.size())
+   {
+      std::vector<SampleRollup::Bucket> finished;
+      std::vector<SampleRollup::Bucket> open;
+
+      for (unsigned int t = 0; t < rollups.size(); t++)
+         rollups[t].closeAll(&open);
+
+      if (addBuckets(&finished, &open) != success || batch->flush() != success)
+         tell(eloAlways, "Error: Storing the open rollup buckets failed");
+   }
+
+   disconnect();
+
+   tell(eloAlways, "Sample writer stopped");
+}
+
+//***************************************************************************
+// Is Flush Due
+//   without flush policy each cycle is written at its commit, otherwise
+//   the samples are kept until flushInterval is over or flushRows are
+//   queued, forced by sync() and stop(), in any case if the ring or the
+//   spool is getting full
+//***************************************************************************
+
+int SampleWriter::isFlushDue(int woken)
+{
+   int pending = ring.getDepth() + spool.getPending();
+
+   if (forceFlush || !active)
+      return yes;
+
+   if (!pending)
+      return no;
+
+   if (ring.getDepth() >= ring.getSize() / 2)
+      return yes;
+
+   if (spool.isOpen() && spool.getPending() >= spool.getMaxRecords() / 2)
+      return yes;
+
+   if (flushRows && pending >= flushRows)
+      return yes;
+
+   if (flushInterval)
+      return woken && time(0) >= nextFlushAt;
+
+   return woken;
+}
+
+//***************************************************************************
+// Flush
+//***************************************************************************
+
+int SampleWriter::flush()
+{
+   uint64_t start = cTimeMs::Now();
+   int status;
+
+   forceFlush = no;
+   nextFlushAt = time(0) + flushInterval;
+
+   // the ring first, as long as the spool holds samples nothing new is pushed to the ring
+
+   status = drain();
+
+   if (!ring.getDepth() && replay() != success)
+      status = fail;
+
+   unsigned long ms = cTimeMs::Now() - start;
+
+   flushes++;
+   flushMs = ms;
+   flushMsTotal += ms;
+
+   if (ms > maxFlushMs)
+      maxFlushMs = ms;
+
+   if (connection)
+      updateServerStatistic();
+
+   return status;
+}
+
+//***************************************************************************
+// Update Server Statistic
+//   fsyncs and bytes written by the database server (all its clients)
+//***************************************************************************
+
+void SampleWriter::updateServerStatistic()
+{
+   unsigned long long dataFsyncs, logFsyncs, dataWritten, logWritten;
+
+   if (connection->getStatusValue("Innodb_data_fsyncs", dataFsyncs) != success
+       || connection->getStatusValue("Innodb_os_log_fsyncs", logFsyncs) != success
+       || connection->getStatusValue("Innodb_data_written", dataWritten) != success
+       || connection->getStatusValue("Innodb_os_log_written", logWritten) != success)
+      return;
+
+   // first call or server restarted
+
+   if (!serverSince || dataFsyncs + logFsyncs < serverFsyncsBase || dataWritten + logWritten < serverBytesBase)
+   {
+      serverSince = time(0);
+      serverFsyncsBase = dataFsyncs + logFsyncs;
+      serverBytesBase = dataWritten + logWritten;
+   }
+
+   serverFsyncs = dataFsyncs + logFsyncs - serverFsyncsBase;
+   serverBytes = dataWritten + logWritten - serverBytesBase;
+}
+
+//***************************************************************************
+// Wait
+//***************************************************************************
+
+int SampleWriter::wait(int timeout)
+{
+   int woken;
+
+   pthread_mutex_lock(&mutex);
+
+   if (!wakeup && active)
+   {
+      struct timespec ts;
+
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += timeout / 1000;
+      ts.tv_nsec += (timeout % 1000) * 1000000;
+      ts.tv_sec += ts.tv_nsec / 1000000000;
+      ts.tv_nsec %= 1000000000;
+
+      pthread_cond_timedwait(&wakeCond, &mutex, &ts);
+   }
+
+   woken = wakeup;
+   wakeup = no;
+   pthread_mutex_unlock(&mutex);
+
+   return woken;
+}
+
+void SampleWriter::signalDone()
+{
+   pthread_mutex_lock(&mutex);
+   pthread_cond_broadcast(&doneCond);
+   pthread_mutex_unlock(&mutex);
+}
+
+//***************************************************************************
+// Connect / Disconnect
+//***************************************************************************
+
+int SampleWriter::connect()
+{
+   if (time(0) < retryAt)
+      return fail;
+
+   connection = new cDbConnection();
+   table = new cDbTable(connection, "sampledata");
+
+   if (table->open() != success || dict.open(connection) != success)
+   {
+      tell(eloAlways, "Sample writer: Connecting database failed, retrying in %d seconds", retryInterval);
+      disconnect();
+      retryAt = time(0) + retryInterval;
+
+      return fail;
+   }
+
+   batch = new cDbBatch(table);
+   tell(eloDetail, "Sample writer: Connected to database");
+
+   return success;
+}
+
+void SampleWriter::disconnect()
+{
+   dict.close();
+   delete batch;       batch = 0;
+   delete table;       table = 0;
+   delete connection;  connection = 0;
+}
+
+//***************************************************************************
+// Drain
+//   on failure the samples of the ring are kept in the spool (if any). The
+//   ring only gets samples while the spool is empty, therefore they are
+//   older than the spooled ones and go in front of them
+//***************************************************************************
+
+int SampleWriter::drain()
+{
+   std::vector<Sample> samples;
+   Sample sample;
+   int status;
+
+   while ((int)samples.size() < ring.getSize() && ring.pop(&sample) == success)
+      samples.push_back(sample);
+
+   if (!samples.size())
+      return done;
+
+   if ((status = write(&samples)) == success)
+      handled += samples.size();
+
+   else
+   {
+      int count = 0;
+
+      if (policy == wpSpool)
+      {
+         // the samples pushed to the ring meanwhile too, afterwards push()
+         // finds the spool pending and appends behind them
+
+         pthread_mutex_lock(&spillMutex);
+
+         while (ring.pop(&sample) == success)
+            samples.push_back(sample);
+
+         count = spool.insert(&samples);
+
+         pthread_mutex_unlock(&spillMutex);
+      }
+
+      failed += samples.size() - count;
+      handled += samples.size() - count;
+      spilled += count;
+
+      tell(eloAlways, "Error: Storing %d samples failed, %d spooled", (int)samples.size(), count);
+   }
+
+   signalDone();
+
+   return status;
+}
+
+//***************************************************************************
+// Replay
+//   in order, replayChunk samples per transaction, a sample leaves the
+//   spool not before its transaction is committed
+//***************************************************************************
+
+int SampleWriter::replay()
+{
+   std::vector<Sample> samples;
+   int status = success;
+   int count = 0;
+
+   while (connection && spool.read(&samples, replayChunk) > 0)
+   {
+      if ((status = write(&samples)) != success)
+         break;
+
+      spool.ack(samples.size());
+      handled += samples.size();
+      count += samples.size();
+      signalDone();
+   }
+
+   replayed += count;
+
+   if (count && !wal)
+      tell(eloAlways, "Replayed %d spooled samples, %d left", count, spool.getPending());
+
+   return status;
+}
+
+//***************************************************************************
+// Add Buckets
+//   the rows of the finished buckets to the batch. Parts of one bucket
+//   are merged, the partial ones with the row stored before (or stored
+//   partial as it is if there is none)
+//***************************************************************************
+
+int SampleWriter::addBuckets(std::vector<SampleRollup::Bucket>* finished,
+                             std::vector<SampleRollup::Bucket>* partial)
+{
+   std::map<std::string, SampleRollup::Bucket> rows;
+
+   SampleRollup::combine(finished, partial, &rows);
+
+   for (std::map<std::string, SampleRollup::Bucket>::iterator it = rows.begin(); it != rows.end(); it++)
+   {
+      SampleRollup::Bucket* b = &it->second;
+
+      table->clear();
+      table->setValue("SERIESID", b->seriesId);
+      table->setValue("AGGREGATE", b->aggregate);
+      table->setValue("TIME", b->end);
+
+      if (!b->exact && table->find())
+      {
+         SampleRollup::Bucket stored = *b;
+
+         stored.count = table->getIntValue("SAMPLES");
+         stored.sum = table->getFloatValue("VALUE") * stored.count;
+         stored.min = table->getFloatValue("MIN");
+         stored.max = table->getFloatValue("MAX");
+         stored.first = table->getFloatValue("FIRST");
+         stored.last = table->getFloatValue("LAST");
+         stored.textId = table->getIntValue("TEXTID");
+         stored.exact = no;
+         stored.late = no;
+
+         if (stored.count > 0)
+            SampleRollup::merge(b, &stored);
+
+         table->clear();
+         table->setValue("SERIESID", b->seriesId);
+         table->setValue("AGGREGATE", b->aggregate);
+         table->setValue("TIME", b->end);
+      }
+
+      table->setValue("VALUE", round(b->sum / b->count * 100) / 100);
+      table->setValue("MIN", b->min);
+      table->setValue("MAX", b->max);
+      table->setValue("FIRST", b->first);
+      table->setValue("LAST", b->last);
+      table->setValue("SAMPLES", b->count);
+
+      if (b->textId)
+         table->setValue("TEXTID", b->textId);
+
+      batch->add();
+   }
+
+   return success;
+}
+
+//***************************************************************************
+// Write
+//   one transaction, on failure the connection is rebuilt
+//***************************************************************************
+
+int SampleWriter::write(std::vector<Sample>* samples)
+{
+   int status = fail;
+   std::vector<SampleRollup::Bucket> finished;
+   std::vector<SampleRollup::Bucket> partials;
+   std::vector<SampleRollup> saved = rollups;     // state before, in case the write fails
+
+   // the ids of series and texts first, they may need a (committed) insert
+
+   for (unsigned int i = 0; i < samples->size() && connection; i++)
+   {
+      Sample* s = &samples->at(i);
+
+      s->seriesId = dict.seriesIdOf(s->address, s->type);
+      s->textId = dict.textIdOf(s->text);
+
+      if (s->seriesId == na || s->textId == na)
+      {
+         tell(eloAlways, "Error: Can't get the series of %s:0x%x", s->type, s->address);
+         disconnect();
+         retryAt = time(0) + retryInterval;
+      }
+   }
+
+   if (connection)
+   {
+      for (unsigned int i = 0; i < samples->size(); i++)
+      {
+         Sample* s = &samples->at(i);
+
+         // samples dropped by the compression only feed the rollups
+
+         if (s->flags & Sample::sfRow)
+         {
+            table->clear();
+            table->setValue("SERIESID", s->seriesId);
+            table->setValue("AGGREGATE", "S");
+            table->setValue("TIME", s->time);
+            table->setValue("VALUE", s->value);
+            table->setValue("SAMPLES", 1);
+
+            if (s->textId)
+               table->setValue("TEXTID", s->textId);
+
+            batch->add();
+         }
+
+         for (unsigned int t = 0; t < rollups.size() && (s->flags & Sample::sfRollup); t++)
+            rollups[t].add(s, &finished, &partials);
+      }
+
+      // finished buckets go to the same transaction
+
+      for (unsigned int t = 0; t < rollups.size(); t++)
+         rollups[t].closeStale(time(0), &finished, &partials);
+
+      addBuckets(&finished, &partials);
+      status = batch->flush();
+
+      if (status != success)
+      {
+         // the samples come again (replayed from the spool), the rollups
+         // continue at their state before - the buckets stay exact and the
+         // finished ones are finished again
+
+         rollups = saved;
+      }
+   }
+
+   if (status == success)
+   {
+      unsigned long lag = cTimeMs::Now() - samples->front().queuedAt;
+
+      written += samples->size();
+      commits++;
+      lagMs = lag;
+
+      if (lag > maxLagMs)
+         maxLagMs = lag;
+
+      tell(eloDetail, "Stored %d samples with %d statement(s) in %.1f ms (%.0f rows/s), lag %lu ms",
+           batch->getLastRows(), batch->getLastStatements(), batch->getLastMs(),
+           batch->getLastMs() > 0 ? batch->getLastRows() / (batch->getLastMs() / 1000.0) : 0.0, lag);
+   }
+   else if (connection)
+   {
+      tell(eloAlways, "Error: Storing %d samples failed", (int)samples->size());
+      disconnect();
+      retryAt = time(0) + retryInterval;
+   }
+
+   return status;
+}
@@ -0,0 +1,419 @@
+//***************************************************************************
+// p4d / Linux - Heizungs Manager
+// File p4writer.h
+// This code is distributed under the terms and conditions of the
+// GNU GENERAL PUBLIC LICENSE. See the file LICENSE for details.
+// Date 16.10.2026  agent
+//***************************************************************************
+// Sample Writer
+//   the samples are written by a thread with its own database connection,
+//   the acquisition only pushes them to a lock free ring (or the spool)
+//   and never waits for the database (except with policy 'block')
+//***************************************************************************
+
+#ifndef _P4WRITER_H_
+#define _P4WRITER_H_
+
+#include <pthread.h>
+
+#include <atomic>
+#include <vector>
+#include <map>
+#include <string>
+
+#include "lib/db.h"
+
+//***************************************************************************
+// Sample
+//***************************************************************************
+
+struct Sample
+{
+   enum Flags
+   {
+      sfRow = 0x01,               // a raw row in sampledata
+      sfRollup = 0x02             // added to the rollups
+   };
+
+   time_t time;
+   int address;
+   char type[2+TB];
+   double value;
+   char text[50+TB];
+   int seriesId;                  // resolved by the writer
+   int textId;                    //  "
+   uint64_t queuedAt;             // ms, for the lag of the writer
+   int flags;                     // sfRow, sfRollup
+};
+
+//***************************************************************************
+// Sample Ring
+//   bounded single producer / single consumer queue, head is only
+//   written by the producer, tail only by the consumer
+//***************************************************************************
+
+class SampleRing
+{
+   public:
+
+      SampleRing(int aSize);       // rounded up to a power of two
+      ~SampleRing();
+
+      int push(const Sample* sample);
+      int pop(Sample* sample);
+
+      int getSize()                { return size; }
+      int getDepth()               { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+
+   protected:
+
+      Sample* ring;
+      unsigned int size;
+      unsigned int mask;
+
+      std::atomic<unsigned int> head;
+      std::atomic<unsigned int> tail;
+};
+
+//***************************************************************************
+// Sample Spool
+//   append only, memory mapped file of fixed size records, synced in
+//   batches (by sync() at the end of a cycle or every syncEvery records).
+//   The header holds the position of the first record not yet committed
+//   to the database, at open the valid records behind it are recovered
+//   by their sequence number and check sum. Once all records are
+//   committed the spool starts over at the begin of the file.
+//***************************************************************************
+
+class SampleSpool
+{
+   public:
+
+      enum Misc
+      {
+         syncEvery = 256,
+         headerSize = 4096
+      };
+
+      struct Header
+      {
+         char magic[8];
+         uint32_t recordSize;
+         uint32_t maxRecords;
+         uint64_t readSeq;         // sequence number of the record at readPos
+         uint32_t readPos;         // first record not yet committed to the database
+         uint32_t check;
+      };
+
+      struct Record
+      {
+         uint64_t seq;
+         uint64_t queuedAt;
+         int64_t time;
+         double value;
+         int32_t address;
+         char type[2+TB];
+         char text[50+TB];
+         char flags;               // in the former padding, 0 -> row and rollup
+         uint32_t check;
+      };
+
+      SampleSpool();
+      ~SampleSpool();
+
+      int open(const char* aPath, int aSize);      // size of the file in bytes
+      int close();
+
+      int append(const Sample* sample);
+      int insert(const std::vector<Sample>* samples);  // in front of the pending records, returns the count
+      int read(std::vector<Sample>* samples, int max);
+      int ack(int count);                          // the first count records are committed
+      int sync();
+
+      int isOpen()                 { return map != 0; }
+      int getPending()             { return pending.load(std::memory_order_acquire); }
+      int getMaxRecords()          { return isOpen() ? header->maxRecords : 0; }
+      unsigned long getSyncs()     { return syncs; }
+      unsigned long getBytesSynced() { return bytesSynced; }
+
+   protected:
+
+      int create(int maxRecords);
+      int attach(size_t size);
+      void detach();
+      int recover();
+      int syncRecords();
+      int syncHeader();
+      void setRecord(Record* r, const Sample* sample, uint64_t seq);
+      void updatePending()         { pending.store(map ? writePos - header->readPos : 0, std::memory_order_release); }
+
+      static uint32_t checksum(const void* p, int size);
+
+      char* path;
+      int fd;
+      byte* map;
+      size_t mapSize;
+      Header* header;
+      Record* records;
+
+      unsigned int writePos;
+      uint64_t writeSeq;
+      unsigned int syncedPos;
+      std::atomic<int> pending;    // read by the acquisition without the lock
+      unsigned long syncs;
+      unsigned long bytesSynced;
+
+      cMyMutex mutex;
+};
+
+//***************************************************************************
+// Series Dict
+//   the ids of the series (address/type) and of the state texts, cached,
+//   one instance per connection
+//***************************************************************************
+
+class SeriesDict
+{
+   public:
+
+      SeriesDict();
+      ~SeriesDict();
+
+      int open(cDbConnection* aConnection);
+      void close();
+
+      int seriesIdOf(int address, const char* type, int create = yes);   // na if unknown
+      int textIdOf(const char* text);                                    // 0 for empty text
+
+   protected:
+
+      cDbTable* tableSeries;
+      cDbTable* tableTexts;
+      cDbStatement* selectSeries;
+      cDbStatement* selectText;
+
+      std::map<std::string, int> seriesIds;    // key 'type:address'
+      std::map<std::string, int> textIds;
+};
+
+//***************************************************************************
+// Sample Rollup
+//   running count/sum/min/max/first/last of the current bucket per series
+//   for one tier, a finished bucket becomes a row with the aggregate code
+//   of the tier at the end time of the bucket. Buckets not seen completely
+//   (started before us, late samples, open at stop) are partial, they are
+//   merged with the stored row of the bucket - the raw samples may be
+//   thinned by the compression or not in sampledata at all (tsdb). A
+//   failed write restores the state before it.
+//***************************************************************************
+
+class SampleRollup
+{
+   public:
+
+      struct Tier
+      {
+         char aggregate[1+TB];     // code in samples.aggregate
+         int interval;             // seconds
+         int history;              // days to keep (0 -> forever)
+      };
+
+      struct Bucket
+      {
+         char aggregate[1+TB];
+         int interval;
+         int seriesId;
+         time_t start;
+         time_t end;
+         int count;
+         double sum;
+         double min;
+         double max;
+         double first;
+         double last;
+         int textId;               // of the last sample
+         int exact;                // all samples of the bucket seen
+         int late;                 // samples older than the stored ones (first/last unknown)
+      };
+
+      SampleRollup(const Tier* aTier, time_t aStartedAt = 0);     // 0 -> now
+
+      const Tier* getTier()            { return &tier; }
+
+      void add(const Sample* sample, std::vector<Bucket>* finished, std::vector<Bucket>* partial);
+      void closeStale(time_t now, std::vector<Bucket>* finished, std::vector<Bucket>* partial);
+      void closeAll(std::vector<Bucket>* partial);
+
+      static int parseTiers(const char* spec, int aggregateInterval, std::vector<Tier>* tiers);
+      static time_t bucketStart(time_t t, int interval);
+      static time_t bucketEnd(time_t start, int interval);
+      static void merge(Bucket* b, const Bucket* before);
+      static void combine(std::vector<Bucket>* finished, std::vector<Bucket>* partial,
+                          std::map<std::string, Bucket>* rows);
+      static char* recomputeStatement(const char* aggregate, int interval, time_t from, time_t to,
+                                      int seriesId = na, int missingOnly = no);
+
+   protected:
+
+      void finish(Bucket* b, std::vector<Bucket>* finished, std::vector<Bucket>* partial);
+
+      Tier tier;
+      std::map<std::string, Bucket> buckets;   // key series id
+      time_t startedAt;
+};
+
+//***************************************************************************
+// Sample Writer
+//***************************************************************************
+
+class SampleWriter
+{
+   public:
+
+      enum Policy                  // if the ring is full
+      {
+         wpBlock,                  // wait up to blockTimeout for the writer, then drop
+         wpDrop,                   // drop the new sample
+         wpSpool                   // append the sample to the spool, replayed later
+      };
+
+      enum Misc
+      {
+         blockTimeout = 5000,      // ms
+         retryInterval = 10,       // seconds between connect attempts
+         replayChunk = 1000        // rows per transaction while replaying the spill file
+      };
+
+      struct Statistic
+      {
+         int size;
+         int depth;
+         int maxDepth;
+         unsigned long queued;
+         unsigned long written;
+         unsigned long dropped;
+         unsigned long spilled;
+         unsigned long replayed;
+         unsigned long failed;
+         unsigned long lagMs;      // enqueue -> commit of the last transaction
+         unsigned long maxLagMs;
+         int spoolPending;
+         int spoolSize;
+         unsigned long spoolSyncs;
+         unsigned long spoolBytes;
+
+         // flush policy
+
+         int seconds;              // since start of the writer
+         unsigned long commits;
+         unsigned long flushes;
+         unsigned long flushMs;
+         unsigned long maxFlushMs;
+         unsigned long avgFlushMs;
+
+         // database server, all clients
+
+         int serverSeconds;
+         unsigned long long serverFsyncs;
+         unsigned long long serverBytes;
+      };
+
+      SampleWriter(int aQueueSize, const char* aPolicy, const char* aSpoolFile,
+                   int aSpoolSize, int aWal = no);
+      ~SampleWriter();
+
+      int start();
+      int stop();
+      void setFlushPolicy(int aInterval, int aRows);   // seconds, samples (0 -> each cycle)
+      void setRollup(const std::vector<SampleRollup::Tier>* tiers);    // before start()
+
+      // producer side
+
+      int push(time_t time, int address, const char* type, double value, const char* text = 0,
+               int flags = Sample::sfRow | Sample::sfRollup);
+      int commit(int force = no);  // end of cycle, write what is queued (if the flush policy says so)
+      int sync(int timeout);       // wait up to timeout ms until all queued samples are written
+
+      void getStatistic(Statistic* s);
+
+      static int toPolicy(const char* name);
+      static const char* toName(int policy);
+
+   protected:
+
+      static void* threadFunc(void* arg);
+
+      void action();
+      int connect();
+      void disconnect();
+      int isFlushDue(int woken);
+      int flush();
+      void updateServerStatistic();
+      int drain();
+      int write(std::vector<Sample>* samples);
+      int addBuckets(std::vector<SampleRollup::Bucket>* finished, std::vector<SampleRollup::Bucket>* partial);
+      int replay();
+      int wait(int timeout);        // yes if woken by commit()
+      void signalDone();
+
+      SampleRing ring;
+      SampleSpool spool;
+      std::vector<SampleRollup> rollups;   // one per tier, writer thread only
+      int policy;
+      int wal;                     // every sample is written to the spool first
+      char* spoolFile;
+      int spoolSize;
+
+      pthread_t thread;
+      int running;
+      std::atomic<int> active;
+      pthread_mutex_t mutex;
+      pthread_mutex_t spillMutex;  // ring or spool decision of push() against the spill of a failed write
+      pthread_cond_t wakeCond;     // producer -> writer
+      pthread_cond_t doneCond;     // writer -> producer
+      int wakeup;
+
+      // writer thread only
+
+      cDbConnection* connection;
+      cDbTable* table;
+      cDbBatch* batch;
+      SeriesDict dict;
+      time_t retryAt;
+
+      // flush policy
+
+      int flushInterval;
+      int flushRows;
+      time_t nextFlushAt;
+      std::atomic<int> forceFlush;
+
+      // counters, each written by one side only
+
+      std::atomic<unsigned long> queued;
+      std::atomic<unsigned long> dropped;
+      std::atomic<unsigned long> spilled;
+      std::atomic<int> maxDepth;
+
+      std::atomic<unsigned long> handled;   // queued samples committed or given up
+      std::atomic<unsigned long> written;
+      std::atomic<unsigned long> replayed;
+      std::atomic<unsigned long> failed;
+      std::atomic<unsigned long> lagMs;
+      std::atomic<unsigned long> maxLagMs;
+
+      time_t startedAt;
+      std::atomic<unsigned long> commits;
+      std::atomic<unsigned long> flushes;
+      std::atomic<unsigned long> flushMs;
+      std::atomic<unsigned long> maxFlushMs;
+      unsigned long flushMsTotal;
+      time_t serverSince;
+      unsigned long long serverFsyncsBase;
+      unsigned long long serverBytesBase;
+      std::atomic<unsigned long long> serverFsyncs;
+      std::atomic<unsigned long long> serverBytes;
+};
+
+//***************************************************************************
+#endif // _P4WRITER_H_
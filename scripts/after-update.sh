@@ -24,8 +24,8 @@ SENSORS="1#UD 2#UD 3#Ud 4#UD 21#VA 22#VA 25#VA 26#VA"
 
 MYSQL="mysql --batch --silent --host=$DB_HOST -u p4 -pp4 -Dp4 --default-character-set=utf8"
 
-MAXTIME=`$MYSQL -e "select max(time) from samples;"`
-LASTTIME=`$MYSQL -e "select max(time) from samples where time < '$MAXTIME';"`
+MAXTIME=`$MYSQL -e "select from_unixtime(max(time)) from sampledata where aggregate = 'S';"`
+LASTTIME=`$MYSQL -e "select from_unixtime(max(time)) from sampledata where aggregate = 'S' and time < unix_timestamp('$MAXTIME');"`
 
 if [ -n $LOG ] && [ "$1" != "debug" ]; then
     echo "----------------------------------------" >> $LOG
@@ -43,19 +43,19 @@ for s in $SENSORS; do
 
     LASTPARAMS=`$MYSQL -e "select concat(replace(case when f.usrtitle is null or f.usrtitle = '' then f.title else f.usrtitle end, ' ', '%20'), \
                                      '%22%29.State%28', \
-                                     case when s.text is null then s.value else concat('%22',replace(s.text, ' ', '%20'), '%22') end, \
+                                     case when t.text is null then d.value else concat('%22',replace(t.text, ' ', '%20'), '%22') end, \
                                      '%29') \
-                from samples s, valuefacts f \
-                where f.address = s.address and f.type = s.type \
-                    and time = '$LASTTIME' and s.address = '$ADDR' and s.type = '$TYPE';"`
+                from sampledata d join series s on s.id = d.seriesid left join statetexts t on t.id = d.textid, valuefacts f \
+                where f.address = s.address and f.type = s.type and d.aggregate = 'S' \
+                    and d.time = unix_timestamp('$LASTTIME') and s.address = '$ADDR' and s.type = '$TYPE';"`
 
     PARAMS=`$MYSQL -e "select concat(replace(case when f.usrtitle is null or f.usrtitle = '' then f.title else f.usrtitle end, ' ', '%20'),
                                      '%22%29.State%28',
-                                     case when s.text is null then s.value else concat('%22',replace(s.text, ' ', '%20'), '%22') end,
+                                     case when t.text is null then d.value else concat('%22',replace(t.text, ' ', '%20'), '%22') end,
                                      '%29') \
-            from samples s, valuefacts f \
-            where f.address = s.address and f.type = s.type \
-                and time = '$MAXTIME' and s.address = '$ADDR' and s.type = '$TYPE';"`
+            from sampledata d join series s on s.id = d.seriesid left join statetexts t on t.id = d.textid, valuefacts f \
+            where f.address = s.address and f.type = s.type and d.aggregate = 'S' \
+                and d.time = unix_timestamp('$MAXTIME') and s.address = '$ADDR' and s.type = '$TYPE';"`
 
     if [ -n $LOG ] && [ "$1" != "debug" ]; then
         echo "last data was: $LASTPARAMS" >> $LOG
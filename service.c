@@ -88,6 +88,43 @@ FroelingService::StateInfo FroelingService::stateInfos[] =
    { na,        "" }
 };
 
+//***************************************************************************
+// Commands
+//***************************************************************************
+
+FroelingService::CommandInfo FroelingService::commandInfos[] =
+{
+   { cmdCheck,             "check"          },
+   { cmdGetValue,          "getValue"       },
+   { cmdGetValueListFirst, "valueListFirst" },
+   { cmdGetValueListNext,  "valueListNext"  },
+   { cmdGetUnknownFirst,   "unknownFirst"   },
+   { cmdGetUnknownNext,    "unknownNext"    },
+   { cmdGetMenuListFirst,  "menuListFirst"  },
+   { cmdGetMenuListNext,   "menuListNext"   },
+   { cmdSetParameter,      "setParameter"   },
+   { cmdGetBaseSetup,      "getBaseSetup"   },
+   { cmdGetVersion,        "getVersion"     },
+   { cmdGetTimesFirst,     "timesFirst"     },
+   { cmdGetTimesNext,      "timesNext"      },
+   { cmdGetDigOut,         "getDigOut"      },
+   { cmdGetAnlOut,         "getAnlOut"      },
+   { cmdGetDigIn,          "getDigIn"       },
+   { cmdGetErrorFirst,     "errorFirst"     },
+   { cmdGetErrorNext,      "errorNext"      },
+   { cmdSetTimes,          "setTimes"       },
+   { cmdGetState,          "getState"       },
+   { cmdSetDateTime,       "setDateTime"    },
+   { cmdGetParameter,      "getParameter"   },
+   { cmdSetDigOut,         "setDigOut"      },
+   { cmdSetAnlOut,         "setAnlOut"      },
+   { cmdSetDigIn,          "setDigIn"       },
+   { cmdGetForce,          "getForce"       },
+   { cmdSetForce,          "setForce"       },
+
+   { na,                   ""               }
+};
+
 //***************************************************************************
 // To Title
 //***************************************************************************
@@ -101,6 +138,15 @@ const char* FroelingService::toTitle(int code)
    return "unknown";
 }
 
+const char* FroelingService::toCommandName(int command)
+{
+   for (int i = 0; commandInfos[i].command != na; i++)
+      if (commandInfos[i].command == command)
+         return commandInfos[i].name;
+
+   return "unknown";
+}
+
 int FroelingService::isError(int code)
 {
    const char* title = toTitle(code);
@@ -37,10 +37,18 @@ class FroelingService
          const char* title;
       };
 
+      struct CommandInfo
+      {
+         int command;
+         const char* name;
+      };
+
       // statics
 
       static StateInfo stateInfos[];
+      static CommandInfo commandInfos[];
       static const char* toTitle(int code);
+      static const char* toCommandName(int command);
       static int isError(int code);
 
       // -------------------------
@@ -57,7 +65,8 @@ class FroelingService
 
          errRequestFailed,        // -994
          errWrongAddress,         // -993
-         errTransmissionFailed    // -992
+         errTransmissionFailed,   // -992
+         errNotSupported          // -991
       };
 
       enum InterfaceDef1
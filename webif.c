@@ -8,11 +8,32 @@
 
 #include "p4d.h"
 
+//***************************************************************************
+// Is Short Job
+//   answered quickly and without side effects on the running cycle
+//***************************************************************************
+
+int P4d::isShortJob(const char* command)
+{
+   static const char* shortJobs[] =
+   {
+      "check-login", "read-config", "getp", "setp", "gettrp", "settrp",
+      "getv", "p4d-state", "s3200-state", 0
+   };
+
+   for (int i = 0; shortJobs[i]; i++)
+      if (strcasecmp(command, shortJobs[i]) == 0)
+         return yes;
+
+   return no;
+}
+
 //***************************************************************************
 // Perform WEBIF Requests
+//   with shortOnly the other jobs stay pending
 //***************************************************************************
 
-int P4d::performWebifRequests()
+int P4d::performWebifRequests(int shortOnly)
 {
    tableJobs->clear();
 
@@ -24,6 +45,9 @@ int P4d::performWebifRequests()
       const char* data = tableJobs->getStrValue("DATA");
       int jobId = tableJobs->getIntValue("ID");
 
+      if (shortOnly && !isShortJob(command))
+         continue;
+
       tableJobs->find();
       tableJobs->setValue("DONEAT", time(0));
       tableJobs->setValue("STATE", "D");
@@ -70,9 +94,9 @@ int P4d::performWebifRequests()
             time_t last;
 
             if (!selectMaxTime->find())
-               tell(eloAlways, "Warning: Got no result by 'select max(time) from samples'");
+               tell(eloAlways, "Warning: Got no result by 'select max(time) from sampledata'");
 
-            last = tableSamples->getTimeValue("TIME");
+            last = tableSamples->getIntValue("TIME");
             selectMaxTime->freeResult();
 
             tableSensorAlert->clear();
@@ -429,7 +453,7 @@ int P4d::performWebifRequests()
 
       else if (strcasecmp(command, "initmenu") == 0)
       {
-         initMenu();
+         initMenu(strcmp(data, "force") == 0);
          tableJobs->setValue("RESULT", "success:done");
       }
 
@@ -448,6 +472,7 @@ int P4d::performWebifRequests()
          double averages[3];
          char dt[10];
          char d[100];
+         char link[200];
          char* buf;
 
          memset(averages, 0, sizeof(averages));
@@ -456,9 +481,10 @@ int P4d::performWebifRequests()
          toElapsed(time(0)-startedAt, d);
 
          getloadavg(averages, 3);
+         request->getStatistic()->summary(link, sizeof(link));
 
-         asprintf(&buf, "success:%s#%s#%s#%3.2f %3.2f %3.2f",
-                  dt, VERSION, d, averages[0], averages[1], averages[2]);
+         asprintf(&buf, "success:%s#%s#%s#%3.2f %3.2f %3.2f#%s",
+                  dt, VERSION, d, averages[0], averages[1], averages[2], link);
 
          tableJobs->setValue("RESULT", buf);
          free(buf);
@@ -483,7 +509,7 @@ int P4d::performWebifRequests()
 
       else if (strcasecmp(command, "initvaluefacts") == 0)
       {
-         updateValueFacts();
+         updateValueFacts(strcmp(data, "force") == 0);
          tableJobs->setValue("RESULT", "success:done");
       }
 
@@ -656,7 +682,7 @@ int P4d::updateTimeRangeData()
          tableTimeRanges->setValue(tName, t.getTimeRangeTo(n));
       }
 
-      tableTimeRanges->store();
+      tableTimeRanges->upsert();
       tableTimeRanges->reset();
    }
 